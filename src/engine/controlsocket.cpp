@@ -242,6 +242,9 @@ int CControlSocket::DoClose(int nErrorCode)
 {
 	log(logmsg::debug_debug, L"CControlSocket::DoClose(%d)", nErrorCode);
 	currentPath_.clear();
+
+	auto const stats = engine_.GetDirectoryCache().GetStatistics();
+	log(logmsg::debug_verbose, L"Directory cache: %u hits, %u misses, %u evictions, %u directories with %d files taking %u bytes", stats.hits, stats.misses, stats.evictions, stats.directories, stats.files, stats.memory);
 	return ResetOperation(FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED | nErrorCode);
 }
 
@@ -362,6 +365,16 @@ int CControlSocket::CheckOverwriteFile()
 	auto & data = static_cast<CFileTransferOpData &>(*operations_.back());
 
 	if (data.download_) {
+		if (data.transferSettings_.segmented()) {
+			// The local file has been preallocated to the size the file had
+			// when it got queued. If it has changed since, the segments
+			// would not add up to the remote file.
+			if (data.remoteFileSize_ >= 0 && data.localFileSize_ >= 0 && data.remoteFileSize_ != data.localFileSize_) {
+				log(logmsg::error, _("The size of the remote file has changed since the segmented download has been queued."));
+				return FZ_REPLY_CRITICALERROR;
+			}
+			return FZ_REPLY_OK;
+		}
 		if (fz::local_filesys::get_file_type(fz::to_native(data.localFile_), true) != fz::local_filesys::file) {
 			return FZ_REPLY_OK;
 		}
@@ -1140,6 +1153,11 @@ void CControlSocket::Lookup(CServerPath const& path, std::vector<std::wstring> c
 	Push(std::make_unique<LookupManyOpData>(*this, path, files));
 }
 
+void CControlSocket::Stat(CServerPath const&, std::wstring const&, CDirentry &)
+{
+	Push(std::make_unique<CNotSupportedOpData>());
+}
+
 void CControlSocket::operator()(fz::event_base const& ev)
 {
 	fz::dispatch<fz::timer_event, CObtainLockEvent>(ev, this,
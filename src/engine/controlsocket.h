@@ -12,6 +12,10 @@
 #include "server.h"
 #include "serverpath.h"
 
+namespace PrivCommand {
+auto const stat = Command::common_private1;
+}
+
 class COpData
 {
 public:
@@ -273,6 +277,14 @@ protected:
 	virtual void Lookup(CServerPath const& path, std::wstring const& file, CDirentry * entry = nullptr);
 	virtual void Lookup(CServerPath const& path, std::vector<std::wstring> const& files);
 
+	// Obtains the details of a single file without listing its directory.
+	// Fails with FZ_REPLY_ERROR_NOTFOUND if the file does not exist, any
+	// other error means the protocol could not tell.
+	virtual void Stat(CServerPath const& path, std::wstring const& file, CDirentry & entry);
+
+	// Number of round trips a call to Stat takes, 0 if not supported
+	virtual int GetStatCost() const { return 0; }
+
 	friend class SleepOpData;
 	friend class LookupOpData;
 	friend class LookupManyOpData;
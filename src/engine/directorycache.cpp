@@ -3,86 +3,181 @@
 
 #include <assert.h>
 
+namespace {
+// Rough per-directory overhead of the containers holding a cache entry
+size_t const entry_overhead = 128;
+
+// Rough size of an expanded entry, not counting its strings
+size_t const expanded_entry_size = sizeof(fz::shared_value<CDirentry>) + sizeof(CDirentry) + 64;
+}
+
 CDirectoryCache::CDirectoryCache()
 {
 }
 
 CDirectoryCache::~CDirectoryCache()
 {
-	for (auto & serverEntry : m_serverList) {
-		for (auto & cacheEntry : serverEntry.cacheList) {
+	for (auto & shard : shards_) {
+		for (auto & serverEntry : shard.m_serverMap) {
+			for (auto & cacheEntry : serverEntry.second.cacheList) {
 #ifndef NDEBUG
-			m_totalFileCount -= cacheEntry.listing.size();
+				shard.m_totalFileCount -= cacheEntry.listing.size();
+				shard.memory_ -= cacheEntry.memory;
 #endif
-			tLruList::iterator* lruIt = (tLruList::iterator*)cacheEntry.lruIt;
-			if (lruIt) {
-				m_leastRecentlyUsedList.erase(*lruIt);
-				delete lruIt;
+				tLruList::iterator* lruIt = (tLruList::iterator*)cacheEntry.lruIt;
+				if (lruIt) {
+					shard.m_leastRecentlyUsedList.erase(*lruIt);
+					delete lruIt;
+				}
 			}
 		}
-	}
 #ifndef NDEBUG
-	assert(m_totalFileCount == 0);
+		assert(shard.m_totalFileCount == 0);
+		assert(shard.memory_ == 0);
 #endif
+	}
+}
+
+size_t CDirectoryCache::ServerHash::operator()(CServer const& server) const
+{
+	// Only fields compared by CServer::SameContent may go into the hash
+	size_t hash = std::hash<std::wstring>()(server.GetHost());
+	hash = hash * 31 + server.GetPort();
+	hash = hash * 31 + std::hash<std::wstring>()(server.GetUser());
+	hash = hash * 31 + static_cast<size_t>(server.GetProtocol());
+	return hash;
+}
+
+CDirectoryCache::Shard& CDirectoryCache::GetShard(CServer const& server, CServerPath const& path)
+{
+	size_t hash = ServerHash()(server);
+	hash ^= std::hash<std::wstring>()(fz::str_tolower(path.GetPath())) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	return shards_[hash % shard_count];
 }
 
 void CDirectoryCache::Store(CDirectoryListing const& listing, CServer const& server)
 {
-	fz::scoped_lock lock(mutex_);
+	Shard & shard = GetShard(server, listing.path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = CreateServerEntry(server);
-	assert(sit != m_serverList.end());
+	tServerIter sit = CreateServerEntry(shard, server);
+	assert(sit != shard.m_serverMap.end());
 
-	m_totalFileCount += listing.size();
+	shard.m_totalFileCount += listing.size();
 
 	tCacheIter cit;
 	bool unused;
-	if (Lookup(cit, sit, listing.path, true, unused)) {
+	if (Lookup(shard, cit, sit, listing.path, true, unused)) {
 		auto & entry = const_cast<CCacheEntry&>(*cit);
 		entry.modificationTime = fz::monotonic_clock::now();
 
-		m_totalFileCount -= cit->listing.size();
-		entry.listing = listing;
+		shard.m_totalFileCount -= cit->listing.size();
+		entry.listing = CCompactDirectoryListing(listing);
+	}
+	else {
+		cit = sit->second.cacheList.emplace_hint(cit, listing);
+		UpdateLru(shard, sit, cit);
+	}
+	Changed(shard, cit);
+
+	lock.unlock();
+	Prune();
+}
+
+bool CDirectoryCache::Append(CDirectoryListing const& listing, CServer const& server)
+{
+	Shard & shard = GetShard(server, listing.path);
+	fz::scoped_lock lock(shard.mutex_);
 
-		return;
+	tServerIter sit = GetServerEntry(shard, server);
+	if (sit == shard.m_serverMap.end()) {
+		return false;
 	}
 
-	cit = sit->cacheList.emplace_hint(cit, listing);
+	tCacheIter cit;
+	bool unused;
+	if (!Lookup(shard, cit, sit, listing.path, true, unused) || !(cit->listing.m_firstListTime == listing.m_firstListTime)) {
+		return false;
+	}
 
-	UpdateLru(sit, cit);
+	auto & entry = const_cast<CCacheEntry&>(*cit);
+	entry.modificationTime = fz::monotonic_clock::now();
 
+	shard.m_totalFileCount += listing.size();
+	entry.listing.Append(listing);
+	entry.listing.m_flags = (entry.listing.m_flags & ~CDirectoryListing::unsure_mask) | listing.get_unsure_flags();
+	Changed(shard, cit);
+
+	lock.unlock();
 	Prune();
+
+	return true;
 }
 
 bool CDirectoryCache::Lookup(CDirectoryListing &listing, CServer const& server, const CServerPath &path, bool allowUnsureEntries, bool& is_outdated)
 {
-	fz::scoped_lock lock(mutex_);
+	Shard & shard = GetShard(server, path);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return false;
-	}
+	CCompactDirectoryListing compact;
+	uint64_t version{};
+	{
+		fz::scoped_lock lock(shard.mutex_);
 
-	tCacheIter iter;
-	if (Lookup(iter, sit, path, allowUnsureEntries, is_outdated)) {
-		listing = iter->listing;
-		return true;
+		tServerIter sit = GetServerEntry(shard, server);
+		if (sit == shard.m_serverMap.end()) {
+			++shard.misses_;
+			return false;
+		}
+
+		tCacheIter iter;
+		if (!Lookup(shard, iter, sit, path, allowUnsureEntries, is_outdated)) {
+			++shard.misses_;
+			return false;
+		}
+		++shard.hits_;
+
+		if (iter->expanded) {
+			listing = iter->expanded;
+			return true;
+		}
+
+		// Copying the columns is cheap compared to materializing all
+		// entries, do the latter without holding the lock.
+		compact = iter->listing;
+		version = iter->version;
+	}
+
+	listing = compact.Expand();
+
+	// Share the result with later lookups, unless the entry got changed
+	// in the meantime.
+	fz::scoped_lock lock(shard.mutex_);
+	tServerIter sit = GetServerEntry(shard, server);
+	if (sit != shard.m_serverMap.end()) {
+		CCacheEntry dummy;
+		dummy.listing.path = path;
+		tCacheIter iter = sit->second.cacheList.find(dummy);
+		if (iter != sit->second.cacheList.end() && iter->version == version && !iter->expanded) {
+			SetExpanded(shard, iter, listing);
+			lock.unlock();
+			Prune();
+		}
 	}
 
-	return false;
+	return true;
 }
 
-bool CDirectoryCache::Lookup(tCacheIter &cacheIter, tServerIter &sit, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated)
+bool CDirectoryCache::Lookup(Shard & shard, tCacheIter &cacheIter, tServerIter &sit, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated)
 {
 	CCacheEntry dummy;
 	dummy.listing.path = path;
-	cacheIter = sit->cacheList.lower_bound(dummy);
+	cacheIter = sit->second.cacheList.lower_bound(dummy);
 
-	if (cacheIter != sit->cacheList.end()) {
+	if (cacheIter != sit->second.cacheList.end()) {
 		CCacheEntry const& entry = *cacheIter;
 
 		if (entry.listing.path == path) {
-			UpdateLru(sit, cacheIter);
+			UpdateLru(shard, sit, cacheIter);
 
 			if (!allowUnsureEntries && entry.listing.get_unsure_flags()) {
 				return false;
@@ -98,19 +193,23 @@ bool CDirectoryCache::Lookup(tCacheIter &cacheIter, tServerIter &sit, CServerPat
 
 bool CDirectoryCache::DoesExist(CServer const& server, CServerPath const& path, int &hasUnsureEntries, bool &is_outdated)
 {
-	fz::scoped_lock lock(mutex_);
+	Shard & shard = GetShard(server, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	tServerIter sit = GetServerEntry(shard, server);
+	if (sit == shard.m_serverMap.end()) {
+		++shard.misses_;
 		return false;
 	}
 
 	tCacheIter iter;
-	if (Lookup(iter, sit, path, true, is_outdated)) {
+	if (Lookup(shard, iter, sit, path, true, is_outdated)) {
+		++shard.hits_;
 		hasUnsureEntries = iter->listing.get_unsure_flags();
 		return true;
 	}
 
+	++shard.misses_;
 	return false;
 }
 
@@ -119,18 +218,22 @@ std::tuple<LookupResults, CDirentry> CDirectoryCache::LookupFile(CServer const&
 	LookupResults results{};
 	CDirentry entry;
 
-	fz::scoped_lock lock(mutex_);
+	Shard & shard = GetShard(server, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	tServerIter sit = GetServerEntry(shard, server);
+	if (sit == shard.m_serverMap.end()) {
+		++shard.misses_;
 		return {results, entry};
 	}
 
 	tCacheIter iter;
 	bool outdated{};
-	if (!Lookup(iter, sit, path, true, outdated)) {
+	if (!Lookup(shard, iter, sit, path, true, outdated)) {
+		++shard.misses_;
 		return {results, entry};
 	}
+	++shard.hits_;
 
 	if (outdated) {
 		results |= LookupResults::outdated;
@@ -142,7 +245,7 @@ std::tuple<LookupResults, CDirentry> CDirectoryCache::LookupFile(CServer const&
 	results |= LookupResults::direxists;
 
 	CCacheEntry const& cacheEntry = *iter;
-	CDirectoryListing const& listing = cacheEntry.listing;
+	CCompactDirectoryListing const& listing = cacheEntry.listing;
 
 	size_t i = listing.FindFile_CmpCase(filename);
 	if (i != std::string::npos) {
@@ -157,6 +260,9 @@ std::tuple<LookupResults, CDirentry> CDirectoryCache::LookupFile(CServer const&
 		}
 	}
 
+	// Searching may have built indexes
+	UpdateMemory(shard, iter);
+
 	return {results, entry};
 }
 
@@ -164,18 +270,22 @@ std::vector<std::tuple<LookupResults, CDirentry>> CDirectoryCache::LookupFiles(C
 {
 	std::vector<std::tuple<LookupResults, CDirentry>> ret;
 
-	fz::scoped_lock lock(mutex_);
+	Shard & shard = GetShard(server, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	tServerIter sit = GetServerEntry(shard, server);
+	if (sit == shard.m_serverMap.end()) {
+		++shard.misses_;
 		return ret;
 	}
 
 	tCacheIter iter;
 	bool outdated{};
-	if (!Lookup(iter, sit, path, true, outdated)) {
+	if (!Lookup(shard, iter, sit, path, true, outdated)) {
+		++shard.misses_;
 		return ret;
 	}
+	++shard.hits_;
 
 	LookupResults results{};
 	if (outdated) {
@@ -189,7 +299,7 @@ std::vector<std::tuple<LookupResults, CDirentry>> CDirectoryCache::LookupFiles(C
 	results |= LookupResults::direxists;
 
 	CCacheEntry const& cacheEntry = *iter;
-	CDirectoryListing const& listing = cacheEntry.listing;
+	CCompactDirectoryListing const& listing = cacheEntry.listing;
 
 	ret.reserve(filenames.size());
 
@@ -211,102 +321,120 @@ std::vector<std::tuple<LookupResults, CDirentry>> CDirectoryCache::LookupFiles(C
 		ret.emplace_back(fileresults, entry);
 	}
 
+	UpdateMemory(shard, iter);
+
 	return ret;
 }
 
 bool CDirectoryCache::LookupFile(CDirentry &entry, CServer const& server, CServerPath const& path, std::wstring const& filename, bool &dirDidExist, bool &matchedCase)
 {
-	fz::scoped_lock lock(mutex_);
+	Shard & shard = GetShard(server, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	tServerIter sit = GetServerEntry(shard, server);
+	if (sit == shard.m_serverMap.end()) {
+		++shard.misses_;
 		dirDidExist = false;
 		return false;
 	}
 
 	tCacheIter iter;
 	bool unused;
-	if (!Lookup(iter, sit, path, true, unused)) {
+	if (!Lookup(shard, iter, sit, path, true, unused)) {
+		++shard.misses_;
 		dirDidExist = false;
 		return false;
 	}
+	++shard.hits_;
 	dirDidExist = true;
 
 	const CCacheEntry &cacheEntry = *iter;
-	const CDirectoryListing &listing = cacheEntry.listing;
+	CCompactDirectoryListing const& listing = cacheEntry.listing;
 
+	bool found = false;
 	size_t i = listing.FindFile_CmpCase(filename);
 	if (i != std::string::npos) {
 		entry = listing[i];
 		matchedCase = true;
-		return true;
+		found = true;
 	}
-	i = listing.FindFile_CmpNoCase(filename);
-	if (i != std::string::npos) {
-		entry = listing[i];
-		matchedCase = false;
-		return true;
+	else {
+		i = listing.FindFile_CmpNoCase(filename);
+		if (i != std::string::npos) {
+			entry = listing[i];
+			matchedCase = false;
+			found = true;
+		}
 	}
 
-	return false;
+	UpdateMemory(shard, iter);
+
+	return found;
 }
 
 bool CDirectoryCache::InvalidateFile(CServer const& server, CServerPath const& path, std::wstring const& filename)
 {
-	fz::scoped_lock lock(mutex_);
-
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return false;
-	}
-
 	bool const cmpCase = server.GetCaseSensitivity() == CaseSensitivity::yes;
 	bool dir{};
 
 	auto const now = fz::monotonic_clock::now();
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
-		auto & entry = const_cast<CCacheEntry&>(*iter);
+	{
+		Shard & shard = GetShard(server, path);
+		fz::scoped_lock lock(shard.mutex_);
 
-		if (cmpCase) {
-			if (path != entry.listing.path) {
-				continue;
-			}
-		}
-		else {
-			if (path.CmpNoCase(entry.listing.path)) {
-				continue;
-			}
+		tServerIter sit = GetServerEntry(shard, server);
+		if (sit == shard.m_serverMap.end()) {
+			return false;
 		}
 
-		UpdateLru(sit, iter);
+		for (tCacheIter iter = sit->second.cacheList.begin(); iter != sit->second.cacheList.end(); ++iter) {
+			auto & entry = const_cast<CCacheEntry&>(*iter);
 
-		for (unsigned int i = 0; i < entry.listing.size(); i++) {
-			bool same;
 			if (cmpCase) {
-				same = filename == entry.listing[i].name;
+				if (path != entry.listing.path) {
+					continue;
+				}
 			}
 			else {
-				same = !fz::stricmp(filename, entry.listing[i].name);
+				if (path.CmpNoCase(entry.listing.path)) {
+					continue;
+				}
 			}
-			if (same) {
-				if (entry.listing[i].is_dir()) {
+
+			UpdateLru(shard, sit, iter);
+
+			auto const matches = cmpCase ? entry.listing.FindAll_CmpCase(filename) : entry.listing.FindAll_CmpNoCase(filename);
+			for (size_t i : matches) {
+				if (entry.listing.is_dir(i)) {
 					dir = true;
 				}
-				entry.listing.get(i).flags |= CDirentry::flag_unsure;
+				entry.listing.add_flags(i, CDirentry::flag_unsure);
 			}
+			entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
+			entry.modificationTime = now;
+			Changed(shard, iter);
 		}
-		entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
-		entry.modificationTime = now;
 	}
 
 	if (dir) {
 		CServerPath child = path;
 		if (child.ChangePath(filename)) {
-			for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
-				auto & entry = const_cast<CCacheEntry&>(*iter);
-				if (path.IsParentOf(entry.listing.path, !cmpCase, true)) {
-					entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
-					entry.modificationTime = now;
+			// Subdirectories can be in any shard
+			for (auto & shard : shards_) {
+				fz::scoped_lock lock(shard.mutex_);
+
+				tServerIter sit = GetServerEntry(shard, server);
+				if (sit == shard.m_serverMap.end()) {
+					continue;
+				}
+
+				for (tCacheIter iter = sit->second.cacheList.begin(); iter != sit->second.cacheList.end(); ++iter) {
+					auto & entry = const_cast<CCacheEntry&>(*iter);
+					if (path.IsParentOf(entry.listing.path, !cmpCase, true)) {
+						entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
+						entry.modificationTime = now;
+						Changed(shard, iter);
+					}
 				}
 			}
 		}
@@ -317,37 +445,37 @@ bool CDirectoryCache::InvalidateFile(CServer const& server, CServerPath const& p
 
 bool CDirectoryCache::UpdateFile(CServer const& server, CServerPath const& path, std::wstring const& filename, bool mayCreate, Filetype type, int64_t size, std::wstring const& ownerGroup)
 {
-	fz::scoped_lock lock(mutex_);
+	Shard & shard = GetShard(server, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	tServerIter sit = GetServerEntry(shard, server);
+	if (sit == shard.m_serverMap.end()) {
 		return false;
 	}
 
 	bool updated = false;
 
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
+	for (tCacheIter iter = sit->second.cacheList.begin(); iter != sit->second.cacheList.end(); ++iter) {
 		auto & entry = const_cast<CCacheEntry&>(*iter);
 		if (path.CmpNoCase(entry.listing.path)) {
 			continue;
 		}
 
-		UpdateLru(sit, iter);
+		UpdateLru(shard, sit, iter);
 
 		bool matchCase = false;
-		size_t i;
-		for (i = 0; i < entry.listing.size(); ++i) {
-			if (!fz::stricmp(filename, entry.listing[i].name)) {
-				entry.listing.get(i).flags |= CDirentry::flag_unsure;
-				if (entry.listing[i].name == filename) {
-					matchCase = true;
-					break;
-				}
+		size_t i{};
+		for (size_t match : entry.listing.FindAll_CmpNoCase(filename)) {
+			i = match;
+			entry.listing.add_flags(i, CDirentry::flag_unsure);
+			if (entry.listing.name(i) == filename) {
+				matchCase = true;
+				break;
 			}
 		}
 
 		if (matchCase) {
-			Filetype old_type = entry.listing[i].is_dir() ? dir : file;
+			Filetype old_type = entry.listing.is_dir(i) ? dir : file;
 			if (type != old_type) {
 				entry.listing.m_flags |= CDirectoryListing::unsure_invalid;
 			}
@@ -382,66 +510,61 @@ bool CDirectoryCache::UpdateFile(CServer const& server, CServerPath const& path,
 				entry.listing.m_flags |= CDirectoryListing::unsure_invalid;
 				break;
 			}
-			entry.listing.Append(std::move(direntry));
+			entry.listing.Append(direntry);
 
-			++m_totalFileCount;
+			++shard.m_totalFileCount;
 		}
 		else {
 			entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
 		}
 		entry.modificationTime = fz::monotonic_clock::now();
+		Changed(shard, iter);
 
 		updated = true;
 	}
 
+	lock.unlock();
+	Prune();
+
 	return updated;
 }
 
 bool CDirectoryCache::RemoveFile(CServer const& server, CServerPath const& path, std::wstring const& filename)
 {
-	fz::scoped_lock lock(mutex_);
+	Shard & shard = GetShard(server, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	tServerIter sit = GetServerEntry(shard, server);
+	if (sit == shard.m_serverMap.end()) {
 		return false;
 	}
 
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
+	return RemoveFile(shard, sit, path, filename);
+}
+
+bool CDirectoryCache::RemoveFile(Shard & shard, tServerIter const& sit, CServerPath const& path, std::wstring const& filename)
+{
+	for (tCacheIter iter = sit->second.cacheList.begin(); iter != sit->second.cacheList.end(); ++iter) {
 		auto & entry = const_cast<CCacheEntry&>(*iter);
 		if (path.CmpNoCase(entry.listing.path)) {
 			continue;
 		}
 
-		UpdateLru(sit, iter);
-
-		bool matchCase = false;
-		for (size_t i = 0; i < entry.listing.size(); ++i) {
-			if (entry.listing[i].name == filename) {
-				matchCase = true;
-			}
-		}
-
-		if (matchCase) {
-			size_t i;
-			for (i = 0; i < entry.listing.size(); ++i) {
-				if (entry.listing[i].name == filename) {
-					break;
-				}
-			}
-			assert(i != entry.listing.size());
+		UpdateLru(shard, sit, iter);
 
+		size_t const i = entry.listing.FindFile_CmpCase(filename);
+		if (i != std::string::npos) {
 			entry.listing.RemoveEntry(i); // This does set m_hasUnsureEntries
-			--m_totalFileCount;
+			--shard.m_totalFileCount;
 		}
 		else {
-			for (size_t i = 0; i < entry.listing.size(); ++i) {
-				if (!fz::stricmp(filename, entry.listing[i].name)) {
-					entry.listing.get(i).flags |= CDirentry::flag_unsure;
-				}
+			for (size_t match : entry.listing.FindAll_CmpNoCase(filename)) {
+				entry.listing.add_flags(match, CDirentry::flag_unsure);
 			}
 			entry.listing.m_flags |= CDirectoryListing::unsure_invalid;
 		}
 		entry.modificationTime = fz::monotonic_clock::now();
+		Changed(shard, iter);
 	}
 
 	return true;
@@ -449,40 +572,35 @@ bool CDirectoryCache::RemoveFile(CServer const& server, CServerPath const& path,
 
 void CDirectoryCache::InvalidateServer(CServer const& server)
 {
-	fz::scoped_lock lock(mutex_);
+	for (auto & shard : shards_) {
+		fz::scoped_lock lock(shard.mutex_);
 
-	for (auto iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
-		if (!iter->server.SameContent(server)) {
+		tServerIter sit = GetServerEntry(shard, server);
+		if (sit == shard.m_serverMap.end()) {
 			continue;
 		}
 
-		for (tCacheIter cit = iter->cacheList.begin(); cit != iter->cacheList.end(); ++cit) {
-			tLruList::iterator* lruIt = (tLruList::iterator*)cit->lruIt;
-			if (lruIt) {
-				m_leastRecentlyUsedList.erase(*lruIt);
-				delete lruIt;
-			}
-
-			m_totalFileCount -= cit->listing.size();
+		auto & cacheList = sit->second.cacheList;
+		while (!cacheList.empty()) {
+			Erase(shard, sit->second, cacheList.begin());
 		}
-
-		m_serverList.erase(iter);
-		break;
+		shard.m_serverMap.erase(sit);
 	}
 }
 
 bool CDirectoryCache::GetChangeTime(fz::monotonic_clock& time, CServer const& server, CServerPath const& path)
 {
-	fz::scoped_lock lock(mutex_);
+	Shard & shard = GetShard(server, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	tServerIter sit = GetServerEntry(shard, server);
+	if (sit == shard.m_serverMap.end()) {
 		return false;
 	}
 
 	tCacheIter iter;
 	bool unused;
-	if (Lookup(iter, sit, path, true, unused)) {
+	if (Lookup(shard, iter, sit, path, true, unused)) {
 		time = iter->modificationTime;
 		return true;
 	}
@@ -492,35 +610,34 @@ bool CDirectoryCache::GetChangeTime(fz::monotonic_clock& time, CServer const& se
 
 void CDirectoryCache::RemoveDir(CServer const& server, CServerPath const& path, std::wstring const& filename, CServerPath const&)
 {
-	fz::scoped_lock lock(mutex_);
-
 	// TODO: This is not 100% foolproof and may not work properly
 	// Perhaps just throw away the complete cache?
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return;
-	}
-
 	CServerPath absolutePath = path;
 	if (!absolutePath.AddSegment(filename)) {
 		absolutePath.clear();
 	}
 
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ) {
-		auto & entry = const_cast<CCacheEntry&>(*iter);
-		// Delete exact matches and subdirs
-		if (!absolutePath.empty() && (entry.listing.path == absolutePath || absolutePath.IsParentOf(entry.listing.path, true))) {
-			m_totalFileCount -= entry.listing.size();
-			tLruList::iterator* lruIt = (tLruList::iterator*)iter->lruIt;
-			if (lruIt) {
-				m_leastRecentlyUsedList.erase(*lruIt);
-				delete lruIt;
+	if (!absolutePath.empty()) {
+		// Subdirectories can be in any shard
+		for (auto & shard : shards_) {
+			fz::scoped_lock lock(shard.mutex_);
+
+			tServerIter sit = GetServerEntry(shard, server);
+			if (sit == shard.m_serverMap.end()) {
+				continue;
+			}
+
+			auto & cacheList = sit->second.cacheList;
+			for (tCacheIter iter = cacheList.begin(); iter != cacheList.end(); ) {
+				// Delete exact matches and subdirs
+				if (iter->listing.path == absolutePath || absolutePath.IsParentOf(iter->listing.path, true)) {
+					Erase(shard, sit->second, iter++);
+				}
+				else {
+					++iter;
+				}
 			}
-			sit->cacheList.erase(iter++);
-		}
-		else {
-			++iter;
 		}
 	}
 
@@ -529,59 +646,85 @@ void CDirectoryCache::RemoveDir(CServer const& server, CServerPath const& path,
 
 void CDirectoryCache::Rename(CServer const& server, CServerPath const& pathFrom, std::wstring const& fileFrom, CServerPath const& pathTo, std::wstring const& fileTo)
 {
-	fz::scoped_lock lock(mutex_);
-
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return;
-	}
-
-	tCacheIter iter;
-	bool is_outdated = false;
-	bool found = Lookup(iter, sit, pathFrom, true, is_outdated);
-	if (found) {
-		auto & listing = const_cast<CDirectoryListing&>(iter->listing);
-		if (pathFrom == pathTo) {
-			RemoveFile(server, pathFrom, fileTo);
-			size_t i;
-			for (i = 0; i < listing.size(); ++i) {
-				if (listing[i].name == fileFrom) {
-					break;
-				}
-			}
-			if (i != listing.size()) {
-				if (listing[i].is_dir()) {
-					RemoveDir(server, pathFrom, fileFrom, CServerPath());
-					RemoveDir(server, pathFrom, fileTo, CServerPath());
-					UpdateFile(server, pathFrom, fileTo, true, dir);
+	// Operations spanning multiple directories must not be called while
+	// holding the lock of a shard, only decide what to do in here.
+	bool found{};
+	bool isDir{};
+	{
+		Shard & shard = GetShard(server, pathFrom);
+		fz::scoped_lock lock(shard.mutex_);
+
+		tServerIter sit = GetServerEntry(shard, server);
+		tCacheIter iter;
+		bool is_outdated = false;
+		if (sit != shard.m_serverMap.end() && Lookup(shard, iter, sit, pathFrom, true, is_outdated)) {
+			auto & listing = const_cast<CCompactDirectoryListing&>(iter->listing);
+			if (pathFrom == pathTo) {
+				RemoveFile(shard, sit, pathFrom, fileTo);
+				size_t const i = listing.FindFile_CmpCase(fileFrom);
+				if (i != std::string::npos) {
+					if (!listing.is_dir(i)) {
+						listing.SetName(i, fileTo);
+						listing.add_flags(i, CDirentry::flag_unsure);
+						listing.m_flags |= CDirectoryListing::unsure_unknown;
+						Changed(shard, iter);
+						return;
+					}
+					isDir = true;
 				}
 				else {
-					listing.get(i).name = fileTo;
-					listing.get(i).flags |= CDirentry::flag_unsure;
-					listing.m_flags |= CDirectoryListing::unsure_unknown;
-					listing.ClearFindMap();
+					return;
 				}
 			}
-			return;
-		}
-		else {
-			size_t i;
-			for (i = 0; i < listing.size(); ++i) {
-				if (listing[i].name == fileFrom) {
-					break;
+			else {
+				size_t const i = listing.FindFile_CmpCase(fileFrom);
+				if (i == std::string::npos) {
+					return;
 				}
+				isDir = listing.is_dir(i);
 			}
-			if (i != listing.size()) {
-				if (listing[i].is_dir()) {
-					RemoveDir(server, pathFrom, fileFrom, CServerPath());
-					UpdateFile(server, pathTo, fileTo, true, dir);
-				}
-				else {
-					RemoveFile(server, pathFrom, fileFrom);
-					UpdateFile(server, pathTo, fileTo, true, file);
+			found = true;
+		}
+	}
+
+	if (!found) {
+		// We know nothing, be on the safe side and invalidate everything.
+		InvalidateServer(server);
+	}
+	else if (pathFrom == pathTo) {
+		RemoveDir(server, pathFrom, fileFrom, CServerPath());
+		RemoveDir(server, pathFrom, fileTo, CServerPath());
+		UpdateFile(server, pathFrom, fileTo, true, dir);
+	}
+	else if (isDir) {
+		RemoveDir(server, pathFrom, fileFrom, CServerPath());
+		UpdateFile(server, pathTo, fileTo, true, dir);
+	}
+	else {
+		RemoveFile(server, pathFrom, fileFrom);
+		UpdateFile(server, pathTo, fileTo, true, file);
+	}
+}
+
+void CDirectoryCache::UpdateOwnerGroup(CServer const& server, CServerPath const& path, std::wstring const& filename, std::wstring& ownerGroup)
+{
+	{
+		Shard & shard = GetShard(server, path);
+		fz::scoped_lock lock(shard.mutex_);
+
+		tServerIter sit = GetServerEntry(shard, server);
+		tCacheIter iter;
+		bool is_outdated = false;
+		if (sit != shard.m_serverMap.end() && Lookup(shard, iter, sit, path, true, is_outdated)) {
+			auto & listing = const_cast<CCompactDirectoryListing&>(iter->listing);
+			size_t const i = listing.FindFile_CmpCase(filename);
+			if (i != std::string::npos) {
+				if (!listing.is_dir(i)) {
+					listing.SetOwnerGroup(i, ownerGroup);
+					Changed(shard, iter);
 				}
+				return;
 			}
-			return;
 		}
 	}
 
@@ -589,101 +732,199 @@ void CDirectoryCache::Rename(CServer const& server, CServerPath const& pathFrom,
 	InvalidateServer(server);
 }
 
-void CDirectoryCache::UpdateOwnerGroup(CServer const& server, CServerPath const& path, std::wstring const& filename, std::wstring& ownerGroup)
+
+CDirectoryCache::tServerIter CDirectoryCache::CreateServerEntry(Shard & shard, CServer const& server)
 {
-	fz::scoped_lock lock(mutex_);
+	return shard.m_serverMap.try_emplace(server).first;
+}
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return;
+CDirectoryCache::tServerIter CDirectoryCache::GetServerEntry(Shard & shard, CServer const& server)
+{
+	return shard.m_serverMap.find(server);
+}
+
+void CDirectoryCache::UpdateLru(Shard & shard, tServerIter const& sit, tCacheIter const& cit)
+{
+	tLruList::iterator* lruIt = (tLruList::iterator*)cit->lruIt;
+	auto & entry = const_cast<CCacheEntry&>(*cit);
+	entry.lastUsed = ++lruClock_;
+	if (lruIt) {
+		shard.m_leastRecentlyUsedList.splice(shard.m_leastRecentlyUsedList.end(), shard.m_leastRecentlyUsedList, *lruIt);
+		**lruIt = std::make_pair(&*sit, cit);
+	}
+	else {
+		entry.lruIt = (void*)new tLruList::iterator(shard.m_leastRecentlyUsedList.emplace(shard.m_leastRecentlyUsedList.end(), &*sit, cit));
 	}
+	UpdateOldest(shard);
+}
 
-	tCacheIter iter;
-	bool is_outdated = false;
-	bool found = Lookup(iter, sit, path, true, is_outdated);
-	if (found) {
-		auto & listing = const_cast<CDirectoryListing&>(iter->listing);
-		size_t i;
-		for (i = 0; i < listing.size(); ++i) {
-			if (listing[i].name == filename) {
-				break;
-			}
-		}
-		if (i != listing.size()) {
-			if (!listing[i].is_dir()) {
-				listing.get(i).ownerGroup.get() = ownerGroup;
-				listing.ClearFindMap();
-			}
-			return;
-		}
+void CDirectoryCache::UpdateOldest(Shard & shard)
+{
+	if (shard.m_leastRecentlyUsedList.empty()) {
+		shard.oldest_ = std::numeric_limits<uint64_t>::max();
 	}
+	else {
+		shard.oldest_ = shard.m_leastRecentlyUsedList.front().second->lastUsed;
+	}
+}
 
-	// We know nothing, be on the safe side and invalidate everything.
-	InvalidateServer(server);
+void CDirectoryCache::UpdateMemory(Shard & shard, tCacheIter const& cit)
+{
+	auto & entry = const_cast<CCacheEntry&>(*cit);
+	shard.memory_ -= entry.memory;
+	memory_ -= entry.memory;
+	entry.memory = entry_overhead + entry.listing.memory_usage();
+	if (entry.expanded) {
+		entry.memory += entry.expanded.size() * expanded_entry_size;
+	}
+	shard.memory_ += entry.memory;
+	memory_ += entry.memory;
 }
 
+void CDirectoryCache::Changed(Shard & shard, tCacheIter const& cit)
+{
+	auto & entry = const_cast<CCacheEntry&>(*cit);
+	entry.version = ++shard.version_;
+	DropExpanded(shard, cit);
+	UpdateMemory(shard, cit);
+}
 
-CDirectoryCache::tServerIter CDirectoryCache::CreateServerEntry(CServer const& server)
+void CDirectoryCache::SetExpanded(Shard & shard, tCacheIter const& cit, CDirectoryListing const& listing)
 {
-	for (tServerIter iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
-		if (iter->server.SameContent(server)) {
-			return iter;
-		}
+	if (shard.expanded_.size() >= expanded_per_shard) {
+		DropOldestExpanded(shard);
 	}
-	m_serverList.emplace_back(server);
 
-	return --m_serverList.end();
+	auto & entry = const_cast<CCacheEntry&>(*cit);
+	entry.expanded = listing;
+	shard.expanded_.push_back(cit);
+	++expandedCount_;
+	UpdateMemory(shard, cit);
 }
 
-CDirectoryCache::tServerIter CDirectoryCache::GetServerEntry(CServer const& server)
+void CDirectoryCache::DropExpanded(Shard & shard, tCacheIter const& cit)
 {
-	tServerIter iter;
-	for (iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
-		if (iter->server.SameContent(server)) {
-			break;
-		}
+	if (cit->expanded) {
+		auto & entry = const_cast<CCacheEntry&>(*cit);
+		entry.expanded = CDirectoryListing();
+		shard.expanded_.remove(cit);
+		--expandedCount_;
 	}
-
-	return iter;
 }
 
-void CDirectoryCache::UpdateLru(tServerIter const& sit, tCacheIter const& cit)
+void CDirectoryCache::Erase(Shard & shard, CServerEntry & serverEntry, tCacheIter const& cit)
 {
 	tLruList::iterator* lruIt = (tLruList::iterator*)cit->lruIt;
 	if (lruIt) {
-		m_leastRecentlyUsedList.splice(m_leastRecentlyUsedList.end(), m_leastRecentlyUsedList, *lruIt);
-		**lruIt = std::make_pair(sit, cit);
-	}
-	else {
-		auto & entry = const_cast<CCacheEntry&>(*cit);
-		entry.lruIt = (void*)new tLruList::iterator(m_leastRecentlyUsedList.emplace(m_leastRecentlyUsedList.end(), sit, cit));
+		shard.m_leastRecentlyUsedList.erase(*lruIt);
+		delete lruIt;
+		UpdateOldest(shard);
 	}
+
+	DropExpanded(shard, cit);
+
+	shard.m_totalFileCount -= cit->listing.size();
+	shard.memory_ -= cit->memory;
+	memory_ -= cit->memory;
+
+	serverEntry.cacheList.erase(cit);
 }
 
 void CDirectoryCache::Prune()
 {
-	while ((m_leastRecentlyUsedList.size() > 50000) ||
-		(m_totalFileCount > 1000000 && m_leastRecentlyUsedList.size() > 1000) ||
-		(m_totalFileCount > 5000000 && m_leastRecentlyUsedList.size() > 100))
-	{
-		tFullEntryPosition pos = m_leastRecentlyUsedList.front();
-		tLruList::iterator* lruIt = (tLruList::iterator*)pos.second->lruIt;
-		delete lruIt;
+	// Expanded listings only speed up lookups, they go before any directory
+	for (auto & shard : shards_) {
+		if (memory_ <= maxMemory_ || !expandedCount_) {
+			break;
+		}
+		fz::scoped_lock lock(shard.mutex_);
+		while (memory_ > maxMemory_ && DropOldestExpanded(shard)) {
+		}
+	}
 
-		m_totalFileCount -= pos.second->listing.size();
+	while (memory_ > maxMemory_) {
+		Shard * shard = OldestShard();
+		if (!shard) {
+			break;
+		}
 
-		pos.first->cacheList.erase(pos.second);
-		if (pos.first->cacheList.empty()) {
-			m_serverList.erase(pos.first);
+		// Another thread may have used or evicted the entry by now, in which
+		// case the shard's next oldest one goes instead. Close enough.
+		fz::scoped_lock lock(shard->mutex_);
+		if (!Shrink(*shard)) {
+			break;
 		}
+	}
+}
+
+CDirectoryCache::Shard* CDirectoryCache::OldestShard()
+{
+	Shard * oldest{};
+	uint64_t oldestUse = std::numeric_limits<uint64_t>::max();
+	for (auto & shard : shards_) {
+		uint64_t const use = shard.oldest_;
+		if (use < oldestUse) {
+			oldestUse = use;
+			oldest = &shard;
+		}
+	}
+	return oldest;
+}
+
+bool CDirectoryCache::DropOldestExpanded(Shard & shard)
+{
+	if (shard.expanded_.empty()) {
+		return false;
+	}
+
+	tCacheIter const oldest = shard.expanded_.front();
+	DropExpanded(shard, oldest);
+	UpdateMemory(shard, oldest);
+	return true;
+}
+
+bool CDirectoryCache::Shrink(Shard & shard)
+{
+	if (DropOldestExpanded(shard)) {
+		return true;
+	}
+
+	if (shard.m_leastRecentlyUsedList.empty()) {
+		return false;
+	}
 
-		m_leastRecentlyUsedList.pop_front();
+	// Keep what the caller has just been working on
+	tFullEntryPosition pos = shard.m_leastRecentlyUsedList.front();
+	if (pos.second->lastUsed == lruClock_) {
+		return false;
+	}
+
+	Erase(shard, pos.first->second, pos.second);
+	if (pos.first->second.cacheList.empty()) {
+		shard.m_serverMap.erase(shard.m_serverMap.find(pos.first->first));
+	}
+	++shard.evictions_;
+
+	return true;
+}
+
+void CDirectoryCache::LockAll()
+{
+	for (auto & shard : shards_) {
+		shard.mutex_.lock();
+	}
+}
+
+void CDirectoryCache::UnlockAll()
+{
+	for (auto & shard : shards_) {
+		shard.mutex_.unlock();
 	}
 }
 
 void CDirectoryCache::SetTtl(fz::duration const& ttl)
 {
-	fz::scoped_lock lock(mutex_);
+	LockAll();
 
 	if (ttl < fz::duration::from_seconds(30)) {
 		ttl_ = fz::duration::from_seconds(30);
@@ -694,4 +935,43 @@ void CDirectoryCache::SetTtl(fz::duration const& ttl)
 	else {
 		ttl_ = ttl;
 	}
+
+	UnlockAll();
+}
+
+void CDirectoryCache::SetMaxMemory(size_t bytes)
+{
+	LockAll();
+
+	maxMemory_ = bytes;
+
+	for (auto & shard : shards_) {
+		while (memory_ > maxMemory_ && DropOldestExpanded(shard)) {
+		}
+	}
+
+	while (memory_ > maxMemory_) {
+		Shard * shard = OldestShard();
+		if (!shard || !Shrink(*shard)) {
+			break;
+		}
+	}
+
+	UnlockAll();
+}
+
+CDirectoryCache::Statistics CDirectoryCache::GetStatistics()
+{
+	Statistics stats;
+	for (auto & shard : shards_) {
+		fz::scoped_lock lock(shard.mutex_);
+
+		stats.hits += shard.hits_;
+		stats.misses += shard.misses_;
+		stats.evictions += shard.evictions_;
+		stats.directories += shard.m_leastRecentlyUsedList.size();
+		stats.files += shard.m_totalFileCount;
+		stats.memory += shard.memory_;
+	}
+	return stats;
 }
@@ -5,7 +5,7 @@
 This class is the directory cache used to store retrieved directory listings
 for further use.
 Directory get either purged from the cache if the maximum cache time exceeds,
-or on possible data inconsistencies.
+if the cache exceeds its memory budget, or on possible data inconsistencies.
 For example since some servers are case sensitive and others aren't, a
 directory is removed from cache once an operation effects a file wich matches
 multiple entries in a cache directory using a case insensitive search
@@ -18,8 +18,11 @@ version.
 
 #include <libfilezilla/mutex.hpp>
 
+#include <atomic>
+#include <limits>
 #include <list>
 #include <set>
+#include <unordered_map>
 
 enum class LookupFlags
 {
@@ -88,6 +91,13 @@ public:
 	std::vector<std::tuple<LookupResults, CDirentry>> LookupFiles(CServer const& server, CServerPath const& path, std::vector<std::wstring> const& filenames, LookupFlags flags);
 
 	void Store(CDirectoryListing const& listing, CServer const& server);
+
+	// Adds the entries of the listing to the cached one of the same path,
+	// which must have been stored from the same listing operation, that is
+	// with the same m_firstListTime. The unsure flags are taken from the
+	// listing. Returns false if there is no such cached listing.
+	bool Append(CDirectoryListing const& listing, CServer const& server);
+
 	bool GetChangeTime(fz::monotonic_clock& time, CServer const& server, CServerPath const& path);
 	bool Lookup(CDirectoryListing &listing, CServer const&server, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated);
 	bool DoesExist(CServer const& server, CServerPath const& path, int &hasUnsureEntries, bool &is_outdated);
@@ -102,6 +112,22 @@ public:
 
 	void SetTtl(fz::duration const& ttl);
 
+	// Least recently used directories get evicted once the cached listings
+	// take up more than the given amount of memory.
+	void SetMaxMemory(size_t bytes);
+
+	struct Statistics final
+	{
+		uint64_t hits{};
+		uint64_t misses{};
+		uint64_t evictions{};
+
+		size_t directories{};
+		int64_t files{};
+		size_t memory{};
+	};
+	Statistics GetStatistics();
+
 protected:
 
 	class CCacheEntry final
@@ -116,7 +142,7 @@ protected:
 			, modificationTime(fz::monotonic_clock::now())
 		{}
 
-		CDirectoryListing listing;
+		CCompactDirectoryListing listing;
 		fz::monotonic_clock modificationTime;
 
 		CCacheEntry& operator=(CCacheEntry const& a) = default;
@@ -124,6 +150,19 @@ protected:
 
 		void* lruIt{}; // void* to break cyclic declaration dependency
 
+		// As accounted in the memory usage of the shard
+		size_t memory{};
+
+		// The listing as returned by Lookup, shared by all callers until the
+		// entry gets modified. Only kept for a few directories per shard.
+		CDirectoryListing expanded;
+
+		// Unique within the shard, changes on every modification
+		uint64_t version{};
+
+		// When the entry was last used, in terms of lruClock_
+		uint64_t lastUsed{};
+
 		bool operator<(CCacheEntry const& op) const noexcept {
 			return listing.path < op.listing.path;
 		}
@@ -132,40 +171,118 @@ protected:
 	class CServerEntry final
 	{
 	public:
-		CServerEntry() {}
-		explicit CServerEntry(CServer const& s)
-			: server(s)
-		{}
-
-		CServer server;
 		std::set<CCacheEntry> cacheList;
 	};
 
-	typedef std::list<CServerEntry>::iterator tServerIter;
+	struct ServerHash final
+	{
+		size_t operator()(CServer const& server) const;
+	};
+
+	struct ServerEqual final
+	{
+		bool operator()(CServer const& lhs, CServer const& rhs) const {
+			return lhs.SameContent(rhs);
+		}
+	};
 
-	tServerIter CreateServerEntry(const CServer& server);
-	tServerIter GetServerEntry(const CServer& server);
+	typedef std::unordered_map<CServer, CServerEntry, ServerHash, ServerEqual> tServerMap;
+	typedef tServerMap::iterator tServerIter;
 
 	typedef std::set<CCacheEntry>::iterator tCacheIter;
 	typedef std::set<CCacheEntry>::const_iterator tCacheConstIter;
 
-	bool Lookup(tCacheIter &cacheIter, tServerIter &sit, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated);
+	// Pointers to elements of an unordered_map remain valid on rehashing, unlike iterators
+	typedef std::pair<tServerMap::value_type*, tCacheIter> tFullEntryPosition;
+	typedef std::list<tFullEntryPosition> tLruList;
+
+	// Directories are distributed over the shards by server and by
+	// case-insensitive path, so that all entries an operation on a single
+	// directory can affect are in the same shard.
+	// Never lock more than one shard at a time, except for in SetTtl and
+	// SetMaxMemory which lock all of them in order.
+	// Each shard publishes when its least recently used entry was last used,
+	// so that eviction can pick the shard holding the oldest entry of the
+	// whole cache without looking inside the other shards.
+	struct Shard final
+	{
+		fz::mutex mutex_;
+
+		tServerMap m_serverMap;
+		tLruList m_leastRecentlyUsedList;
+
+		int64_t m_totalFileCount{};
+		size_t memory_{};
+
+		// Entries holding an expanded listing, least recently expanded first
+		std::list<tCacheIter> expanded_;
+		uint64_t version_{};
+
+		uint64_t hits_{};
+		uint64_t misses_{};
+		uint64_t evictions_{};
+
+		// lastUsed of the front of m_leastRecentlyUsedList, max if empty
+		std::atomic<uint64_t> oldest_{std::numeric_limits<uint64_t>::max()};
+	};
+
+	static size_t const shard_count = 16;
+	static size_t const expanded_per_shard = 4;
+	Shard shards_[shard_count];
+
+	Shard& GetShard(CServer const& server, CServerPath const& path);
 
-	fz::mutex mutex_;
+	tServerIter CreateServerEntry(Shard & shard, CServer const& server);
+	tServerIter GetServerEntry(Shard & shard, CServer const& server);
 
-	std::list<CServerEntry> m_serverList;
+	bool Lookup(Shard & shard, tCacheIter &cacheIter, tServerIter &sit, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated);
 
-	void UpdateLru(tServerIter const& sit, tCacheIter const& cit);
+	bool RemoveFile(Shard & shard, tServerIter const& sit, CServerPath const& path, std::wstring const& filename);
 
+	void UpdateLru(Shard & shard, tServerIter const& sit, tCacheIter const& cit);
+	void UpdateOldest(Shard & shard);
+	void UpdateMemory(Shard & shard, tCacheIter const& cit);
+
+	// To be called after modifying the listing of an entry
+	void Changed(Shard & shard, tCacheIter const& cit);
+
+	void SetExpanded(Shard & shard, tCacheIter const& cit, CDirectoryListing const& listing);
+	void DropExpanded(Shard & shard, tCacheIter const& cit);
+
+	void Erase(Shard & shard, CServerEntry & serverEntry, tCacheIter const& cit);
+
+	// The memory budget applies to the cache as a whole. Once exceeded,
+	// expanded listings get dropped first, then the least recently used
+	// directories of the whole cache get evicted, no matter which shard they
+	// are in, until it is within budget again.
+	// Must be called without holding any shard lock.
 	void Prune();
 
-	typedef std::pair<tServerIter, tCacheIter> tFullEntryPosition;
-	typedef std::list<tFullEntryPosition> tLruList;
-	tLruList m_leastRecentlyUsedList;
+	// The shard holding the least recently used directory, nullptr if the
+	// cache is empty.
+	Shard* OldestShard();
 
-	int64_t m_totalFileCount{};
+	bool DropOldestExpanded(Shard & shard);
+
+	// Drops the oldest expanded listing of the shard or, if there is none,
+	// evicts its least recently used directory. The directory used last in
+	// the whole cache is kept. Returns false if nothing could be freed.
+	bool Shrink(Shard & shard);
+
+	void LockAll();
+	void UnlockAll();
 
 	fz::duration ttl_{fz::duration::from_seconds(600)};
+	size_t maxMemory_{256 * 1024 * 1024};
+
+	// Sum of the memory usage of all shards
+	std::atomic<size_t> memory_{};
+
+	// Incremented whenever an entry gets used
+	std::atomic<uint64_t> lruClock_{};
+
+	// Number of entries holding an expanded listing, in all shards
+	std::atomic<size_t> expandedCount_{};
 };
 
 #endif
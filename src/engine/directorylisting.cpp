@@ -246,3 +246,412 @@ bool CheckInclusion(const CDirectoryListing& listing1, const CDirectoryListing&
 
 	return true;
 }
+
+namespace {
+uint8_t const compact_direntry_flags = CDirentry::flag_dir | CDirentry::flag_link | CDirentry::flag_unsure;
+uint8_t const compact_has_time = 0x08;
+int const compact_accuracy_shift = 4;
+
+uint32_t const compact_empty_slot = static_cast<uint32_t>(-1);
+
+fz::datetime const& epoch()
+{
+	static fz::datetime const t(static_cast<time_t>(0), fz::datetime::milliseconds);
+	return t;
+}
+
+size_t hash_case(std::string_view const& name)
+{
+	return std::hash<std::string_view>()(name);
+}
+
+size_t hash_nocase(std::wstring const& lower)
+{
+	return std::hash<std::wstring>()(lower);
+}
+}
+
+CCompactDirectoryListing::CCompactDirectoryListing(CDirectoryListing const& listing)
+	: path(listing.path)
+	, m_firstListTime(listing.m_firstListTime)
+	, m_flags(listing.m_flags)
+{
+	size_t const count = listing.size();
+	names_.reserve(count);
+	sizes_.reserve(count);
+	times_.reserve(count);
+	flags_.reserve(count);
+	permissions_.reserve(count);
+	ownerGroups_.reserve(count);
+
+	// Most listings only have a handful of distinct permissions and owners.
+	// Different entries usually still hold separate copies of the strings
+	// though, so look them up by value.
+	std::unordered_map<std::wstring, uint32_t> interned;
+	strings_.emplace_back();
+	interned.emplace(std::wstring(), 0);
+	auto intern = [&](fz::shared_value<std::wstring> const& s) {
+		auto it = interned.find(*s);
+		if (it != interned.end()) {
+			return it->second;
+		}
+		uint32_t const index = static_cast<uint32_t>(strings_.size());
+		strings_.push_back(s);
+		interned.emplace(*s, index);
+		return index;
+	};
+
+	for (size_t i = 0; i < count; ++i) {
+		CDirentry const& entry = listing[i];
+		Push(entry, intern(entry.permissions), intern(entry.ownerGroup));
+	}
+}
+
+void CCompactDirectoryListing::Push(CDirentry const& entry, uint32_t permissions, uint32_t ownerGroup)
+{
+	uint32_t const index = static_cast<uint32_t>(size());
+
+	names_.push_back(AddString(entry.name));
+	sizes_.push_back(entry.size);
+
+	uint8_t flags = static_cast<uint8_t>(entry.flags & compact_direntry_flags);
+	if (entry.has_date()) {
+		flags |= compact_has_time | static_cast<uint8_t>(entry.time.get_accuracy() << compact_accuracy_shift);
+		times_.push_back((entry.time - epoch()).get_milliseconds());
+	}
+	else {
+		times_.push_back(0);
+	}
+	flags_.push_back(flags);
+
+	permissions_.push_back(permissions);
+	ownerGroups_.push_back(ownerGroup);
+
+	if (entry.target) {
+		targets_.emplace_back(index, AddString(*entry.target));
+	}
+}
+
+CDirectoryListing CCompactDirectoryListing::Expand() const
+{
+	std::vector<fz::shared_value<CDirentry>> entries;
+	entries.reserve(size());
+	for (size_t i = 0; i < size(); ++i) {
+		entries.emplace_back((*this)[i]);
+	}
+
+	CDirectoryListing listing;
+	listing.path = path;
+	listing.m_firstListTime = m_firstListTime;
+	listing.Assign(std::move(entries));
+	listing.m_flags = m_flags;
+
+	return listing;
+}
+
+CDirentry CCompactDirectoryListing::operator[](size_t index) const
+{
+	CDirentry entry;
+	entry.name = name(index);
+	entry.size = sizes_[index];
+	entry.permissions = strings_[permissions_[index]];
+	entry.ownerGroup = strings_[ownerGroups_[index]];
+
+	uint8_t const flags = flags_[index];
+	entry.flags = flags & compact_direntry_flags;
+	if (flags & compact_has_time) {
+		entry.time = fz::datetime(static_cast<time_t>(0), static_cast<fz::datetime::accuracy>(flags >> compact_accuracy_shift));
+		entry.time += fz::duration::from_milliseconds(times_[index]);
+	}
+
+	auto it = std::lower_bound(targets_.cbegin(), targets_.cend(), index, [](auto const& target, size_t i) { return target.first < i; });
+	if (it != targets_.cend() && it->first == index) {
+		entry.target = fz::to_wstring_from_utf8(GetString(it->second));
+	}
+
+	return entry;
+}
+
+std::wstring CCompactDirectoryListing::name(size_t index) const
+{
+	return fz::to_wstring_from_utf8(GetString(names_[index]));
+}
+
+void CCompactDirectoryListing::add_flags(size_t index, int flags)
+{
+	flags_[index] |= static_cast<uint8_t>(flags & compact_direntry_flags);
+}
+
+void CCompactDirectoryListing::SetName(size_t index, std::wstring const& name)
+{
+	garbage_ += names_[index].length;
+	names_[index] = AddString(name);
+	ClearIndexes();
+	Compact();
+}
+
+void CCompactDirectoryListing::SetOwnerGroup(size_t index, std::wstring const& ownerGroup)
+{
+	ownerGroups_[index] = Intern(fz::shared_value<std::wstring>(ownerGroup));
+	if (!ownerGroup.empty()) {
+		m_flags |= CDirectoryListing::listing_has_usergroup;
+	}
+}
+
+void CCompactDirectoryListing::Append(CDirentry const& entry)
+{
+	uint32_t const index = static_cast<uint32_t>(size());
+	Push(entry, Intern(entry.permissions), Intern(entry.ownerGroup));
+
+	// Keep existing search indexes up to date as long as they have room
+	if (!index_case_.empty()) {
+		if ((size() * 2) > index_case_.size()) {
+			index_case_.clear();
+		}
+		else {
+			InsertIntoIndex(index_case_, hash_case(GetString(names_[index])), index);
+		}
+	}
+	if (!index_nocase_.empty()) {
+		if ((size() * 2) > index_nocase_.size()) {
+			index_nocase_.clear();
+		}
+		else {
+			InsertIntoIndex(index_nocase_, hash_nocase(fz::str_tolower(entry.name)), index);
+		}
+	}
+}
+
+void CCompactDirectoryListing::Append(CDirectoryListing const& listing)
+{
+	if (strings_.empty()) {
+		strings_.emplace_back();
+	}
+
+	// Like the constructor, look up strings by value. Only the first few
+	// strings are candidates though: Most listings have a handful of distinct
+	// permissions and owners, if there are many more they are unique per
+	// entry, such as Storj object ids. Considering all of them would make
+	// appending a listing page by page quadratic.
+	std::unordered_map<std::wstring, uint32_t> interned;
+	for (size_t i = 0; i < strings_.size() && i < 256; ++i) {
+		interned.emplace(*strings_[i], static_cast<uint32_t>(i));
+	}
+	auto intern = [&](fz::shared_value<std::wstring> const& s) {
+		auto it = interned.find(*s);
+		if (it != interned.end()) {
+			return it->second;
+		}
+		uint32_t const index = static_cast<uint32_t>(strings_.size());
+		strings_.push_back(s);
+		interned.emplace(*s, index);
+		return index;
+	};
+
+	ClearIndexes();
+
+	// No reserve, exact sizes would defeat the geometric growth over many pages
+	for (size_t i = 0; i < listing.size(); ++i) {
+		CDirentry const& entry = listing[i];
+		Push(entry, intern(entry.permissions), intern(entry.ownerGroup));
+	}
+
+	m_flags |= listing.m_flags;
+}
+
+bool CCompactDirectoryListing::RemoveEntry(size_t index)
+{
+	if (index >= size()) {
+		return false;
+	}
+
+	ClearIndexes();
+
+	if (is_dir(index)) {
+		m_flags |= CDirectoryListing::unsure_dir_removed;
+	}
+	else {
+		m_flags |= CDirectoryListing::unsure_file_removed;
+	}
+
+	garbage_ += names_[index].length;
+	names_.erase(names_.begin() + index);
+	sizes_.erase(sizes_.begin() + index);
+	times_.erase(times_.begin() + index);
+	flags_.erase(flags_.begin() + index);
+	permissions_.erase(permissions_.begin() + index);
+	ownerGroups_.erase(ownerGroups_.begin() + index);
+
+	auto it = std::lower_bound(targets_.begin(), targets_.end(), index, [](auto const& target, size_t i) { return target.first < i; });
+	if (it != targets_.end() && it->first == index) {
+		garbage_ += it->second.length;
+		it = targets_.erase(it);
+	}
+	for (; it != targets_.end(); ++it) {
+		--it->first;
+	}
+
+	Compact();
+
+	return true;
+}
+
+template<typename F>
+void CCompactDirectoryListing::Find(std::wstring const& name, bool nocase, F && f) const
+{
+	if (names_.empty()) {
+		return;
+	}
+
+	BuildIndex(nocase);
+	auto const& index = nocase ? index_nocase_ : index_case_;
+	size_t const mask = index.size() - 1;
+
+	std::string const utf8 = nocase ? std::string() : fz::to_utf8(name);
+	std::wstring const lower = nocase ? fz::str_tolower(name) : std::wstring();
+
+	// Linear probing keeps entries with the same name in ascending order
+	for (size_t slot = (nocase ? hash_nocase(lower) : hash_case(utf8)) & mask; index[slot] != compact_empty_slot; slot = (slot + 1) & mask) {
+		uint32_t const i = index[slot];
+		bool const match = nocase ? (fz::str_tolower(this->name(i)) == lower) : (GetString(names_[i]) == utf8);
+		if (match && !f(i)) {
+			break;
+		}
+	}
+}
+
+void CCompactDirectoryListing::BuildIndex(bool nocase) const
+{
+	auto & index = nocase ? index_nocase_ : index_case_;
+	if (!index.empty()) {
+		return;
+	}
+
+	size_t capacity = 8;
+	while (capacity < size() * 2) {
+		capacity *= 2;
+	}
+	index.assign(capacity, compact_empty_slot);
+
+	for (size_t i = 0; i < size(); ++i) {
+		size_t const hash = nocase ? hash_nocase(fz::str_tolower(name(i))) : hash_case(GetString(names_[i]));
+		InsertIntoIndex(index, hash, static_cast<uint32_t>(i));
+	}
+}
+
+void CCompactDirectoryListing::InsertIntoIndex(std::vector<uint32_t> & index, size_t hash, uint32_t i) const
+{
+	size_t const mask = index.size() - 1;
+	size_t slot = hash & mask;
+	while (index[slot] != compact_empty_slot) {
+		slot = (slot + 1) & mask;
+	}
+	index[slot] = i;
+}
+
+void CCompactDirectoryListing::ClearIndexes()
+{
+	index_case_.clear();
+	index_case_.shrink_to_fit();
+	index_nocase_.clear();
+	index_nocase_.shrink_to_fit();
+}
+
+size_t CCompactDirectoryListing::FindFile_CmpCase(std::wstring const& name) const
+{
+	size_t ret = std::string::npos;
+	Find(name, false, [&](size_t i) { ret = i; return false; });
+	return ret;
+}
+
+size_t CCompactDirectoryListing::FindFile_CmpNoCase(std::wstring const& name) const
+{
+	size_t ret = std::string::npos;
+	Find(name, true, [&](size_t i) { ret = i; return false; });
+	return ret;
+}
+
+std::vector<size_t> CCompactDirectoryListing::FindAll_CmpCase(std::wstring const& name) const
+{
+	std::vector<size_t> ret;
+	Find(name, false, [&](size_t i) { ret.push_back(i); return true; });
+	return ret;
+}
+
+std::vector<size_t> CCompactDirectoryListing::FindAll_CmpNoCase(std::wstring const& name) const
+{
+	std::vector<size_t> ret;
+	Find(name, true, [&](size_t i) { ret.push_back(i); return true; });
+	return ret;
+}
+
+size_t CCompactDirectoryListing::memory_usage() const
+{
+	size_t usage = sizeof(*this);
+	usage += arena_.capacity();
+	usage += names_.capacity() * sizeof(range);
+	usage += (sizes_.capacity() + times_.capacity()) * sizeof(int64_t);
+	usage += flags_.capacity();
+	usage += (permissions_.capacity() + ownerGroups_.capacity()) * sizeof(uint32_t);
+	usage += targets_.capacity() * sizeof(std::pair<uint32_t, range>);
+	usage += (index_case_.capacity() + index_nocase_.capacity()) * sizeof(uint32_t);
+	for (auto const& s : strings_) {
+		usage += sizeof(s) + sizeof(std::wstring) + s->capacity() * sizeof(wchar_t);
+	}
+	return usage;
+}
+
+CCompactDirectoryListing::range CCompactDirectoryListing::AddString(std::wstring const& s)
+{
+	std::string const utf8 = fz::to_utf8(s);
+
+	range r;
+	r.offset = static_cast<uint32_t>(arena_.size());
+	r.length = static_cast<uint32_t>(utf8.size());
+	arena_ += utf8;
+
+	return r;
+}
+
+uint32_t CCompactDirectoryListing::Intern(fz::shared_value<std::wstring> const& s)
+{
+	if (strings_.empty()) {
+		strings_.emplace_back();
+	}
+
+	if (s->empty()) {
+		return 0;
+	}
+	for (size_t i = 1; i < strings_.size(); ++i) {
+		if (*strings_[i] == *s) {
+			return static_cast<uint32_t>(i);
+		}
+	}
+
+	strings_.push_back(s);
+	return static_cast<uint32_t>(strings_.size() - 1);
+}
+
+void CCompactDirectoryListing::Compact()
+{
+	if (garbage_ < 4096 || garbage_ * 2 < arena_.size()) {
+		return;
+	}
+
+	std::string arena;
+	arena.reserve(arena_.size() - garbage_);
+	auto move = [&](range & r) {
+		uint32_t const offset = static_cast<uint32_t>(arena.size());
+		arena.append(arena_, r.offset, r.length);
+		r.offset = offset;
+	};
+	for (auto & r : names_) {
+		move(r);
+	}
+	for (auto & target : targets_) {
+		move(target.second);
+	}
+
+	arena_ = std::move(arena);
+	garbage_ = 0;
+}
@@ -42,7 +42,47 @@ struct ObjectCache
 };
 
 
-ObjectCache objcache;
+// Chunks of large listings get parsed on multiple threads
+thread_local ObjectCache objcache;
+
+// Returns the offset of the first CR, LF or NUL character, or len if there
+// is none. Looks at a whole word at a time, checking all its bytes at once.
+size_t FindLineEnd(unsigned char const* p, size_t len)
+{
+	uint64_t const ones = 0x0101010101010101ull;
+	uint64_t const highs = 0x8080808080808080ull;
+
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, 8);
+		uint64_t const cr = w ^ (ones * '\r');
+		uint64_t const lf = w ^ (ones * '\n');
+
+		// Can report bytes following a zero byte as well, the exact
+		// position gets determined below.
+		if ((((w - ones) & ~w) | ((cr - ones) & ~cr) | ((lf - ones) & ~lf)) & highs) {
+			break;
+		}
+	}
+	for (; i < len; ++i) {
+		if (p[i] == '\r' || p[i] == '\n' || !p[i]) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+bool IsLineSeparator(unsigned char c)
+{
+	return c == '\r' || c == '\n' || c == ' ' || c == '\t' || !c;
+}
+
+size_t const max_line_length = 10000;
+
+// Number of lines parsed at once on the thread pool
+size_t const chunk_lines = 4096;
 }
 
 class CToken final
@@ -661,20 +701,15 @@ CDirectoryListingParser::CDirectoryListingParser(CControlSocket* pControlSocket,
 
 #ifdef LISTDEBUG
 	for (unsigned int i = 0; data[i][0]; ++i) {
-		unsigned int len = (unsigned int)strlen(data[i]);
-		char *pData = new char[len + 3];
-		strcpy(pData, data[i]);
-		strcat(pData, "\r\n");
-		AddData(pData, len + 2);
+		AddData(data[i], strlen(data[i]));
+		AddData("\r\n", 2);
 	}
 #endif
 }
 
 CDirectoryListingParser::~CDirectoryListingParser()
 {
-	for (auto iter = m_DataList.begin(); iter != m_DataList.end(); ++iter) {
-		delete [] iter->p;
-	}
+	ClearChunks();
 
 	delete m_prevLine;
 }
@@ -686,35 +721,146 @@ bool CDirectoryListingParser::ParseData(bool partial)
 	bool error = false;
 	CLine *pLine = GetLine(partial, error);
 	while (pLine) {
-		bool res = ParseLine(*pLine, m_server.GetType(), false);
-		if (!res) {
-			if (m_prevLine) {
-				CLine* pConcatenatedLine = m_prevLine->Concat(pLine);
-				res = ParseLine(*pConcatenatedLine, m_server.GetType(), true);
-				delete pConcatenatedLine;
-				delete m_prevLine;
-
-				if (res) {
-					delete pLine;
-					m_prevLine = nullptr;
-				}
-				else {
-					m_prevLine = pLine;
-				}
+		if (pool_) {
+			pendingLines_.emplace_back(pLine);
+			if (pendingLines_.size() >= chunk_lines) {
+				StartChunk();
+			}
+		}
+		else {
+			ProcessLine(pLine);
+		}
+		pLine = GetLine(partial, error);
+	};
+
+	return !error;
+}
+
+void CDirectoryListingParser::ProcessLine(CLine *pLine)
+{
+	bool res = ParseLine(*pLine, m_server.GetType(), false);
+	if (!res) {
+		if (m_prevLine) {
+			CLine* pConcatenatedLine = m_prevLine->Concat(pLine);
+			res = ParseLine(*pConcatenatedLine, m_server.GetType(), true);
+			delete pConcatenatedLine;
+			delete m_prevLine;
+
+			if (res) {
+				delete pLine;
+				m_prevLine = nullptr;
 			}
 			else {
 				m_prevLine = pLine;
 			}
 		}
 		else {
+			m_prevLine = pLine;
+		}
+	}
+	else {
+		delete m_prevLine;
+		m_prevLine = nullptr;
+		delete pLine;
+	}
+}
+
+void CDirectoryListingParser::StartChunk()
+{
+	auto chunk = std::make_unique<ParseChunk>();
+	chunk->lines = std::move(pendingLines_);
+	pendingLines_.clear();
+
+	chunk->parser = std::make_unique<CDirectoryListingParser>(nullptr, m_server, m_listingEncoding);
+	chunk->parser->SetTimezoneOffset(m_timezoneOffset);
+
+	ParseChunk* p = chunk.get();
+	chunk->task = pool_->spawn([p]() { p->parser->ParseChunkLines(*p); });
+	if (!chunk->task) {
+		// Parse it later on this thread instead
+		chunk->parser.reset();
+	}
+
+	chunks_.emplace_back(std::move(chunk));
+}
+
+void CDirectoryListingParser::ParseChunkLines(ParseChunk & chunk)
+{
+	// The state after a line depends on the lines before it. Look for the
+	// first line this parser can parse on its own. After such a line, this
+	// parser is in the same state the sequential parser would be in.
+	// The line before must not be a possible part of a multiline VMS entry,
+	// those affect how the next line gets parsed.
+	auto & lines = chunk.lines;
+	for (size_t i = 1; i < lines.size(); ++i) {
+		if (chunk.sync != std::string::npos) {
+			ProcessLine(lines[i].release());
+			continue;
+		}
+
+		CToken token = lines[i - 1]->GetEndToken(0);
+		if (token && token.Find(' ') == -1 && token.Find(';') != -1) {
+			continue;
+		}
+
+		m_maybeMultilineVms = false;
+		if (ParseLine(*lines[i], m_server.GetType(), false)) {
+			chunk.sync = i;
+			lines[i].reset();
+		}
+	}
+}
+
+void CDirectoryListingParser::FinishChunks()
+{
+	for (auto & chunk : chunks_) {
+		if (chunk->task) {
+			chunk->task.join();
+		}
+
+		auto & lines = chunk->lines;
+		size_t const sync = chunk->parser ? std::min(chunk->sync, lines.size()) : lines.size();
+		for (size_t i = 0; i < sync; ++i) {
+			ProcessLine(lines[i].release());
+		}
+
+		if (sync < lines.size()) {
+			auto & parser = *chunk->parser;
+
 			delete m_prevLine;
-			m_prevLine = nullptr;
-			delete pLine;
+			m_prevLine = parser.m_prevLine;
+			parser.m_prevLine = nullptr;
+
+			m_maybeMultilineVms = parser.m_maybeMultilineVms;
+			m_fileList.clear();
+			m_fileListOnly = false;
+			lastFormat_ = parser.lastFormat_;
+
+			entries_.insert(entries_.end(), std::make_move_iterator(parser.entries_.begin()), std::make_move_iterator(parser.entries_.end()));
 		}
-		pLine = GetLine(partial, error);
-	};
 
-	return !error;
+		if (chunk->parser) {
+			formatStats_.lines += chunk->parser->formatStats_.lines;
+			formatStats_.hits += chunk->parser->formatStats_.hits;
+		}
+	}
+	chunks_.clear();
+
+	for (auto & line : pendingLines_) {
+		ProcessLine(line.release());
+	}
+	pendingLines_.clear();
+}
+
+void CDirectoryListingParser::ClearChunks()
+{
+	for (auto & chunk : chunks_) {
+		if (chunk->task) {
+			chunk->task.join();
+		}
+	}
+	chunks_.clear();
+	pendingLines_.clear();
 }
 
 CDirectoryListing CDirectoryListingParser::Parse(const CServerPath &path)
@@ -727,6 +873,11 @@ CDirectoryListing CDirectoryListingParser::Parse(const CServerPath &path)
 		listing.m_flags |= CDirectoryListing::listing_failed;
 		return listing;
 	}
+	FinishChunks();
+
+	if (m_pControlSocket && formatStats_.lines) {
+		m_pControlSocket->log(logmsg::debug_info, L"%d of %d lines matched the format of the preceding line", formatStats_.hits, formatStats_.lines);
+	}
 
 	if (!m_fileList.empty()) {
 		assert(entries_.empty());
@@ -767,27 +918,46 @@ bool CDirectoryListingParser::ParseLine(CLine &line, ServerType const serverType
 		}
 	}
 
-	ires = ParseAsMlsd(line, entry);
-	if (ires == 1) {
-		goto done;
+	if (lastFormat_ != listingFormat::none) {
+		++formatStats_.lines;
+		ires = ParseAsFormat(lastFormat_, line, entry);
+		if (ires) {
+			++formatStats_.hits;
+			if (ires == 1) {
+				goto done;
+			}
+			goto skip;
+		}
+		lastFormat_ = listingFormat::none;
+		entry = CDirentry();
 	}
-	else if (ires == 2) {
+
+	ires = ParseAsMlsd(line, entry);
+	if (ires) {
+		lastFormat_ = listingFormat::mlsd;
+		if (ires == 1) {
+			goto done;
+		}
 		goto skip;
 	}
 	res = ParseAsUnix(line, entry, true); // Common 'ls -l'
 	if (res) {
+		lastFormat_ = listingFormat::unix_style;
 		goto done;
 	}
 	res = ParseAsDos(line, entry);
 	if (res) {
+		lastFormat_ = listingFormat::dos;
 		goto done;
 	}
 	res = ParseAsEplf(line, entry);
 	if (res) {
+		lastFormat_ = listingFormat::eplf;
 		goto done;
 	}
 	res = ParseAsVms(line, entry);
 	if (res) {
+		lastFormat_ = listingFormat::vms;
 		goto done;
 	}
 	res = ParseOther(line, entry);
@@ -908,6 +1078,24 @@ skip:
 	return true;
 }
 
+int CDirectoryListingParser::ParseAsFormat(listingFormat format, CLine &line, CDirentry &entry)
+{
+	switch (format) {
+	case listingFormat::mlsd:
+		return ParseAsMlsd(line, entry);
+	case listingFormat::unix_style:
+		return ParseAsUnix(line, entry, true) ? 1 : 0;
+	case listingFormat::dos:
+		return ParseAsDos(line, entry) ? 1 : 0;
+	case listingFormat::eplf:
+		return ParseAsEplf(line, entry) ? 1 : 0;
+	case listingFormat::vms:
+		return ParseAsVms(line, entry) ? 1 : 0;
+	default:
+		return 0;
+	}
+}
+
 bool CDirectoryListingParser::ParseAsUnix(CLine &line, CDirentry &entry, bool expect_date)
 {
 	int index = 0;
@@ -2078,11 +2266,12 @@ bool CDirectoryListingParser::ParseOther(CLine &line, CDirentry &entry)
 	return true;
 }
 
-bool CDirectoryListingParser::AddData(char *pData, int len)
+bool CDirectoryListingParser::AddData(char const* data, size_t len)
 {
-	ConvertEncoding(pData, len);
-
-	m_DataList.emplace_back(pData, len);
+	unsigned char* p = data_.get(len);
+	memcpy(p, data, len);
+	ConvertEncoding(p, len);
+	data_.add(len);
 	m_totalData += len;
 
 	if (m_totalData < 512) {
@@ -2107,126 +2296,75 @@ bool CDirectoryListingParser::AddLine(std::wstring && line, std::wstring && name
 	return true;
 }
 
-CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
+void CDirectoryListingParser::AddEntry(CDirentry && entry, std::wstring const& permissions, std::wstring const& ownerGroup)
 {
-	while (!m_DataList.empty()) {
-		// Trim empty lines and spaces
-		auto iter = m_DataList.begin();
-		int len = iter->len;
-		while (iter->p[m_currentOffset] == '\r' || iter->p[m_currentOffset] == '\n'
-			|| iter->p[m_currentOffset] == ' ' || iter->p[m_currentOffset] == '\t'
-			|| !iter->p[m_currentOffset])
-		{
-			++m_currentOffset;
-			if (m_currentOffset >= len) {
-				delete [] iter->p;
-				++iter;
-				m_currentOffset = 0;
-				if (iter == m_DataList.end()) {
-					m_DataList.clear();
-					return nullptr;
-				}
-				len = iter->len;
-			}
-		}
-		m_DataList.erase(m_DataList.begin(), iter);
-		iter = m_DataList.begin();
+	m_fileList.clear();
+	m_fileListOnly = false;
+
+	// Don't add . or ..
+	if (entry.name == L"." || entry.name == L"..") {
+		return;
+	}
 
-		// Remember start offset and find next linebreak
-		int startpos = m_currentOffset;
-		int reslen = 0;
+	auto const timezoneOffset = m_server.GetTimezoneOffset();
+	if (timezoneOffset) {
+		entry.time += fz::duration::from_minutes(timezoneOffset);
+	}
 
-		int currentOffset = m_currentOffset;
-		while (iter->p[currentOffset] != '\n' && iter->p[currentOffset] != '\r' && iter->p[currentOffset]) {
-			++reslen;
+	entry.permissions = objcache.get(permissions);
+	entry.ownerGroup = objcache.get(ownerGroup);
 
-			++currentOffset;
-			if (currentOffset >= len) {
-				++iter;
-				if (iter == m_DataList.end()) {
-					if (reslen > 10000) {
-						if (m_pControlSocket) {
-							m_pControlSocket->log(logmsg::error, _("Received a line exceeding 10000 characters, aborting."));
-						}
-						error = true;
-						return nullptr;
-					}
-					if (breakAtEnd) {
-						return nullptr;
-					}
-					break;
-				}
-				len = iter->len;
-				currentOffset = 0;
-			}
+	entries_.emplace_back(std::move(entry));
+}
+
+CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
+{
+	while (!data_.empty()) {
+		// Trim empty lines and spaces
+		unsigned char const* p = data_.get();
+		size_t size = data_.size();
+		size_t start = 0;
+		while (start < size && IsLineSeparator(p[start])) {
+			++start;
+		}
+		data_.consume(start);
+		if (data_.empty()) {
+			return nullptr;
 		}
+		p = data_.get();
+		size = data_.size();
 
-		if (reslen > 10000) {
+		// Find next linebreak, no need to look further than the longest acceptable line
+		size_t const len = FindLineEnd(p, std::min(size, max_line_length + 1));
+		if (len > max_line_length) {
 			if (m_pControlSocket) {
 				m_pControlSocket->log(logmsg::error, _("Received a line exceeding 10000 characters, aborting."));
 			}
 			error = true;
 			return nullptr;
 		}
-		m_currentOffset = currentOffset;
-
-		// Reslen is now the length of the line, including any terminating whitespace
-		int const buflen = reslen;
-		char *res = new char[buflen + 1];
-		res[buflen] = 0;
-
-		int respos = 0;
-
-		// Copy line data
-		auto i = m_DataList.begin();
-		while (i != iter && reslen) {
-			int copylen = i->len - startpos;
-			if (copylen > reslen) {
-				copylen = reslen;
-			}
-			memcpy(&res[respos], &i->p[startpos], copylen);
-			reslen -= copylen;
-			respos += i->len - startpos;
-			startpos = 0;
-
-			delete [] i->p;
-			++i;
-		};
-
-		// Copy last chunk
-		if (iter != m_DataList.end() && reslen) {
-			int copylen = m_currentOffset-startpos;
-			if (copylen > reslen) {
-				copylen = reslen;
-			}
-			memcpy(&res[respos], &iter->p[startpos], copylen);
-			if (reslen >= iter->len) {
-				delete [] iter->p;
-				m_DataList.erase(m_DataList.begin(), ++iter);
-			}
-			else {
-				m_DataList.erase(m_DataList.begin(), iter);
-			}
-		}
-		else {
-			m_DataList.erase(m_DataList.begin(), iter);
+		if (len == size && breakAtEnd) {
+			// Line might not be complete yet
+			return nullptr;
 		}
 
+		char const* const line = reinterpret_cast<char const*>(p);
+
 		std::wstring buffer;
 		if (m_pControlSocket) {
-			buffer = m_pControlSocket->ConvToLocal(res, buflen);
+			buffer = m_pControlSocket->ConvToLocal(line, len);
 			m_pControlSocket->log_raw(logmsg::listing, buffer);
 		}
 		else {
-			buffer = fz::to_wstring_from_utf8(res);
+			buffer = fz::to_wstring_from_utf8(line, len);
 			if (buffer.empty()) {
-				buffer = fz::to_wstring(res);
+				buffer = fz::to_wstring(std::string_view(line, len));
 				if (buffer.empty()) {
-					buffer = std::wstring(res, res + strlen(res));
+					buffer = std::wstring(line, line + len);
 				}
 			}
 		}
-		delete [] res;
+		data_.consume(len);
 
 		// Strip BOM
 		if (buffer[0] == 0xfeff) {
@@ -2924,19 +3062,19 @@ bool CDirectoryListingParser::ParseAsOS9(CLine &line, CDirentry &entry)
 
 void CDirectoryListingParser::Reset()
 {
-	for (auto & item : m_DataList) {
-		delete [] item.p;
-	}
-	m_DataList.clear();
+	data_.clear();
+	ClearChunks();
 
 	delete m_prevLine;
 	m_prevLine = nullptr;
 
 	entries_.clear();
 	m_fileList.clear();
-	m_currentOffset = 0;
 	m_fileListOnly = true;
 	m_maybeMultilineVms = false;
+
+	lastFormat_ = listingFormat::none;
+	formatStats_ = FormatStats();
 }
 
 bool CDirectoryListingParser::ParseAsZVM(CLine &line, CDirentry &entry)
@@ -3117,14 +3255,14 @@ char const ebcdic_table[256] = {
 	'0',  '1',  '2',  '3',  '4',  '5',  '6',  '7',  '8',  '9',  ' ',  ' ',  ' ',  ' ',  ' ',  ' '   // f
 };
 
-void CDirectoryListingParser::ConvertEncoding(char *pData, int len)
+void CDirectoryListingParser::ConvertEncoding(unsigned char *pData, size_t len)
 {
 	if (m_listingEncoding != listingEncoding::ebcdic) {
 		return;
 	}
 
-	for (int i = 0; i < len; ++i) {
-		pData[i] = ebcdic_table[static_cast<unsigned char>(pData[i])];
+	for (size_t i = 0; i < len; ++i) {
+		pData[i] = ebcdic_table[pData[i]];
 	}
 }
 
@@ -3138,10 +3276,9 @@ void CDirectoryListingParser::DeduceEncoding()
 
 	memset(&count, 0, sizeof(int)*256);
 
-	for (auto const& data : m_DataList) {
-		for (int i = 0; i < data.len; ++i) {
-			++count[static_cast<unsigned char>(data.p[i])];
-		}
+	unsigned char const* const p = data_.get();
+	for (size_t i = 0; i < data_.size(); ++i) {
+		++count[p[i]];
 	}
 
 	int count_normal = 0;
@@ -3184,9 +3321,7 @@ void CDirectoryListingParser::DeduceEncoding()
 			m_pControlSocket->log(logmsg::status, _("Received a directory listing which appears to be encoded in EBCDIC."));
 		}
 		m_listingEncoding = listingEncoding::ebcdic;
-		for (auto & data : m_DataList) {
-			ConvertEncoding(data.p, data.len);
-		}
+		ConvertEncoding(data_.get(), data_.size());
 	}
 	else {
 		m_listingEncoding = listingEncoding::normal;
@@ -25,8 +25,10 @@
  * expected parser result.
  *
  * If adding data to the parser, it first decomposes the raw data into lines,
- * which then are processed further. Each line gets consecutively tested for
- * different formats, starting with the most common Unix style format.
+ * which then are processed further. Received data is kept in a single
+ * contiguous buffer, each line gets converted directly from it.
+ * Each line gets consecutively tested for different formats, starting with
+ * the most common Unix style format.
  * Lines not containing a recognized format (e.g. a part of a multiline
  * entry) are rememberd and if the next line cannot be parsed either, they
  * get concatenated to be parsed again (and discarded if not recognized).
@@ -35,7 +37,10 @@
 #include <directorylisting.h>
 #include <server.h>
 
-#include <deque>
+#include <libfilezilla/buffer.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+#include <memory>
 #include <vector>
 
 class CLine;
@@ -64,20 +69,71 @@ public:
 
 	CDirectoryListing Parse(const CServerPath &path);
 
-	bool AddData(char *pData, int len);
+	bool AddData(char const* data, size_t len);
 	bool AddLine(std::wstring && line, std::wstring && name, fz::datetime const& time);
 
+	// Adds an already parsed entry, e.g. from structured SFTP attributes.
+	void AddEntry(CDirentry && entry, std::wstring const& permissions, std::wstring const& ownerGroup);
+
 	void Reset();
 
 	void SetTimezoneOffset(fz::duration const& span) { m_timezoneOffset = span; }
 
 	void SetServer(const CServer& server) { m_server = server; };
 
+	// Lines received through AddData get parsed in chunks on the given
+	// thread pool. The results get merged in order by Parse.
+	void EnableParallelParsing(fz::thread_pool & pool) { pool_ = &pool; }
+
+	// Each line is first tried with the format of the last successfully
+	// parsed line, all formats only get tried if that fails.
+	struct FormatStats
+	{
+		int64_t lines{};  // Lines tried with the remembered format
+		int64_t hits{};   // Of those, lines in the remembered format
+	};
+	FormatStats const& GetFormatStats() const { return formatStats_; }
+
 protected:
+	// Formats eligible for the fast path. Only those which cannot be
+	// mistaken for formats preceding them in the full list of formats.
+	enum class listingFormat
+	{
+		none,
+		mlsd,
+		unix_style,
+		dos,
+		eplf,
+		vms
+	};
+	int ParseAsFormat(listingFormat format, CLine &line, CDirentry &entry);
+
 	CLine *GetLine(bool breakAtEnd, bool& error);
 
 	bool ParseData(bool partial);
 
+	// Parses the line, possibly together with the previous line if it
+	// could not be parsed on its own. Takes ownership of the line.
+	void ProcessLine(CLine *pLine);
+
+	// Lines parsed on the thread pool
+	struct ParseChunk
+	{
+		std::vector<std::unique_ptr<CLine>> lines;
+
+		// Index of the first line the chunk parser could parse on its own
+		// while being in the same state as the sequential parser. Lines
+		// before it are left to the sequential parser.
+		size_t sync{std::string::npos};
+
+		std::unique_ptr<CDirectoryListingParser> parser;
+		fz::async_task task;
+	};
+	void StartChunk();
+	void ParseChunkLines(ParseChunk & chunk);
+	void FinishChunks();
+	void ClearChunks();
+
 	bool ParseLine(CLine &line, ServerType const serverType, bool concatenated, CDirentry const* override = nullptr);
 
 	bool ParseAsUnix(CLine &line, CDirentry &entry, bool expect_date);
@@ -114,26 +170,15 @@ protected:
 	bool GetMonthFromName(std::wstring const& name, int &month);
 
 	void DeduceEncoding();
-	void ConvertEncoding(char *pData, int len);
+	void ConvertEncoding(unsigned char *pData, size_t len);
 
 	CControlSocket* m_pControlSocket;
 
 	static std::map<std::wstring, int> m_MonthNamesMap;
 
-	struct t_list
-	{
-		t_list() = default;
-		t_list(char* s, int l)
-			: p(s), len(l)
-		{}
-
-		char *p;
-		int len;
-	};
-
-	int m_currentOffset{};
+	// Received data not yet split into lines
+	fz::buffer data_;
 
-	std::deque<t_list> m_DataList;
 	std::vector<fz::shared_value<CDirentry>> entries_;
 	int64_t m_totalData{};
 
@@ -146,9 +191,16 @@ protected:
 
 	bool m_maybeMultilineVms{};
 
+	listingFormat lastFormat_{listingFormat::none};
+	FormatStats formatStats_;
+
 	fz::duration m_timezoneOffset;
 
 	listingEncoding::type m_listingEncoding;
+
+	fz::thread_pool* pool_{};
+	std::vector<std::unique_ptr<CLine>> pendingLines_;
+	std::vector<std::unique_ptr<ParseChunk>> chunks_;
 };
 
 #endif
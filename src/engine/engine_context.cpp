@@ -6,12 +6,23 @@
 #include "oplock_manager.h"
 #include "option_change_event_handler.h"
 #include "pathcache.h"
+#include "servercapabilities.h"
+#include "xmlutils.h"
 
 #include <libfilezilla/event_loop.hpp>
 #include <libfilezilla/rate_limiter.hpp>
 #include <libfilezilla/thread_pool.hpp>
 #include <libfilezilla/tls_system_trust_store.hpp>
 
+namespace {
+size_t CacheMemoryLimit(COptionsBase& options)
+{
+	// The option is in MiB and allows more than fits into a 32-bit size_t
+	uint64_t const bytes = static_cast<uint64_t>(options.GetOptionVal(OPTION_CACHE_MAXSIZE)) * 1024 * 1024;
+	return static_cast<size_t>(std::min<uint64_t>(bytes, std::numeric_limits<size_t>::max()));
+}
+}
+
 class CFileZillaEngineContext::Impl final : private COptionChangeEventHandler
 {
 public:
@@ -21,6 +32,7 @@ public:
 		, tlsSystemTrustStore_(pool_)
 	{
 		directory_cache_.SetTtl(fz::duration::from_seconds(options.GetOptionVal(OPTION_CACHE_TTL)));
+		directory_cache_.SetMaxMemory(CacheMemoryLimit(options));
 		rate_limit_mgr_.add(&rate_limiter_);
 
 		RegisterOption(OPTION_SPEEDLIMIT_ENABLE);
@@ -129,3 +141,15 @@ fz::tls_system_trust_store& CFileZillaEngineContext::GetTlsSystemTrustStore()
 {
 	return impl_->tlsSystemTrustStore_;
 }
+
+void CFileZillaEngineContext::LoadServerCapabilities(pugi::xml_node element)
+{
+	CServerCapabilities::Load(element, fz::duration::from_seconds(options_.GetOptionVal(OPTION_CAPABILITIES_CACHE_TTL)));
+}
+
+void CFileZillaEngineContext::SaveServerCapabilities(pugi::xml_node element)
+{
+	// Keep what other instances have saved in the meantime
+	LoadServerCapabilities(element);
+	CServerCapabilities::Save(element);
+}
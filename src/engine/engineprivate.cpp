@@ -939,6 +939,18 @@ void CTransferStatusManager::Update(int64_t transferredBytes)
 	}
 }
 
+void CTransferStatusManager::SetCompression(int64_t compressed, int64_t uncompressed, fz::duration const& time)
+{
+	fz::scoped_lock lock(mutex_);
+	if (!status_) {
+		return;
+	}
+
+	status_.compressedSize = compressed;
+	status_.uncompressedSize = uncompressed;
+	status_.compressionTime = time;
+}
+
 CTransferStatus CTransferStatusManager::Get(bool &changed)
 {
 	fz::scoped_lock lock(mutex_);
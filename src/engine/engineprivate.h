@@ -41,6 +41,7 @@ public:
 	void SetStartTime();
 	void SetMadeProgress();
 	void Update(int64_t transferredBytes);
+	void SetCompression(int64_t compressed, int64_t uncompressed, fz::duration const& time);
 
 	CTransferStatus Get(bool &changed);
 
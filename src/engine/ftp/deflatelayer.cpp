@@ -0,0 +1,217 @@
+#include <filezilla.h>
+
+#include "deflatelayer.h"
+
+#include <algorithm>
+
+#include <errno.h>
+
+namespace {
+size_t const chunk_size = 64 * 1024;
+}
+
+CDeflateLayer::CDeflateLayer(fz::event_loop & loop, fz::event_handler* handler, fz::socket_interface & next_layer, bool upload)
+	: fz::event_handler(loop)
+	, fz::socket_layer(handler, next_layer, false)
+	, upload_(upload)
+{
+	next_layer_.set_event_handler(this);
+}
+
+CDeflateLayer::~CDeflateLayer()
+{
+	remove_handler();
+	next_layer_.set_event_handler(nullptr);
+
+	if (inflate_initialized_) {
+		inflateEnd(&inflate_);
+	}
+	if (deflate_initialized_) {
+		deflateEnd(&deflate_);
+	}
+}
+
+int CDeflateLayer::read(void *buffer, unsigned int size, int& error)
+{
+	if (!inflate_initialized_) {
+		if (inflateInit(&inflate_) != Z_OK) {
+			error = ENOMEM;
+			return -1;
+		}
+		inflate_initialized_ = true;
+	}
+
+	while (!inflate_finished_) {
+		if (!recv_buffer_.empty() || inflate_pending_) {
+			inflate_.next_in = recv_buffer_.get();
+			inflate_.avail_in = static_cast<uInt>(recv_buffer_.size());
+			inflate_.next_out = static_cast<unsigned char*>(buffer);
+			inflate_.avail_out = size;
+
+			auto const start = fz::monotonic_clock::now();
+			int const res = inflate(&inflate_, Z_NO_FLUSH);
+			compression_time_ += fz::monotonic_clock::now() - start;
+
+			size_t const consumed = recv_buffer_.size() - inflate_.avail_in;
+			recv_buffer_.consume(consumed);
+
+			if (res == Z_STREAM_END) {
+				inflate_finished_ = true;
+			}
+			else if (res != Z_OK && res != Z_BUF_ERROR) {
+				error = EPROTO;
+				return -1;
+			}
+
+			unsigned int const produced = size - inflate_.avail_out;
+			inflate_pending_ = !inflate_.avail_out;
+			if (produced) {
+				uncompressed_bytes_ += produced;
+				return static_cast<int>(produced);
+			}
+			if (!consumed && !recv_buffer_.empty() && !inflate_finished_) {
+				error = EPROTO;
+				return -1;
+			}
+			continue;
+		}
+
+		int const read = next_layer_.read(recv_buffer_.get(chunk_size), chunk_size, error);
+		if (read < 0) {
+			return -1;
+		}
+		if (!read) {
+			// Some servers do not properly finish the stream
+			inflate_finished_ = true;
+			break;
+		}
+		recv_buffer_.add(static_cast<size_t>(read));
+		compressed_bytes_ += read;
+	}
+
+	// Anything following the end of the compressed stream gets ignored
+	return 0;
+}
+
+int CDeflateLayer::write(void const* buffer, unsigned int size, int& error)
+{
+	if (shutting_down_) {
+		error = ENOTCONN;
+		return -1;
+	}
+
+	// Only accept more data once the previous data has been passed on
+	if (!Flush(error)) {
+		return -1;
+	}
+
+	if (!InitDeflate(error) || !Deflate(static_cast<unsigned char const*>(buffer), size, Z_NO_FLUSH, error)) {
+		return -1;
+	}
+	uncompressed_bytes_ += size;
+
+	if (!Flush(error) && error != EAGAIN) {
+		return -1;
+	}
+
+	return static_cast<int>(size);
+}
+
+int CDeflateLayer::shutdown()
+{
+	int error{};
+	if (upload_ && !deflate_finished_) {
+		if (!InitDeflate(error) || !Deflate(nullptr, 0, Z_FINISH, error)) {
+			return error;
+		}
+		deflate_finished_ = true;
+	}
+	shutting_down_ = true;
+
+	if (!Flush(error)) {
+		return error;
+	}
+
+	return next_layer_.shutdown();
+}
+
+bool CDeflateLayer::InitDeflate(int & error)
+{
+	if (!deflate_initialized_) {
+		if (deflateInit(&deflate_, Z_DEFAULT_COMPRESSION) != Z_OK) {
+			error = ENOMEM;
+			return false;
+		}
+		deflate_initialized_ = true;
+	}
+
+	return true;
+}
+
+bool CDeflateLayer::Deflate(unsigned char const* data, unsigned int size, int flush, int & error)
+{
+	deflate_.next_in = const_cast<unsigned char*>(data);
+	deflate_.avail_in = size;
+
+	auto const start = fz::monotonic_clock::now();
+	int res;
+	do {
+		deflate_.next_out = send_buffer_.get(chunk_size);
+		deflate_.avail_out = static_cast<uInt>(chunk_size);
+
+		res = deflate(&deflate_, flush);
+		send_buffer_.add(chunk_size - deflate_.avail_out);
+
+		if (res == Z_STREAM_ERROR) {
+			error = EINVAL;
+			return false;
+		}
+	} while (deflate_.avail_in || (flush == Z_FINISH && res != Z_STREAM_END));
+	compression_time_ += fz::monotonic_clock::now() - start;
+
+	return true;
+}
+
+bool CDeflateLayer::Flush(int & error)
+{
+	while (!send_buffer_.empty()) {
+		unsigned int const size = static_cast<unsigned int>(std::min(send_buffer_.size(), chunk_size));
+		int const written = next_layer_.write(send_buffer_.get(), size, error);
+		if (written <= 0) {
+			if (!written) {
+				error = EAGAIN;
+			}
+			return false;
+		}
+		send_buffer_.consume(static_cast<size_t>(written));
+		compressed_bytes_ += written;
+	}
+
+	return true;
+}
+
+void CDeflateLayer::operator()(fz::event_base const& ev)
+{
+	fz::dispatch<fz::socket_event, fz::hostaddress_event>(ev, this,
+		&CDeflateLayer::OnSocketEvent,
+		&CDeflateLayer::forward_hostaddress_event);
+}
+
+void CDeflateLayer::OnSocketEvent(fz::socket_event_source* source, fz::socket_event_flag t, int error)
+{
+	if (t == fz::socket_event_flag::write && !error && !send_buffer_.empty()) {
+		if (!Flush(error)) {
+			if (error == EAGAIN) {
+				return;
+			}
+		}
+		else if (shutting_down_) {
+			error = next_layer_.shutdown();
+			if (error == EAGAIN) {
+				return;
+			}
+		}
+	}
+
+	forward_socket_event(source, t, error);
+}
@@ -0,0 +1,61 @@
+#ifndef FILEZILLA_ENGINE_FTP_DEFLATELAYER_HEADER
+#define FILEZILLA_ENGINE_FTP_DEFLATELAYER_HEADER
+
+#include <libfilezilla/buffer.hpp>
+#include <libfilezilla/socket.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <zlib.h>
+
+// Socket layer for FTP MODE Z: Data read from the next layer gets inflated,
+// data written gets deflated. On uploads, shutdown finishes the compressed
+// stream before shutting down the next layer.
+class CDeflateLayer final : protected fz::event_handler, public fz::socket_layer
+{
+public:
+	CDeflateLayer(fz::event_loop & loop, fz::event_handler* handler, fz::socket_interface & next_layer, bool upload);
+	virtual ~CDeflateLayer();
+
+	virtual int read(void *buffer, unsigned int size, int& error) override;
+	virtual int write(void const* buffer, unsigned int size, int& error) override;
+
+	virtual int shutdown() override;
+
+	// Amount of data on the wire and of the data it corresponds to
+	int64_t compressed_bytes() const { return compressed_bytes_; }
+	int64_t uncompressed_bytes() const { return uncompressed_bytes_; }
+
+	// Time spent in zlib
+	fz::duration compression_time() const { return compression_time_; }
+
+private:
+	virtual void operator()(fz::event_base const& ev) override;
+	void OnSocketEvent(fz::socket_event_source* source, fz::socket_event_flag t, int error);
+
+	bool InitDeflate(int & error);
+	bool Deflate(unsigned char const* data, unsigned int size, int flush, int & error);
+
+	// Writes out pending compressed data
+	bool Flush(int & error);
+
+	bool const upload_;
+
+	z_stream inflate_{};
+	bool inflate_initialized_{};
+	bool inflate_finished_{};
+	bool inflate_pending_{}; // zlib may hold back output if the last read filled the whole buffer
+	fz::buffer recv_buffer_;
+
+	z_stream deflate_{};
+	bool deflate_initialized_{};
+	bool deflate_finished_{};
+	fz::buffer send_buffer_;
+
+	bool shutting_down_{};
+
+	int64_t compressed_bytes_{};
+	int64_t uncompressed_bytes_{};
+	fz::duration compression_time_;
+};
+
+#endif
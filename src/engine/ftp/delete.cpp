@@ -18,21 +18,30 @@ int CFtpDeleteOpData::Send()
 		return FZ_REPLY_CONTINUE;
 	}
 	else if (opState == del_del) {
-		std::wstring const& file = files_.back();
-		if (file.empty()) {
-			log(logmsg::debug_info, L"Empty filename");
-			return FZ_REPLY_INTERNALERROR;
-		}
-
-		std::wstring filename = path_.FormatFilename(file, omitPath_);
-		if (filename.empty()) {
-			log(logmsg::error, _("Filename cannot be constructed for directory %s and filename %s"), path_.GetPath(), file);
-			return FZ_REPLY_ERROR;
+		while (pending_ < depth_ && static_cast<size_t>(pending_) < files_.size()) {
+			std::wstring const& file = files_[files_.size() - 1 - pending_];
+			if (file.empty()) {
+				log(logmsg::debug_info, L"Empty filename");
+				return FZ_REPLY_INTERNALERROR;
+			}
+
+			std::wstring filename = path_.FormatFilename(file, omitPath_);
+			if (filename.empty()) {
+				log(logmsg::error, _("Filename cannot be constructed for directory %s and filename %s"), path_.GetPath(), file);
+				return FZ_REPLY_ERROR;
+			}
+
+			engine_.GetDirectoryCache().InvalidateFile(currentServer_, path_, file);
+
+			// Round trip time can only be measured if nothing else is in flight
+			int res = controlSocket_.SendCommand(L"DELE " + filename, false, !pending_);
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				return res;
+			}
+			++pending_;
 		}
 
-		engine_.GetDirectoryCache().InvalidateFile(currentServer_, path_, file);
-
-		return controlSocket_.SendCommand(L"DELE " + filename);
+		return FZ_REPLY_WOULDBLOCK;
 	}
 
 	log(logmsg::debug_warning, L"Unkown op state %d", opState);
@@ -42,8 +51,26 @@ int CFtpDeleteOpData::Send()
 int CFtpDeleteOpData::ParseResponse()
 {
 	int code = controlSocket_.GetReplyCode();
+	if (code == 1) {
+		// Preliminary reply, wait for the one completing the command
+		return FZ_REPLY_WOULDBLOCK;
+	}
+
+	if (pending_ > 0) {
+		--pending_;
+	}
+
 	if (code != 2 && code != 3) {
 		deleteFailed_ = true;
+
+		std::wstring const& response = controlSocket_.m_Response;
+		if (depth_ > 1 && (response.substr(0, 2) == L"50" || response.substr(0, 3) == L"421")) {
+			// Syntax errors, bad sequence of commands or the server
+			// closing the connection hint at the server not coping with
+			// pipelined commands. Continue one command at a time.
+			controlSocket_.DisablePipelining();
+			depth_ = 1;
+		}
 	}
 	else {
 		std::wstring const& file = files_.back();
@@ -80,6 +107,7 @@ int CFtpDeleteOpData::SubcommandResult(int prevResult, COpData const&)
 		}
 
 		time_ = fz::monotonic_clock::now();
+		depth_ = controlSocket_.GetPipelineDepth();
 		return FZ_REPLY_CONTINUE;
 	}
 	else {
@@ -89,6 +117,11 @@ int CFtpDeleteOpData::SubcommandResult(int prevResult, COpData const&)
 
 int CFtpDeleteOpData::Reset(int result)
 {
+	if (depth_ > 1 && pending_ > 1 && (result & FZ_REPLY_TIMEOUT) == FZ_REPLY_TIMEOUT) {
+		// Some servers silently drop commands received while still busy
+		controlSocket_.DisablePipelining();
+	}
+
 	if (needSendListing_ && !(result & FZ_REPLY_DISCONNECTED)) {
 		controlSocket_.SendDirectoryListingNotification(path_, false);
 	}
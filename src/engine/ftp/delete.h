@@ -30,6 +30,11 @@ public:
 
 	// Set to true if deletion of at least one file failed
 	bool deleteFailed_{};
+
+	// With pipelining, DELE is sent for up to depth_ files before
+	// waiting for replies. The last pending_ entries of files_ are in flight.
+	int depth_{1};
+	int pending_{};
 };
 
 #endif
@@ -71,7 +71,14 @@ int CFtpFileTransferOpData::Send()
 
 		{
 			auto pFile = std::make_unique<fz::file>();
-			if (download_) {
+			int64_t expectedSize = -1;
+			if (download_ && transferSettings_.segmented()) {
+				if (!OpenSegment(*pFile)) {
+					return FZ_REPLY_ERROR;
+				}
+				expectedSize = transferSettings_.segmentLength;
+			}
+			else if (download_) {
 				int64_t startOffset = 0;
 
 				// Potentially racy
@@ -117,6 +124,10 @@ int CFtpFileTransferOpData::Send()
 
 				engine_.transfer_status_.Init(remoteFileSize_, startOffset, false);
 
+				if (remoteFileSize_ >= startOffset) {
+					expectedSize = remoteFileSize_ - startOffset;
+				}
+
 				if (engine_.GetOptions().GetOptionVal(OPTION_PREALLOCATE_SPACE)) {
 					// Try to preallocate the file in order to reduce fragmentation
 					int64_t sizeToPreallocate = remoteFileSize_ - startOffset;
@@ -196,18 +207,43 @@ int CFtpFileTransferOpData::Send()
 				auto len = pFile->size();
 				engine_.transfer_status_.Init(len, startOffset, false);
 			}
-			ioThread_ = std::make_unique<CIOThread>();
-			if (!ioThread_->Create(engine_.GetThreadPool(), std::move(pFile), !download_, binary)) {
-				// CIOThread will delete pFile
-				ioThread_.reset();
-				log(logmsg::error, _("Could not spawn IO thread"));
-				return FZ_REPLY_ERROR;
+
+			TransferMode const mode = download_ ? TransferMode::download : TransferMode::upload;
+			if (!transferSettings_.segmented() && CTransferSocket::CanUseZeroCopy(engine_, controlSocket_, mode, binary)) {
+				// The file is accessed directly by the transfer socket, pFile only
+				// served to prepare it. Preallocated space remains in place.
+				int64_t const offset = pFile->seek(0, fz::file::current);
+				if (offset >= 0) {
+					auto transferSocket = std::make_unique<CTransferSocket>(engine_, controlSocket_, mode);
+					if (transferSocket->SetupZeroCopy(localFile_, offset)) {
+						controlSocket_.m_pTransferSocket = std::move(transferSocket);
+					}
+				}
+			}
+
+			if (!controlSocket_.m_pTransferSocket) {
+				ioThread_ = std::make_unique<CIOThread>();
+				if (download_ && transferSettings_.segmented()) {
+					// Other segments are written to the same file
+					ioThread_->SetTruncateOnClose(false);
+				}
+				if (!ioThread_->Create(engine_.GetThreadPool(), std::move(pFile), !download_, binary, expectedSize)) {
+					// CIOThread will delete pFile
+					ioThread_.reset();
+					log(logmsg::error, _("Could not spawn IO thread"));
+					return FZ_REPLY_ERROR;
+				}
+
+				controlSocket_.m_pTransferSocket = std::make_unique<CTransferSocket>(engine_, controlSocket_, mode);
+				controlSocket_.m_pTransferSocket->SetIOThread(ioThread_.get());
+			}
+
+			if (download_ && transferSettings_.segmented()) {
+				controlSocket_.m_pTransferSocket->SetTransferLimit(transferSettings_.segmentLength);
 			}
 		}
 
-		controlSocket_.m_pTransferSocket = std::make_unique<CTransferSocket>(engine_, controlSocket_, download_ ? TransferMode::download : TransferMode::upload);
 		controlSocket_.m_pTransferSocket->m_binaryMode = transferSettings_.binary;
-		controlSocket_.m_pTransferSocket->SetIOThread(ioThread_.get());
 
 		if (download_) {
 			cmd = L"RETR ";
@@ -251,6 +287,27 @@ int CFtpFileTransferOpData::Send()
 	return FZ_REPLY_WOULDBLOCK;
 }
 
+bool CFtpFileTransferOpData::OpenSegment(fz::file & file)
+{
+	int64_t const offset = transferSettings_.segmentOffset;
+	if (!file.open(fz::to_native(localFile_), fz::file::writing, fz::file::existing)) {
+		log(logmsg::error, _("Failed to open \"%s\" for writing"), localFile_);
+		return false;
+	}
+	if (file.seek(offset, fz::file::begin) != offset) {
+		log(logmsg::error, _("Could not seek to offset %d within file"), offset);
+		return false;
+	}
+
+	log(logmsg::debug_info, L"Downloading segment of %d bytes at offset %d", transferSettings_.segmentLength, offset);
+
+	// REST positions the server, the transfer socket stops at the end of the segment
+	resumeOffset = offset;
+	engine_.transfer_status_.Init(transferSettings_.segmentLength, 0, false);
+
+	return true;
+}
+
 int CFtpFileTransferOpData::TestResumeCapability()
 {
 	log(logmsg::debug_verbose, L"CFtpFileTransferOpData::TestResumeCapability()");
@@ -387,7 +444,7 @@ int CFtpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			bool found = engine_.GetDirectoryCache().LookupFile(entry, currentServer_, tryAbsolutePath_ ? remotePath_ : currentPath_, remoteFile_, dirDidExist, matchedCase);
 			if (!found) {
 				if (!dirDidExist) {
-					opState = filetransfer_waitlist;
+					opState = filetransfer_waitlookup;
 				}
 				else if (download_ && engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS) && CServerCapabilities::GetCapability(currentServer_, mdtm_command) == yes) {
 					opState = filetransfer_mdtm;
@@ -398,7 +455,7 @@ int CFtpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			}
 			else {
 				if (entry.is_unsure()) {
-					opState = filetransfer_waitlist;
+					opState = filetransfer_waitlookup;
 				}
 				else {
 					if (matchedCase) {
@@ -423,8 +480,9 @@ int CFtpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 					}
 				}
 			}
-			if (opState == filetransfer_waitlist) {
-				controlSocket_.List(CServerPath(), L"", LIST_FLAG_REFRESH);
+			if (opState == filetransfer_waitlookup) {
+				// Only lists the directory if the file cannot be looked at on its own
+				controlSocket_.Lookup(tryAbsolutePath_ ? remotePath_ : currentPath_, remoteFile_, &lookupEntry_);
 				return FZ_REPLY_CONTINUE;
 			}
 			else if (opState == filetransfer_resumetest) {
@@ -439,17 +497,16 @@ int CFtpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			opState = filetransfer_size;
 		}
 	}
-	else if (opState == filetransfer_waitlist) {
+	else if (opState == filetransfer_waitlookup) {
 		if (prevResult == FZ_REPLY_OK) {
-			CDirentry entry;
-			bool dirDidExist;
-			bool matchedCase;
-			bool found = engine_.GetDirectoryCache().LookupFile(entry, currentServer_, tryAbsolutePath_ ? remotePath_ : currentPath_, remoteFile_, dirDidExist, matchedCase);
-			if (!found) {
-				if (!dirDidExist) {
-					opState = filetransfer_size;
+			if (lookupEntry_.name == remoteFile_ && !lookupEntry_.is_unsure()) {
+				remoteFileSize_ = lookupEntry_.size;
+				if (lookupEntry_.has_date()) {
+					fileTime_ = lookupEntry_.time;
 				}
-				else if (download_ &&
+
+				if (download_ &&
+					!lookupEntry_.has_time() &&
 					engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS) &&
 					CServerCapabilities::GetCapability(currentServer_, mdtm_command) == yes)
 				{
@@ -460,38 +517,30 @@ int CFtpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 				}
 			}
 			else {
-				if (matchedCase && !entry.is_unsure()) {
-					remoteFileSize_ = entry.size;
-					if (entry.has_date()) {
-						fileTime_ = entry.time;
-					}
-
-					if (download_ &&
-						!entry.has_time() &&
-						engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS) &&
-						CServerCapabilities::GetCapability(currentServer_, mdtm_command) == yes)
-					{
-						opState = filetransfer_mdtm;
-					}
-					else {
-						opState = filetransfer_resumetest;
-					}
-				}
-				else {
-					opState = filetransfer_size;
-				}
+				opState = filetransfer_size;
 			}
-
-			if (opState == filetransfer_resumetest) {
-				int res = controlSocket_.CheckOverwriteFile();
-				if (res != FZ_REPLY_OK) {
-					return res;
-				}
+		}
+		else if ((prevResult & FZ_REPLY_ERROR_NOTFOUND) == FZ_REPLY_ERROR_NOTFOUND) {
+			if (download_ &&
+				engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS) &&
+				CServerCapabilities::GetCapability(currentServer_, mdtm_command) == yes)
+			{
+				opState = filetransfer_mdtm;
+			}
+			else {
+				opState = filetransfer_resumetest;
 			}
 		}
 		else {
 			opState = filetransfer_size;
 		}
+
+		if (opState == filetransfer_resumetest) {
+			int res = controlSocket_.CheckOverwriteFile();
+			if (res != FZ_REPLY_OK) {
+				return res;
+			}
+		}
 	}
 	else if (opState == filetransfer_waittransfer) {
 		if (prevResult == FZ_REPLY_OK && engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS)) {
@@ -505,7 +554,7 @@ int CFtpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 					return FZ_REPLY_CONTINUE;
 				}
 			}
-			else if (download_ && !fileTime_.empty()) {
+			else if (download_ && !fileTime_.empty() && !transferSettings_.segmented()) {
 				ioThread_.reset();
 				if (!fz::local_filesys::set_modification_time(fz::to_native(localFile_), fileTime_)) {
 					log(logmsg::debug_warning, L"Could not set modification time");
@@ -9,7 +9,7 @@ enum filetransferStates
 {
 	filetransfer_init = 0,
 	filetransfer_waitcwd,
-	filetransfer_waitlist,
+	filetransfer_waitlookup,
 	filetransfer_size,
 	filetransfer_mdtm,
 	filetransfer_resumetest,
@@ -30,8 +30,13 @@ public:
 
 	int TestResumeCapability();
 
+	// Opens the existing local file at the start of the segment to download
+	bool OpenSegment(fz::file & file);
+
 	std::unique_ptr<CIOThread> ioThread_;
 	bool fileDidExist_{true};
+
+	CDirentry lookupEntry_;
 };
 
 #endif
@@ -20,6 +20,7 @@
 #include "rename.h"
 #include "rmd.h"
 #include "servercapabilities.h"
+#include "stat.h"
 #include "transfersocket.h"
 
 #include <libfilezilla/file.hpp>
@@ -176,6 +177,7 @@ void CFtpControlSocket::ParseLine(std::wstring line)
 void CFtpControlSocket::OnConnect()
 {
 	m_lastTypeBinary = -1;
+	m_lastModeZ = 0;
 	m_sentRestartOffset = false;
 	m_protectDataChannel = false;
 
@@ -396,6 +398,22 @@ bool CFtpControlSocket::CanSendNextCommand()
 	return true;
 }
 
+int CFtpControlSocket::GetPipelineDepth()
+{
+	int const depth = engine_.GetOptions().GetOptionVal(OPTION_FTP_PIPELINE_DEPTH);
+	if (depth <= 1 || CServerCapabilities::GetCapability(currentServer_, pipelining) == no) {
+		return 1;
+	}
+
+	return depth;
+}
+
+void CFtpControlSocket::DisablePipelining()
+{
+	log(logmsg::debug_warning, L"Server does not handle pipelined commands, disabling pipelining");
+	CServerCapabilities::SetCapability(currentServer_, pipelining, no);
+}
+
 void CFtpControlSocket::ChangeDir(CServerPath const& path, std::wstring const& subDir, bool link_discovery)
 {
 	auto pData = std::make_unique<CFtpChangeDirOpData>(*this);
@@ -589,6 +607,22 @@ void CFtpControlSocket::Chmod(CChmodCommand const& command)
 	Push(std::make_unique<CFtpChmodOpData>(*this, command));
 }
 
+void CFtpControlSocket::Stat(CServerPath const& path, std::wstring const& file, CDirentry & entry)
+{
+	Push(std::make_unique<CFtpStatOpData>(*this, path, file, entry));
+}
+
+int CFtpControlSocket::GetStatCost() const
+{
+	if (CServerCapabilities::GetCapability(currentServer_, mlsd_command) == yes) {
+		return 1;
+	}
+	if (CServerCapabilities::GetCapability(currentServer_, size_command) == yes) {
+		return CServerCapabilities::GetCapability(currentServer_, mdtm_command) == yes ? 2 : 1;
+	}
+	return 0;
+}
+
 int CFtpControlSocket::GetExternalIPAddress(std::string& address)
 {
 	// Local IP should work. Only a complete moron would use IPv6
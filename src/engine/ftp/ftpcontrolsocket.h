@@ -52,6 +52,8 @@ protected:
 	virtual void Mkdir(CServerPath const& path) override;
 	virtual void Rename(CRenameCommand const& command) override;
 	virtual void Chmod(CChmodCommand const& command) override;
+	virtual void Stat(CServerPath const& path, std::wstring const& file, CDirentry & entry) override;
+	virtual int GetStatCost() const override;
 	void Transfer(std::wstring const& cmd, CFtpTransferOpData* oldData);
 
 	void TransferEnd();
@@ -76,6 +78,12 @@ protected:
 
 	int GetReplyCode() const;
 
+	// Number of independent commands an operation may send ahead of their
+	// replies. Returns 1 unless pipelining is enabled and the server has
+	// not misbehaved with it before.
+	int GetPipelineDepth();
+	void DisablePipelining();
+
 	int GetExternalIPAddress(std::string& address);
 
 	void StartKeepaliveTimer();
@@ -101,6 +109,7 @@ protected:
 	bool m_protectDataChannel{};
 
 	int m_lastTypeBinary{-1};
+	int m_lastModeZ{-1}; // 1 if MODE Z is active, 0 for MODE S, -1 if unknown
 
 	// Used by keepalive code so that we're not using keep alive
 	// till the end of time. Stop after a couple of minutes.
@@ -129,6 +138,7 @@ protected:
 	friend class CFtpRawTransferOpData;
 	friend class CFtpRemoveDirOpData;
 	friend class CFtpRenameOpData;
+	friend class CFtpStatOpData;
 };
 
 typedef CProtocolOpData<CFtpControlSocket> CFtpOpData;
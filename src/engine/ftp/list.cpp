@@ -96,6 +96,7 @@ int CFtpListOpData::Send()
 		listing_parser_ = std::make_unique<CDirectoryListingParser>(&controlSocket_, currentServer_, encoding);
 
 		listing_parser_->SetTimezoneOffset(controlSocket_.GetTimezoneOffset());
+		listing_parser_->EnableParallelParsing(engine_.GetThreadPool());
 		controlSocket_.m_pTransferSocket->m_pDirectoryListingParser = listing_parser_.get();
 
 		engine_.transfer_status_.Init(-1, 0, true);
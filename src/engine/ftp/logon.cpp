@@ -247,6 +247,18 @@ int CFtpLogonOpData::ParseResponse()
 		if (code != 2 && code != 3) {
 			return FZ_REPLY_DISCONNECTED | (code == 5 ? FZ_REPLY_CRITICALERROR : FZ_REPLY_ERROR);
 		}
+
+		// The capabilities may have been remembered from an earlier session.
+		// If the banner differs, the server software might have changed.
+		std::wstring banner;
+		if (CServerCapabilities::GetCapability(currentServer_, server_banner, &banner) == yes && banner != response) {
+			log(logmsg::debug_info, L"Welcome message has changed, discarding known server capabilities");
+			CServerCapabilities::Invalidate(currentServer_);
+			if (currentServer_.GetEncodingType() == ENCODING_AUTO) {
+				controlSocket_.m_useUTF8 = true;
+			}
+		}
+		CServerCapabilities::SetCapability(currentServer_, server_banner, yes, response);
 	}
 	else if (opState == LOGON_AUTH_TLS ||
 	         opState == LOGON_AUTH_SSL)
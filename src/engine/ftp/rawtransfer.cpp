@@ -20,10 +20,11 @@ int CFtpRawTransferOpData::Send()
 	switch (opState)
 	{
 	case rawtransfer_init:
+		modeZ_ = CTransferSocket::WantsCompression(engine_, controlSocket_, controlSocket_.m_pTransferSocket->GetTransferMode(), pOldData->binary);
 		if ((pOldData->binary && controlSocket_.m_lastTypeBinary == 1) ||
 			(!pOldData->binary && controlSocket_.m_lastTypeBinary == 0))
 		{
-			opState = rawtransfer_port_pasv;
+			opState = GetModeState();
 		}
 		else {
 			opState = rawtransfer_type;
@@ -64,6 +65,16 @@ int CFtpRawTransferOpData::Send()
 		}
 		measureRTT = true;
 		break;
+	case rawtransfer_mode:
+		controlSocket_.m_lastModeZ = -1;
+		if (modeZ_) {
+			cmd = L"MODE Z";
+		}
+		else {
+			cmd = L"MODE S";
+		}
+		measureRTT = true;
+		break;
 	case rawtransfer_port_pasv:
 		if (bPasv) {
 			cmd = GetPassiveCommand();
@@ -106,6 +117,12 @@ int CFtpRawTransferOpData::Send()
 		measureRTT = true;
 		break;
 	case rawtransfer_transfer:
+		// Needs to happen before the layers of the data connection get
+		// created, in passive mode that is right away.
+		if (controlSocket_.m_lastModeZ == 1) {
+			controlSocket_.m_pTransferSocket->EnableCompression();
+		}
+
 		if (bPasv) {
 			if (!controlSocket_.m_pTransferSocket->SetupPassiveTransfer(host_, port_)) {
 				log(logmsg::error, _("Could not establish connection to server"));
@@ -151,10 +168,26 @@ int CFtpRawTransferOpData::ParseResponse()
 			error = true;
 		}
 		else {
-			opState = rawtransfer_port_pasv;
+			opState = GetModeState();
 			controlSocket_.m_lastTypeBinary = pOldData->binary ? 1 : 0;
 		}
 		break;
+	case rawtransfer_mode:
+		if (code == 2 || code == 3) {
+			controlSocket_.m_lastModeZ = modeZ_ ? 1 : 0;
+		}
+		else if (modeZ_) {
+			// Continue without compression, the server is still in MODE S
+			log(logmsg::debug_info, L"MODE Z failed, not using compression.");
+			CServerCapabilities::SetCapability(currentServer_, mode_z_support, no);
+			controlSocket_.m_lastModeZ = 0;
+		}
+		else {
+			error = true;
+			break;
+		}
+		opState = rawtransfer_port_pasv;
+		break;
 	case rawtransfer_port_pasv:
 		if (code != 2 && code != 3) {
 			if (!engine_.GetOptions().GetOptionVal(OPTION_ALLOW_TRANSFERMODEFALLBACK)) {
@@ -252,7 +285,7 @@ int CFtpRawTransferOpData::ParseResponse()
 		}
 		break;
 	case rawtransfer_waitfinish:
-		if (code != 2 && code != 3) {
+		if (code != 2 && code != 3 && !TransferLimitReached()) {
 			if (pOldData->transferEndReason == TransferEndReason::successful) {
 				pOldData->transferEndReason = TransferEndReason::transfer_command_failure;
 			}
@@ -263,7 +296,7 @@ int CFtpRawTransferOpData::ParseResponse()
 		}
 		break;
 	case rawtransfer_waittransfer:
-		if (code != 2 && code != 3) {
+		if (code != 2 && code != 3 && !TransferLimitReached()) {
 			if (pOldData->transferEndReason == TransferEndReason::successful) {
 				pOldData->transferEndReason = TransferEndReason::transfer_command_failure;
 			}
@@ -293,6 +326,26 @@ int CFtpRawTransferOpData::ParseResponse()
 	return FZ_REPLY_CONTINUE;
 }
 
+bool CFtpRawTransferOpData::TransferLimitReached() const
+{
+	// Closing the data connection early makes the server reply with an error
+	return controlSocket_.m_pTransferSocket && controlSocket_.m_pTransferSocket->TransferLimitReached();
+}
+
+int CFtpRawTransferOpData::GetModeState() const
+{
+	int const mode = modeZ_ ? 1 : 0;
+	if (controlSocket_.m_lastModeZ == mode) {
+		return rawtransfer_port_pasv;
+	}
+	if (controlSocket_.m_lastModeZ == -1 && !modeZ_ && CServerCapabilities::GetCapability(currentServer_, mode_z_support) != yes) {
+		// Server cannot have been switched into MODE Z
+		return rawtransfer_port_pasv;
+	}
+
+	return rawtransfer_mode;
+}
+
 bool CFtpRawTransferOpData::ParseEpsvResponse()
 {
 	size_t pos = controlSocket_.m_Response.find(L"(|||");
@@ -7,6 +7,7 @@ enum rawtransferStates
 {
 	rawtransfer_init = 0,
 	rawtransfer_type,
+	rawtransfer_mode,
 	rawtransfer_port_pasv,
 	rawtransfer_rest,
 	rawtransfer_transfer,
@@ -32,6 +33,12 @@ public:
 	bool ParsePasvResponse();
 	bool ParseEpsvResponse();
 
+	// Returns rawtransfer_mode if MODE needs to be changed, rawtransfer_port_pasv otherwise
+	int GetModeState() const;
+
+	// Whether a segmented download has received all of its data
+	bool TransferLimitReached() const;
+
 	std::wstring cmd_;
 
 	CFtpTransferOpData* pOldData{};
@@ -40,6 +47,8 @@ public:
 	bool bTriedPasv{};
 	bool bTriedActive{};
 
+	bool modeZ_{};
+
 	std::wstring host_;
 	int port_{};
 };
@@ -0,0 +1,141 @@
+#include <filezilla.h>
+
+#include "stat.h"
+#include "directorylistingparser.h"
+#include "servercapabilities.h"
+
+enum statStates
+{
+	stat_init,
+	stat_mlst,
+	stat_size,
+	stat_mdtm
+};
+
+namespace {
+bool IsNotFoundReply(std::wstring const& response, std::wstring const& file)
+{
+	// Leave out the name itself, it could contain anything
+	std::wstring text = response.substr(3);
+	if (!file.empty()) {
+		fz::replace_substrings(text, file, std::wstring());
+	}
+	text = fz::str_tolower_ascii(text);
+	for (auto const& phrase : { L"no such file", L"not found", L"not exist", L"doesn't exist", L"can't find", L"cannot find" }) {
+		if (text.find(phrase) != std::wstring::npos) {
+			return true;
+		}
+	}
+	return false;
+}
+}
+
+int CFtpStatOpData::Send()
+{
+	switch (opState) {
+	case stat_init:
+		if (path_.empty() || file_.empty()) {
+			return FZ_REPLY_INTERNALERROR;
+		}
+
+		entry_.clear();
+		entry_.name = file_;
+		entry_.size = -1;
+
+		if (CServerCapabilities::GetCapability(currentServer_, mlsd_command) == yes) {
+			opState = stat_mlst;
+		}
+		else if (CServerCapabilities::GetCapability(currentServer_, size_command) == yes) {
+			opState = stat_size;
+		}
+		else {
+			return FZ_REPLY_NOTSUPPORTED;
+		}
+		return FZ_REPLY_CONTINUE;
+	case stat_mlst:
+		return controlSocket_.SendCommand(L"MLST " + path_.FormatFilename(file_));
+	case stat_size:
+		return controlSocket_.SendCommand(L"SIZE " + path_.FormatFilename(file_));
+	case stat_mdtm:
+		return controlSocket_.SendCommand(L"MDTM " + path_.FormatFilename(file_));
+	}
+
+	log(logmsg::debug_warning, L"Unknown op state %d", opState);
+	return FZ_REPLY_INTERNALERROR;
+}
+
+int CFtpStatOpData::ParseResponse()
+{
+	int const code = controlSocket_.GetReplyCode();
+	std::wstring const& response = controlSocket_.m_Response;
+
+	switch (opState) {
+	case stat_mlst:
+		if (code != 2) {
+			// 550 is also sent for permission problems and the like, only
+			// trust it if the server says the file is missing.
+			if (response.substr(0, 3) == L"550" && IsNotFoundReply(response, file_)) {
+				return FZ_REPLY_ERROR_NOTFOUND;
+			}
+			return FZ_REPLY_ERROR;
+		}
+		return ParseMlst();
+	case stat_size:
+		// A failing SIZE does not distinguish between missing files and
+		// directories, let the caller fall back to a listing.
+		if (code != 2) {
+			return FZ_REPLY_ERROR;
+		}
+		if (response.size() < 5 || response[4] < '0' || response[4] > '9') {
+			log(logmsg::debug_info, L"Invalid SIZE reply");
+			return FZ_REPLY_ERROR;
+		}
+		entry_.size = 0;
+		for (auto const c : response.substr(4)) {
+			if (c < '0' || c > '9') {
+				break;
+			}
+			entry_.size *= 10;
+			entry_.size += c - '0';
+		}
+		if (CServerCapabilities::GetCapability(currentServer_, mdtm_command) == yes) {
+			opState = stat_mdtm;
+			return FZ_REPLY_CONTINUE;
+		}
+		return FZ_REPLY_OK;
+	case stat_mdtm:
+		if (code == 2 && response.substr(0, 4) == L"213 " && response.size() > 16) {
+			entry_.time = fz::datetime(response.substr(4), fz::datetime::utc);
+			if (!entry_.time.empty()) {
+				entry_.time += fz::duration::from_minutes(currentServer_.GetTimezoneOffset());
+			}
+		}
+		return FZ_REPLY_OK;
+	}
+
+	log(logmsg::debug_warning, L"Unknown op state %d", opState);
+	return FZ_REPLY_INTERNALERROR;
+}
+
+int CFtpStatOpData::ParseMlst()
+{
+	// The facts are on the single line starting with a space
+	for (auto & line : controlSocket_.m_MultilineResponseLines) {
+		if (line.size() < 2 || line[0] != ' ') {
+			continue;
+		}
+
+		CDirectoryListingParser parser(&controlSocket_, currentServer_);
+		parser.AddLine(line.substr(1), std::wstring(file_), fz::datetime());
+		CDirectoryListing const listing = parser.Parse(path_);
+		if (listing.size() != 1) {
+			break;
+		}
+
+		entry_ = listing[0];
+		return FZ_REPLY_OK;
+	}
+
+	log(logmsg::debug_info, L"Could not parse MLST reply");
+	return FZ_REPLY_ERROR;
+}
@@ -0,0 +1,31 @@
+#ifndef FILEZILLA_ENGINE_FTP_STAT_HEADER
+#define FILEZILLA_ENGINE_FTP_STAT_HEADER
+
+#include "ftpcontrolsocket.h"
+
+// Obtains the details of a single file using MLST or SIZE and MDTM,
+// without listing the whole directory.
+class CFtpStatOpData final : public COpData, public CFtpOpData
+{
+public:
+	CFtpStatOpData(CFtpControlSocket & controlSocket, CServerPath const& path, std::wstring const& file, CDirentry & entry)
+		: COpData(PrivCommand::stat, L"CFtpStatOpData")
+		, CFtpOpData(controlSocket)
+		, path_(path)
+		, file_(file)
+		, entry_(entry)
+	{}
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+
+private:
+	int ParseMlst();
+
+	CServerPath const path_;
+	std::wstring const file_;
+
+	CDirentry & entry_;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include <filezilla.h>
+#include "deflatelayer.h"
 #include "directorylistingparser.h"
 #include "engineprivate.h"
 #include "ftp/ftpcontrolsocket.h"
@@ -12,8 +13,29 @@
 #include <libfilezilla/tls_layer.hpp>
 #include <libfilezilla/util.hpp>
 
+#include <algorithm>
+
 #include <assert.h>
 
+namespace {
+// Upper limit when growing socket buffers from the bandwidth-delay product.
+// The OS may clamp it further.
+int const max_tuned_socket_buffer_size = 32 * 1024 * 1024;
+}
+
+#if FZ_TRANSFERSOCKET_ZEROCOPY
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+namespace {
+// Upper limit for a single splice/sendfile call
+size_t const zero_copy_chunk = 1024 * 1024;
+}
+#endif
+
 CTransferSocket::CTransferSocket(CFileZillaEnginePrivate & engine, CFtpControlSocket & controlSocket, TransferMode transferMode)
 : fz::event_handler(controlSocket.event_loop_)
 , engine_(engine)
@@ -38,14 +60,24 @@ CTransferSocket::~CTransferSocket()
 			ioThread_->SetEventHandler(nullptr);
 		}
 	}
+
+#if FZ_TRANSFERSOCKET_ZEROCOPY
+	ResetZeroCopy();
+#endif
 }
 
 void CTransferSocket::ResetSocket()
 {
+#if FZ_TRANSFERSOCKET_ZEROCOPY
+	// Before closing the descriptor it waits on
+	StopZeroCopyWait();
+#endif
+
 	socketServer_.reset();
 
 	active_layer_ = nullptr;
 
+	deflate_layer_.reset();
 	tls_layer_.reset();
 	proxy_layer_.reset();
 	ratelimit_layer_.reset();
@@ -190,12 +222,12 @@ void CTransferSocket::OnConnect()
 		socket_->set_flags(fz::socket::flag_nodelay, false);
 	}
 
-#ifdef FZ_WINDOWS
-	if (m_transferMode == TransferMode::upload) {
-		// For send buffer tuning
+	if (m_transferMode != TransferMode::resumetest) {
+		// For socket buffer tuning
+		bufferTuningBytes_ = 0;
+		bufferTuningStart_ = fz::monotonic_clock::now();
 		add_timer(fz::duration::from_seconds(1), false);
 	}
-#endif
 
 	if (m_bActive) {
 		TriggerPostponedEvents();
@@ -214,12 +246,11 @@ void CTransferSocket::OnReceive()
 
 	if (m_transferEndReason == TransferEndReason::none) {
 		if (m_transferMode == TransferMode::list) {
+			char buffer[4096];
 			for (;;) {
-				char *pBuffer = new char[4096];
 				int error;
-				int numread = active_layer_->read(pBuffer, 4096, error);
+				int numread = active_layer_->read(buffer, sizeof(buffer), error);
 				if (numread < 0) {
-					delete [] pBuffer;
 					if (error != EAGAIN) {
 						controlSocket_.log(logmsg::error, L"Could not read from transfer socket: %s", fz::socket_error_description(error));
 						TransferEnd(TransferEndReason::transfer_failure);
@@ -228,7 +259,7 @@ void CTransferSocket::OnReceive()
 				}
 
 				if (numread > 0) {
-					if (!m_pDirectoryListingParser->AddData(pBuffer, numread)) {
+					if (!m_pDirectoryListingParser->AddData(buffer, static_cast<size_t>(numread))) {
 						TransferEnd(TransferEndReason::transfer_failure);
 						return;
 					}
@@ -239,9 +270,9 @@ void CTransferSocket::OnReceive()
 						engine_.transfer_status_.SetMadeProgress();
 					}
 					engine_.transfer_status_.Update(numread);
+					bufferTuningBytes_ += numread;
 				}
 				else {
-					delete [] pBuffer;
 					TransferEnd(TransferEndReason::successful);
 					return;
 				}
@@ -249,6 +280,13 @@ void CTransferSocket::OnReceive()
 			return;
 		}
 		else if (m_transferMode == TransferMode::download) {
+#if FZ_TRANSFERSOCKET_ZEROCOPY
+			if (zeroCopyFile_ != -1) {
+				OnZeroCopyReceive();
+				return;
+			}
+#endif
+
 			int error;
 			int numread;
 
@@ -260,7 +298,11 @@ void CTransferSocket::OnReceive()
 					return;
 				}
 
-				numread = active_layer_->read(m_pTransferBuffer, m_transferBufferLen, error);
+				unsigned int len = static_cast<unsigned int>(m_transferBufferLen);
+				if (transferLimit_ >= 0 && transferLimit_ < len) {
+					len = static_cast<unsigned int>(transferLimit_);
+				}
+				numread = active_layer_->read(m_pTransferBuffer, len, error);
 				if (numread <= 0) {
 					break;
 				}
@@ -271,9 +313,19 @@ void CTransferSocket::OnReceive()
 					engine_.transfer_status_.SetMadeProgress();
 				}
 				engine_.transfer_status_.Update(numread);
+				bufferTuningBytes_ += numread;
 
 				m_pTransferBuffer += numread;
 				m_transferBufferLen -= numread;
+
+				if (transferLimit_ > 0) {
+					transferLimit_ -= numread;
+					if (!transferLimit_) {
+						controlSocket_.log(logmsg::debug_info, L"Received all data of the segment, closing data connection");
+						FinalizeWrite();
+						return;
+					}
+				}
 			}
 
 			if (numread < 0) {
@@ -283,7 +335,14 @@ void CTransferSocket::OnReceive()
 				}
 			}
 			else if (!numread) {
-				FinalizeWrite();
+				if (transferLimit_ > 0) {
+					// The remote file ended before the segment did
+					controlSocket_.log(logmsg::error, L"Data connection closed %d bytes before the end of the segment", transferLimit_);
+					TransferEnd(TransferEndReason::transfer_failure);
+				}
+				else {
+					FinalizeWrite();
+				}
 			}
 			else {
 				send_event<fz::socket_event>(active_layer_, fz::socket_event_flag::read, 0);
@@ -365,6 +424,13 @@ void CTransferSocket::OnSend()
 		return;
 	}
 
+#if FZ_TRANSFERSOCKET_ZEROCOPY
+	if (zeroCopyFile_ != -1) {
+		OnZeroCopySend();
+		return;
+	}
+#endif
+
 	int error;
 	int written;
 
@@ -388,6 +454,7 @@ void CTransferSocket::OnSend()
 			engine_.transfer_status_.SetMadeProgress();
 		}
 		engine_.transfer_status_.Update(written);
+		bufferTuningBytes_ += written;
 
 		m_pTransferBuffer += written;
 		m_transferBufferLen -= written;
@@ -474,6 +541,15 @@ bool CTransferSocket::SetupPassiveTransfer(std::wstring const& host, int port)
 
 bool CTransferSocket::InitLayers(bool active)
 {
+#if FZ_TRANSFERSOCKET_ZEROCOPY
+	if (zeroCopyFile_ != -1) {
+		// CanUseZeroCopy made sure that no other layers are needed
+		active_layer_ = socket_.get();
+		active_layer_->set_event_handler(this);
+		return true;
+	}
+#endif
+
 	ratelimit_layer_ = std::make_unique<fz::rate_limited_layer>(nullptr, *socket_, &engine_.GetRateLimiter());
 	active_layer_ = ratelimit_layer_.get();
 
@@ -503,6 +579,12 @@ bool CTransferSocket::InitLayers(bool active)
 		}
 	}
 
+	if (compress_) {
+		// The data is compressed before it gets encrypted
+		deflate_layer_ = std::make_unique<CDeflateLayer>(controlSocket_.event_loop_, nullptr, *active_layer_, m_transferMode == TransferMode::upload);
+		active_layer_ = deflate_layer_.get();
+	}
+
 	active_layer_->set_event_handler(this);
 
 	return true;
@@ -538,7 +620,13 @@ void CTransferSocket::TransferEnd(TransferEndReason reason)
 	}
 	m_transferEndReason = reason;
 
-	if (reason != TransferEndReason::successful) {
+	if (deflate_layer_) {
+		UpdateCompressionStatus();
+		controlSocket_.log(logmsg::debug_info, L"MODE Z: %d bytes of data were transferred as %d bytes, %d ms spent in zlib",
+			deflate_layer_->uncompressed_bytes(), deflate_layer_->compressed_bytes(), deflate_layer_->compression_time().get_milliseconds());
+	}
+
+	if (reason != TransferEndReason::successful || TransferLimitReached()) {
 		ResetSocket();
 	}
 	else {
@@ -629,7 +717,7 @@ bool CTransferSocket::CheckGetNextWriteBuffer()
 			return false;
 		}
 
-		m_transferBufferLen = BUFFERSIZE;
+		m_transferBufferLen = ioThread_->GetBufferSize();
 	}
 
 	return true;
@@ -678,8 +766,9 @@ void CTransferSocket::OnIOThreadEvent()
 
 void CTransferSocket::FinalizeWrite()
 {
-	bool res = ioThread_->Finalize(BUFFERSIZE - m_transferBufferLen);
-	m_transferBufferLen = BUFFERSIZE;
+	int const bufferSize = static_cast<int>(ioThread_->GetBufferSize());
+	bool res = ioThread_->Finalize(bufferSize - m_transferBufferLen);
+	m_transferBufferLen = bufferSize;
 
 	if (m_transferEndReason != TransferEndReason::none) {
 		return;
@@ -728,6 +817,9 @@ void CTransferSocket::SetSocketBufferSizes(fz::socket_base& socket)
 	const int size_write = engine_.GetOptions().GetOptionVal(OPTION_SOCKET_BUFFERSIZE_SEND);
 #endif
 	socket.set_buffer_sizes(size_read, size_write);
+
+	tunedRecvBufferSize_ = size_read;
+	tunedSendBufferSize_ = size_write;
 }
 
 void CTransferSocket::operator()(fz::event_base const& ev)
@@ -740,10 +832,381 @@ void CTransferSocket::operator()(fz::event_base const& ev)
 
 void CTransferSocket::OnTimer(fz::timer_id)
 {
-	if (socket_ && socket_->is_connected()) {
+	if (!socket_ || !socket_->is_connected()) {
+		return;
+	}
+
+	UpdateCompressionStatus();
+
+#ifdef FZ_WINDOWS
+	if (m_transferMode == TransferMode::upload) {
 		int const ideal_send_buffer = socket_->ideal_send_buffer_size();
 		if (ideal_send_buffer != -1) {
 			socket_->set_buffer_sizes(-1, ideal_send_buffer);
 		}
+		return;
+	}
+#endif
+
+	TuneSocketBufferSizes();
+}
+
+void CTransferSocket::TuneSocketBufferSizes()
+{
+	auto const now = fz::monotonic_clock::now();
+	auto const elapsed = (now - bufferTuningStart_).get_milliseconds();
+	int64_t const bytes = bufferTuningBytes_;
+	bufferTuningStart_ = now;
+	bufferTuningBytes_ = 0;
+
+	int const rtt = controlSocket_.m_rtt.GetLatency();
+	if (elapsed <= 0 || rtt <= 0 || !bytes) {
+		return;
+	}
+
+	// Bandwidth-delay product of the last interval. As long as the socket
+	// buffer limits the window, the measured rate is at most buffer/rtt,
+	// so aim for twice the product to let the window open further.
+	int64_t const rate = bytes * 1000 / elapsed;
+	int64_t target = rate * rtt / 1000 * 2;
+
+	// Never go below the configured sizes. Leave the buffers alone if
+	// left to the system: Setting any size disables the autotuning of
+	// the kernel, which usually does better.
+	bool const receiving = m_transferMode != TransferMode::upload;
+	int const configured = engine_.GetOptions().GetOptionVal(receiving ? OPTION_SOCKET_BUFFERSIZE_RECV : OPTION_SOCKET_BUFFERSIZE_SEND);
+	if (configured == -1) {
+		return;
+	}
+	int & current = receiving ? tunedRecvBufferSize_ : tunedSendBufferSize_;
+	if (current < configured) {
+		current = configured;
+	}
+
+	target = std::min(target, static_cast<int64_t>(max_tuned_socket_buffer_size));
+	if (target <= current + current / 4) {
+		// Not worth a change
+		return;
+	}
+
+	controlSocket_.log(logmsg::debug_verbose, L"Adjusting socket %s buffer from %d to %d bytes, rtt=%d ms, rate=%d bytes/s", receiving ? L"receive" : L"send", current, target, rtt, rate);
+
+	current = static_cast<int>(target);
+	if (receiving) {
+		socket_->set_buffer_sizes(current, -1);
+	}
+	else {
+		socket_->set_buffer_sizes(-1, current);
+	}
+}
+
+void CTransferSocket::UpdateCompressionStatus()
+{
+	if (deflate_layer_) {
+		engine_.transfer_status_.SetCompression(deflate_layer_->compressed_bytes(), deflate_layer_->uncompressed_bytes(), deflate_layer_->compression_time());
+	}
+}
+
+bool CTransferSocket::WantsCompression(CFileZillaEnginePrivate & engine, CFtpControlSocket const& controlSocket, TransferMode transferMode, bool binary)
+{
+	if (transferMode == TransferMode::resumetest) {
+		return false;
+	}
+
+	if (CServerCapabilities::GetCapability(controlSocket.currentServer_, mode_z_support) != yes) {
+		return false;
+	}
+
+	// The site can override the global setting
+	int mode = engine.GetOptions().GetOptionVal(OPTION_FTP_MODEZ);
+	std::wstring const siteMode = controlSocket.currentServer_.GetExtraParameter("modez");
+	if (!siteMode.empty()) {
+		mode = fz::to_integral<int>(siteMode, mode);
+	}
+
+	switch (mode) {
+	case 1:
+		// Listings and text compress well, other files often are compressed already
+		return transferMode == TransferMode::list || !binary;
+	case 2:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool CTransferSocket::CanUseZeroCopy(CFileZillaEnginePrivate & engine, CFtpControlSocket const& controlSocket, TransferMode transferMode, bool binary)
+{
+#if FZ_TRANSFERSOCKET_ZEROCOPY
+	if (!binary || controlSocket.m_protectDataChannel || controlSocket.proxy_layer_) {
+		return false;
+	}
+
+	if (WantsCompression(engine, controlSocket, transferMode, binary)) {
+		return false;
+	}
+
+	if (transferMode != TransferMode::download && transferMode != TransferMode::upload) {
+		return false;
+	}
+
+	if (engine.GetOptions().GetOptionVal(OPTION_SPEEDLIMIT_ENABLE)) {
+		int const limit = engine.GetOptions().GetOptionVal(transferMode == TransferMode::download ? OPTION_SPEEDLIMIT_INBOUND : OPTION_SPEEDLIMIT_OUTBOUND);
+		if (limit > 0) {
+			return false;
+		}
+	}
+
+	return true;
+#else
+	(void)engine;
+	(void)controlSocket;
+	(void)transferMode;
+	(void)binary;
+	return false;
+#endif
+}
+
+bool CTransferSocket::SetupZeroCopy(std::wstring const& localFile, int64_t offset)
+{
+#if FZ_TRANSFERSOCKET_ZEROCOPY
+	ResetZeroCopy();
+
+	// Set first, on failure ResetZeroCopy truncates the file to this offset
+	zeroCopyOffset_ = offset;
+
+	bool const download = m_transferMode == TransferMode::download;
+	zeroCopyFile_ = open(fz::to_native(localFile).c_str(), (download ? O_WRONLY : O_RDONLY) | O_CLOEXEC);
+	if (zeroCopyFile_ == -1) {
+		controlSocket_.log(logmsg::debug_warning, L"Could not open \"%s\" for zero-copy transfer: %s", localFile, fz::to_wstring(GetSystemErrorDescription(errno)));
+		return false;
+	}
+
+	if (download) {
+		// splice needs a pipe between socket and file
+		if (pipe2(zeroCopyPipe_, O_CLOEXEC) != 0) {
+			controlSocket_.log(logmsg::debug_warning, L"Could not create pipe for zero-copy transfer: %s", fz::to_wstring(GetSystemErrorDescription(errno)));
+			ResetZeroCopy();
+			return false;
+		}
+
+		// The default pipe capacity of 64 KiB would limit the amount of data
+		// moved per call. Not fatal if it cannot be raised.
+		fcntl(zeroCopyPipe_[1], F_SETPIPE_SZ, static_cast<int>(zero_copy_chunk));
+	}
+
+	// Wakes up WaitZeroCopy when the transfer gets stopped
+	if (pipe2(zeroCopyWakeup_, O_CLOEXEC | O_NONBLOCK) != 0) {
+		controlSocket_.log(logmsg::debug_warning, L"Could not create pipe for zero-copy transfer: %s", fz::to_wstring(GetSystemErrorDescription(errno)));
+		ResetZeroCopy();
+		return false;
+	}
+
+	zeroCopyPending_ = 0;
+
+	controlSocket_.log(logmsg::debug_info, L"Using zero-copy transfer at offset %d", offset);
+
+	return true;
+#else
+	(void)localFile;
+	(void)offset;
+	return false;
+#endif
+}
+
+#if FZ_TRANSFERSOCKET_ZEROCOPY
+void CTransferSocket::OnZeroCopyReceive()
+{
+	int const fd = socket_->get_descriptor();
+
+	// Only do a certain number of iterations in one go to keep the event loop going,
+	// see OnReceive.
+	for (int i = 0; i < 100; ++i) {
+		ssize_t received = splice(fd, nullptr, zeroCopyPipe_[1], nullptr, zero_copy_chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (received < 0) {
+			if (errno == EAGAIN) {
+				WaitZeroCopy(fz::socket_event_flag::read);
+			}
+			else {
+				controlSocket_.log(logmsg::error, L"Could not read from transfer socket: %s", fz::socket_error_description(errno));
+				TransferEnd(TransferEndReason::transfer_failure);
+			}
+			return;
+		}
+
+		if (!received) {
+			if (FinalizeZeroCopy()) {
+				TransferEnd(TransferEndReason::successful);
+			}
+			else {
+				OnZeroCopyWriteError();
+			}
+			return;
+		}
+
+		zeroCopyPending_ = received;
+		while (zeroCopyPending_ > 0) {
+			loff_t offset = zeroCopyOffset_;
+			ssize_t written = splice(zeroCopyPipe_[0], nullptr, zeroCopyFile_, &offset, zeroCopyPending_, SPLICE_F_MOVE);
+			if (written <= 0) {
+				OnZeroCopyWriteError();
+				return;
+			}
+			zeroCopyOffset_ = offset;
+			zeroCopyPending_ -= written;
+		}
+
+		// Only count the data once it is in the file
+		controlSocket_.SetActive(CFileZillaEngine::recv);
+		if (!m_madeProgress) {
+			m_madeProgress = 2;
+			engine_.transfer_status_.SetMadeProgress();
+		}
+		engine_.transfer_status_.Update(received);
+		bufferTuningBytes_ += received;
+	}
+
+	send_event<fz::socket_event>(active_layer_, fz::socket_event_flag::read, 0);
+}
+
+void CTransferSocket::OnZeroCopyWriteError()
+{
+	std::wstring const error = fz::to_wstring(GetSystemErrorDescription(errno));
+	controlSocket_.log(logmsg::error, _("Can't write data to file: %s"), error);
+	TransferEnd(TransferEndReason::transfer_failure_critical);
+}
+
+void CTransferSocket::OnZeroCopySend()
+{
+	int const fd = socket_->get_descriptor();
+
+	// Only do a certain number of iterations in one go to keep the event loop going,
+	// see OnSend.
+	for (int i = 0; i < 100; ++i) {
+		off_t offset = zeroCopyOffset_;
+		ssize_t written = sendfile(fd, zeroCopyFile_, &offset, zero_copy_chunk);
+		if (written < 0) {
+			if (errno != EAGAIN) {
+				controlSocket_.log(logmsg::error, L"Could not write to transfer socket: %s", fz::socket_error_description(errno));
+				TransferEnd(TransferEndReason::transfer_failure);
+				return;
+			}
+
+			if (!m_madeProgress) {
+				controlSocket_.log(logmsg::debug_debug, L"First EAGAIN in CTransferSocket::OnZeroCopySend()");
+				m_madeProgress = 1;
+				engine_.transfer_status_.SetMadeProgress();
+			}
+			WaitZeroCopy(fz::socket_event_flag::write);
+			return;
+		}
+
+		if (!written) {
+			int res = active_layer_->shutdown();
+			if (res && res != EAGAIN) {
+				TransferEnd(TransferEndReason::transfer_failure);
+				return;
+			}
+			TransferEnd(TransferEndReason::successful);
+			return;
+		}
+
+		zeroCopyOffset_ = offset;
+
+		controlSocket_.SetActive(CFileZillaEngine::send);
+		if (m_madeProgress == 1) {
+			controlSocket_.log(logmsg::debug_debug, L"Made progress in CTransferSocket::OnZeroCopySend()");
+			m_madeProgress = 2;
+			engine_.transfer_status_.SetMadeProgress();
+		}
+		engine_.transfer_status_.Update(written);
 	}
+
+	send_event<fz::socket_event>(active_layer_, fz::socket_event_flag::write, 0);
 }
+
+void CTransferSocket::WaitZeroCopy(fz::socket_event_flag flag)
+{
+	// The previous wait has ended already, its event got us here.
+	zeroCopyWait_.join();
+
+	int const fd = socket_->get_descriptor();
+	int const wakeup = zeroCopyWakeup_[0];
+	short const events = (flag == fz::socket_event_flag::read) ? POLLIN : POLLOUT;
+	fz::socket_event_source* const source = active_layer_;
+
+	zeroCopyWait_ = engine_.GetThreadPool().spawn([this, fd, wakeup, events, flag, source]() {
+		pollfd fds[2]{};
+		fds[0].fd = fd;
+		fds[0].events = events;
+		fds[1].fd = wakeup;
+		fds[1].events = POLLIN;
+
+		int res;
+		do {
+			res = poll(fds, 2, -1);
+		} while (res < 0 && errno == EINTR);
+
+		if (!(fds[1].revents & POLLIN)) {
+			// Also on errors, the next splice or sendfile reports them
+			send_event<fz::socket_event>(source, flag, 0);
+		}
+	});
+	if (!zeroCopyWait_) {
+		controlSocket_.log(logmsg::error, L"Could not wait for the transfer socket");
+		TransferEnd(TransferEndReason::transfer_failure);
+	}
+}
+
+void CTransferSocket::StopZeroCopyWait()
+{
+	if (zeroCopyWait_) {
+		char c = 0;
+		while (write(zeroCopyWakeup_[1], &c, 1) < 0 && errno == EINTR) {
+		}
+		zeroCopyWait_.join();
+		while (read(zeroCopyWakeup_[0], &c, 1) > 0) {
+		}
+	}
+}
+
+bool CTransferSocket::FinalizeZeroCopy()
+{
+	bool ret = true;
+	if (m_transferMode == TransferMode::download && zeroCopyFile_ != -1) {
+		// Get rid of any preallocated space beyond the written data
+		ret = ftruncate(zeroCopyFile_, zeroCopyOffset_) == 0;
+	}
+	ResetZeroCopy();
+	return ret;
+}
+
+void CTransferSocket::ResetZeroCopy()
+{
+	StopZeroCopyWait();
+
+	if (zeroCopyFile_ != -1) {
+		if (m_transferMode == TransferMode::download) {
+			// The file might have been preallocated and the transfer stopped before being completed
+			if (ftruncate(zeroCopyFile_, zeroCopyOffset_) != 0) {
+				controlSocket_.log(logmsg::debug_warning, L"Could not truncate file to %d bytes", zeroCopyOffset_);
+			}
+		}
+		close(zeroCopyFile_);
+		zeroCopyFile_ = -1;
+	}
+	for (auto & p : zeroCopyWakeup_) {
+		if (p != -1) {
+			close(p);
+			p = -1;
+		}
+	}
+	for (auto & p : zeroCopyPipe_) {
+		if (p != -1) {
+			close(p);
+			p = -1;
+		}
+	}
+	zeroCopyPending_ = 0;
+}
+#endif
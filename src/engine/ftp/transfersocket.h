@@ -4,6 +4,12 @@
 #include "iothread.h"
 #include "controlsocket.h"
 
+#if defined(__linux__)
+// Plain binary transfers can move data between the data connection and the
+// local file with splice/sendfile instead of going through CIOThread.
+#define FZ_TRANSFERSOCKET_ZEROCOPY 1
+#endif
+
 class CFileZillaEnginePrivate;
 class CFtpControlSocket;
 class CDirectoryListingParser;
@@ -17,6 +23,7 @@ enum class TransferMode
 };
 
 class CIOThread;
+class CDeflateLayer;
 
 namespace fz {
 class tls_layer;
@@ -41,6 +48,33 @@ public:
 
 	void SetIOThread(CIOThread* ioThread) { ioThread_ = ioThread; }
 
+	// Whether a transfer with these settings would end up directly on the
+	// raw socket, without TLS, proxy or rate limiting layers in between.
+	static bool CanUseZeroCopy(CFileZillaEnginePrivate & engine, CFtpControlSocket const& controlSocket, TransferMode transferMode, bool binary);
+
+	// Use instead of SetIOThread to transfer from or to the given file,
+	// starting at the given offset.
+	bool SetupZeroCopy(std::wstring const& localFile, int64_t offset);
+
+	// Whether the data of such a transfer should be compressed using MODE Z,
+	// depending on settings and server capabilities.
+	static bool WantsCompression(CFileZillaEnginePrivate & engine, CFtpControlSocket const& controlSocket, TransferMode transferMode, bool binary);
+
+	// Call once the server has accepted MODE Z, before the data connection
+	// gets established. In passive mode that means before calling
+	// SetupPassiveTransfer, it sets up the socket layers.
+	void EnableCompression() { compress_ = true; }
+
+	TransferMode GetTransferMode() const { return m_transferMode; }
+
+	// Downloads only: Stop after receiving the given number of bytes and
+	// close the data connection. Not supported with zero-copy transfers.
+	void SetTransferLimit(int64_t bytes) { transferLimit_ = bytes; }
+
+	// Whether the transfer ended because the limit has been reached. The
+	// server usually reports the closed data connection as an error then.
+	bool TransferLimitReached() const { return !transferLimit_; }
+
 protected:
 	bool CheckGetNextWriteBuffer();
 	bool CheckGetNextReadBuffer();
@@ -66,9 +100,43 @@ protected:
 
 	void SetSocketBufferSizes(fz::socket_base & socket);
 
+	// Passes the statistics of the deflate layer to the transfer status
+	void UpdateCompressionStatus();
+
+	// Grows the socket buffers towards the bandwidth-delay product
+	// computed from control connection latency and measured throughput.
+	// Does nothing if the configured size is -1, the system default.
+	void TuneSocketBufferSizes();
+	fz::monotonic_clock bufferTuningStart_;
+	int64_t bufferTuningBytes_{};
+	int tunedRecvBufferSize_{-1};
+	int tunedSendBufferSize_{-1};
+
 	virtual void operator()(fz::event_base const& ev);
 	void OnIOThreadEvent();
 
+#if FZ_TRANSFERSOCKET_ZEROCOPY
+	void OnZeroCopyReceive();
+	void OnZeroCopyWriteError();
+	void OnZeroCopySend();
+	bool FinalizeZeroCopy();
+	void ResetZeroCopy();
+
+	// The socket only waits for readiness itself after a read or write
+	// through it failed. splice and sendfile bypass it, so a task on the
+	// thread pool polls the descriptor instead and sends the socket_event.
+	void WaitZeroCopy(fz::socket_event_flag flag);
+	void StopZeroCopyWait();
+
+	fz::async_task zeroCopyWait_;
+	int zeroCopyWakeup_[2]{-1, -1};
+
+	int zeroCopyFile_{-1};
+	int zeroCopyPipe_[2]{-1, -1};
+	int64_t zeroCopyOffset_{};
+	int64_t zeroCopyPending_{};
+#endif
+
 	// Will be set only while creating active mode connections
 	std::unique_ptr<fz::listen_socket> socketServer_;
 
@@ -91,8 +159,12 @@ protected:
 	std::unique_ptr<fz::rate_limited_layer> ratelimit_layer_;
 	std::unique_ptr<CProxySocket> proxy_layer_;
 	std::unique_ptr<fz::tls_layer> tls_layer_;
+	std::unique_ptr<CDeflateLayer> deflate_layer_;
+	bool compress_{};
+
+	fz::socket_interface* active_layer_{};
 
-	fz::socket_layer* active_layer_{};
+	int64_t transferLimit_{-1};
 
 
 	// Needed for the madeProgress field in CTransferStatus
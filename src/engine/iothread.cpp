@@ -4,15 +4,25 @@
 
 #include <libfilezilla/file.hpp>
 
+#include <algorithm>
+
 #include <assert.h>
 
+namespace {
+unsigned int const min_buffer_size = 32 * 1024;
+unsigned int const max_buffer_size = 256 * 1024;
+
+int const min_buffer_count = 2;
+int const default_buffer_count = 8;
+int const max_buffer_count = 32;
+
+// Number of times the socket side has to wait on the ring within a single
+// round through it before the ring gets deepened.
+int const stall_threshold = 4;
+}
+
 CIOThread::CIOThread()
 {
-	m_buffers[0] = new char[BUFFERSIZE*BUFFERCOUNT];
-	for (unsigned int i = 0; i < BUFFERCOUNT; ++i) {
-		m_buffers[i] = m_buffers[0] + BUFFERSIZE * i;
-		m_bufferLens[i] = 0;
-	}
 }
 
 CIOThread::~CIOThread()
@@ -20,8 +30,6 @@ CIOThread::~CIOThread()
 	Destroy();
 
 	Close();
-
-	delete [] m_buffers[0];
 }
 
 void CIOThread::Close()
@@ -29,7 +37,7 @@ void CIOThread::Close()
 	if (m_pFile) {
 		// The file might have been preallocated and the transfer stopped before being completed
 		// so always truncate the file to the actually written size before closing it.
-		if (!m_read) {
+		if (!m_read && m_truncate) {
 			m_pFile->truncate();
 		}
 
@@ -37,7 +45,7 @@ void CIOThread::Close()
 	}
 }
 
-bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary)
+bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary, int64_t expected_size)
 {
 	assert(pFile);
 
@@ -47,8 +55,17 @@ bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile
 	m_read = read;
 	m_binary = binary;
 
+	if (read && expected_size < 0) {
+		auto const pos = m_pFile->seek(0, fz::file::current);
+		auto const size = m_pFile->size();
+		if (pos >= 0 && size >= pos) {
+			expected_size = size - pos;
+		}
+	}
+	AllocateBuffers(expected_size);
+
 	if (read) {
-		m_curAppBuf = BUFFERCOUNT - 1;
+		m_curAppBuf = static_cast<int>(m_buffers.size()) - 1;
 		m_curThreadBuf = 0;
 	}
 	else {
@@ -71,14 +88,90 @@ bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile
 	return true;
 }
 
+void CIOThread::AllocateBuffers(int64_t expected_size)
+{
+	buffer_size_ = max_buffer_size;
+	int count = default_buffer_count;
+	max_buffer_count_ = max_buffer_count;
+
+	if (expected_size >= 0) {
+		// Leave room to detect EOF. On ASCII uploads the data can double in
+		// size due to line ending conversion.
+		int64_t needed = expected_size + 1;
+		if (m_read && !m_binary) {
+			needed *= 2;
+		}
+
+		if (needed <= max_buffer_size) {
+			// Small file, fits into a single buffer.
+			buffer_size_ = min_buffer_size;
+			while (buffer_size_ < needed) {
+				buffer_size_ *= 2;
+			}
+			count = min_buffer_count;
+			max_buffer_count_ = min_buffer_count;
+		}
+		else if (needed < static_cast<int64_t>(max_buffer_size) * default_buffer_count) {
+			// No point in having more buffers than needed for the whole file.
+			count = static_cast<int>(needed / max_buffer_size) + 2;
+			max_buffer_count_ = count;
+		}
+	}
+
+	m_buffers.clear();
+	m_bufferLens.clear();
+	for (int i = 0; i < count; ++i) {
+		m_buffers.emplace_back(new char[buffer_size_]);
+		m_bufferLens.push_back(0);
+	}
+	stalls_ = 0;
+	buffers_since_stall_ = 0;
+}
+
+bool CIOThread::GrowRing()
+{
+	buffers_since_stall_ = 0;
+	if (++stalls_ < stall_threshold) {
+		return false;
+	}
+	stalls_ = 0;
+
+	int const count = static_cast<int>(m_buffers.size());
+	if (count >= max_buffer_count_) {
+		return false;
+	}
+
+	// Free buffers are always taken right after the one the producing side
+	// currently holds, so that is where new buffers go. Buffers with
+	// pending data keep their order.
+	int const producer = m_read ? m_curThreadBuf : m_curAppBuf;
+	if (producer < 0) {
+		return false;
+	}
+
+	int const add = std::min(count, max_buffer_count_ - count);
+	for (int i = 0; i < add; ++i) {
+		m_buffers.emplace(m_buffers.begin() + producer + 1, new char[buffer_size_]);
+		m_bufferLens.insert(m_bufferLens.begin() + producer + 1, 0);
+	}
+
+	int & consumer = m_read ? m_curAppBuf : m_curThreadBuf;
+	if (consumer > producer) {
+		consumer += add;
+	}
+
+	return true;
+}
+
 void CIOThread::entry()
 {
 	if (m_read) {
 		fz::scoped_lock l(m_mutex);
 		while (m_running) {
 
+			char* const buffer = m_buffers[m_curThreadBuf].get();
 			l.unlock();
-			auto len = ReadFromFile(m_buffers[m_curThreadBuf], BUFFERSIZE);
+			auto len = ReadFromFile(buffer, buffer_size_);
 			l.lock();
 
 			if (m_appWaiting) {
@@ -103,7 +196,7 @@ void CIOThread::entry()
 				break;
 			}
 
-			++m_curThreadBuf %= BUFFERCOUNT;
+			++m_curThreadBuf %= static_cast<int>(m_buffers.size());
 			if (m_curThreadBuf == m_curAppBuf) {
 				if (!m_running) {
 					break;
@@ -137,8 +230,9 @@ void CIOThread::entry()
 				m_condition.wait(l);
 			}
 
+			char* const buffer = m_buffers[m_curThreadBuf].get();
 			l.unlock();
-			bool writeSuccessful = WriteToFile(m_buffers[m_curThreadBuf], BUFFERSIZE);
+			bool writeSuccessful = WriteToFile(buffer, buffer_size_);
 			l.lock();
 
 			if (!writeSuccessful) {
@@ -159,7 +253,7 @@ void CIOThread::entry()
 				break;
 			}
 
-			++m_curThreadBuf %= BUFFERCOUNT;
+			++m_curThreadBuf %= static_cast<int>(m_buffers.size());
 		}
 	}
 }
@@ -174,14 +268,20 @@ int CIOThread::GetNextWriteBuffer(char** pBuffer)
 
 	if (m_curAppBuf == -1) {
 		m_curAppBuf = 0;
-		*pBuffer = m_buffers[0];
+		*pBuffer = m_buffers[0].get();
 		return IO_Success;
 	}
 
-	int newBuf = (m_curAppBuf + 1) % BUFFERCOUNT;
+	int newBuf = (m_curAppBuf + 1) % static_cast<int>(m_buffers.size());
 	if (newBuf == m_curThreadBuf) {
-		m_appWaiting = true;
-		return IO_Again;
+		if (!GrowRing()) {
+			m_appWaiting = true;
+			return IO_Again;
+		}
+		newBuf = m_curAppBuf + 1;
+	}
+	else if (++buffers_since_stall_ >= static_cast<int>(m_buffers.size())) {
+		stalls_ = 0;
 	}
 
 	if (m_threadWaiting) {
@@ -190,7 +290,7 @@ int CIOThread::GetNextWriteBuffer(char** pBuffer)
 	}
 
 	m_curAppBuf = newBuf;
-	*pBuffer = m_buffers[newBuf];
+	*pBuffer = m_buffers[newBuf].get();
 
 	return IO_Success;
 }
@@ -213,7 +313,7 @@ bool CIOThread::Finalize(int len)
 		return true;
 	}
 
-	if (!WriteToFile(m_buffers[m_curAppBuf], len)) {
+	if (!WriteToFile(m_buffers[m_curAppBuf].get(), len)) {
 		return false;
 	}
 
@@ -235,10 +335,9 @@ int CIOThread::GetNextReadBuffer(char** pBuffer)
 {
 	assert(m_read);
 
-	int newBuf = (m_curAppBuf + 1) % BUFFERCOUNT;
-
 	fz::scoped_lock l(m_mutex);
 
+	int newBuf = (m_curAppBuf + 1) % static_cast<int>(m_buffers.size());
 	if (newBuf == m_curThreadBuf) {
 		if (m_error) {
 			return IO_Error;
@@ -247,17 +346,23 @@ int CIOThread::GetNextReadBuffer(char** pBuffer)
 			return IO_Success;
 		}
 		else {
+			// Growing the ring lets the thread read further ahead,
+			// there is no data for us yet either way.
+			GrowRing();
 			m_appWaiting = true;
 			return IO_Again;
 		}
 	}
+	else if (++buffers_since_stall_ >= static_cast<int>(m_buffers.size())) {
+		stalls_ = 0;
+	}
 
 	if (m_threadWaiting) {
 		m_condition.signal(l);
 		m_threadWaiting = false;
 	}
 
-	*pBuffer = m_buffers[newBuf];
+	*pBuffer = m_buffers[newBuf].get();
 	m_curAppBuf = newBuf;
 
 	return m_bufferLens[newBuf];
@@ -5,8 +5,8 @@
 #include <libfilezilla/event_handler.hpp>
 #include <libfilezilla/thread_pool.hpp>
 
-#define BUFFERCOUNT 8
-#define BUFFERSIZE 256*1024
+#include <memory>
+#include <vector>
 
 // Does not actually read from or write to file
 // Useful for benchmarks to avoid IO bottleneck
@@ -33,9 +33,17 @@ public:
 	CIOThread();
 	~CIOThread();
 
-	bool Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary);
+	// The buffer ring is sized from expected_size, the number of bytes
+	// expected to be transferred. Pass -1 if unknown. For reads the
+	// remaining size of the file is used if not given.
+	bool Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary, int64_t expected_size = -1);
 	void Destroy(); // Only call that might be blocking
 
+	// Writing only: By default the file gets truncated at the current
+	// position when closing it, removing preallocated space. Disable
+	// when writing a region within a larger file, e.g. a segment.
+	void SetTruncateOnClose(bool truncate) { m_truncate = truncate; }
+
 	// Call before first call to one of the GetNext*Buffer functions
 	// This handler will receive the CIOThreadEvent events. The events
 	// get triggerd iff a buffer is available after a call to the
@@ -59,9 +67,20 @@ public:
 
 	std::wstring GetError();
 
+	// Size of each buffer handed out by the GetNext*Buffer functions.
+	// Fixed between Create() and the end of the transfer.
+	unsigned int GetBufferSize() const { return buffer_size_; }
+
 private:
 	void Close();
 
+	void AllocateBuffers(int64_t expected_size);
+
+	// Called with the mutex held by the GetNext*Buffer functions after
+	// the socket side had to wait on the ring. Adds free buffers if the
+	// ring is starved repeatedly.
+	bool GrowRing();
+
 	void entry();
 
 	int64_t ReadFromFile(char* pBuffer, int64_t maxLen);
@@ -72,10 +91,15 @@ private:
 
 	bool m_read{};
 	bool m_binary{};
+	bool m_truncate{true};
 	std::unique_ptr<fz::file> m_pFile;
 
-	char* m_buffers[BUFFERCOUNT];
-	unsigned int m_bufferLens[BUFFERCOUNT];
+	std::vector<std::unique_ptr<char[]>> m_buffers;
+	std::vector<unsigned int> m_bufferLens;
+	unsigned int buffer_size_{};
+	int max_buffer_count_{};
+	int stalls_{};
+	int buffers_since_stall_{};
 
 	fz::mutex m_mutex{false};
 	fz::condition m_condition;
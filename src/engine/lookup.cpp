@@ -5,6 +5,7 @@
 
 enum {
 	lookup_init = 0,
+	lookup_stat,
 	lookup_list
 };
 
@@ -56,8 +57,14 @@ int LookupOpData::Send()
 		}
 
 		if (opState == lookup_init) {
-			opState = lookup_list;
-			controlSocket_.List(path_, std::wstring(), LIST_FLAG_REFRESH);
+			if (controlSocket_.GetStatCost() > 0) {
+				opState = lookup_stat;
+				controlSocket_.Stat(path_, file_, *entry_);
+			}
+			else {
+				opState = lookup_list;
+				controlSocket_.List(path_, std::wstring(), LIST_FLAG_REFRESH);
+			}
 			return FZ_REPLY_CONTINUE;
 		}
 		else {
@@ -70,6 +77,24 @@ int LookupOpData::Send()
 int LookupOpData::SubcommandResult(int prevResult, COpData const&)
 {
 	switch (opState) {
+	case lookup_stat:
+		if (prevResult == FZ_REPLY_OK) {
+			log(logmsg::debug_info, L"Found '%s' without listing the directory", file_);
+			return FZ_REPLY_OK;
+		}
+		if ((prevResult & FZ_REPLY_ERROR_NOTFOUND) == FZ_REPLY_ERROR_NOTFOUND) {
+			log(logmsg::debug_info, L"'%s' does not appear to exist", file_);
+			return FZ_REPLY_ERROR_NOTFOUND;
+		}
+		if (prevResult & FZ_REPLY_DISCONNECTED) {
+			return prevResult;
+		}
+
+		log(logmsg::debug_info, L"Could not look at '%s' directly, listing the directory instead", file_);
+		entry_->clear();
+		opState = lookup_list;
+		controlSocket_.List(path_, std::wstring(), LIST_FLAG_REFRESH);
+		return FZ_REPLY_CONTINUE;
 	case lookup_list:
 		if (prevResult == FZ_REPLY_OK) {
 			return FZ_REPLY_CONTINUE;
@@ -568,6 +568,7 @@ bool CServer::ProtocolHasFeature(ServerProtocol const protocol, ProtocolFeature
 	case ProtocolFeature::PreserveTimestamp:
 	case ProtocolFeature::ServerType:
 	case ProtocolFeature::UnixChmod:
+	case ProtocolFeature::SegmentedDownload:
 		if (protocol == FTP || protocol == FTPS || protocol == FTPES || protocol == INSECURE_FTP ||
 			protocol == SFTP) {
 			return true;
@@ -843,6 +844,19 @@ std::vector<LogonType> GetSupportedLogonTypes(ServerProtocol protocol)
 std::vector<ParameterTraits> const& ExtraServerParameterTraits(ServerProtocol protocol)
 {
 	switch (protocol) {
+	case FTP:
+	case FTPS:
+	case FTPES:
+	case INSECURE_FTP:
+		{
+			static std::vector<ParameterTraits> ret = []() {
+				std::vector<ParameterTraits> ret;
+				// Overrides OPTION_FTP_MODEZ for the site
+				ret.emplace_back(ParameterTraits{"modez", ParameterSection::custom, ParameterTraits::optional | ParameterTraits::numeric, std::wstring(), std::wstring()});
+				return ret;
+			}();
+			return ret;
+		}
 	case GOOGLE_CLOUD:
 		{
 			static std::vector<ParameterTraits> ret = []() {
@@ -1,5 +1,6 @@
 #include <filezilla.h>
 #include "servercapabilities.h"
+#include "xmlutils.h"
 
 #include <assert.h>
 
@@ -87,6 +88,7 @@ void CServerCapabilities::SetCapability(const CServer& server, capabilityNames n
 	if (iter == m_serverMap.end()) {
 		CCapabilities capabilities;
 		capabilities.SetCapability(name, cap, option);
+		capabilities.updated_ = fz::datetime::now();
 		m_serverMap[server] = capabilities;
 		return;
 	}
@@ -102,9 +104,115 @@ void CServerCapabilities::SetCapability(const CServer& server, capabilityNames n
 	if (iter == m_serverMap.end()) {
 		CCapabilities capabilities;
 		capabilities.SetCapability(name, cap, option);
+		capabilities.updated_ = fz::datetime::now();
 		m_serverMap[server] = capabilities;
 		return;
 	}
 
 	iter->second.SetCapability(name, cap, option);
 }
+
+void CServerCapabilities::Invalidate(CServer const& server)
+{
+	fz::scoped_lock l(m_);
+	m_serverMap.erase(server);
+}
+
+void CServerCapabilities::Load(pugi::xml_node element, fz::duration const& ttl)
+{
+	auto const now = fz::datetime::now();
+
+	fz::scoped_lock l(m_);
+
+	element = element.child("Capabilities");
+	for (auto serverElement = element.child("Server"); serverElement; serverElement = serverElement.next_sibling("Server")) {
+		CCapabilities capabilities;
+		capabilities.updated_ = fz::datetime(static_cast<time_t>(serverElement.attribute("Updated").as_llong()), fz::datetime::seconds);
+		if (capabilities.updated_.empty() || capabilities.updated_ > now || now - capabilities.updated_ > ttl) {
+			continue;
+		}
+
+		auto const protocol = static_cast<ServerProtocol>(GetAttributeInt(serverElement, "Protocol"));
+		auto const type = static_cast<ServerType>(GetAttributeInt(serverElement, "Type"));
+		if (protocol <= UNKNOWN || protocol > MAX_VALUE || type < 0 || type >= SERVERTYPE_MAX) {
+			continue;
+		}
+
+		CServer server(protocol, type, GetTextAttribute(serverElement, "Host"), GetAttributeInt(serverElement, "Port"));
+		if (server.empty()) {
+			continue;
+		}
+		server.SetUser(GetTextAttribute(serverElement, "User"));
+		server.SetTimezoneOffset(GetAttributeInt(serverElement, "TimezoneOffset"));
+		server.SetPasvMode(static_cast<PasvMode>(GetAttributeInt(serverElement, "PasvMode")));
+		server.SetEncodingType(static_cast<CharsetEncoding>(GetAttributeInt(serverElement, "EncodingType")), GetTextAttribute(serverElement, "CustomEncoding"));
+		server.SetBypassProxy(GetAttributeInt(serverElement, "BypassProxy") != 0);
+		for (auto parameter = serverElement.child("Parameter"); parameter; parameter = parameter.next_sibling("Parameter")) {
+			server.SetExtraParameter(parameter.attribute("Name").value(), GetTextElement(parameter));
+		}
+
+		for (auto capElement = serverElement.child("Capability"); capElement; capElement = capElement.next_sibling("Capability")) {
+			int const name = GetAttributeInt(capElement, "Name");
+			int const value = GetAttributeInt(capElement, "Value");
+			if (name < 0 || name > pipelining || value < unknown || value > no) {
+				continue;
+			}
+
+			CCapabilities::t_cap cap;
+			cap.cap = static_cast<capabilities>(value);
+			if (cap.cap == yes) {
+				cap.option = GetTextElement(capElement);
+				cap.number = GetAttributeInt(capElement, "Number");
+			}
+			capabilities.m_capabilityMap[static_cast<capabilityNames>(name)] = cap;
+		}
+
+		// Capabilities detected in this session take precedence
+		m_serverMap.emplace(std::move(server), std::move(capabilities));
+	}
+}
+
+void CServerCapabilities::Save(pugi::xml_node element)
+{
+	pugi::xml_node old;
+	while ((old = element.child("Capabilities"))) {
+		element.remove_child(old);
+	}
+	element = element.append_child("Capabilities");
+
+	{
+		fz::scoped_lock l(m_);
+
+		for (auto const& [server, capabilities] : m_serverMap) {
+			if (capabilities.m_capabilityMap.empty()) {
+				continue;
+			}
+
+			auto serverElement = element.append_child("Server");
+			serverElement.append_attribute("Updated").set_value(static_cast<long long>(capabilities.updated_.get_time_t()));
+			SetAttributeInt(serverElement, "Protocol", server.GetProtocol());
+			SetAttributeInt(serverElement, "Type", server.GetType());
+			SetTextAttribute(serverElement, "Host", server.GetHost());
+			SetAttributeInt(serverElement, "Port", server.GetPort());
+			SetTextAttribute(serverElement, "User", server.GetUser());
+			SetAttributeInt(serverElement, "TimezoneOffset", server.GetTimezoneOffset());
+			SetAttributeInt(serverElement, "PasvMode", server.GetPasvMode());
+			SetAttributeInt(serverElement, "EncodingType", server.GetEncodingType());
+			SetTextAttribute(serverElement, "CustomEncoding", server.GetCustomEncoding());
+			SetAttributeInt(serverElement, "BypassProxy", server.GetBypassProxy() ? 1 : 0);
+			for (auto const& parameter : server.GetExtraParameters()) {
+				auto parameterElement = AddTextElement(serverElement, "Parameter", parameter.second);
+				SetTextAttributeUtf8(parameterElement, "Name", parameter.first);
+			}
+
+			for (auto const& cap : capabilities.m_capabilityMap) {
+				auto capElement = AddTextElement(serverElement, "Capability", cap.second.option);
+				SetAttributeInt(capElement, "Name", cap.first);
+				SetAttributeInt(capElement, "Value", cap.second.cap);
+				if (cap.second.number) {
+					SetAttributeInt(capElement, "Number", cap.second.number);
+				}
+			}
+		}
+	}
+}
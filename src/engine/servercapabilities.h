@@ -2,11 +2,16 @@
 #define FILEZILLA_ENGINE_SERVERCAPABILITIES_HEADER
 
 #include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
 
 #include <server.h>
 
 #include <map>
 
+namespace pugi {
+class xml_node;
+}
+
 enum capabilities
 {
 	unknown,
@@ -14,6 +19,8 @@ enum capabilities
 	no
 };
 
+// The values get stored in the persistent capabilities cache, only ever
+// append new names at the end.
 enum capabilityNames
 {
 	resume2GBbug,
@@ -44,7 +51,10 @@ enum capabilityNames
 	timezone_offset,
 
 	auth_tls_command,
-	auth_ssl_command
+	auth_ssl_command,
+
+	server_banner, // Last line of the welcome message, used to detect changes of the server software
+	pipelining // set to 'no' if the server failed to handle pipelined commands
 };
 
 class CCapabilities final
@@ -56,6 +66,8 @@ public:
 	void SetCapability(capabilityNames name, capabilities cap, int option);
 
 protected:
+	friend class CServerCapabilities;
+
 	struct t_cap
 	{
 		capabilities cap{unknown};
@@ -63,6 +75,9 @@ protected:
 		int number{};
 	};
 	std::map<capabilityNames, t_cap> m_capabilityMap;
+
+	// When the server was first seen, used for expiry in the persistent cache
+	fz::datetime updated_;
 };
 
 class CServerCapabilities final
@@ -75,6 +90,16 @@ public:
 	static void SetCapability(const CServer& server, capabilityNames name, capabilities cap, std::wstring const& option = std::wstring());
 	static void SetCapability(const CServer& server, capabilityNames name, capabilities cap, int option);
 
+	// Forgets everything known about the server
+	static void Invalidate(CServer const& server);
+
+	// The capabilities can be kept across sessions, so that the detection
+	// does not have to be repeated on each connection. Both take the root
+	// element of the file. Entries older than the given time-to-live are
+	// skipped when loading, entries already known are kept.
+	static void Load(pugi::xml_node element, fz::duration const& ttl);
+	static void Save(pugi::xml_node element);
+
 protected:
 	static std::map<CServer, CCapabilities> m_serverMap;
 
@@ -2,11 +2,10 @@
 
 #include "connect.h"
 #include "event.h"
-#include "input_thread.h"
+#include "helper.h"
 #include "proxy.h"
 
 #include <libfilezilla/local_filesys.hpp>
-#include <libfilezilla/process.hpp>
 
 int CSftpConnectOpData::Send()
 {
@@ -46,20 +45,27 @@ int CSftpConnectOpData::Send()
 				args.push_back(fzT("-C"));
 			}
 			engine_.GetRateLimiter().add(&controlSocket_);
-			controlSocket_.process_ = std::make_unique<fz::process>();
-			if (!controlSocket_.process_->spawn(executable, args)) {
+
+			CSftpHelper::state state;
+			size_t const max_clients = static_cast<size_t>(std::max(1, engine_.GetOptions().GetOptionVal(OPTION_SFTP_SESSION_CONNECTIONS)));
+			controlSocket_.helper_ = CSftpHelper::Acquire(engine_.GetThreadPool(), executable, args, currentServer_, controlSocket_.credentials_,
+				max_clients, controlSocket_, controlSocket_.tag_, state);
+			if (!controlSocket_.helper_) {
 				log(logmsg::debug_warning, L"Could not create process");
 				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
 			}
 
-			controlSocket_.input_thread_ = std::make_unique<CSftpInputThread>(controlSocket_, *controlSocket_.process_);
-			if (!controlSocket_.input_thread_->spawn(engine_.GetThreadPool())) {
-				log(logmsg::debug_warning, L"Thread creation failed");
-				controlSocket_.input_thread_.reset();
-				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
+			if (state == CSftpHelper::state::ready) {
+				return Attached();
+			}
+			else if (state == CSftpHelper::state::connecting) {
+				log(logmsg::debug_info, L"Waiting for another connection to log in");
+				opState = connect_wait;
 			}
 		}
 		return FZ_REPLY_WOULDBLOCK;
+	case connect_wait:
+		return FZ_REPLY_WOULDBLOCK;
 	case connect_proxy:
 		{
 			int type;
@@ -148,6 +154,8 @@ int CSftpConnectOpData::ParseResponse()
 		}
 		break;
 	case connect_open:
+		controlSocket_.helper_->SetReady(controlSocket_.m_sftpEncryptionDetails);
+		controlSocket_.tagged_ = true;
 		engine_.AddNotification(new CSftpEncryptionNotification(controlSocket_.m_sftpEncryptionDetails));
 		return FZ_REPLY_OK;
 	default:
@@ -158,6 +166,17 @@ int CSftpConnectOpData::ParseResponse()
 	return FZ_REPLY_CONTINUE;
 }
 
+int CSftpConnectOpData::Attached()
+{
+	log(logmsg::status, _("Using existing SFTP session"));
+
+	controlSocket_.tagged_ = true;
+	controlSocket_.m_sftpEncryptionDetails = controlSocket_.helper_->GetEncryptionDetails();
+	engine_.AddNotification(new CSftpEncryptionNotification(controlSocket_.m_sftpEncryptionDetails));
+
+	return FZ_REPLY_OK;
+}
+
 int CSftpConnectOpData::Reset(int result)
 {
 	if (opState == connect_init && (result & FZ_REPLY_CANCELED) != FZ_REPLY_CANCELED) {
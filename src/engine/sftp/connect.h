@@ -8,7 +8,8 @@ enum connectStates
 	connect_init,
 	connect_proxy,
 	connect_keys,
-	connect_open
+	connect_open,
+	connect_wait // For another connection to log in to the shared session
 };
 
 class CSftpConnectOpData final : public COpData, public CSftpOpData
@@ -24,6 +25,9 @@ public:
 	virtual int ParseResponse() override;
 	virtual int Reset(int result) override;
 
+	// Completes the connection using an already logged in session
+	int Attached();
+
 	std::wstring lastChallenge;
 	CInteractiveLoginNotification::type lastChallengeType{ CInteractiveLoginNotification::interactive };
 	bool criticalFailure{};
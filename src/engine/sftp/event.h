@@ -1,7 +1,7 @@
 #ifndef FILEZILLA_ENGINE_SFTP_EVENT_HEADER
 #define FILEZILLA_ENGINE_SFTP_EVENT_HEADER
 
-#define FZSFTP_PROTOCOL_VERSION 9
+#define FZSFTP_PROTOCOL_VERSION 13
 
 enum class sftpEvent {
 	Unknown = -1,
@@ -44,11 +44,30 @@ struct sftp_message
 struct sftp_event_type;
 typedef fz::simple_event<sftp_event_type, sftp_message> CSftpEvent;
 
+// Attribute flags as in the SFTP protocol
+enum sftp_attr_flags : uint32_t
+{
+	sftp_attr_size = 0x1,
+	sftp_attr_uidgid = 0x2,
+	sftp_attr_permissions = 0x4,
+	sftp_attr_acmodtime = 0x8
+};
+
+struct sftp_list_entry
+{
+	std::wstring name;
+	std::wstring longname;
+	uint64_t size{};
+	uint64_t mtime{};
+	uint32_t flags{};
+	uint32_t uid{};
+	uint32_t gid{};
+	uint32_t permissions{};
+};
+
 struct sftp_list_message
 {
-	mutable std::wstring text;
-	mutable std::wstring name;
-	uint64_t mtime;
+	mutable std::vector<sftp_list_entry> entries;
 };
 
 struct sftp_list_event_type;
@@ -57,4 +76,9 @@ typedef fz::simple_event<sftp_list_event_type, sftp_list_message> CSftpListEvent
 struct terminate_event_type;
 typedef fz::simple_event<terminate_event_type, std::wstring> CTerminateEvent;
 
+// Sent by CSftpHelper once the control socket that spawned the process
+// has logged in, or failed to.
+struct sftp_ready_event_type;
+typedef fz::simple_event<sftp_ready_event_type, bool> CSftpReadyEvent;
+
 #endif
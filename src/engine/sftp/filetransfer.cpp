@@ -11,7 +11,7 @@ enum filetransferStates
 {
 	filetransfer_init = 0,
 	filetransfer_waitcwd,
-	filetransfer_waitlist,
+	filetransfer_waitlookup,
 	filetransfer_mtime,
 	filetransfer_transfer,
 	filetransfer_chmtime
@@ -62,7 +62,25 @@ int CSftpFileTransferOpData::Send()
 			cmd = "re";
 			logstr = L"re";
 		}
-		if (download_) {
+		if (download_ && transferSettings_.segmented()) {
+			// Downloads the segment into the prepared local file
+			engine_.transfer_status_.Init(transferSettings_.segmentLength, 0, false);
+			cmd = fz::sprintf("getrange %d %d ", transferSettings_.segmentOffset, transferSettings_.segmentLength);
+			logstr = fz::sprintf(L"getrange %d %d ", transferSettings_.segmentOffset, transferSettings_.segmentLength);
+
+			std::string remoteFile = controlSocket_.ConvToServer(controlSocket_.QuoteFilename(remotePath_.FormatFilename(remoteFile_, !tryAbsolutePath_)));
+			if (remoteFile.empty()) {
+				log(logmsg::error, _("Could not convert command to server encoding"));
+				return FZ_REPLY_ERROR;
+			}
+			cmd += remoteFile + " ";
+			logstr += controlSocket_.QuoteFilename(remotePath_.FormatFilename(remoteFile_, !tryAbsolutePath_)) + L" ";
+
+			std::wstring localFile = controlSocket_.QuoteFilename(localFile_);
+			cmd += fz::to_utf8(localFile);
+			logstr += localFile;
+		}
+		else if (download_) {
 			if (!resume_) {
 				controlSocket_.CreateLocalDir(localFile_);
 			}
@@ -137,7 +155,8 @@ int CSftpFileTransferOpData::ParseResponse()
 	if (opState == filetransfer_transfer) {
 		if (controlSocket_.result_ == FZ_REPLY_OK && engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS)) {
 			if (download_) {
-				if (!fileTime_.empty()) {
+				// With segments, other segments may still be written to
+				if (!fileTime_.empty() && !transferSettings_.segmented()) {
 					if (!fz::local_filesys::set_modification_time(fz::to_native(localFile_), fileTime_))
 						log(logmsg::debug_warning, L"Could not set modification time");
 				}
@@ -204,7 +223,7 @@ int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			bool found = engine_.GetDirectoryCache().LookupFile(entry, currentServer_, tryAbsolutePath_ ? remotePath_ : currentPath_, remoteFile_, dirDidExist, matchedCase);
 			if (!found) {
 				if (!dirDidExist) {
-					opState = filetransfer_waitlist;
+					opState = filetransfer_waitlookup;
 				}
 				else if (download_ && engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS)) {
 					opState = filetransfer_mtime;
@@ -215,7 +234,7 @@ int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			}
 			else {
 				if (entry.is_unsure()) {
-					opState = filetransfer_waitlist;
+					opState = filetransfer_waitlookup;
 				}
 				else {
 					if (matchedCase) {
@@ -238,8 +257,9 @@ int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 					}
 				}
 			}
-			if (opState == filetransfer_waitlist) {
-				controlSocket_.List(CServerPath(), L"", LIST_FLAG_REFRESH);
+			if (opState == filetransfer_waitlookup) {
+				// Only lists the directory if the file cannot be looked at on its own
+				controlSocket_.Lookup(tryAbsolutePath_ ? remotePath_ : currentPath_, remoteFile_, &lookupEntry_);
 				return FZ_REPLY_CONTINUE;
 			}
 			else if (opState == filetransfer_transfer) {
@@ -254,17 +274,15 @@ int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			opState = filetransfer_mtime;
 		}
 	}
-	else if (opState == filetransfer_waitlist) {
+	else if (opState == filetransfer_waitlookup) {
 		if (prevResult == FZ_REPLY_OK) {
-			CDirentry entry;
-			bool dirDidExist;
-			bool matchedCase;
-			bool found = engine_.GetDirectoryCache().LookupFile(entry, currentServer_, tryAbsolutePath_ ? remotePath_ : currentPath_, remoteFile_, dirDidExist, matchedCase);
-			if (!found) {
-				if (!dirDidExist) {
-					opState = filetransfer_mtime;
+			if (lookupEntry_.name == remoteFile_ && !lookupEntry_.is_unsure()) {
+				remoteFileSize_ = lookupEntry_.size;
+				if (lookupEntry_.has_date()) {
+					fileTime_ = lookupEntry_.time;
 				}
-				else if (download_ &&
+
+				if (download_ && !lookupEntry_.has_time() &&
 					engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS))
 				{
 					opState = filetransfer_mtime;
@@ -274,35 +292,29 @@ int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 				}
 			}
 			else {
-				if (matchedCase && !entry.is_unsure()) {
-					remoteFileSize_ = entry.size;
-					if (entry.has_date()) {
-						fileTime_ = entry.time;
-					}
-
-					if (download_ && !entry.has_time() &&
-						engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS))
-					{
-						opState = filetransfer_mtime;
-					}
-					else {
-						opState = filetransfer_transfer;
-					}
-				}
-				else {
-					opState = filetransfer_mtime;
-				}
+				opState = filetransfer_mtime;
 			}
-			if (opState == filetransfer_transfer) {
-				int res = controlSocket_.CheckOverwriteFile();
-				if (res != FZ_REPLY_OK) {
-					return res;
-				}
+		}
+		else if ((prevResult & FZ_REPLY_ERROR_NOTFOUND) == FZ_REPLY_ERROR_NOTFOUND) {
+			if (download_ &&
+				engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS))
+			{
+				opState = filetransfer_mtime;
+			}
+			else {
+				opState = filetransfer_transfer;
 			}
 		}
 		else {
 			opState = filetransfer_mtime;
 		}
+
+		if (opState == filetransfer_transfer) {
+			int res = controlSocket_.CheckOverwriteFile();
+			if (res != FZ_REPLY_OK) {
+				return res;
+			}
+		}
 	}
 	else {
 		log(logmsg::debug_warning, L"  Unknown opState (%d)", opState);
@@ -14,6 +14,8 @@ public:
 	virtual int Send() override;
 	virtual int ParseResponse() override;
 	virtual int SubcommandResult(int, COpData const&) override;
+
+	CDirentry lookupEntry_;
 };
 
 #endif
@@ -0,0 +1,236 @@
+#include <filezilla.h>
+
+#include "event.h"
+#include "helper.h"
+#include "input_thread.h"
+#include "sftpcontrolsocket.h"
+
+#include <libfilezilla/process.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+std::multimap<std::wstring, std::weak_ptr<CSftpHelper>> CSftpHelper::helpers_;
+fz::mutex CSftpHelper::helpers_mutex_(false);
+
+CSftpHelper::~CSftpHelper()
+{
+	if (process_) {
+		process_->kill();
+	}
+	input_thread_.reset();
+	process_.reset();
+}
+
+std::shared_ptr<CSftpHelper> CSftpHelper::Acquire(fz::thread_pool & pool, fz::native_string const& executable, std::vector<fz::native_string> const& args,
+	CServer const& server, Credentials const& credentials, size_t max_clients, CSftpControlSocket & client, std::wstring & tag, state & s)
+{
+	s = state::spawned;
+
+	std::wstring key = server.Format(ServerFormat::with_optional_port) + L"\n" + server.GetUser() + L"\n" + credentials.GetPass() + L"\n" + credentials.keyFile_ + L"\n";
+	key += fz::to_wstring(static_cast<int>(server.GetEncodingType())) + L" " + server.GetCustomEncoding() + L"\n";
+	key += fz::to_wstring(executable);
+	for (auto const& arg : args) {
+		key += L" " + fz::to_wstring(arg);
+	}
+
+	fz::scoped_lock l(helpers_mutex_);
+
+	for (auto it = helpers_.begin(); it != helpers_.end(); ) {
+		if (it->second.expired()) {
+			it = helpers_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	auto const range = helpers_.equal_range(key);
+	for (auto it = range.first; it != range.second; ++it) {
+		auto helper = it->second.lock();
+		if (helper) {
+			bool ready{};
+			tag = helper->Attach(client, &ready, max_clients);
+			if (!tag.empty()) {
+				s = ready ? state::ready : state::connecting;
+				return helper;
+			}
+		}
+	}
+
+	// Attach before spawning so that the initial reply has a recipient.
+	auto helper = std::make_shared<CSftpHelper>();
+	tag = helper->Attach(client);
+	if (!helper->Spawn(pool, executable, args)) {
+		helper->Detach(tag);
+		tag.clear();
+		return nullptr;
+	}
+	helpers_.emplace(key, helper);
+
+	return helper;
+}
+
+bool CSftpHelper::Spawn(fz::thread_pool & pool, fz::native_string const& executable, std::vector<fz::native_string> const& args)
+{
+	process_ = std::make_unique<fz::process>();
+	if (!process_->spawn(executable, args)) {
+		process_.reset();
+		return false;
+	}
+
+	input_thread_ = std::make_unique<CSftpInputThread>(*this, *process_);
+	if (!input_thread_->spawn(pool)) {
+		input_thread_.reset();
+		process_->kill();
+		process_.reset();
+		return false;
+	}
+
+	return true;
+}
+
+std::wstring CSftpHelper::Attach(CSftpControlSocket & client, bool * ready, size_t max_clients)
+{
+	fz::scoped_lock l(mutex_);
+
+	if (failed_) {
+		return std::wstring();
+	}
+	if (max_clients && clients_.size() >= max_clients) {
+		return std::wstring();
+	}
+	if (ready) {
+		*ready = ready_;
+	}
+
+	std::wstring const tag = fz::to_wstring(++next_tag_);
+	clients_[tag] = &client;
+	if (next_tag_ == 1) {
+		default_client_ = &client;
+	}
+
+	return tag;
+}
+
+void CSftpHelper::SetReady(CSftpEncryptionNotification const& details)
+{
+	fz::scoped_lock l(mutex_);
+
+	ready_ = true;
+	encryption_details_ = details;
+	NotifyWaiting(true);
+}
+
+CSftpEncryptionNotification CSftpHelper::GetEncryptionDetails()
+{
+	fz::scoped_lock l(mutex_);
+	return encryption_details_;
+}
+
+void CSftpHelper::NotifyWaiting(bool success)
+{
+	for (auto & client : clients_) {
+		if (client.second != default_client_) {
+			client.second->send_event<CSftpReadyEvent>(success);
+		}
+	}
+}
+
+void CSftpHelper::Detach(std::wstring const& tag)
+{
+	fz::scoped_lock l(mutex_);
+
+	auto it = clients_.find(tag);
+	if (it == clients_.end()) {
+		return;
+	}
+
+	bool const was_default = default_client_ == it->second;
+	clients_.erase(it);
+
+	if (was_default) {
+		default_client_ = nullptr;
+		if (!ready_) {
+			// Login got abandoned
+			if (!failed_) {
+				failed_ = true;
+				NotifyWaiting(false);
+			}
+		}
+		else if (!clients_.empty()) {
+			// Someone has to answer the quota requests
+			default_client_ = clients_.begin()->second;
+		}
+	}
+}
+
+bool CSftpHelper::Send(std::string const& str)
+{
+	fz::scoped_lock l(mutex_);
+
+	if (!process_ || failed_) {
+		return false;
+	}
+
+	return process_->write(str);
+}
+
+void CSftpHelper::Dispatch(std::wstring const& tag, fz::event_base * ev)
+{
+	fz::scoped_lock l(mutex_);
+
+	CSftpControlSocket * client{};
+	if (tag.empty()) {
+		client = default_client_;
+	}
+	else {
+		auto it = clients_.find(tag);
+		if (it != clients_.end()) {
+			client = it->second;
+		}
+	}
+
+	if (client) {
+		client->send_event(ev);
+	}
+	else {
+		delete ev;
+	}
+}
+
+void CSftpHelper::OnTerminate(std::wstring const& error)
+{
+	fz::scoped_lock l(mutex_);
+
+	failed_ = true;
+	for (auto & client : clients_) {
+		client.second->send_event<CTerminateEvent>(error);
+	}
+}
+
+std::wstring CSftpHelper::ConvToLocal(std::wstring const& tag, char const* buffer, size_t len)
+{
+	fz::scoped_lock l(mutex_);
+
+	CSftpControlSocket * client{};
+	if (tag.empty()) {
+		client = default_client_;
+	}
+	else {
+		auto it = clients_.find(tag);
+		if (it != clients_.end()) {
+			client = it->second;
+		}
+	}
+
+	if (client) {
+		// Holding the mutex keeps the client from detaching meanwhile
+		return client->ConvToLocal(buffer, len);
+	}
+
+	// Nobody listens, the event gets discarded anyhow.
+	std::wstring ret = fz::to_wstring_from_utf8(buffer, len);
+	if (ret.empty() && len) {
+		ret.assign(reinterpret_cast<unsigned char const*>(buffer), reinterpret_cast<unsigned char const*>(buffer + len));
+	}
+	return ret;
+}
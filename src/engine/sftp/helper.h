@@ -0,0 +1,95 @@
+#ifndef FILEZILLA_ENGINE_SFTP_HELPER_HEADER
+#define FILEZILLA_ENGINE_SFTP_HELPER_HEADER
+
+#include "notification.h"
+
+#include <libfilezilla/mutex.hpp>
+
+#include <map>
+#include <memory>
+
+namespace fz {
+class process;
+class thread_pool;
+}
+
+class CSftpControlSocket;
+class CSftpInputThread;
+
+// A running fzsftp process. Once logged in, it is shared by up to
+// OPTION_SFTP_SESSION_CONNECTIONS SFTP control sockets that connect to the
+// same server with the same credentials, so that they use a single SSH
+// session. Each attached
+// control socket gets a tag which is prefixed to its commands, fzsftp
+// runs the transfers of different tags concurrently and prefixes the
+// resulting events with the tag.
+//
+// The control socket which spawned the process logs in using untagged
+// commands. Untagged events, which includes the login prompts and the
+// quota requests, go to that socket.
+class CSftpHelper final
+{
+public:
+	enum class state
+	{
+		spawned, // Caller needs to log in
+		connecting, // Another control socket is logging in, wait for CSftpReadyEvent
+		ready
+	};
+
+	CSftpHelper() = default;
+	~CSftpHelper();
+
+	CSftpHelper(CSftpHelper const&) = delete;
+	CSftpHelper& operator=(CSftpHelper const&) = delete;
+
+	// Returns a helper for the given server and credentials, spawning
+	// the process if needed, with the control socket attached under the
+	// returned tag. A process is shared by at most max_clients control
+	// sockets, further ones get their own SSH session. Each session has
+	// its own TCP connection, which is what parallel transfers such as
+	// the segments of a download need to be any faster.
+	static std::shared_ptr<CSftpHelper> Acquire(fz::thread_pool & pool, fz::native_string const& executable, std::vector<fz::native_string> const& args,
+		CServer const& server, Credentials const& credentials, size_t max_clients, CSftpControlSocket & client, std::wstring & tag, state & s);
+
+	// Called by the control socket which spawned the process once it has
+	// logged in. Sends CSftpReadyEvent to the waiting control sockets.
+	void SetReady(CSftpEncryptionNotification const& details);
+
+	CSftpEncryptionNotification GetEncryptionDetails();
+
+	// After Detach returns, no further events get sent to the control socket.
+	void Detach(std::wstring const& tag);
+
+	bool Send(std::string const& str);
+
+	// Called from the input thread
+	void Dispatch(std::wstring const& tag, fz::event_base * ev);
+	void OnTerminate(std::wstring const& error);
+	std::wstring ConvToLocal(std::wstring const& tag, char const* buffer, size_t len);
+
+private:
+	// Returns an empty tag if the process can no longer be used or already
+	// has max_clients control sockets attached. 0 means no limit.
+	std::wstring Attach(CSftpControlSocket & client, bool * ready = nullptr, size_t max_clients = 0);
+	bool Spawn(fz::thread_pool & pool, fz::native_string const& executable, std::vector<fz::native_string> const& args);
+	void NotifyWaiting(bool success);
+
+	std::unique_ptr<fz::process> process_;
+	std::unique_ptr<CSftpInputThread> input_thread_;
+
+	fz::mutex mutex_{false};
+
+	std::map<std::wstring, CSftpControlSocket*> clients_;
+	CSftpControlSocket* default_client_{};
+	uint64_t next_tag_{};
+
+	bool ready_{};
+	bool failed_{};
+	CSftpEncryptionNotification encryption_details_;
+
+	static std::multimap<std::wstring, std::weak_ptr<CSftpHelper>> helpers_;
+	static fz::mutex helpers_mutex_;
+};
+
+#endif
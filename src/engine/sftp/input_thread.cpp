@@ -2,11 +2,11 @@
 
 #include "event.h"
 #include "input_thread.h"
-#include "sftpcontrolsocket.h"
+#include "helper.h"
 
 #include <libfilezilla/process.hpp>
 
-CSftpInputThread::CSftpInputThread(CSftpControlSocket& owner, fz::process& proc)
+CSftpInputThread::CSftpInputThread(CSftpHelper& owner, fz::process& proc)
 	: process_(proc)
 	, owner_(owner)
 {
@@ -60,7 +60,7 @@ uint64_t CSftpInputThread::ReadUInt(std::wstring &error)
 	return 0;
 }
 
-std::wstring CSftpInputThread::ReadLine(std::wstring &error)
+std::wstring CSftpInputThread::ReadLine(std::wstring const& tag, std::wstring &error)
 {
 	int len = 0;
 	const int buffersize = 4096;
@@ -83,7 +83,7 @@ std::wstring CSftpInputThread::ReadLine(std::wstring &error)
 					--len;
 				}
 
-				std::wstring const line = owner_.ConvToLocal(buffer, len);
+				std::wstring const line = owner_.ConvToLocal(tag, buffer, len);
 				if (len && line.empty()) {
 					error = L"Failed to convert reply to local character set.";
 				}
@@ -104,6 +104,147 @@ std::wstring CSftpInputThread::ReadLine(std::wstring &error)
 	return std::wstring();
 }
 
+std::wstring CSftpInputThread::ReadTag(std::wstring &error)
+{
+	std::string tag;
+
+	while (true) {
+		if (!readFromProcess(error, true)) {
+			return std::wstring();
+		}
+
+		auto const* p = recv_buffer_.get();
+		size_t i;
+		for (i = 0; i < recv_buffer_.size(); ++i) {
+			unsigned char const c = p[i];
+			if (c == ' ') {
+				recv_buffer_.consume(i + 1);
+				if (tag.empty()) {
+					error = L"Empty tag";
+				}
+				return fz::to_wstring_from_utf8(tag);
+			}
+			if (c < '0' || c > '9' || tag.size() > 20) {
+				error = L"Malformed tag";
+				return std::wstring();
+			}
+			tag += c;
+		}
+		recv_buffer_.clear();
+	}
+
+	return std::wstring();
+}
+
+bool CSftpInputThread::ReadData(fz::buffer & out, size_t len, std::wstring & error)
+{
+	while (len) {
+		if (recv_buffer_.empty() && len > 1024) {
+			// Skip the detour through recv_buffer_ for the bulk of the data
+			unsigned int const chunk = static_cast<unsigned int>(std::min(len, size_t(1024 * 1024)));
+			int read = process_.read(reinterpret_cast<char *>(out.get(chunk)), chunk);
+			if (read <= 0) {
+				error = read ? L"Unknown error reading from process" : L"Unexpected EOF.";
+				return false;
+			}
+			out.add(read);
+			len -= read;
+			continue;
+		}
+
+		if (!readFromProcess(error, true)) {
+			return false;
+		}
+
+		size_t const chunk = std::min(len, recv_buffer_.size());
+		out.append(recv_buffer_.get(), chunk);
+		recv_buffer_.consume(chunk);
+		len -= chunk;
+	}
+
+	return true;
+}
+
+namespace {
+// Reads the big-endian integers and length-prefixed strings of a listing batch
+class batch_reader final
+{
+public:
+	batch_reader(fz::buffer const& data)
+		: p_(data.get())
+		, end_(data.get() + data.size())
+	{}
+
+	bool get(uint32_t & v)
+	{
+		if (end_ - p_ < 4) {
+			return false;
+		}
+		v = (uint32_t(p_[0]) << 24) | (uint32_t(p_[1]) << 16) | (uint32_t(p_[2]) << 8) | uint32_t(p_[3]);
+		p_ += 4;
+		return true;
+	}
+
+	bool get(uint64_t & v)
+	{
+		uint32_t high, low;
+		if (!get(high) || !get(low)) {
+			return false;
+		}
+		v = (uint64_t(high) << 32) | low;
+		return true;
+	}
+
+	bool get_string(char const*& s, size_t & len)
+	{
+		uint32_t l;
+		if (!get(l) || static_cast<size_t>(end_ - p_) < l) {
+			return false;
+		}
+		s = reinterpret_cast<char const*>(p_);
+		len = l;
+		p_ += l;
+		return true;
+	}
+
+	bool done() const { return p_ == end_; }
+
+private:
+	unsigned char const* p_;
+	unsigned char const* end_;
+};
+}
+
+bool CSftpInputThread::ParseListEntries(std::wstring const& tag, fz::buffer const& data, std::vector<sftp_list_entry> & entries)
+{
+	batch_reader reader(data);
+
+	// Each entry takes at least 40 bytes
+	uint32_t count{};
+	if (!reader.get(count) || count > data.size() / 40) {
+		return false;
+	}
+	entries.resize(count);
+
+	for (auto & entry : entries) {
+		char const* name;
+		size_t name_len;
+		char const* longname;
+		size_t longname_len;
+		if (!reader.get(entry.flags) || !reader.get(entry.size) || !reader.get(entry.uid) || !reader.get(entry.gid) ||
+			!reader.get(entry.permissions) || !reader.get(entry.mtime) ||
+			!reader.get_string(name, name_len) || !reader.get_string(longname, longname_len))
+		{
+			return false;
+		}
+
+		entry.name = owner_.ConvToLocal(tag, name, name_len);
+		entry.longname = owner_.ConvToLocal(tag, longname, longname_len);
+	}
+
+	return reader.done();
+}
+
 bool CSftpInputThread::readFromProcess(std::wstring & error, bool eof_is_error)
 {
 	if (recv_buffer_.empty()) {
@@ -127,7 +268,7 @@ bool CSftpInputThread::readFromProcess(std::wstring & error, bool eof_is_error)
 	return true;
 }
 
-void CSftpInputThread::processEvent(sftpEvent eventType, std::wstring & error)
+void CSftpInputThread::processEvent(std::wstring const& tag, sftpEvent eventType, std::wstring & error)
 {
 	int lines{};
 	switch (eventType)
@@ -168,18 +309,30 @@ void CSftpInputThread::processEvent(sftpEvent eventType, std::wstring & error)
 		break;
 	case sftpEvent::Listentry:
 		{
-			auto msg = new CSftpListEvent;
-			auto & message = std::get<0>(msg->v_);
-			message.text = ReadLine(error);
-			message.mtime = ReadUInt(error);
-			message.name = ReadLine(error);
+			// A whole batch of entries, see CSftpInputThread::ParseListEntries
+			uint64_t const len = ReadUInt(error);
+			if (!error.empty()) {
+				return;
+			}
+			if (len > 16 * 1024 * 1024) {
+				error = L"Directory listing batch too large";
+				return;
+			}
 
-			if (error.empty()) {
-				owner_.send_event(msg);
+			fz::buffer data;
+			if (!ReadData(data, static_cast<size_t>(len), error)) {
+				return;
 			}
-			else {
+
+			auto msg = new CSftpListEvent;
+			auto & message = std::get<0>(msg->v_);
+			if (!ParseListEntries(tag, data, message.entries)) {
+				error = L"Malformed directory listing batch";
 				delete msg;
+				return;
 			}
+
+			owner_.Dispatch(tag, msg);
 		}
 		return;
 	};
@@ -188,7 +341,7 @@ void CSftpInputThread::processEvent(sftpEvent eventType, std::wstring & error)
 	auto & message = std::get<0>(msg->v_);
 	message.type = eventType;
 	for (int i = 0; i < lines && error.empty(); ++i) {
-		message.text[i] = ReadLine(error);
+		message.text[i] = ReadLine(tag, error);
 	}
 
 	if (!error.empty()) {
@@ -196,7 +349,7 @@ void CSftpInputThread::processEvent(sftpEvent eventType, std::wstring & error)
 		return;
 	}
 
-	owner_.send_event(msg);
+	owner_.Dispatch(tag, msg);
 }
 
 void CSftpInputThread::entry()
@@ -207,6 +360,16 @@ void CSftpInputThread::entry()
 			break;
 		}
 
+		// Events resulting from tagged commands carry the same tag
+		std::wstring tag;
+		if (*recv_buffer_.get() == '#') {
+			recv_buffer_.consume(1);
+			tag = ReadTag(error);
+			if (!error.empty() || !readFromProcess(error, true)) {
+				break;
+			}
+		}
+
 		unsigned char readType = *recv_buffer_.get();
 		recv_buffer_.consume(1);
 
@@ -219,8 +382,8 @@ void CSftpInputThread::entry()
 
 		sftpEvent eventType = static_cast<sftpEvent>(readType);
 
-		processEvent(eventType, error);
+		processEvent(tag, eventType, error);
 	}
 
-	owner_.send_event<CTerminateEvent>(error);
+	owner_.OnTerminate(error);
 }
@@ -1,7 +1,8 @@
 #ifndef FILEZILLA_ENGINE_SFTP_INPUTTHREAD_HEADER
 #define FILEZILLA_ENGINE_SFTP_INPUTTHREAD_HEADER
 
-class CSftpControlSocket;
+class CSftpHelper;
+struct sftp_list_entry;
 
 #include <libfilezilla/buffer.hpp>
 #include <libfilezilla/thread_pool.hpp>
@@ -13,7 +14,7 @@ class process;
 class CSftpInputThread final
 {
 public:
-	CSftpInputThread(CSftpControlSocket & owner, fz::process& proc);
+	CSftpInputThread(CSftpHelper & owner, fz::process& proc);
 	~CSftpInputThread();
 
 	bool spawn(fz::thread_pool & pool);
@@ -21,15 +22,18 @@ public:
 protected:
 
 	bool readFromProcess(std::wstring & error, bool eof_is_error);
-	std::wstring ReadLine(std::wstring & error);
+	std::wstring ReadLine(std::wstring const& tag, std::wstring & error);
 	uint64_t ReadUInt(std::wstring & error);
+	std::wstring ReadTag(std::wstring & error);
+	bool ReadData(fz::buffer & out, size_t len, std::wstring & error);
+	bool ParseListEntries(std::wstring const& tag, fz::buffer const& data, std::vector<sftp_list_entry> & entries);
 
 	void entry();
 
-	void processEvent(sftpEvent eventType, std::wstring & error);
+	void processEvent(std::wstring const& tag, sftpEvent eventType, std::wstring & error);
 
 	fz::process& process_;
-	CSftpControlSocket& owner_;
+	CSftpHelper& owner_;
 
 	fz::async_task thread_;
 
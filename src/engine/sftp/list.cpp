@@ -1,6 +1,7 @@
 #include <filezilla.h>
 
 #include "../directorycache.h"
+#include "event.h"
 #include "list.h"
 
 #include <assert.h>
@@ -117,31 +118,157 @@ int CSftpListOpData::SubcommandResult(int prevResult, COpData const&)
 	return FZ_REPLY_CONTINUE;
 }
 
-int CSftpListOpData::ParseEntry(std::wstring && entry, uint64_t mtime, std::wstring && name)
+void format_permissions(uint32_t mode, std::wstring & out)
 {
-	if (opState != list_list) {
-		controlSocket_.log_raw(logmsg::listing, entry);
-		log(logmsg::debug_warning, L"CSftpListOpData::ParseEntry called at improper time: %d", opState);
-		return FZ_REPLY_INTERNALERROR;
+	out.clear();
+
+	switch (mode & 0170000) {
+	case 0040000:
+		out += 'd';
+		break;
+	case 0120000:
+		out += 'l';
+		break;
+	case 0020000:
+		out += 'c';
+		break;
+	case 0060000:
+		out += 'b';
+		break;
+	case 0010000:
+		out += 'p';
+		break;
+	case 0140000:
+		out += 's';
+		break;
+	default:
+		out += '-';
+		break;
 	}
 
-	if (entry.size() > 65536 || name.size() > 65536) {
-		log(fz::logmsg::error, _("Received too long response line from server, closing connection."));
-		return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
+	auto const add = [&](uint32_t bits, uint32_t special, wchar_t set, wchar_t unset) {
+		out += (bits & 4) ? 'r' : '-';
+		out += (bits & 2) ? 'w' : '-';
+		if (special) {
+			out += (bits & 1) ? set : unset;
+		}
+		else {
+			out += (bits & 1) ? 'x' : '-';
+		}
+	};
+	add(mode >> 6, mode & 04000, 's', 'S');
+	add(mode >> 3, mode & 02000, 's', 'S');
+	add(mode, mode & 01000, 't', 'T');
+}
+
+namespace {
+// Servers format the longname like ls -l does:
+// "-rw-r--r--    1 owner    group        1234 Jan  1 00:00 name"
+// Owner and group are only available from there. Returns false if the
+// longname does not look like that.
+bool extract_owner_group(std::wstring_view longname, uint64_t size, std::wstring & out)
+{
+	std::wstring_view tokens[5];
+	size_t pos = 0;
+	for (auto & token : tokens) {
+		pos = longname.find_first_not_of(' ', pos);
+		if (pos == std::wstring_view::npos) {
+			return false;
+		}
+		size_t end = longname.find(' ', pos);
+		if (end == std::wstring_view::npos) {
+			return false;
+		}
+		token = longname.substr(pos, end - pos);
+		pos = end;
 	}
 
+	if (tokens[0].size() < 10 || tokens[1].find_first_not_of(L"0123456789") != std::wstring_view::npos) {
+		return false;
+	}
+	uint64_t value{};
+	for (auto const c : tokens[4]) {
+		if (c < '0' || c > '9') {
+			return false;
+		}
+		value = value * 10 + (c - '0');
+	}
+	if (value != size) {
+		return false;
+	}
+
+	out.assign(tokens[2]);
+	out += ' ';
+	out.append(tokens[3]);
+	return true;
+}
+}
+
+int CSftpListOpData::ParseEntries(std::vector<sftp_list_entry> && entries)
+{
+	if (opState != list_list) {
+		log(logmsg::debug_warning, L"CSftpListOpData::ParseEntries called at improper time: %d", opState);
+		return FZ_REPLY_INTERNALERROR;
+	}
 
 	if (!listing_parser_) {
-		controlSocket_.log_raw(logmsg::listing, entry);
 		log(logmsg::debug_warning, L"listing_parser_ is null");
 		return FZ_REPLY_INTERNALERROR;
 	}
 
-	fz::datetime time;
-	if (mtime) {
-		time = fz::datetime(static_cast<time_t>(mtime), fz::datetime::seconds);
+	for (auto & entry : entries) {
+		if (entry.longname.size() > 65536 || entry.name.size() > 65536) {
+			log(fz::logmsg::error, _("Received too long response line from server, closing connection."));
+			return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
+		}
+
+		fz::datetime time;
+		if (entry.flags & sftp_attr_acmodtime) {
+			time = fz::datetime(static_cast<time_t>(entry.mtime), fz::datetime::seconds);
+		}
+
+		uint32_t const needed = sftp_attr_size | sftp_attr_permissions;
+		if ((entry.flags & needed) != needed || entry.name.empty()) {
+			// Not enough structured data, fall back to parsing the longname
+			listing_parser_->AddLine(std::move(entry.longname), std::move(entry.name), time);
+			continue;
+		}
+
+		controlSocket_.log_raw(logmsg::listing, entry.longname);
+
+		CDirentry direntry;
+		direntry.name = std::move(entry.name);
+		direntry.size = static_cast<int64_t>(entry.size);
+		direntry.time = time;
+		direntry.flags = 0;
+
+		uint32_t const type = entry.permissions & 0170000;
+		if (type == 0040000) {
+			direntry.flags |= CDirentry::flag_dir;
+		}
+		else if (type == 0120000) {
+			direntry.flags |= CDirentry::flag_dir | CDirentry::flag_link;
+
+			size_t const pos = entry.longname.rfind(L" -> ");
+			if (pos != std::wstring::npos && pos >= direntry.name.size() &&
+				!entry.longname.compare(pos - direntry.name.size(), direntry.name.size(), direntry.name))
+			{
+				direntry.target = fz::sparse_optional<std::wstring>(entry.longname.substr(pos + 4));
+			}
+		}
+
+		format_permissions(entry.permissions, permissions_);
+		if (!extract_owner_group(entry.longname, entry.size, ownerGroup_)) {
+			if (entry.flags & sftp_attr_uidgid) {
+				ownerGroup_ = fz::sprintf(L"%u %u", entry.uid, entry.gid);
+			}
+			else {
+				ownerGroup_.clear();
+			}
+		}
+
+		listing_parser_->AddEntry(std::move(direntry), permissions_, ownerGroup_);
 	}
-	listing_parser_->AddLine(std::move(entry), std::move(name), time);
 
 	return FZ_REPLY_WOULDBLOCK;
 }
@@ -4,6 +4,11 @@
 #include "directorylistingparser.h"
 #include "sftpcontrolsocket.h"
 
+struct sftp_list_entry;
+
+// Formats SFTP permission bits like ls -l does
+void format_permissions(uint32_t mode, std::wstring & out);
+
 class CSftpListOpData final : public COpData, public CSftpOpData
 {
 public:
@@ -19,11 +24,15 @@ public:
 	virtual int ParseResponse() override;
 	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
 
-	int ParseEntry(std::wstring && entry, uint64_t mtime, std::wstring && name);
+	int ParseEntries(std::vector<sftp_list_entry> && entries);
 
 private:
 	std::unique_ptr<CDirectoryListingParser> listing_parser_;
 
+	// Scratch space reused for each entry
+	std::wstring permissions_;
+	std::wstring ownerGroup_;
+
 	CServerPath path_;
 	std::wstring subDir_; 
 	
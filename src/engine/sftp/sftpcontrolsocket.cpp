@@ -9,6 +9,7 @@
 #include "engineprivate.h"
 #include "event.h"
 #include "filetransfer.h"
+#include "helper.h"
 #include "list.h"
 #include "input_thread.h"
 #include "mkd.h"
@@ -18,9 +19,9 @@
 #include "rmd.h"
 #include "servercapabilities.h"
 #include "sftpcontrolsocket.h"
+#include "stat.h"
 
 #include <libfilezilla/event_loop.hpp>
-#include <libfilezilla/process.hpp>
 
 #include <algorithm>
 
@@ -61,7 +62,7 @@ void CSftpControlSocket::OnSftpEvent(sftp_message const& message)
 		return;
 	}
 
-	if (!input_thread_) {
+	if (!helper_) {
 		return;
 	}
 
@@ -263,19 +264,24 @@ void CSftpControlSocket::OnSftpListEvent(sftp_list_message const& message)
 		return;
 	}
 
-	if (!input_thread_) {
+	if (!helper_) {
 		return;
 	}
 
-	if (operations_.empty() || operations_.back()->opId != Command::list) {
+	int res;
+	if (!operations_.empty() && operations_.back()->opId == Command::list) {
+		res = static_cast<CSftpListOpData&>(*operations_.back()).ParseEntries(std::move(message.entries));
+	}
+	else if (!operations_.empty() && operations_.back()->opId == PrivCommand::stat) {
+		res = static_cast<CSftpStatOpData&>(*operations_.back()).ParseEntries(std::move(message.entries));
+	}
+	else {
 		log(logmsg::debug_warning, L"sftpEvent::Listentry outside list operation, ignoring.");
 		return;
 	}
-	else {
-		int res = static_cast<CSftpListOpData&>(*operations_.back()).ParseEntry(std::move(message.text), message.mtime, std::move(message.name));
-		if (res != FZ_REPLY_WOULDBLOCK) {
-			ResetOperation(res);
-		}
+
+	if (res != FZ_REPLY_WOULDBLOCK) {
+		ResetOperation(res);
 	}
 }
 
@@ -287,11 +293,31 @@ void CSftpControlSocket::OnTerminate(std::wstring const& error)
 	else {
 		log_raw(logmsg::debug_info, L"CSftpControlSocket::OnTerminate without error");
 	}
-	if (process_) {
+	if (helper_) {
 		DoClose();
 	}
 }
 
+void CSftpControlSocket::OnReady(bool success)
+{
+	if (operations_.empty() || operations_.back()->opId != Command::connect) {
+		return;
+	}
+
+	auto & data = static_cast<CSftpConnectOpData &>(*operations_.back());
+	if (data.opState != connect_wait) {
+		return;
+	}
+
+	if (!success) {
+		log(logmsg::error, _("Login on the shared SFTP session failed."));
+		DoClose(FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED);
+		return;
+	}
+
+	ResetOperation(data.Attached());
+}
+
 int CSftpControlSocket::SendCommand(std::wstring const& cmd, std::wstring const& show)
 {
 	SetWait(true);
@@ -323,11 +349,11 @@ int CSftpControlSocket::AddToStream(std::wstring const& cmd)
 
 int CSftpControlSocket::AddToStream(std::string const& cmd)
 {
-	if (!process_) {
+	if (!helper_) {
 		return FZ_REPLY_INTERNALERROR;
 	}
 
-	if (!process_->write(cmd)) {
+	if (!helper_->Send(tagged_ ? ("#" + fz::to_utf8(tag_) + " " + cmd) : cmd)) {
 		return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
 	}
 
@@ -483,18 +509,22 @@ int CSftpControlSocket::DoClose(int nErrorCode)
 {
 	remove_bucket();
 
-	if (process_) {
-		process_->kill();
-	}
-
-	if (input_thread_) {
-		input_thread_.reset();
+	if (helper_) {
+		if (tagged_) {
+			// Aborts our transfers if the process is shared, otherwise it
+			// gets killed once released below.
+			helper_->Send("#" + fz::to_utf8(tag_) + " detach\n");
+		}
+		helper_->Detach(tag_);
+		helper_.reset();
 
 		auto threadEventsFilter = [&](fz::event_loop::Events::value_type const& ev) -> bool {
 			if (ev.first != this) {
 				return false;
 			}
-			else if (ev.second->derived_type() == CSftpEvent::type() || ev.second->derived_type() == CTerminateEvent::type()) {
+			else if (ev.second->derived_type() == CSftpEvent::type() || ev.second->derived_type() == CSftpListEvent::type() ||
+				ev.second->derived_type() == CTerminateEvent::type() || ev.second->derived_type() == CSftpReadyEvent::type())
+			{
 				return true;
 			}
 			return false;
@@ -502,7 +532,8 @@ int CSftpControlSocket::DoClose(int nErrorCode)
 
 		event_loop_.filter_events(threadEventsFilter);
 	}
-	process_.reset();
+	tag_.clear();
+	tagged_ = false;
 
 	m_sftpEncryptionDetails = CSftpEncryptionNotification();
 
@@ -556,6 +587,11 @@ void CSftpControlSocket::Chmod(CChmodCommand const& command)
 	Push(std::make_unique<CSftpChmodOpData>(*this, command));
 }
 
+void CSftpControlSocket::Stat(CServerPath const& path, std::wstring const& file, CDirentry & entry)
+{
+	Push(std::make_unique<CSftpStatOpData>(*this, path, file, entry));
+}
+
 void CSftpControlSocket::Rename(CRenameCommand const& command)
 {
 	Push(std::make_unique<CSftpRenameOpData>(*this, command));
@@ -568,13 +604,14 @@ void CSftpControlSocket::wakeup(fz::direction::type const d)
 
 void CSftpControlSocket::OnQuotaRequest(fz::direction::type const d)
 {
-	if (!process_) {
+	if (!helper_) {
 		return;
 	}
 
+	// Quota replies are never tagged
 	size_t bytes = available(d);
 	if (bytes == fz::rate::unlimited) {
-		AddToStream(fz::sprintf("-%d-\n", d));
+		helper_->Send(fz::sprintf("-%d-\n", d));
 	}
 	else if (bytes > 0) {
 		int b;
@@ -584,17 +621,18 @@ void CSftpControlSocket::OnQuotaRequest(fz::direction::type const d)
 		else {
 			b = static_cast<int>(bytes);
 		}
-		AddToStream(fz::sprintf("-%d%d,%d\n", d, b, engine_.GetOptions().GetOptionVal(OPTION_SPEEDLIMIT_INBOUND + static_cast<int>(d))));
+		helper_->Send(fz::sprintf("-%d%d,%d\n", d, b, engine_.GetOptions().GetOptionVal(OPTION_SPEEDLIMIT_INBOUND + static_cast<int>(d))));
 		consume(d, static_cast<size_t>(bytes));
 	}
 }
 
 void CSftpControlSocket::operator()(fz::event_base const& ev)
 {
-	if (fz::dispatch<CSftpEvent, CSftpListEvent, CTerminateEvent, SftpRateAvailableEvent>(ev, this,
+	if (fz::dispatch<CSftpEvent, CSftpListEvent, CTerminateEvent, CSftpReadyEvent, SftpRateAvailableEvent>(ev, this,
 		&CSftpControlSocket::OnSftpEvent,
 		&CSftpControlSocket::OnSftpListEvent,
 		&CSftpControlSocket::OnTerminate,
+		&CSftpControlSocket::OnReady,
 		&CSftpControlSocket::OnQuotaRequest)) {
 		return;
 	}
@@ -606,7 +644,7 @@ void CSftpControlSocket::Push(std::unique_ptr<COpData> && pNewOpData)
 {
 	CControlSocket::Push(std::move(pNewOpData));
 	if (operations_.size() == 1 && operations_.back()->opId != Command::connect) {
-		if (!process_) {
+		if (!helper_) {
 			std::unique_ptr<COpData> connOp = std::make_unique<CSftpConnectOpData>(*this);
 			connOp->topLevelOperation_ = true;
 			CControlSocket::Push(std::move(connOp));
@@ -5,11 +5,7 @@
 
 #include <libfilezilla/rate_limiter.hpp>
 
-namespace fz {
-class process;
-}
-
-class CSftpInputThread;
+class CSftpHelper;
 struct sftp_message;
 struct sftp_list_message;
 
@@ -30,9 +26,11 @@ public:
 	virtual void Mkdir(CServerPath const& path) override;
 	virtual void Rename(CRenameCommand const& command) override;
 	virtual void Chmod(CChmodCommand const& command) override;
+	virtual void Stat(CServerPath const& path, std::wstring const& file, CDirentry & entry) override;
+	virtual int GetStatCost() const override { return 1; }
 	virtual void Cancel() override;
 
-	virtual bool Connected() const override { return input_thread_.operator bool(); }
+	virtual bool Connected() const override { return helper_.operator bool(); }
 
 	virtual bool SetAsyncRequestReply(CAsyncRequestNotification *pNotification) override;
 
@@ -54,13 +52,17 @@ protected:
 	virtual void wakeup(fz::direction::type const d) override;
 	void OnQuotaRequest(fz::direction::type const d);
 
-	std::unique_ptr<fz::process> process_;
-	std::unique_ptr<CSftpInputThread> input_thread_;
+	// The fzsftp process, possibly shared with other control sockets.
+	// Commands are prefixed with the tag once logged in.
+	std::shared_ptr<CSftpHelper> helper_;
+	std::wstring tag_;
+	bool tagged_{};
 
 	virtual void operator()(fz::event_base const& ev) override;
 	void OnSftpEvent(sftp_message const& message);
 	void OnSftpListEvent(sftp_list_message const& message);
 	void OnTerminate(std::wstring const& error);
+	void OnReady(bool success);
 
 	std::wstring m_requestPreamble;
 	std::wstring m_requestInstruction;
@@ -80,6 +82,7 @@ protected:
 	friend class CSftpMkdirOpData;
 	friend class CSftpRemoveDirOpData;
 	friend class CSftpRenameOpData;
+	friend class CSftpStatOpData;
 };
 
 typedef CProtocolOpData<CSftpControlSocket> CSftpOpData;
@@ -0,0 +1,82 @@
+#include <filezilla.h>
+
+#include "directorylistingparser.h"
+#include "event.h"
+#include "list.h"
+#include "stat.h"
+
+int CSftpStatOpData::Send()
+{
+	if (path_.empty() || file_.empty()) {
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	entry_.clear();
+	found_ = false;
+
+	return controlSocket_.SendCommand(L"stat " + controlSocket_.QuoteFilename(path_.FormatFilename(file_)));
+}
+
+int CSftpStatOpData::ParseResponse()
+{
+	if (controlSocket_.result_ != FZ_REPLY_OK) {
+		return controlSocket_.result_;
+	}
+
+	return found_ ? FZ_REPLY_OK : FZ_REPLY_ERROR_NOTFOUND;
+}
+
+int CSftpStatOpData::ParseEntries(std::vector<sftp_list_entry> && entries)
+{
+	if (entries.size() != 1 || found_) {
+		log(logmsg::debug_warning, L"Unexpected number of entries in stat reply");
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	auto const& entry = entries.front();
+
+	CDirentry direntry;
+	direntry.name = file_;
+	direntry.size = (entry.flags & sftp_attr_size) ? static_cast<int64_t>(entry.size) : -1;
+	if (entry.flags & sftp_attr_acmodtime) {
+		direntry.time = fz::datetime(static_cast<time_t>(entry.mtime), fz::datetime::seconds);
+	}
+	direntry.flags = 0;
+
+	std::wstring permissions;
+	if (entry.flags & sftp_attr_permissions) {
+		uint32_t const type = entry.permissions & 0170000;
+		if (type == 0040000) {
+			direntry.flags |= CDirentry::flag_dir;
+		}
+		else if (type == 0120000) {
+			// Same as in listings, the link might point to a directory
+			direntry.flags |= CDirentry::flag_dir | CDirentry::flag_link;
+
+			// fzsftp passes the target as "<path> -> <target>"
+			std::wstring const prefix = path_.FormatFilename(file_) + L" -> ";
+			if (entry.longname.size() > prefix.size() && !entry.longname.compare(0, prefix.size(), prefix)) {
+				direntry.target = fz::sparse_optional<std::wstring>(entry.longname.substr(prefix.size()));
+			}
+		}
+		format_permissions(entry.permissions, permissions);
+	}
+
+	std::wstring ownerGroup;
+	if (entry.flags & sftp_attr_uidgid) {
+		ownerGroup = fz::sprintf(L"%u %u", entry.uid, entry.gid);
+	}
+
+	// Let the parser apply the timezone offset and share the strings
+	CDirectoryListingParser parser(&controlSocket_, currentServer_);
+	parser.AddEntry(std::move(direntry), permissions, ownerGroup);
+	CDirectoryListing const listing = parser.Parse(path_);
+	if (listing.size() != 1) {
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	entry_ = listing[0];
+	found_ = true;
+
+	return FZ_REPLY_WOULDBLOCK;
+}
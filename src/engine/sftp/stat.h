@@ -0,0 +1,33 @@
+#ifndef FILEZILLA_ENGINE_SFTP_STAT_HEADER
+#define FILEZILLA_ENGINE_SFTP_STAT_HEADER
+
+#include "sftpcontrolsocket.h"
+
+struct sftp_list_entry;
+
+class CSftpStatOpData final : public COpData, public CSftpOpData
+{
+public:
+	CSftpStatOpData(CSftpControlSocket & controlSocket, CServerPath const& path, std::wstring const& file, CDirentry & entry)
+		: COpData(PrivCommand::stat, L"CSftpStatOpData")
+		, CSftpOpData(controlSocket)
+		, path_(path)
+		, file_(file)
+		, entry_(entry)
+	{}
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+
+	// The attributes arrive as a listing with a single entry
+	int ParseEntries(std::vector<sftp_list_entry> && entries);
+
+private:
+	CServerPath const path_;
+	std::wstring const file_;
+
+	CDirentry & entry_;
+	bool found_{};
+};
+
+#endif
@@ -2,10 +2,9 @@
 
 #include "connect.h"
 #include "event.h"
-#include "input_thread.h"
+#include "helper.h"
 #include "proxy.h"
 
-#include <libfilezilla/process.hpp>
 #include <libfilezilla/uri.hpp>
 
 int CStorjConnectOpData::Send()
@@ -22,23 +21,31 @@ int CStorjConnectOpData::Send()
 			}
 			log(logmsg::debug_verbose, L"Going to execute %s", executable);
 
-			std::vector<fz::native_string> args;
-			controlSocket_.process_ = std::make_unique<fz::process>();
-			if (!controlSocket_.process_->spawn(executable, args)) {
+			bool spawned{};
+			controlSocket_.helper_ = CStorjHelper::Acquire(engine_.GetThreadPool(), executable, currentServer_,
+				currentServer_.GetUser(), controlSocket_.credentials_.GetPass(), controlSocket_, controlSocket_.tag_, spawned);
+			if (!controlSocket_.helper_) {
 				log(logmsg::debug_warning, L"Could not create process");
 				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
 			}
 
-			controlSocket_.input_thread_ = std::make_unique<CStorjInputThread>(controlSocket_, *controlSocket_.process_);
-			if (!controlSocket_.input_thread_->spawn(engine_.GetThreadPool())) {
-				log(logmsg::debug_warning, L"Thread creation failed");
-				controlSocket_.input_thread_.reset();
-				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
+			if (!spawned) {
+				// Already running on behalf of another connection
+				log(logmsg::debug_info, L"Reusing running fzstorj process");
+				opState = connect_timeout;
+				return FZ_REPLY_CONTINUE;
 			}
 		}
 		return FZ_REPLY_WOULDBLOCK;
 	case connect_timeout:
 		return controlSocket_.SendCommand(fz::sprintf(L"timeout %d", engine_.GetOptions().GetOptionVal(OPTION_TIMEOUT)));
+	case connect_transfer_settings:
+		return controlSocket_.SendCommand(fz::sprintf(L"transfer-settings %d %d %d", engine_.GetOptions().GetOptionVal(OPTION_STORJ_BUFFERSIZE),
+			engine_.GetOptions().GetOptionVal(OPTION_PREALLOCATE_SPACE) ? 1 : 0, engine_.GetOptions().GetOptionVal(OPTION_STORJ_PARALLEL_DOWNLOADS)));
+	case connect_workers:
+		// One worker for each connection sharing the process so that a long
+		// transfer never holds up the commands of another connection.
+		return controlSocket_.SendCommand(fz::sprintf(L"workers %d", controlSocket_.helper_->ClientCount()));
 	case connect_proxy:
 		{
 			fz::uri proxy_uri;
@@ -125,6 +132,12 @@ int CStorjConnectOpData::ParseResponse()
 		opState = connect_timeout;
 		break;
 	case connect_timeout:
+		opState = connect_transfer_settings;
+		break;
+	case connect_transfer_settings:
+		opState = connect_workers;
+		break;
+	case connect_workers:
 		opState = connect_host;
 		break;
 	case connect_proxy:
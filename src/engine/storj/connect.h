@@ -7,6 +7,8 @@ enum connectStates
 {
 	connect_init,
 	connect_timeout,
+	connect_transfer_settings,
+	connect_workers,
 	connect_proxy,
 	connect_host,
 	connect_user,
@@ -71,8 +71,13 @@ int CStorjFileTransferOpData::Send()
 			controlSocket_.CreateLocalDir(localFile_);
 		}
 
+		// Downloads get resumed by only requesting the rest of the object
+		int64_t startOffset{};
 		if (download_) {
-			engine_.transfer_status_.Init(remoteFileSize_, 0, false);
+			if (resume_ && localFileSize_ > 0) {
+				startOffset = localFileSize_;
+			}
+			engine_.transfer_status_.Init(remoteFileSize_, startOffset, false);
 		}
 		else {
 			engine_.transfer_status_.Init(localFileSize_, 0, false);
@@ -88,7 +93,11 @@ int CStorjFileTransferOpData::Send()
 			size_t pos = objectName.find_first_of(bucket_);
 			objectName = objectName.substr(pos + bucket_.size() + 1, objectName.size());
 
-			return controlSocket_.SendCommand(L"get " + bucket_ + L" " + objectName + L" " + controlSocket_.QuoteFilename(localFile_));
+			std::wstring cmd = L"get " + bucket_ + L" " + objectName + L" " + controlSocket_.QuoteFilename(localFile_);
+			if (startOffset) {
+				cmd += fz::sprintf(L" %d", startOffset);
+			}
+			return controlSocket_.SendCommand(cmd);
 		}
 		else {
 			std::wstring path = remotePath_.GetPath();
@@ -161,3 +170,8 @@ int CStorjFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 	return FZ_REPLY_INTERNALERROR;
 }
 
+void CStorjFileTransferOpData::SetRemoteEntry(std::wstring const& size, std::wstring && id)
+{
+	remoteEntrySize_ = fz::to_integral<int64_t>(size, -1);
+	remoteEntryId_ = std::move(id);
+}
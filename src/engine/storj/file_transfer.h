@@ -16,9 +16,17 @@ public:
 	virtual int ParseResponse() override;
 	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
 
+	void SetRemoteEntry(std::wstring const& size, std::wstring && id);
+
 private:
 	std::wstring bucket_;
 	std::wstring fileId_;
+
+	// Entry of the uploaded object as reported by fzstorj
+	int64_t remoteEntrySize_{-1};
+	std::wstring remoteEntryId_;
+
+	friend class CStorjControlSocket;
 };
 
 #endif
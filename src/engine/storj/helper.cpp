@@ -0,0 +1,164 @@
+#include <filezilla.h>
+
+#include "event.h"
+#include "helper.h"
+#include "input_thread.h"
+
+#include <libfilezilla/process.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+std::map<std::wstring, std::weak_ptr<CStorjHelper>> CStorjHelper::helpers_;
+fz::mutex CStorjHelper::helpers_mutex_(false);
+
+CStorjHelper::~CStorjHelper()
+{
+	if (process_) {
+		process_->kill();
+	}
+	input_thread_.reset();
+	process_.reset();
+}
+
+std::shared_ptr<CStorjHelper> CStorjHelper::Acquire(fz::thread_pool & pool, fz::native_string const& executable, CServer const& server, std::wstring const& user, std::wstring const& pass,
+	fz::event_handler & handler, std::wstring & tag, bool & spawned)
+{
+	spawned = false;
+
+	std::wstring const key = server.Format(ServerFormat::with_optional_port) + L"\n" + user + L"\n" + pass;
+
+	fz::scoped_lock l(helpers_mutex_);
+
+	for (auto it = helpers_.begin(); it != helpers_.end(); ) {
+		if (it->second.expired()) {
+			it = helpers_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	auto it = helpers_.find(key);
+	if (it != helpers_.end()) {
+		auto helper = it->second.lock();
+		if (helper) {
+			bool terminated;
+			{
+				fz::scoped_lock hl(helper->mutex_);
+				terminated = helper->terminated_;
+			}
+			if (!terminated) {
+				tag = helper->Attach(handler);
+				return helper;
+			}
+		}
+	}
+
+	// Attach before spawning so that the initial reply has a recipient.
+	auto helper = std::make_shared<CStorjHelper>();
+	tag = helper->Attach(handler);
+	if (!helper->Spawn(pool, executable)) {
+		helper->Detach(tag);
+		tag.clear();
+		return nullptr;
+	}
+	helpers_[key] = helper;
+	spawned = true;
+
+	return helper;
+}
+
+bool CStorjHelper::Spawn(fz::thread_pool & pool, fz::native_string const& executable)
+{
+	std::vector<fz::native_string> args;
+	process_ = std::make_unique<fz::process>();
+	if (!process_->spawn(executable, args)) {
+		process_.reset();
+		return false;
+	}
+
+	input_thread_ = std::make_unique<CStorjInputThread>(*this, *process_);
+	if (!input_thread_->spawn(pool)) {
+		input_thread_.reset();
+		process_->kill();
+		process_.reset();
+		return false;
+	}
+
+	return true;
+}
+
+std::wstring CStorjHelper::Attach(fz::event_handler & handler)
+{
+	fz::scoped_lock l(mutex_);
+
+	std::wstring const tag = fz::to_wstring(++next_tag_);
+	clients_[tag] = &handler;
+	if (next_tag_ == 1) {
+		default_client_ = &handler;
+	}
+
+	return tag;
+}
+
+void CStorjHelper::Detach(std::wstring const& tag)
+{
+	fz::scoped_lock l(mutex_);
+
+	auto it = clients_.find(tag);
+	if (it != clients_.end()) {
+		if (default_client_ == it->second) {
+			default_client_ = nullptr;
+		}
+		clients_.erase(it);
+	}
+}
+
+size_t CStorjHelper::ClientCount()
+{
+	fz::scoped_lock l(mutex_);
+	return clients_.size();
+}
+
+bool CStorjHelper::Send(std::string const& str)
+{
+	fz::scoped_lock l(mutex_);
+
+	if (!process_ || terminated_) {
+		return false;
+	}
+
+	return process_->write(str);
+}
+
+void CStorjHelper::Dispatch(std::wstring const& tag, fz::event_base * ev)
+{
+	fz::scoped_lock l(mutex_);
+
+	fz::event_handler * handler{};
+	if (tag.empty()) {
+		handler = default_client_;
+	}
+	else {
+		auto it = clients_.find(tag);
+		if (it != clients_.end()) {
+			handler = it->second;
+		}
+	}
+
+	if (handler) {
+		handler->send_event(ev);
+	}
+	else {
+		delete ev;
+	}
+}
+
+void CStorjHelper::OnTerminate(std::wstring const& error)
+{
+	fz::scoped_lock l(mutex_);
+
+	terminated_ = true;
+	for (auto & client : clients_) {
+		client.second->send_event<StorjTerminateEvent>(error);
+	}
+}
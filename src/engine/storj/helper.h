@@ -0,0 +1,69 @@
+#ifndef FILEZILLA_ENGINE_STORJ_HELPER_HEADER
+#define FILEZILLA_ENGINE_STORJ_HELPER_HEADER
+
+#include <libfilezilla/event_handler.hpp>
+#include <libfilezilla/mutex.hpp>
+
+#include <map>
+#include <memory>
+
+namespace fz {
+class process;
+class thread_pool;
+}
+
+class CStorjInputThread;
+class CServer;
+
+// A running fzstorj process. It is shared by all Storj control sockets
+// that connect to the same server with the same credentials so that they
+// share the opened project. Each attached control socket gets a tag which
+// is prefixed to its commands, fzstorj runs tagged commands concurrently
+// and prefixes all resulting events with the tag.
+class CStorjHelper final
+{
+public:
+	CStorjHelper() = default;
+	~CStorjHelper();
+
+	CStorjHelper(CStorjHelper const&) = delete;
+	CStorjHelper& operator=(CStorjHelper const&) = delete;
+
+	// Returns a running helper for the given server and credentials, spawning
+	// the process if needed, with the handler attached under the returned tag.
+	// spawned is set if the handler has to wait for the initial reply of the
+	// process, untagged events go to the handler which spawned the process.
+	static std::shared_ptr<CStorjHelper> Acquire(fz::thread_pool & pool, fz::native_string const& executable, CServer const& server, std::wstring const& user, std::wstring const& pass,
+		fz::event_handler & handler, std::wstring & tag, bool & spawned);
+
+	// After Detach returns, no further events get sent to the handler.
+	void Detach(std::wstring const& tag);
+
+	bool Send(std::string const& str);
+
+	// Number of attached control sockets
+	size_t ClientCount();
+
+	// Called from the input thread
+	void Dispatch(std::wstring const& tag, fz::event_base * ev);
+	void OnTerminate(std::wstring const& error);
+
+private:
+	std::wstring Attach(fz::event_handler & handler);
+	bool Spawn(fz::thread_pool & pool, fz::native_string const& executable);
+
+	std::unique_ptr<fz::process> process_;
+	std::unique_ptr<CStorjInputThread> input_thread_;
+
+	fz::mutex mutex_{false};
+
+	std::map<std::wstring, fz::event_handler*> clients_;
+	fz::event_handler* default_client_{};
+	uint64_t next_tag_{};
+	bool terminated_{};
+
+	static std::map<std::wstring, std::weak_ptr<CStorjHelper>> helpers_;
+	static fz::mutex helpers_mutex_;
+};
+
+#endif
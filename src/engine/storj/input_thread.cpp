@@ -1,12 +1,12 @@
 #include <filezilla.h>
 
 #include "event.h"
+#include "helper.h"
 #include "input_thread.h"
-#include "storjcontrolsocket.h"
 
 #include <libfilezilla/process.hpp>
 
-CStorjInputThread::CStorjInputThread(CStorjControlSocket& owner, fz::process& proc)
+CStorjInputThread::CStorjInputThread(CStorjHelper& owner, fz::process& proc)
 	: process_(proc)
 	, owner_(owner)
 {
@@ -48,9 +48,10 @@ std::wstring CStorjInputThread::ReadLine(std::wstring &error)
 					--len;
 				}
 
-				std::wstring const line = owner_.ConvToLocal(buffer, len);
+				// fzstorj always talks UTF-8, treat anything else as ISO8859-1
+				std::wstring line = fz::to_wstring_from_utf8(buffer, len);
 				if (len && line.empty()) {
-					error = L"Failed to convert reply to local character set.";
+					line.assign(reinterpret_cast<unsigned char const*>(buffer), reinterpret_cast<unsigned char const*>(buffer + len));
 				}
 
 				return line;
@@ -69,6 +70,38 @@ std::wstring CStorjInputThread::ReadLine(std::wstring &error)
 	return std::wstring();
 }
 
+std::wstring CStorjInputThread::ReadTag(std::wstring &error)
+{
+	std::string tag;
+
+	while (true) {
+		if (!readFromProcess(error, true)) {
+			return std::wstring();
+		}
+
+		auto const* p = recv_buffer_.get();
+		size_t i;
+		for (i = 0; i < recv_buffer_.size(); ++i) {
+			unsigned char const c = p[i];
+			if (c == ' ') {
+				recv_buffer_.consume(i + 1);
+				if (tag.empty()) {
+					error = L"Empty tag";
+				}
+				return fz::to_wstring_from_utf8(tag);
+			}
+			if (c == '\n' || tag.size() > 64) {
+				error = L"Malformed tag";
+				return std::wstring();
+			}
+			tag += c;
+		}
+		recv_buffer_.clear();
+	}
+
+	return std::wstring();
+}
+
 bool CStorjInputThread::readFromProcess(std::wstring & error, bool eof_is_error)
 {
 	if (recv_buffer_.empty()) {
@@ -92,7 +125,7 @@ bool CStorjInputThread::readFromProcess(std::wstring & error, bool eof_is_error)
 	return true;
 }
 
-void CStorjInputThread::processEvent(storjEvent eventType, std::wstring &error)
+void CStorjInputThread::processEvent(std::wstring const& tag, storjEvent eventType, std::wstring &error)
 {
 	int lines{};
 	switch (eventType)
@@ -114,6 +147,7 @@ void CStorjInputThread::processEvent(storjEvent eventType, std::wstring &error)
 	case storjEvent::Info:
 	case storjEvent::Status:
 	case storjEvent::Transfer:
+	case storjEvent::ListCursor:
 		lines = 1;
 		break;
 	case storjEvent::Listentry:
@@ -133,7 +167,7 @@ void CStorjInputThread::processEvent(storjEvent eventType, std::wstring &error)
 		return;
 	}
 
-	owner_.send_event(msg);
+	owner_.Dispatch(tag, msg);
 }
 
 void CStorjInputThread::entry()
@@ -144,6 +178,16 @@ void CStorjInputThread::entry()
 			break;
 		}
 
+		// Events of tagged commands are prefixed with #<tag><space>
+		std::wstring tag;
+		if (*recv_buffer_.get() == '#') {
+			recv_buffer_.consume(1);
+			tag = ReadTag(error);
+			if (!error.empty() || !readFromProcess(error, true)) {
+				break;
+			}
+		}
+
 		unsigned char readType = *recv_buffer_.get();
 		recv_buffer_.consume(1);
 
@@ -156,8 +200,8 @@ void CStorjInputThread::entry()
 
 		storjEvent eventType = static_cast<storjEvent>(readType);
 
-		processEvent(eventType, error);
+		processEvent(tag, eventType, error);
 	}
 
-	owner_.send_event<StorjTerminateEvent>(error);
+	owner_.OnTerminate(error);
 }
@@ -1,7 +1,7 @@
 #ifndef FILEZILLA_ENGINE_STORJ_INPUT_THREAD_HEADER
 #define FILEZILLA_ENGINE_STORJ_INPUT_THREAD_HEADER
 
-class CStorjControlSocket;
+class CStorjHelper;
 
 #include <libfilezilla/buffer.hpp>
 #include <libfilezilla/thread_pool.hpp>
@@ -13,7 +13,7 @@ class process;
 class CStorjInputThread final
 {
 public:
-	CStorjInputThread(CStorjControlSocket & owner, fz::process& proc);
+	CStorjInputThread(CStorjHelper & owner, fz::process& proc);
 	~CStorjInputThread();
 
 	bool spawn(fz::thread_pool & pool);
@@ -22,13 +22,14 @@ protected:
 
 	bool readFromProcess(std::wstring & error, bool eof_is_error);
 	std::wstring ReadLine(std::wstring &error);
+	std::wstring ReadTag(std::wstring &error);
 
 	void entry();
 
-	void processEvent(storjEvent eventType, std::wstring & error);
+	void processEvent(std::wstring const& tag, storjEvent eventType, std::wstring & error);
 
 	fz::process& process_;
-	CStorjControlSocket& owner_;
+	CStorjHelper& owner_;
 
 	fz::async_task thread_;
 
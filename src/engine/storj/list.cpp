@@ -66,6 +66,15 @@ int CStorjListOpData::Send()
 				path = controlSocket_.QuoteFilename(path.substr(pos + 1) + L"/");
 			}
 
+			// Continue after the last page, fzstorj sets a new cursor if there are more
+			if (!cursor_.empty()) {
+				if (path.empty()) {
+					path = controlSocket_.QuoteFilename(path);
+				}
+				path += L" " + controlSocket_.QuoteFilename(cursor_);
+				cursor_.clear();
+			}
+
 			return controlSocket_.SendCommand(L"list " + bucket_ + L" " + path);
 		}
 	}
@@ -80,12 +89,57 @@ int CStorjListOpData::ParseResponse()
 		if (controlSocket_.result_ != FZ_REPLY_OK) {
 			return controlSocket_.result_;
 		}
+
+		bool const firstPage = !firstListTime_;
+		if (firstPage) {
+			firstListTime_ = fz::monotonic_clock::now();
+		}
+
 		CDirectoryListing listing;
 		listing.path = path_;
-		listing.m_firstListTime = fz::monotonic_clock::now();
+		listing.m_firstListTime = firstListTime_;
 		listing.Assign(std::move(entries_));
+		entries_.clear();
+		if (!cursor_.empty()) {
+			// Flagged as unsure, the cache does not hand out the partial
+			// listing as valid
+			listing.m_flags |= CDirectoryListing::unsure_unknown;
+		}
+
+		// Each page goes into the cache right away, only the entries of the
+		// current page are held here.
+		auto & cache = engine_.GetDirectoryCache();
+		if (firstPage) {
+			cache.Store(listing, currentServer_);
+		}
+		else if (!cache.Append(listing, currentServer_)) {
+			if (restarted_) {
+				log(logmsg::debug_warning, L"Partial listing got removed from the cache again");
+				return FZ_REPLY_ERROR;
+			}
+
+			// Evicted or replaced by another operation in the meantime
+			log(logmsg::debug_info, L"Partial listing got removed from the cache, starting over");
+			restarted_ = true;
+			firstListTime_ = fz::monotonic_clock();
+			lastNotification_ = fz::monotonic_clock();
+			cursor_.clear();
+			return FZ_REPLY_CONTINUE;
+		}
+
+		if (!cursor_.empty()) {
+			// Show what we have so far after the first page, then at most
+			// once a second as the interface reads the whole listing each time.
+			auto const now = fz::monotonic_clock::now();
+			if (!lastNotification_ || (now - lastNotification_).get_seconds() >= 1) {
+				lastNotification_ = now;
+				controlSocket_.SendDirectoryListingNotification(listing.path, false);
+			}
+
+			log(logmsg::debug_info, L"Listing has more entries, requesting next page after %s", cursor_);
+			return FZ_REPLY_CONTINUE;
+		}
 
-		engine_.GetDirectoryCache().Store(listing, currentServer_);
 		controlSocket_.SendDirectoryListingNotification(listing.path, false);
 
 		currentPath_ = path_;
@@ -20,14 +20,28 @@ public:
 
 	int ParseEntry(std::wstring && name, std::wstring const& size, std::wstring && id, std::wstring const& created);
 
+	// Set if the listing has further pages
+	void SetCursor(std::wstring && cursor) { cursor_ = std::move(cursor); }
+
 	std::wstring GetPathId() const { return pathId_; }
 
 private:
 	CServerPath path_;
 	std::wstring subDir_;
 
+	// Listings come in pages, this only holds the current one. The
+	// previous ones are in the directory cache already.
 	std::vector<fz::shared_value<CDirentry>> entries_;
 
+	fz::monotonic_clock firstListTime_;
+	std::wstring cursor_;
+
+	// Set once the listing had to be started over
+	bool restarted_{};
+
+	// When the partial listing was last shown
+	fz::monotonic_clock lastNotification_;
+
 	fz::monotonic_clock time_before_locking_;
 
 	std::wstring bucket_;
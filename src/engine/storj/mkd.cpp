@@ -52,7 +52,8 @@ int CStorjMkdirOpData::ParseResponse()
 	switch (opState) {
 	case mkd_mkbucket:
 		if (controlSocket_.result_ == FZ_REPLY_OK) {
-			engine_.GetDirectoryCache().UpdateFile(currentServer_, CServerPath(L"/"), path_.GetFirstSegment(), true, CDirectoryCache::dir);
+			// Bucket ids are their names
+			engine_.GetDirectoryCache().UpdateFile(currentServer_, CServerPath(L"/"), path_.GetFirstSegment(), true, CDirectoryCache::dir, -1, L"id:" + path_.GetFirstSegment());
 			controlSocket_.SendDirectoryListingNotification(CServerPath(L"/"), false);
 		}
 
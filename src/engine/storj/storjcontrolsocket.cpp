@@ -3,7 +3,7 @@
 #include "connect.h"
 #include "delete.h"
 #include "event.h"
-#include "input_thread.h"
+#include "helper.h"
 #include "../directorycache.h"
 #include "directorylistingparser.h"
 #include "engineprivate.h"
@@ -19,7 +19,6 @@
 
 #include <libfilezilla/event_loop.hpp>
 #include <libfilezilla/local_filesys.hpp>
-#include <libfilezilla/process.hpp>
 #include <libfilezilla/thread_pool.hpp>
 
 #include <algorithm>
@@ -105,7 +104,7 @@ void CStorjControlSocket::OnStorjEvent(storj_message const& message)
 		return;
 	}
 
-	if (!input_thread_) {
+	if (!helper_) {
 		return;
 	}
 
@@ -141,7 +140,16 @@ void CStorjControlSocket::OnStorjEvent(storj_message const& message)
 		SetActive(CFileZillaEngine::send);
 		break;
 	case storjEvent::Listentry:
-		if (operations_.empty() || operations_.back()->opId != Command::list) {
+		if (!operations_.empty() && operations_.back()->opId == Command::transfer) {
+			// The uploaded object, used to update the directory cache
+			static_cast<CStorjFileTransferOpData&>(*operations_.back()).SetRemoteEntry(message.text[1], std::move(message.text[2]));
+			break;
+		}
+		else if (!operations_.empty() && operations_.back()->opId == Command::mkdir) {
+			// Directory placeholder object, the cache is updated by the operation itself
+			break;
+		}
+		else if (operations_.empty() || operations_.back()->opId != Command::list) {
 			log(logmsg::debug_warning, L"storjEvent::Listentry outside list operation, ignoring.");
 			break;
 		}
@@ -152,6 +160,14 @@ void CStorjControlSocket::OnStorjEvent(storj_message const& message)
 			}
 		}
 		break;
+	case storjEvent::ListCursor:
+		if (operations_.empty() || operations_.back()->opId != Command::list) {
+			log(logmsg::debug_warning, L"storjEvent::ListCursor outside list operation, ignoring.");
+		}
+		else {
+			static_cast<CStorjListOpData&>(*operations_.back()).SetCursor(std::move(message.text[0]));
+		}
+		break;
 	case storjEvent::Transfer:
 		{
 			auto value = fz::to_integral<int64_t>(message.text[0]);
@@ -194,7 +210,7 @@ void CStorjControlSocket::OnTerminate(std::wstring const& error)
 	else {
 		log_raw(logmsg::debug_info, L"CStorjControlSocket::OnTerminate without error");
 	}
-	if (process_) {
+	if (helper_) {
 		DoClose();
 	}
 }
@@ -221,7 +237,7 @@ int CStorjControlSocket::SendCommand(std::wstring const& cmd, std::wstring const
 
 int CStorjControlSocket::AddToStream(std::wstring const& cmd)
 {
-	if (!process_) {
+	if (!helper_) {
 		ResetOperation(FZ_REPLY_INTERNALERROR);
 		return false;
 	}
@@ -232,7 +248,7 @@ int CStorjControlSocket::AddToStream(std::wstring const& cmd)
 		return FZ_REPLY_ERROR;
 	}
 
-	if (!process_->write(str)) {
+	if (!helper_->Send("#" + fz::to_utf8(tag_) + " " + str)) {
 		return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
 	}
 
@@ -311,14 +327,30 @@ int CStorjControlSocket::ResetOperation(int nErrorCode)
 	return CControlSocket::ResetOperation(nErrorCode);
 }
 
-int CStorjControlSocket::DoClose(int nErrorCode)
+void CStorjControlSocket::UpdateCache(COpData const& data, CServerPath const& serverPath, std::wstring const& remoteFile, int64_t fileSize)
 {
-	if (process_) {
-		process_->kill();
+	// After a successful upload, fzstorj reports just the new object. Put it into
+	// the cache with its id so that it can be used without listing the directory again.
+	auto const& transferData = static_cast<CStorjFileTransferOpData const&>(data);
+	if (fileSize < 0 || transferData.remoteEntryId_.empty()) {
+		CControlSocket::UpdateCache(data, serverPath, remoteFile, fileSize);
+		return;
 	}
 
-	if (input_thread_) {
-		input_thread_.reset();
+	bool updated = engine_.GetDirectoryCache().UpdateFile(currentServer_, serverPath, remoteFile, true, CDirectoryCache::file, transferData.remoteEntrySize_, transferData.remoteEntryId_);
+	if (updated) {
+		SendDirectoryListingNotification(serverPath, false);
+	}
+}
+
+int CStorjControlSocket::DoClose(int nErrorCode)
+{
+	if (helper_) {
+		// The helper may be shared, only abort our own command.
+		if (GetCurrentCommandId() != Command::none) {
+			helper_->Send("cancel " + fz::to_utf8(tag_) + "\n");
+		}
+		helper_->Detach(tag_);
 
 		auto threadEventsFilter = [&](fz::event_loop::Events::value_type const& ev) -> bool {
 			if (ev.first != this) {
@@ -331,8 +363,10 @@ int CStorjControlSocket::DoClose(int nErrorCode)
 		};
 
 		event_loop_.filter_events(threadEventsFilter);
+
+		helper_.reset();
+		tag_.clear();
 	}
-	process_.reset();
 	return CControlSocket::DoClose(nErrorCode);
 }
 
@@ -363,7 +397,7 @@ void CStorjControlSocket::Push(std::unique_ptr<COpData> && pNewOpData)
 {
 	CControlSocket::Push(std::move(pNewOpData));
 	if (operations_.size() == 1 && operations_.back()->opId != Command::connect) {
-		if (!process_) {
+		if (!helper_) {
 			std::unique_ptr<COpData> connOp = std::make_unique<CStorjConnectOpData>(*this);
 			connOp->topLevelOperation_ = true;
 			CControlSocket::Push(std::move(connOp));
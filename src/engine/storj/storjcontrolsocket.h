@@ -3,15 +3,11 @@
 
 #include "controlsocket.h"
 
-namespace fz {
-class process;
-}
-
 namespace PrivCommand {
 auto const resolve = Command::private1;
 }
 
-class CStorjInputThread;
+class CStorjHelper;
 
 struct storj_message;
 class CStorjControlSocket final : public CControlSocket
@@ -34,7 +30,7 @@ public:
 	/*virtual void Rename(const CRenameCommand& command) override;*/
 	virtual void Cancel() override;
 
-	virtual bool Connected() const override { return input_thread_.operator bool(); }
+	virtual bool Connected() const override { return helper_.operator bool(); }
 
 	virtual bool SetAsyncRequestReply(CAsyncRequestNotification *pNotification) override;
 
@@ -48,14 +44,17 @@ protected:
 	virtual int DoClose(int nErrorCode = FZ_REPLY_DISCONNECTED) override;
 
 	virtual int ResetOperation(int nErrorCode) override;
+	virtual void UpdateCache(COpData const& data, CServerPath const& serverPath, std::wstring const& remoteFile, int64_t fileSize) override;
 
 	void ProcessReply(int result, std::wstring const& reply);
 
 	int SendCommand(std::wstring const& cmd, std::wstring const& show = std::wstring());
 	int AddToStream(std::wstring const& cmd);
 
-	std::unique_ptr<fz::process> process_;
-	std::unique_ptr<CStorjInputThread> input_thread_;
+	// Possibly shared with other control sockets, our commands and events
+	// are told apart by the tag.
+	std::shared_ptr<CStorjHelper> helper_;
+	std::wstring tag_;
 
 	virtual void operator()(fz::event_base const& ev) override;
 	void OnStorjEvent(storj_message const& message);
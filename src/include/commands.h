@@ -174,6 +174,15 @@ public:
 	public:
 		bool binary{true};
 		bool fsync{};
+
+		// Downloads only: If segmentOffset is not negative, only the
+		// segmentLength bytes starting at that offset get transferred into
+		// the same range of the local file, which has to exist already. The
+		// local file is neither truncated nor checked for existence.
+		int64_t segmentOffset{-1};
+		int64_t segmentLength{-1};
+
+		bool segmented() const { return segmentOffset >= 0; }
 	};
 
 	// For uploads, set download to false.
@@ -7,6 +7,7 @@
 #include <libfilezilla/shared.hpp>
 #include <libfilezilla/time.hpp>
 
+#include <string_view>
 #include <unordered_map>
 
 class CDirentry
@@ -150,6 +151,113 @@ protected:
 	mutable fz::shared_optional<std::unordered_multimap<std::wstring, size_t>> m_searchmap_nocase;
 };
 
+// Memory-efficient representation of a directory listing for long-term
+// storage, e.g. in the directory cache.
+//
+// Names and link targets are kept as UTF-8 in a single string arena,
+// permissions and owner/group strings are interned, and sizes, times and
+// flags are stored in packed columns. Entries get materialized into
+// CDirentry objects on access, Expand turns the whole listing back into a
+// regular CDirectoryListing.
+class CCompactDirectoryListing final
+{
+public:
+	CCompactDirectoryListing() = default;
+	explicit CCompactDirectoryListing(CDirectoryListing const& listing);
+
+	CCompactDirectoryListing(CCompactDirectoryListing const&) = default;
+	CCompactDirectoryListing(CCompactDirectoryListing &&) noexcept = default;
+
+	CCompactDirectoryListing& operator=(CCompactDirectoryListing const&) = default;
+	CCompactDirectoryListing& operator=(CCompactDirectoryListing &&) noexcept = default;
+
+	CDirectoryListing Expand() const;
+
+	CDirentry operator[](size_t index) const;
+
+	size_t size() const { return sizes_.size(); }
+
+	std::wstring name(size_t index) const;
+	bool is_dir(size_t index) const { return (flags_[index] & CDirentry::flag_dir) != 0; }
+
+	// Only the flags of CDirentry can be added
+	void add_flags(size_t index, int flags);
+
+	void SetName(size_t index, std::wstring const& name);
+	void SetOwnerGroup(size_t index, std::wstring const& ownerGroup);
+
+	void Append(CDirentry const& entry);
+
+	// Appends all entries of the listing, e.g. the next page of a listing
+	// received in pieces. Its flags get added to the own ones.
+	void Append(CDirectoryListing const& listing);
+
+	bool RemoveEntry(size_t index);
+
+	size_t FindFile_CmpCase(std::wstring const& name) const;
+	size_t FindFile_CmpNoCase(std::wstring const& name) const;
+
+	// Returns the indexes of all matching entries in ascending order
+	std::vector<size_t> FindAll_CmpCase(std::wstring const& name) const;
+	std::vector<size_t> FindAll_CmpNoCase(std::wstring const& name) const;
+
+	// Approximate number of bytes allocated for this listing
+	size_t memory_usage() const;
+
+	explicit operator bool() const { return !path.empty(); }
+
+	CServerPath path;
+	fz::monotonic_clock m_firstListTime;
+
+	// See CDirectoryListing::m_flags
+	int m_flags{};
+
+	int get_unsure_flags() const { return m_flags & CDirectoryListing::unsure_mask; }
+
+private:
+	struct range final
+	{
+		uint32_t offset{};
+		uint32_t length{};
+	};
+
+	range AddString(std::wstring const& s);
+	std::string_view GetString(range const& r) const { return std::string_view(arena_.data() + r.offset, r.length); }
+
+	uint32_t Intern(fz::shared_value<std::wstring> const& s);
+
+	void Push(CDirentry const& entry, uint32_t permissions, uint32_t ownerGroup);
+
+	template<typename F>
+	void Find(std::wstring const& name, bool nocase, F && f) const;
+	void BuildIndex(bool nocase) const;
+	void InsertIntoIndex(std::vector<uint32_t> & index, size_t hash, uint32_t i) const;
+	void ClearIndexes();
+
+	// Drops the strings no longer referenced from the arena
+	void Compact();
+
+	std::string arena_;
+	size_t garbage_{};
+
+	std::vector<range> names_;
+	std::vector<int64_t> sizes_;
+	std::vector<int64_t> times_; // Milliseconds since the epoch
+	std::vector<uint8_t> flags_; // CDirentry flags, presence and accuracy of the time
+	std::vector<uint32_t> permissions_;
+	std::vector<uint32_t> ownerGroups_;
+
+	// Sorted by entry index, most entries are no links
+	std::vector<std::pair<uint32_t, range>> targets_;
+
+	// Index 0 is always the empty string
+	std::vector<fz::shared_value<std::wstring>> strings_;
+
+	// Open addressing hash tables of entry indexes, built on first search
+	mutable std::vector<uint32_t> index_case_;
+	mutable std::vector<uint32_t> index_nocase_;
+};
+
 // Checks if listing2 is a subset of listing1. Compares only filenames.
 bool CheckInclusion(CDirectoryListing const& listing1, CDirectoryListing const& listing2);
 
@@ -8,6 +8,10 @@ class COptionsBase;
 class CPathCache;
 class OpLockManager;
 
+namespace pugi {
+class xml_node;
+}
+
 namespace fz {
 class event_loop;
 class rate_limiter;
@@ -42,6 +46,12 @@ public:
 	OpLockManager& GetOpLockManager();
 	fz::tls_system_trust_store& GetTlsSystemTrustStore();
 
+	// Detected server capabilities can be kept across sessions. The caller
+	// takes care of the file they are kept in, and of locking it. Saving
+	// first takes over entries from the element not known to this process.
+	void LoadServerCapabilities(pugi::xml_node element);
+	void SaveServerCapabilities(pugi::xml_node element);
+
 protected:
 	COptionsBase& options_;
 	CustomEncodingConverterBase const& customEncodingConverter_;
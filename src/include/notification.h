@@ -269,6 +269,12 @@ public:
 	bool madeProgress{};
 
 	bool list{};
+
+	// Only set on FTP transfers using MODE Z, -1 otherwise. Amount of data
+	// on the wire and of the data it corresponds to.
+	int64_t compressedSize{-1};
+	int64_t uncompressedSize{-1};
+	fz::duration compressionTime;
 };
 
 class CTransferStatusNotification final : public CNotificationHelper<nId_transferstatus>
@@ -55,6 +55,12 @@ enum engineOptions
 	OPTION_SOCKET_BUFFERSIZE_SEND,
 
 	OPTION_FTP_SENDKEEPALIVE,
+	OPTION_FTP_PIPELINE_DEPTH,	// Number of commands sent ahead of their replies in batch operations, 0 or 1 to disable
+	OPTION_FTP_MODEZ,			/* Compress data connections using MODE Z
+								   Values: 0: never (default)
+										   1: directory listings and ASCII transfers
+										   2: all transfers
+								*/
 
 	OPTION_FTP_PROXY_TYPE,
 	OPTION_FTP_PROXY_HOST,
@@ -64,6 +70,7 @@ enum engineOptions
 
 	OPTION_SFTP_KEYFILES,
 	OPTION_SFTP_COMPRESSION,
+	OPTION_SFTP_SESSION_CONNECTIONS, // Connections sharing one SSH session, 1 to not share
 
 	OPTION_PROXY_TYPE,
 	OPTION_PROXY_HOST,
@@ -82,6 +89,12 @@ enum engineOptions
 	OPTION_TCP_KEEPALIVE_INTERVAL,
 
 	OPTION_CACHE_TTL,
+	OPTION_CACHE_MAXSIZE,	// In MiB, memory available to the directory cache
+
+	OPTION_CAPABILITIES_CACHE_TTL,	// In seconds, 0 disables the persistent cache
+
+	OPTION_STORJ_BUFFERSIZE,
+	OPTION_STORJ_PARALLEL_DOWNLOADS,
 
 	OPTIONS_ENGINE_NUM
 };
@@ -101,7 +101,8 @@ enum class ProtocolFeature
 	TemporaryUrl,
 	S3Sse,
 	Security, // Encryption, integrity protection and authentication
-	UnixChmod
+	UnixChmod,
+	SegmentedDownload // Downloads of byte ranges into an existing local file
 };
 
 enum class CaseSensitivity
@@ -20,6 +20,7 @@
 #include "filter.h"
 #include "import.h"
 #include "inputdialog.h"
+#include "ipcmutex.h"
 #include "led.h"
 #include "list_search_panel.h"
 #include "local_recursive_operation.h"
@@ -51,6 +52,7 @@
 #include "viewheader.h"
 #include "welcome_dialog.h"
 #include "window_state_manager.h"
+#include "xmlfunctions.h"
 
 #ifdef __WXMSW__
 #include <wx/module.h>
@@ -327,6 +329,8 @@ CMainFrame::CMainFrame()
 
 	CPowerManagement::Create(this);
 
+	LoadServerCapabilities();
+
 	// It's important that the context control gets created before our own state handler
 	// so that contextchange events can be processed in the right order.
 	m_pContextControl = new CContextControl(*this);
@@ -513,6 +517,39 @@ CMainFrame::~CMainFrame()
 #ifndef __WXMAC__
 	delete m_taskBarIcon;
 #endif
+
+	SaveServerCapabilities();
+}
+
+void CMainFrame::LoadServerCapabilities()
+{
+	if (COptions::Get()->GetOptionVal(OPTION_CAPABILITIES_CACHE_TTL) <= 0) {
+		return;
+	}
+
+	CInterProcessMutex mutex(MUTEX_CAPABILITIES);
+
+	CXmlFile file(wxGetApp().GetSettingsFile(L"capabilities"));
+	auto element = file.Load();
+	if (element) {
+		m_engineContext.LoadServerCapabilities(element);
+	}
+}
+
+void CMainFrame::SaveServerCapabilities()
+{
+	if (COptions::Get()->GetOptionVal(OPTION_CAPABILITIES_CACHE_TTL) <= 0) {
+		return;
+	}
+
+	CInterProcessMutex mutex(MUTEX_CAPABILITIES);
+
+	CXmlFile file(wxGetApp().GetSettingsFile(L"capabilities"));
+	auto element = file.Load(true);
+	if (element) {
+		m_engineContext.SaveServerCapabilities(element);
+		file.Save(false);
+	}
 }
 
 void CMainFrame::HandleResize()
@@ -79,6 +79,10 @@ private:
 
 	void FocusNextEnabled(std::list<wxWindow*>& windowOrder, std::list<wxWindow*>::iterator iter, bool skipFirst, bool forward);
 
+	// Keep detected server capabilities across sessions
+	void LoadServerCapabilities();
+	void SaveServerCapabilities();
+
 	CStatusBar* m_pStatusBar{};
 	CMenuBar* m_pMenuBar{};
 	CToolBar* m_pToolBar{};
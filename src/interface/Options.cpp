@@ -105,6 +105,8 @@ static const t_Option options[OPTIONS_NUM] =
 														 // to enable a large TCP window scale
 	{ "Socket send buffer size (v2)", number, L"262144", normal },
 	{ "FTP Keep-alive commands", number, L"0", normal },
+	{ "FTP pipeline depth", number, L"0", normal },
+	{ "FTP MODE Z", number, L"0", normal },
 	{ "FTP Proxy type", number, L"0", normal },
 	{ "FTP Proxy host", string, L"", normal },
 	{ "FTP Proxy user", string, L"", normal },
@@ -112,6 +114,7 @@ static const t_Option options[OPTIONS_NUM] =
 	{ "FTP Proxy login sequence", string, L"", normal },
 	{ "SFTP keyfiles", string, L"", platform },
 	{ "SFTP compression", number, L"", normal },
+	{ "SFTP connections per session", number, L"2", normal },
 	{ "Proxy type", number, L"0", normal },
 	{ "Proxy host", string, L"", normal },
 	{ "Proxy port", number, L"0", normal },
@@ -125,6 +128,10 @@ static const t_Option options[OPTIONS_NUM] =
 	{ "Size decimal places", number, L"1", normal },
 	{ "TCP Keepalive Interval", number, L"15", normal },
 	{ "Cache TTL", number, L"600", normal },
+	{ "Cache max size", number, L"256", normal },
+	{ "Capabilities cache TTL", number, L"604800", normal },
+	{ "Storj transfer buffer size", number, L"4194304", normal },
+	{ "Storj parallel downloads", number, L"4", normal },
 
 	// Interface settings
 	{ "Number of Transfers", number, L"2", normal },
@@ -212,6 +219,8 @@ static const t_Option options[OPTIONS_NUM] =
 	{ "Disable update footer", number, L"0", normal },
 	{ "Master password encryptor", string, L"", normal },
 	{ "Tab data", xml, std::wstring(), normal },
+	{ "Segmented download min size", number, L"64", normal }, // MiB per segment, 0 to disable
+	{ "Segmented download max segments", number, L"4", normal },
 
 	// Default/internal options
 	{ "Config Location", string, L"", static_cast<Flags>(default_only|platform) },
@@ -612,6 +621,21 @@ int COptions::Validate(unsigned int nID, int value)
 			value = 0;
 		}
 		break;
+	case OPTION_SEGMENTED_DOWNLOAD_MINSIZE:
+		if (value < 0) {
+			value = 0;
+		}
+		break;
+	case OPTION_SFTP_SESSION_CONNECTIONS:
+		if (value < 1 || value > 10) {
+			value = 2;
+		}
+		break;
+	case OPTION_SEGMENTED_DOWNLOAD_MAXSEGMENTS:
+		if (value < 1 || value > 10) {
+			value = 4;
+		}
+		break;
 	case OPTION_SPEEDLIMIT_BURSTTOLERANCE:
 		if (value < 0 || value > 2) {
 			value = 0;
@@ -633,6 +657,29 @@ int COptions::Validate(unsigned int nID, int value)
 			value = 131072;
 		}
 		break;
+	case OPTION_FTP_PIPELINE_DEPTH:
+		if (value < 0) {
+			value = 0;
+		}
+		else if (value > 64) {
+			value = 64;
+		}
+		break;
+	case OPTION_FTP_MODEZ:
+		if (value < 0 || value > 2) {
+			value = 0;
+		}
+		break;
+	case OPTION_STORJ_BUFFERSIZE:
+		if (value < 65536 || value > 64 * 1024 * 1024) {
+			value = 4 * 1024 * 1024;
+		}
+		break;
+	case OPTION_STORJ_PARALLEL_DOWNLOADS:
+		if (value < 1 || value > 16) {
+			value = 4;
+		}
+		break;
 	case OPTION_COMPARISONMODE:
 		if (value < 0 || value > 0) {
 			value = 1;
@@ -683,6 +730,22 @@ int COptions::Validate(unsigned int nID, int value)
 			value = 60 * 60 * 24;
 		}
 		break;
+	case OPTION_CACHE_MAXSIZE:
+		if (value < 16) {
+			value = 16;
+		}
+		else if (value > 64 * 1024) {
+			value = 64 * 1024;
+		}
+		break;
+	case OPTION_CAPABILITIES_CACHE_TTL:
+		if (value < 0) {
+			value = 0;
+		}
+		else if (value > 60 * 60 * 24 * 30) {
+			value = 60 * 60 * 24 * 30;
+		}
+		break;
 	case OPTION_ICONS_SCALE:
 		if (value < 25) {
 			value = 25;
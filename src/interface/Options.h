@@ -98,6 +98,8 @@ enum interfaceOptions
 	OPTION_DISABLE_UPDATE_FOOTER,
 	OPTION_MASTERPASSWORDENCRYPTOR,
 	OPTION_TAB_DATA,
+	OPTION_SEGMENTED_DOWNLOAD_MINSIZE,
+	OPTION_SEGMENTED_DOWNLOAD_MAXSEGMENTS,
 
 	// Default/internal options
 	OPTION_DEFAULT_SETTINGSDIR, // guaranteed to be (back)slash-terminated
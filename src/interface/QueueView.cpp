@@ -36,6 +36,11 @@
 #include <wx/sound.h>
 #include <wx/utils.h>
 
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
+#include <map>
+
 #ifdef __WXMSW__
 #include <powrprof.h>
 #endif
@@ -494,6 +499,7 @@ void CQueueView::ProcessNotification(t_EngineData* pEngineData, std::unique_ptr<
 				{
 					CFileItem* pItem = (CFileItem*)pEngineData->pItem;
 					pItem->set_made_progress(true);
+					pItem->SetSegmentProgress(status.currentOffset - status.startOffset);
 				}
 				pEngineData->pStatusLineCtrl->SetTransferStatus(status);
 			}
@@ -674,6 +680,8 @@ bool CQueueView::TryStartNextTransfer()
 		return false;
 	}
 
+	SplitIntoSegments(*bestMatch.serverItem, *bestMatch.fileItem);
+
 	// Find idle engine
 	t_EngineData* pEngineData;
 	if (bestMatch.pEngineData) {
@@ -760,6 +768,154 @@ bool CQueueView::TryStartNextTransfer()
 	return true;
 }
 
+void CQueueView::SplitIntoSegments(CServerItem& server_item, CFileItem& item)
+{
+	if (item.GetType() != QueueItemType::File || !item.Download() || item.Ascii() ||
+		item.m_edit != CEditHandler::none || item.GetSegment())
+	{
+		return;
+	}
+
+	Site const& site = server_item.GetSite();
+	if (!site.server.HasFeature(ProtocolFeature::SegmentedDownload)) {
+		return;
+	}
+
+	int64_t const minSize = static_cast<int64_t>(COptions::Get()->GetOptionVal(OPTION_SEGMENTED_DOWNLOAD_MINSIZE)) * 1024 * 1024;
+	int64_t const size = item.GetSize();
+	if (minSize <= 0 || size < minSize * 2) {
+		return;
+	}
+
+	int64_t count = COptions::Get()->GetOptionVal(OPTION_SEGMENTED_DOWNLOAD_MAXSEGMENTS);
+	int const maxConnections = site.server.MaximumMultipleConnections();
+	count = std::min(count, static_cast<int64_t>(maxConnections ? maxConnections : COptions::Get()->GetOptionVal(OPTION_NUMTRANSFERS)));
+	count = std::min(count, size / minSize);
+	if (count < 2) {
+		return;
+	}
+
+	// Segments write into a preallocated local file. Never touch existing
+	// files, those are subject to the file exists handling.
+	std::wstring const localFile = item.GetLocalPath().GetPath() + item.GetLocalFile();
+	if (fz::local_filesys::get_file_type(fz::to_native(localFile)) != fz::local_filesys::unknown) {
+		return;
+	}
+
+	CLocalPath localPath = item.GetLocalPath();
+	if (!localPath.Exists() && !localPath.Create()) {
+		return;
+	}
+
+	{
+		fz::file f(fz::to_native(localFile), fz::file::writing, fz::file::empty);
+		if (!f.opened() || f.seek(size, fz::file::begin) != size || !f.truncate()) {
+			f.close();
+			fz::remove_file(fz::to_native(localFile));
+			return;
+		}
+	}
+
+	int64_t const length = size / count;
+
+	UpdateItemSize(&item, length);
+	item.SetSegment(0, length);
+
+	std::vector<CFileItem*> segments;
+	for (int64_t i = 1; i < count; ++i) {
+		int64_t const offset = i * length;
+		int64_t const segmentLength = (i == count - 1) ? size - offset : length;
+
+		auto segment = new CFileItem(&server_item, item.queued(), true, item.GetSourceFile(),
+			item.GetTargetFile() ? *item.GetTargetFile() : std::wstring(),
+			item.GetLocalPath(), item.GetRemotePath(), segmentLength);
+		segment->SetPriorityRaw(item.GetPriority());
+		segment->SetSegment(offset, segmentLength);
+		InsertItem(&server_item, segment);
+		segments.push_back(segment);
+	}
+	for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+		server_item.MoveToFront(*it);
+	}
+	CommitChanges();
+
+	for (auto & state : *CContextManager::Get()->GetAllStates()) {
+		state->RefreshLocalFile(localFile);
+	}
+}
+
+int CQueueView::RemoveQueuedSegments(CServerItem& server_item, CFileItem const& item)
+{
+	std::wstring const localFile = item.GetLocalPath().GetPath() + item.GetLocalFile();
+
+	int active{};
+
+	std::vector<CQueueItem*> const items = server_item.GetChildren();
+	int const removedAtFront = server_item.GetRemovedAtFront();
+	for (int i = static_cast<int>(items.size()) - 1; i >= removedAtFront; --i) {
+		if (items[i] == &item || items[i]->GetType() != QueueItemType::File) {
+			continue;
+		}
+
+		CFileItem* pFile = static_cast<CFileItem*>(items[i]);
+		if (!pFile->GetSegment() || pFile->GetLocalPath().GetPath() + pFile->GetLocalFile() != localFile) {
+			continue;
+		}
+
+		if (pFile->IsActive()) {
+			++active;
+		}
+		else {
+			RemoveItem(pFile, true);
+		}
+	}
+
+	return active;
+}
+
+void CQueueView::RemoveSegmentedDownload(CServerItem& server_item, std::wstring const& localFile)
+{
+	m_abandonedSegmentedDownloads.insert(localFile);
+
+	std::vector<CFileItem*> active;
+
+	// Queued segments first, stopping the active ones may remove the server item
+	std::vector<CQueueItem*> const items = server_item.GetChildren();
+	int const removedAtFront = server_item.GetRemovedAtFront();
+	for (int i = static_cast<int>(items.size()) - 1; i >= removedAtFront; --i) {
+		if (items[i]->GetType() != QueueItemType::File) {
+			continue;
+		}
+
+		CFileItem* pFile = static_cast<CFileItem*>(items[i]);
+		if (!pFile->GetSegment() || pFile->GetLocalPath().GetPath() + pFile->GetLocalFile() != localFile) {
+			continue;
+		}
+
+		if (pFile->IsActive()) {
+			active.push_back(pFile);
+		}
+		else {
+			RemoveItem(pFile, true, false, false, false);
+		}
+	}
+
+	if (active.empty()) {
+		m_abandonedSegmentedDownloads.erase(localFile);
+		fz::remove_file(fz::to_native(localFile));
+		for (auto *pState : *CContextManager::Get()->GetAllStates()) {
+			pState->RefreshLocalFile(localFile);
+		}
+		return;
+	}
+
+	// ResetEngine drops them and deletes the file after the last one
+	for (auto * pFile : active) {
+		pFile->set_pending_remove(true);
+		StopItem(pFile);
+	}
+}
+
 void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification const& notification)
 {
 	wxASSERT(notification.commandId != ::Command::none);
@@ -963,6 +1119,10 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 	m_waitStatusLineUpdate = true;
 
 	if (data.pItem) {
+		std::wstring segmentedFile;
+		bool dropSegment{};
+		int activeSegments{};
+
 		CServerItem* pServerItem = static_cast<CServerItem*>(data.pItem->GetTopLevelItem());
 		if (pServerItem) {
 			wxASSERT(pServerItem->m_activeCount > 0);
@@ -988,6 +1148,7 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 			SaveSetItemCount(m_itemCount);
 
 			CFileItem* const pFileItem = (CFileItem*)data.pItem;
+			pFileItem->CommitSegmentProgress();
 			if (pFileItem->Download()) {
 				const std::vector<CState*> *pStates = CContextManager::Get()->GetAllStates();
 				for (auto *pState : *pStates) {
@@ -1013,6 +1174,26 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 				pFileItem->m_onetime_action = CFileExistsNotification::unknown;
 				pFileItem->set_made_progress(false);
 			}
+
+			if (pFileItem->GetSegment() && pServerItem) {
+				// Once a segment failed for good, the local file would keep a
+				// gap. The other segments get dropped and the file deleted
+				// after the last of them has stopped.
+				segmentedFile = pFileItem->GetLocalPath().GetPath() + pFileItem->GetLocalFile();
+				if (m_abandonedSegmentedDownloads.find(segmentedFile) != m_abandonedSegmentedDownloads.end()) {
+					dropSegment = true;
+				}
+				else if (reason == ResetReason::failure) {
+					m_abandonedSegmentedDownloads.insert(segmentedFile);
+				}
+				else {
+					segmentedFile.clear();
+				}
+
+				if (!segmentedFile.empty()) {
+					activeSegments = RemoveQueuedSegments(*pServerItem, *pFileItem);
+				}
+			}
 		}
 
 		wxASSERT(data.pItem->IsActive());
@@ -1033,7 +1214,10 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 			}
 		}
 
-		if (reason == ResetReason::reset) {
+		if (dropSegment) {
+			RemoveItem(data.pItem, true);
+		}
+		else if (reason == ResetReason::reset) {
 			if (!data.pItem->queued()) {
 				static_cast<CServerItem*>(data.pItem->GetTopLevelItem())->QueueImmediateFile(data.pItem);
 			}
@@ -1047,6 +1231,13 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 
 				RemoveItem(data.pItem, false);
 
+				if (!segmentedFile.empty()) {
+					// Requeuing it downloads the whole file again
+					auto* pFileItem = static_cast<CFileItem*>(data.pItem);
+					pFileItem->SetSegment(-1, -1);
+					pFileItem->SetSize(-1);
+				}
+
 				CQueueViewFailed* pQueueViewFailed = m_pQueue->GetQueueView_Failed();
 				CServerItem* pNewServerItem = pQueueViewFailed->CreateServerItem(site);
 				data.pItem->SetParent(pNewServerItem);
@@ -1082,6 +1273,14 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 			RemoveItem(data.pItem, true);
 		}
 		data.pItem = 0;
+
+		if (!segmentedFile.empty() && !activeSegments) {
+			m_abandonedSegmentedDownloads.erase(segmentedFile);
+			fz::remove_file(fz::to_native(segmentedFile));
+			for (auto *pState : *CContextManager::Get()->GetAllStates()) {
+				pState->RefreshLocalFile(segmentedFile);
+			}
+		}
 	}
 	wxASSERT(m_activeCount > 0);
 	if (m_activeCount > 0) {
@@ -1245,6 +1444,13 @@ void CQueueView::SendNextCommand(t_EngineData& engineData)
 
 			CFileTransferCommand::t_transferSettings transferSettings;
 			transferSettings.binary = !fileItem->Ascii();
+			// Retrying a segment resumes after what the previous attempts wrote
+			fileItem->CommitSegmentProgress();
+			auto const& segment = fileItem->GetSegment();
+			if (segment) {
+				transferSettings.segmentOffset = segment->offset + segment->done;
+				transferSettings.segmentLength = segment->length - segment->done;
+			}
 			int res = engineData.pEngine->Execute(CFileTransferCommand(fileItem->GetLocalPath().GetPath() + fileItem->GetLocalFile(), fileItem->GetRemotePath(),
 												fileItem->GetRemoteFile(), fileItem->Download(), transferSettings));
 			wxASSERT((res & FZ_REPLY_BUSY) != FZ_REPLY_BUSY);
@@ -1677,6 +1883,9 @@ void CQueueView::ImportQueue(pugi::xml_node element, bool updateSelections)
 				}
 				bool binary = dataType != 0;
 				int overwrite_action = GetTextElementInt(file, "OverwriteAction", CFileExistsNotification::unknown);
+				int64_t segmentOffset = GetTextElementInt(file, "SegmentOffset", -1);
+				int64_t segmentLength = GetTextElementInt(file, "SegmentLength", -1);
+				int64_t segmentDone = GetTextElementInt(file, "SegmentDone", 0);
 
 				CServerPath remotePath;
 				if (!localFile.empty() && !remoteFile.empty() && remotePath.SetSafePath(safeRemotePath) &&
@@ -1705,6 +1914,9 @@ void CQueueView::ImportQueue(pugi::xml_node element, bool updateSelections)
 					fileItem->SetAscii(!binary);
 					fileItem->SetPriorityRaw(QueuePriority(priority));
 					fileItem->m_errorCount = errorCount;
+					if (download) {
+						fileItem->SetSegment(segmentOffset, segmentLength, segmentDone);
+					}
 					InsertItem(pServerItem, fileItem);
 
 					if (overwrite_action > 0 && overwrite_action < CFileExistsNotification::ACTION_COUNT) {
@@ -1996,6 +2208,9 @@ void CQueueView::OnRemoveSelected(wxCommandEvent&)
 
 	m_waitStatusLineUpdate = true;
 
+	// Segmented downloads get removed as a whole once the other items are gone
+	std::map<std::wstring, CServerItem*> segmentedDownloads;
+
 	while (!selectedItems.empty()) {
 		auto selectedItem = selectedItems.front();
 		CQueueItem* pItem = selectedItem.second;
@@ -2015,6 +2230,10 @@ void CQueueView::OnRemoveSelected(wxCommandEvent&)
 				 pItem->GetType() == QueueItemType::Folder)
 		{
 			CFileItem* pFile = (CFileItem*)pItem;
+			if (pFile->GetSegment()) {
+				segmentedDownloads[pFile->GetLocalPath().GetPath() + pFile->GetLocalFile()] = static_cast<CServerItem*>(pFile->GetTopLevelItem());
+				continue;
+			}
 			if (pFile->IsActive()) {
 				pFile->set_pending_remove(true);
 				StopItem(pFile);
@@ -2038,6 +2257,9 @@ void CQueueView::OnRemoveSelected(wxCommandEvent&)
 		bool forward = selectedItem.first < (topItemIndex + static_cast<int>(pTopLevelItem->GetChildrenCount(false)) / 2);
 		RemoveItem(pItem, true, false, false, forward);
 	}
+	for (auto const& download : segmentedDownloads) {
+		RemoveSegmentedDownload(*download.second, download.first);
+	}
 	DisplayNumberQueuedFiles();
 	DisplayQueueSize();
 	SaveSetItemCount(m_itemCount);
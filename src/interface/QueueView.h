@@ -178,6 +178,23 @@ protected:
 	// whether it is allowed to start another transfer on that server item
 	bool CanStartTransfer(const CServerItem& server_item, t_EngineData *&pEngineData);
 
+	// Called from TryStartNextTransfer(), splits large downloads into
+	// segments which get transferred over multiple connections
+	void SplitIntoSegments(CServerItem& server_item, CFileItem& item);
+
+	// Removes the queued segments sharing the local file of the given
+	// segment, returns the number of still active ones.
+	int RemoveQueuedSegments(CServerItem& server_item, CFileItem const& item);
+
+	// Removing a single segment would leave a gap in the local file. Removes
+	// all segments of the download instead, stopping the active ones, and
+	// deletes the local file once the last of them has stopped.
+	void RemoveSegmentedDownload(CServerItem& server_item, std::wstring const& localFile);
+
+	// Local files of segmented downloads of which a segment has failed or
+	// got removed
+	std::set<std::wstring> m_abandonedSegmentedDownloads;
+
 	void ProcessReply(t_EngineData* pEngineData, COperationNotification const& notification);
 	void SendNextCommand(t_EngineData& engineData);
 
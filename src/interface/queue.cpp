@@ -9,6 +9,8 @@
 
 #include <wx/filedlg.h>
 
+#include <algorithm>
+
 CQueueItem::CQueueItem(CQueueItem* parent)
 	: m_parent(parent)
 {
@@ -317,6 +319,13 @@ void CFileItem::SaveItem(pugi::xml_node& element) const
 	if (m_defaultFileExistsAction != CFileExistsNotification::unknown) {
 		AddTextElement(file, "OverwriteAction", m_defaultFileExistsAction);
 	}
+	if (m_segment) {
+		AddTextElement(file, "SegmentOffset", m_segment->offset);
+		AddTextElement(file, "SegmentLength", m_segment->length);
+		if (m_segment->done) {
+			AddTextElement(file, "SegmentDone", m_segment->done);
+		}
+	}
 }
 
 bool CFileItem::TryRemoveAll()
@@ -339,6 +348,34 @@ void CFileItem::SetTargetFile(std::wstring const& file)
 	}
 }
 
+void CFileItem::SetSegment(int64_t offset, int64_t length, int64_t done)
+{
+	m_segmentProgress = 0;
+	if (offset >= 0 && length > 0) {
+		m_segment = fz::sparse_optional<Segment>(Segment{offset, length, std::clamp<int64_t>(done, 0, length - 1)});
+	}
+	else {
+		m_segment.clear();
+	}
+}
+
+void CFileItem::SetSegmentProgress(int64_t bytes)
+{
+	if (m_segment && bytes > m_segmentProgress) {
+		m_segmentProgress = bytes;
+	}
+}
+
+void CFileItem::CommitSegmentProgress()
+{
+	if (m_segment && m_segmentProgress > 0) {
+		// The last byte is always left to the next transfer, so that the
+		// segment only completes by a transfer succeeding.
+		m_segment->done = std::min(m_segment->done + m_segmentProgress, m_segment->length - 1);
+	}
+	m_segmentProgress = 0;
+}
+
 void CFileItem::SetStatusMessage(CFileItem::Status status)
 {
 	m_status = status;
@@ -446,6 +483,12 @@ void CServerItem::AddFileItemToList(CFileItem* pItem)
 	m_fileList[pItem->queued() ? 0 : 1][static_cast<int>(pItem->GetPriority())].push_back(pItem);
 }
 
+void CServerItem::MoveToFront(CFileItem* pItem)
+{
+	RemoveFileItemFromList(pItem, false);
+	m_fileList[pItem->queued() ? 0 : 1][static_cast<int>(pItem->GetPriority())].push_front(pItem);
+}
+
 void CServerItem::RemoveFileItemFromList(CFileItem* pItem, bool forward)
 {
 	std::deque<CFileItem*>& fileList = m_fileList[pItem->queued() ? 0 : 1][static_cast<int>(pItem->GetPriority())];
@@ -974,7 +1017,14 @@ wxString CQueueViewBase::OnGetItemText(CQueueItem* pItem, ColumnId column) const
 				}
 				break;
 			case colRemoteName:
-				return pFileItem->GetRemotePath().FormatFilename(pFileItem->GetRemoteFile());
+				{
+					wxString name = pFileItem->GetRemotePath().FormatFilename(pFileItem->GetRemoteFile());
+					auto const& segment = pFileItem->GetSegment();
+					if (segment) {
+						name += wxString::Format(_(" (bytes %s-%s)"), fz::to_wstring(segment->offset), fz::to_wstring(segment->offset + segment->length - 1));
+					}
+					return name;
+				}
 			case colSize:
 				{
 					auto const& size = pFileItem->GetSize();
@@ -119,6 +119,9 @@ public:
 
 	void Sort(int col, bool reverse);
 
+	// Lets the scheduler pick the item before other idle items of the same priority
+	void MoveToFront(CFileItem* pItem);
+
 protected:
 	void AddFileItemToList(CFileItem* pItem);
 	void RemoveFileItemFromList(CFileItem* pItem, bool forward);
@@ -269,9 +272,30 @@ public:
 		}
 	}
 
+	// Segments of a segmented download cover the given byte range of the
+	// remote file. Each segment is a queue item of its own, all of them
+	// sharing the same, preallocated local file. The first done bytes of
+	// the range have already been written, the segment resumes after them.
+	struct Segment
+	{
+		int64_t offset{};
+		int64_t length{};
+		int64_t done{};
+	};
+	fz::sparse_optional<Segment> const& GetSegment() const { return m_segment; }
+	void SetSegment(int64_t offset, int64_t length, int64_t done = 0);
+
+	// Bytes of the segment written by the transfer in progress
+	void SetSegmentProgress(int64_t bytes);
+
+	// Adds the bytes written by the last transfer to the done ones
+	void CommitSegmentProgress();
+
 protected:
 	std::wstring const m_sourceFile;
 	fz::sparse_optional<std::wstring> m_targetFile;
+	fz::sparse_optional<Segment> m_segment;
+	int64_t m_segmentProgress{};
 	CLocalPath const m_localPath;
 	CServerPath const m_remotePath;
 	int64_t m_size{};
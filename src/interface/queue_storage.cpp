@@ -94,7 +94,10 @@ namespace file_table_column_names
 		error_count,
 		priority,
 		ascii_file,
-		default_exists_action
+		default_exists_action,
+		segment_offset,
+		segment_length,
+		segment_done
 	};
 }
 
@@ -110,7 +113,10 @@ _column file_table_columns[] = {
 	{ "error_count", Column_type::integer, 0 },
 	{ "priority", Column_type::integer, 0 },
 	{ "ascii_file", Column_type::integer, 0 },
-	{ "default_exists_action", Column_type::integer, 0 }
+	{ "default_exists_action", Column_type::integer, 0 },
+	{ "segment_offset", Column_type::integer, default_null },
+	{ "segment_length", Column_type::integer, default_null },
+	{ "segment_done", Column_type::integer, default_null }
 };
 
 namespace path_table_column_names
@@ -295,7 +301,7 @@ bool CQueueStorage::Impl::MigrateSchema()
 	bool ret = sqlite3_exec(db_, "PRAGMA user_version", int_callback, &version, 0) == SQLITE_OK;
 
 	if (ret) {
-		if (version > 5) {
+		if (version > 6) {
 			ret = false;
 		}
 		else if (version > 0) {
@@ -309,9 +315,14 @@ bool CQueueStorage::Impl::MigrateSchema()
 			if (ret && version < 5) {
 				ret = sqlite3_exec(db_, "ALTER TABLE servers ADD COLUMN site_path TEXT DEFAULT NULL", 0, 0, 0) == SQLITE_OK;
 			}
+			if (ret && version < 6) {
+				ret = sqlite3_exec(db_, "ALTER TABLE files ADD COLUMN segment_offset INTEGER DEFAULT NULL", 0, 0, 0) == SQLITE_OK &&
+					sqlite3_exec(db_, "ALTER TABLE files ADD COLUMN segment_length INTEGER DEFAULT NULL", 0, 0, 0) == SQLITE_OK &&
+					sqlite3_exec(db_, "ALTER TABLE files ADD COLUMN segment_done INTEGER DEFAULT NULL", 0, 0, 0) == SQLITE_OK;
+			}
 		}
-		if (ret && version != 5) {
-			ret = sqlite3_exec(db_, "PRAGMA user_version = 5", 0, 0, 0) == SQLITE_OK;
+		if (ret && version != 6) {
+			ret = sqlite3_exec(db_, "PRAGMA user_version = 6", 0, 0, 0) == SQLITE_OK;
 		}
 	}
 
@@ -830,6 +841,18 @@ bool CQueueStorage::Impl::SaveFile(CFileItem const& file)
 		BindNull(insertFileQuery_, file_table_column_names::default_exists_action);
 	}
 
+	auto const& segment = file.GetSegment();
+	if (segment) {
+		Bind(insertFileQuery_, file_table_column_names::segment_offset, segment->offset);
+		Bind(insertFileQuery_, file_table_column_names::segment_length, segment->length);
+		Bind(insertFileQuery_, file_table_column_names::segment_done, segment->done);
+	}
+	else {
+		BindNull(insertFileQuery_, file_table_column_names::segment_offset);
+		BindNull(insertFileQuery_, file_table_column_names::segment_length);
+		BindNull(insertFileQuery_, file_table_column_names::segment_done);
+	}
+
 	int res;
 	do {
 		res = sqlite3_step(insertFileQuery_);
@@ -872,6 +895,9 @@ bool CQueueStorage::Impl::SaveDirectory(CFolderItem const& directory)
 	BindNull(insertFileQuery_, file_table_column_names::ascii_file);
 
 	BindNull(insertFileQuery_, file_table_column_names::default_exists_action);
+	BindNull(insertFileQuery_, file_table_column_names::segment_offset);
+	BindNull(insertFileQuery_, file_table_column_names::segment_length);
+	BindNull(insertFileQuery_, file_table_column_names::segment_done);
 
 	int res;
 	do {
@@ -1101,6 +1127,9 @@ int64_t CQueueStorage::Impl::ParseFileFromRow(CFileItem** pItem)
 
 		bool ascii = GetColumnInt(selectFilesQuery_, file_table_column_names::ascii_file) != 0;
 		int overwrite_action = GetColumnInt(selectFilesQuery_, file_table_column_names::default_exists_action, CFileExistsNotification::unknown);
+		int64_t segmentOffset = GetColumnInt64(selectFilesQuery_, file_table_column_names::segment_offset, -1);
+		int64_t segmentLength = GetColumnInt64(selectFilesQuery_, file_table_column_names::segment_length, -1);
+		int64_t segmentDone = GetColumnInt64(selectFilesQuery_, file_table_column_names::segment_done, 0);
 
 		if (sourceFile.empty() || localPath.empty() ||
 			remotePath.empty() ||
@@ -1119,6 +1148,9 @@ int64_t CQueueStorage::Impl::ParseFileFromRow(CFileItem** pItem)
 		if (overwrite_action > 0 && overwrite_action < CFileExistsNotification::ACTION_COUNT) {
 			fileItem->m_defaultFileExistsAction = (CFileExistsNotification::OverwriteAction)overwrite_action;
 		}
+		if (download) {
+			fileItem->SetSegment(segmentOffset, segmentLength, segmentDone);
+		}
 	}
 
 	return GetColumnInt64(selectFilesQuery_, file_table_column_names::id);
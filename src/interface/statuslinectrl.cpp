@@ -180,6 +180,13 @@ void CStatusLineCtrl::OnPaint(wxPaintEvent&)
 			bytes_and_rate.Printf(_("%s (? B/s)"), bytestr);
 		}
 
+		if (status_.compressedSize >= 0 && status_.uncompressedSize > 0) {
+			// MODE Z transfer, show how much the compression saves and what it costs
+			int const ratio = static_cast<int>(status_.compressedSize * 100 / status_.uncompressedSize);
+			double const seconds = status_.compressionTime.get_milliseconds() / 1000.0;
+			bytes_and_rate += wxString::Format(_(", compressed to %d%% using %.1f s of CPU time"), ratio, seconds);
+		}
+
 		if (m_last_bytes_and_rate != bytes_and_rate) {
 			refresh |= 8;
 			m_last_bytes_and_rate = bytes_and_rate;
@@ -318,6 +325,7 @@ void CStatusLineCtrl::OnTimer(wxTimerEvent&)
 		{
 			CFileItem* pItem = (CFileItem*)m_pEngineData->pItem;
 			pItem->set_made_progress(true);
+			pItem->SetSegmentProgress(status.currentOffset - status.startOffset);
 		}
 		SetTransferStatus(status);
 	}
@@ -3,6 +3,27 @@
 
 bool pending_reply = false;
 
+static unsigned current_tag = 0;
+
+void fzprintf_set_tag(unsigned tag)
+{
+    current_tag = tag;
+}
+
+unsigned fzprintf_get_tag(void)
+{
+    return current_tag;
+}
+
+static void fzprintf_tag(void)
+{
+    if (current_tag) {
+        fprintf(stdout, "#%u ", current_tag);
+    }
+}
+
+// Used for activity and quota notifications. They concern the connection
+// as a whole, so they are never tagged.
 int fznotify(sftpEventTypes type)
 {
     if (type == sftpDone || type == sftpReply) {
@@ -27,6 +48,7 @@ int fzprintf(sftpEventTypes type, const char* fmt, ...)
         sfree(str);
         va_end(ap);
 
+        fzprintf_tag();
         fprintf(stdout, "%c\n", (int)type + '0');
         fflush(stdout);
 
@@ -38,6 +60,7 @@ int fzprintf(sftpEventTypes type, const char* fmt, ...)
         if (*p == '\r' || *p == '\n') {
             if (p != s) {
                 *p = 0;
+                fzprintf_tag();
                 fprintf(stdout, "%c%s\n", (int)type + '0', s);
                 s = p + 1;
             }
@@ -48,6 +71,7 @@ int fzprintf(sftpEventTypes type, const char* fmt, ...)
         else if (!*p) {
             if (p != s) {
                 *p = 0;
+                fzprintf_tag();
                 fprintf(stdout, "%c%s\n", (int)type + '0', s);
                 s = p + 1;
             }
@@ -93,6 +117,7 @@ int fzprintf_raw_untrusted(sftpEventTypes type, const char* fmt, ...)
     *s = 0;
 
     if (type != sftpUnknown) {
+        fzprintf_tag();
         fputc((int)type + '0', stdout);
     }
     fputs(str, stdout);
@@ -117,6 +142,7 @@ int fzprintf_raw(sftpEventTypes type, const char* fmt, ...)
     va_start(ap, fmt);
     str = dupvprintf(fmt, ap);
 
+    fzprintf_tag();
     fputc((char)type + '0', stdout);
     fputs(str, stdout);
     fflush(stdout);
@@ -134,8 +160,21 @@ int fznotify1(sftpEventTypes type, int data)
         pending_reply = false;
     }
 
+    fzprintf_tag();
     fprintf(stdout, "%c%d\n", (int)type + '0', data);
     fflush(stdout);
     return 0;
 }
 
+int fzprintf_batch(sftpEventTypes type, const void* data, size_t len)
+{
+    if (type == sftpDone || type == sftpReply) {
+        pending_reply = false;
+    }
+
+    fzprintf_tag();
+    fprintf(stdout, "%c%lu\n", (int)type + '0', (unsigned long)len);
+    fwrite(data, 1, len, stdout);
+    fflush(stdout);
+    return 0;
+}
@@ -1,4 +1,4 @@
-#define FZSFTP_PROTOCOL_VERSION 9
+#define FZSFTP_PROTOCOL_VERSION 13
 
 typedef enum
 {
@@ -33,6 +33,10 @@ typedef enum
 
 extern bool pending_reply;
 
+// While a tag is set, each event is prefixed by "#<tag> ". 0 means untagged.
+void fzprintf_set_tag(unsigned tag);
+unsigned fzprintf_get_tag(void);
+
 int fznotify(sftpEventTypes type);
 
 // Format the string. Each line of the string is prepended by type
@@ -44,3 +48,6 @@ int fzprintf_raw(sftpEventTypes type, const char* p, ...);
 // Format the string, then print the type (if not sftpUnknown) and the string with linebreaks replaced by spaces.
 int fzprintf_raw_untrusted(sftpEventTypes type, const char* p, ...);
 int fznotify1(sftpEventTypes type, int data);
+
+// Print the type and the length of the binary data on a line of their own, followed by the data itself
+int fzprintf_batch(sftpEventTypes type, const void* data, size_t len);
@@ -9,7 +9,28 @@
 int bytesAvailable[2] = { 0, 0 };
 int limit[2] = { 0, 0 };
 
-char* input_pushback = 0;
+/*
+ * Lines that arrived while we were waiting for quota. With tagged
+ * commands several of them can arrive before the quota does, so they
+ * are kept in order.
+ */
+struct input_pushback_line {
+    char* line;
+    struct input_pushback_line* next;
+};
+static struct input_pushback_line *input_pushback_head = 0, *input_pushback_tail = 0;
+
+static void push_input_line(char* line)
+{
+    struct input_pushback_line* p = snew(struct input_pushback_line);
+    p->line = line;
+    p->next = 0;
+    if (input_pushback_tail)
+        input_pushback_tail->next = p;
+    else
+        input_pushback_head = p;
+    input_pushback_tail = p;
+}
 
 #ifndef _WINDOWS
 #include <unistd.h>
@@ -46,16 +67,11 @@ static int ReadQuotas(int i)
 
         if (buffer[0] != '-')
         {
-                if (input_pushback != 0) {
-                        fzprintf(sftpError, "input_pushback not null!");
-                        cleanup_exit(1);
-                }
-            else {
-                int pos = strcspn(buffer, "\n") + 1;
-                input_pushback = snewn(pos + 1, char);
-                strncpy(input_pushback, buffer, pos);
-                input_pushback[pos] = 0;
-            }
+            int pos = strcspn(buffer, "\n") + 1;
+            char* pushback = snewn(pos + 1, char);
+            strncpy(pushback, buffer, pos);
+            pushback[pos] = 0;
+            push_input_line(pushback);
         }
         else
             ProcessQuotaCmd(buffer);
@@ -75,12 +91,11 @@ static int ReadQuotas(int i)
 
         if (line[0] != '-')
         {
-            if (input_pushback != 0) {
-                fzprintf(sftpError, "input_pushback not null!");
-                cleanup_exit(1);
-            }
-            else
-                input_pushback = strndup(line, strcspn(line, "\n") + 1);
+            int pos = strcspn(line, "\n") + 1;
+            char* pushback = snewn(pos + 1, char);
+            memcpy(pushback, line, pos);
+            pushback[pos] = 0;
+            push_input_line(pushback);
         }
         else
             ProcessQuotaCmd(line);
@@ -199,14 +214,22 @@ int ProcessQuotaCmd(const char* line)
 
 char* get_input_pushback()
 {
-    char* pushback = input_pushback;
-    input_pushback = 0;
-    return pushback;
+    struct input_pushback_line* p = input_pushback_head;
+    char* line;
+    if (!p)
+        return 0;
+
+    input_pushback_head = p->next;
+    if (!input_pushback_head)
+        input_pushback_tail = 0;
+    line = p->line;
+    sfree(p);
+    return line;
 }
 
 int has_input_pushback()
 {
-    if (input_pushback != 0)
+    if (input_pushback_head != 0)
         return 1;
     else
         return 0;
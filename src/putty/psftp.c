@@ -31,6 +31,9 @@ const char *const appname = "PSFTP";
 static int psftp_connect(char *userhost, char *user, int portnumber);
 static int do_sftp_init(void);
 static void do_sftp_cleanup(void);
+static bool sftp_packet_available(void);
+static bool sftp_transfer_dispatch(struct sftp_request *rreq,
+                                   struct sftp_packet *pktin);
 
 /* ----------------------------------------------------------------------
  * sftp client state.
@@ -90,19 +93,24 @@ struct sftp_packet *sftp_wait_for_reply(struct sftp_request *req)
     struct sftp_request *rreq;
 
     sftp_register(req);
-    pktin = sftp_recv();
-    if (pktin == NULL) {
-        seat_connection_fatal(
-            psftp_seat, "did not receive SFTP response packet from server");
-    }
-    rreq = sftp_find_request(pktin);
-    if (rreq != req) {
-        seat_connection_fatal(
-            psftp_seat,
-            "unable to understand SFTP response packet from server: %s",
-            fxp_error());
+    while (1) {
+        pktin = sftp_recv();
+        if (pktin == NULL) {
+            seat_connection_fatal(
+                psftp_seat, "did not receive SFTP response packet from server");
+        }
+        rreq = sftp_find_request(pktin);
+        if (rreq == req)
+            return pktin;
+
+        /* Replies for transfers running in the background */
+        if (!rreq || !sftp_transfer_dispatch(rreq, pktin)) {
+            seat_connection_fatal(
+                psftp_seat,
+                "unable to understand SFTP response packet from server: %s",
+                fxp_error());
+        }
     }
-    return pktin;
 }
 
 /* ----------------------------------------------------------------------
@@ -273,19 +281,370 @@ static void not_connected(void)
 
 /* ----------------------------------------------------------------------
  * The meat of the `get' and `put' commands.
+ *
+ * Any number of transfers can be in progress at the same time on the
+ * one SFTP channel, each with its own window of outstanding requests.
+ * A transfer started by a tagged command runs in the background: the
+ * command returns straight away so that further commands can be
+ * processed, and the sftpDone of the transfer is sent with its tag
+ * once it has finished. Untagged transfers block until they are done.
+ */
+
+/* Size of the chunks in which uploads read the local file */
+#define UPLOAD_READ_SIZE (1024 * 1024)
+
+struct sftp_transfer {
+    unsigned tag;
+    bool download, background, finished, canceled;
+    struct fxp_handle *fh;
+    struct fxp_xfer *xfer;
+    bool err, shown_err;
+
+    /* Downloads */
+    WFile *wfile;
+    _fztimer timer;
+    int winterval;
+
+    /*
+     * Uploads. The local file is read in large chunks and each chunk
+     * is split into writes of the largest size the server accepts.
+     * The data gets copied into the write packets, so the chunk
+     * buffer can be refilled as soon as it has been queued.
+     */
+    RFile *rfile;
+    char *buffer;
+    int buflen, bufpos, writesize;
+    bool eof;
+
+    struct sftp_transfer *next;
+};
+
+static struct sftp_transfer *transfers = NULL;
+
+int pending_receive() {
+    return ssh_pending_receive(backend);
+}
+
+static struct sftp_transfer *transfer_new(bool download,
+                                          struct fxp_handle *fh)
+{
+    struct sftp_transfer *t = snew(struct sftp_transfer);
+
+    t->tag = fzprintf_get_tag();
+    t->download = download;
+    t->background = false;
+    t->finished = false;
+    t->canceled = false;
+    t->fh = fh;
+    t->xfer = NULL;
+    t->err = false;
+    t->shown_err = false;
+    t->wfile = NULL;
+    fz_timer_init(&t->timer);
+    t->winterval = 0;
+    t->rfile = NULL;
+    t->buffer = NULL;
+    t->buflen = t->bufpos = 0;
+    t->writesize = fxp_get_max_write_size();
+    t->eof = false;
+    t->next = NULL;
+
+    return t;
+}
+
+static bool transfer_done(struct sftp_transfer *t)
+{
+    if (t->download)
+        return xfer_done(t->xfer);
+    return (t->err || t->eof) && xfer_done(t->xfer);
+}
+
+/*
+ * Queue as many requests as the window of the transfer allows.
+ */
+static void transfer_queue(struct sftp_transfer *t)
+{
+    int len;
+
+    if (t->download) {
+        xfer_download_queue(t->xfer);
+        return;
+    }
+
+    while (xfer_upload_ready(t->xfer) && !t->err && !t->eof) {
+        if (t->bufpos == t->buflen) {
+            len = read_from_file(t->rfile, t->buffer, UPLOAD_READ_SIZE);
+            if (len == -1) {
+                fzprintf(sftpError, "error while reading local file");
+                t->err = true;
+                break;
+            } else if (len == 0) {
+                t->eof = true;
+                break;
+            }
+            t->buflen = len;
+            t->bufpos = 0;
+        }
+
+        len = t->buflen - t->bufpos;
+        if (len > t->writesize)
+            len = t->writesize;
+        xfer_upload_data(t->xfer, t->buffer + t->bufpos, len);
+        t->bufpos += len;
+        if (pending_receive() >= 5)
+            break;
+    }
+}
+
+static void transfer_gotreq(struct sftp_transfer *t,
+                            struct sftp_request *rreq,
+                            struct sftp_packet *pktin)
+{
+    void *vbuf;
+    int ret, len, wpos, wlen;
+
+    if (!t->download) {
+        ret = xfer_upload_gotreq(t->xfer, rreq, pktin);
+        if (ret <= 0) {
+            if (ret == INT_MIN)        /* pktin not even freed */
+                sfree(pktin);
+            if (!t->err) {
+                fzprintf(sftpError, "error while writing: %s", fxp_error());
+                t->err = true;
+            }
+        }
+        return;
+    }
+
+    ret = xfer_download_gotreq(t->xfer, rreq, pktin);
+    if (ret <= 0) {
+        if (!t->shown_err) {
+            fzprintf(sftpError, "error while reading: %s", fxp_error());
+            t->shown_err = true;
+        }
+        if (ret == INT_MIN)            /* pktin not even freed */
+            sfree(pktin);
+        t->err = true;
+    }
+
+    while (xfer_download_data(t->xfer, &vbuf, &len)) {
+        unsigned char *buf = (unsigned char *)vbuf;
+
+        wpos = 0;
+        while (wpos < len) {
+            wlen = write_to_file(t->wfile, buf + wpos, len - wpos);
+            if (wlen <= 0) {
+                if (!t->shown_err) {
+                    fzprintf(sftpError, "error while writing local file");
+                    t->shown_err = true;
+                }
+                break;
+            }
+            wpos += wlen;
+        }
+        if (wpos < len) {               /* we had an error */
+            t->err = true;
+            xfer_set_error(t->xfer);
+        }
+        t->winterval += wpos;
+        sfree(vbuf);
+    }
+
+    if (fz_timer_check(&t->timer)) {
+        fzprintf(sftpTransfer, "%d", t->winterval);
+        t->winterval = 0;
+    }
+}
+
+/*
+ * Hand a reply to the transfer it belongs to and let that transfer
+ * queue further requests. Returns false if the request isn't part of
+ * any transfer.
+ */
+static bool sftp_transfer_dispatch(struct sftp_request *rreq,
+                                   struct sftp_packet *pktin)
+{
+    struct fxp_xfer *xfer = xfer_from_request(rreq);
+    struct sftp_transfer *t;
+    unsigned prevtag;
+
+    if (!xfer)
+        return false;
+    for (t = transfers; t; t = t->next)
+        if (t->xfer == xfer)
+            break;
+    if (!t)
+        return false;
+
+    prevtag = fzprintf_get_tag();
+    fzprintf_set_tag(t->tag);
+    transfer_gotreq(t, rreq, pktin);
+    transfer_queue(t);
+    t->finished = transfer_done(t);
+    fzprintf_set_tag(prevtag);
+
+    return true;
+}
+
+/*
+ * Close the files of a finished transfer and free it. This waits for
+ * the server to confirm the close, so it must not be called while
+ * another reply is being waited for.
+ */
+static int transfer_finish(struct sftp_transfer *t)
+{
+    struct sftp_transfer **prev;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    bool err;
+
+    for (prev = &transfers; *prev != t; prev = &(*prev)->next);
+    *prev = t->next;
+
+    xfer_cleanup(t->xfer);
+    if (t->download)
+        close_wfile(t->wfile);
+
+    req = fxp_close_send(t->fh);
+    pktin = sftp_wait_for_reply(req);
+    if (!fxp_close_recv(pktin, req) && !t->download && !t->err) {
+        fzprintf(sftpError, "error while writing: %s", fxp_error());
+        t->err = true;
+    }
+
+    if (!t->download) {
+        close_rfile(t->rfile);
+        sfree(t->buffer);
+    }
+
+    err = t->err;
+    sfree(t);
+
+    return err ? 0 : 1;
+}
+
+static void transfer_complete_background(struct sftp_transfer *t)
+{
+    unsigned prevtag = fzprintf_get_tag();
+    bool prev_pending_reply = pending_reply;
+    bool canceled = t->canceled;
+    int ret;
+
+    fzprintf_set_tag(t->tag);
+    ret = transfer_finish(t);
+    if (!canceled)
+        fznotify1(sftpDone, ret);
+    fzprintf_set_tag(prevtag);
+    pending_reply = prev_pending_reply;
+}
+
+/*
+ * Process the replies that have already arrived, queue further
+ * requests and complete finished background transfers. Never waits
+ * for the network; called whenever we are about to.
+ */
+void sftp_service_transfers(void)
+{
+    struct sftp_transfer *t;
+    struct sftp_packet *pktin;
+    struct sftp_request *rreq;
+    unsigned prevtag;
+
+    if (!transfers)
+        return;
+
+    while (sftp_packet_available()) {
+        pktin = sftp_recv();
+        rreq = sftp_find_request(pktin);
+        if (!rreq || !sftp_transfer_dispatch(rreq, pktin)) {
+            seat_connection_fatal(
+                psftp_seat,
+                "unable to understand SFTP response packet from server: %s",
+                fxp_error());
+        }
+    }
+
+    /* Uploads may have been waiting for the send buffer to drain */
+    prevtag = fzprintf_get_tag();
+    for (t = transfers; t; t = t->next) {
+        if (!t->finished) {
+            fzprintf_set_tag(t->tag);
+            transfer_queue(t);
+            t->finished = transfer_done(t);
+        }
+    }
+    fzprintf_set_tag(prevtag);
+
+    /* Completing a transfer waits for a reply, which can change the list */
+    t = transfers;
+    while (t) {
+        if (t->finished && t->background) {
+            transfer_complete_background(t);
+            t = transfers;
+        } else {
+            t = t->next;
+        }
+    }
+}
+
+static int transfer_start(struct sftp_transfer *t)
+{
+    struct sftp_transfer **tail;
+
+    for (tail = &transfers; *tail; tail = &(*tail)->next);
+    *tail = t;
+
+    transfer_queue(t);
+    t->finished = transfer_done(t);
+
+    if (t->tag) {
+        /* The reply is sent once the transfer has finished */
+        t->background = true;
+        pending_reply = false;
+        return 1;
+    }
+
+    while (!t->finished) {
+        sftp_service_transfers();
+        if (t->finished)
+            break;
+        if (backend_exitcode(backend) >= 0 ||
+            ssh_sftp_loop_iteration() < 0) {
+            seat_connection_fatal(
+                psftp_seat, "did not receive SFTP response packet from server");
+        }
+    }
+
+    return transfer_finish(t);
+}
+
+/*
+ * Abort the transfers of a client that went away. They stay around
+ * until the replies to their outstanding requests have arrived, but
+ * no longer report anything.
  */
+static void transfer_cancel(unsigned tag)
+{
+    struct sftp_transfer *t;
+
+    for (t = transfers; t; t = t->next) {
+        if (t->tag == tag) {
+            t->canceled = true;
+            t->err = true;
+            xfer_set_error(t->xfer);
+        }
+    }
+}
+
 int sftp_get_file(char *fname, char *outfname, bool restart)
 {
     struct fxp_handle *fh;
     struct sftp_packet *pktin;
     struct sftp_request *req;
-    struct fxp_xfer *xfer;
+    struct sftp_transfer *t;
     uint64_t offset;
     WFile *file;
-    int ret, shown_err = false;
     struct fxp_attrs attrs;
-    _fztimer timer;
-    int winterval;
 
     req = fxp_stat_send(fname);
     pktin = sftp_wait_for_reply(req);
@@ -337,89 +696,89 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
 
     fzprintf(sftpInfo, "remote:%s => local:%s", fname, outfname);
 
-    fz_timer_init(&timer);
-    winterval = 0;
+    t = transfer_new(true, fh);
+    t->wfile = file;
+    t->xfer = xfer_download_init(fh, offset);
+    return transfer_start(t);
+}
 
-    /*
-     * FIXME: we can use FXP_FSTAT here to get the file size, and
-     * thus put up a progress bar.
-     */
-    ret = 1;
-    xfer = xfer_download_init(fh, offset);
-    while (!xfer_done(xfer)) {
-        void *vbuf;
-        int retd, len;
-        int wpos, wlen;
+/*
+ * Download the given byte range of a file into the same range of an
+ * existing local file. Used to fetch a large file in several segments
+ * over multiple connections at once.
+ */
+int sftp_get_file_range(char *fname, char *outfname,
+                        uint64_t offset, uint64_t length)
+{
+    struct fxp_handle *fh;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    struct sftp_transfer *t;
+    WFile *file;
 
-        xfer_download_queue(xfer);
-        pktin = sftp_recv();
-        retd = xfer_download_gotpkt(xfer, pktin);
-        if (retd <= 0) {
-            if (!shown_err) {
-                fzprintf(sftpError, "error while reading: %s", fxp_error());
-                shown_err = true;
-            }
-            if (retd == INT_MIN)        /* pktin not even freed */
-                sfree(pktin);
-            ret = 0;
-        }
+    req = fxp_open_send(fname, SSH_FXF_READ, NULL);
+    pktin = sftp_wait_for_reply(req);
+    fh = fxp_open_recv(pktin, req);
+
+    if (!fh) {
+        fzprintf(sftpError, "%s: open for read: %s", fname, fxp_error());
+        return 0;
+    }
 
-        while (xfer_download_data(xfer, &vbuf, &len)) {
-            unsigned char *buf = (unsigned char *)vbuf;
+    {
+        struct fxp_attrs attrs;
+        bool retd;
 
-            wpos = 0;
-            while (file && wpos < len) {
-                wlen = write_to_file(file, buf + wpos, len - wpos);
-                if (wlen <= 0) {
-                    if (!shown_err) {
-                        fzprintf(sftpError, "error while writing local file");
-                        shown_err = true;
-                    }
-                    ret = 0;
-                    xfer_set_error(xfer);
-                    break;
-                }
-                wpos += wlen;
-            }
-            if (wpos < len) {               /* we had an error */
-                ret = 0;
-                xfer_set_error(xfer);
-            }
-            winterval += wpos;
-            sfree(vbuf);
-        }
+        req = fxp_fstat_send(fh);
+        pktin = sftp_wait_for_reply(req);
+        retd = fxp_fstat_recv(pktin, req, &attrs);
 
-        if (fz_timer_check(&timer)) {
-            fzprintf(sftpTransfer, "%d", winterval);
-            winterval = 0;
-        }
+        /* The segment has to lie entirely within the remote file */
+        if (retd && (attrs.flags & SSH_FILEXFER_ATTR_SIZE) &&
+            attrs.size < offset + length) {
+            fzprintf(sftpError, "%s: file is only %"PRIu64" bytes long, "
+                     "segment ends at %"PRIu64, fname, attrs.size,
+                     offset + length);
+
+            req = fxp_close_send(fh);
+            pktin = sftp_wait_for_reply(req);
+            fxp_close_recv(pktin, req);
 
+            return 2;
+        }
     }
 
-    xfer_cleanup(xfer);
+    file = open_existing_wfile(outfname, NULL);
+    if (!file || seek_file(file, offset, FROM_START) != 0) {
+        if (file)
+            close_wfile(file);
+        fzprintf(sftpError, "local: unable to open %s at position %"PRIu64,
+                 outfname, offset);
 
-    close_wfile(file);
+        req = fxp_close_send(fh);
+        pktin = sftp_wait_for_reply(req);
+        fxp_close_recv(pktin, req);
 
-    req = fxp_close_send(fh);
-    pktin = sftp_wait_for_reply(req);
-    fxp_close_recv(pktin, req);
+        return 2;
+    }
 
-    return ret;
-}
+    fzprintf(sftpInfo, "remote:%s => local:%s, bytes %"PRIu64"-%"PRIu64,
+             fname, outfname, offset, offset + length);
 
-int pending_receive() {
-    return ssh_pending_receive(backend);
+    t = transfer_new(true, fh);
+    t->wfile = file;
+    t->xfer = xfer_download_range_init(fh, offset, offset + length);
+    return transfer_start(t);
 }
 
 int sftp_put_file(char *fname, char *outfname, int restart)
 {
     struct fxp_handle *fh;
-    struct fxp_xfer *xfer;
     struct sftp_packet *pktin;
     struct sftp_request *req;
+    struct sftp_transfer *t;
     uint64_t offset;
     RFile *file;
-    bool err = false, eof;
     struct fxp_attrs attrs;
     long permissions;
 
@@ -456,12 +815,10 @@ int sftp_put_file(char *fname, char *outfname, int restart)
 
         if (!retd) {
             fzprintf(sftpError, "read size of %s: %s", outfname, fxp_error());
-            err = true;
             goto cleanup;
         }
         if (!(attrs.flags & SSH_FILEXFER_ATTR_SIZE)) {
             fzprintf(sftpError, "read size of %s: size was not given", outfname);
-            err = true;
             goto cleanup;
         }
         offset = attrs.size;
@@ -474,69 +831,20 @@ int sftp_put_file(char *fname, char *outfname, int restart)
 
     fzprintf(sftpInfo, "local:%s => remote:%s\n", fname, outfname);
 
-    /*
-     * FIXME: we can use FXP_FSTAT here to get the file size, and
-     * thus put up a progress bar.
-     */
-    xfer = xfer_upload_init(fh, offset);
-    eof = false;
-    while ((!err && !eof) || !xfer_done(xfer)) {
-        char buffer[4096*4];
-        int len, ret;
-
-        while (xfer_upload_ready(xfer) && !err && !eof) {
-            len = read_from_file(file, buffer, sizeof(buffer));
-            if (len == -1) {
-                fzprintf(sftpError, "error while reading local file");
-                err = true;
-            } else if (len == 0) {
-                eof = true;
-            } else {
-                xfer_upload_data(xfer, buffer, len);
-                if (pending_receive() >= 5)
-                    break;
-            }
-        }
-
-        if (toplevel_callback_pending() && !err && !eof) {
-            /* If we have pending callbacks, they might make
-             * xfer_upload_ready start to return true. So we should
-             * run them and then re-check xfer_upload_ready, before
-             * we go as far as waiting for an entire packet to
-             * arrive. */
-            run_toplevel_callbacks();
-            continue;
-        }
-
-        if (!xfer_done(xfer)) {
-            pktin = sftp_recv();
-            ret = xfer_upload_gotpkt(xfer, pktin);
-            if (ret <= 0) {
-                if (ret == INT_MIN)        /* pktin not even freed */
-                    sfree(pktin);
-                if (!err) {
-                    fzprintf(sftpError, "error while writing: %s", fxp_error());
-                    err = true;
-                }
-            }
-        }
-    }
-
-    xfer_cleanup(xfer);
+    t = transfer_new(false, fh);
+    t->rfile = file;
+    t->buffer = snewn(UPLOAD_READ_SIZE, char);
+    t->xfer = xfer_upload_init(fh, offset);
+    return transfer_start(t);
 
   cleanup:
     req = fxp_close_send(fh);
     pktin = sftp_wait_for_reply(req);
-    if (!fxp_close_recv(pktin, req)) {
-        if (!err) {
-            fzprintf(sftpError, "error while writing: %s", fxp_error());
-            err = true;
-        }
-    }
+    fxp_close_recv(pktin, req);
 
     close_rfile(file);
 
-    return err ? 0 : 1;
+    return 0;
 }
 
 /* ----------------------------------------------------------------------
@@ -545,9 +853,76 @@ int sftp_put_file(char *fname, char *outfname, int restart)
 struct sftp_command {
     char **words;
     size_t nwords, wordssize;
+    unsigned tag;                      /* 0 if untagged */
     int (*obey) (struct sftp_command *);        /* returns <0 to quit */
 };
 
+/*
+ * Commands prefixed by "#<tag> " come from different clients sharing
+ * this session. Each of them has its own working directory, which is
+ * swapped into pwd while one of its commands runs.
+ */
+struct sftp_client {
+    unsigned tag;
+    char *pwd;
+    struct sftp_client *next;
+};
+
+static struct sftp_client *clients = NULL, *current_client = NULL;
+
+static void select_client(unsigned tag)
+{
+    struct sftp_client *c;
+
+    fzprintf_set_tag(tag);
+
+    if (current_client && current_client->tag == tag)
+        return;
+    if (current_client)
+        current_client->pwd = pwd;
+
+    for (c = clients; c; c = c->next)
+        if (c->tag == tag)
+            break;
+    if (!c) {
+        c = snew(struct sftp_client);
+        c->tag = tag;
+        if (!current_client) {
+            /* Working directory set up before the first command */
+            c->pwd = pwd;
+        } else {
+            c->pwd = NULL;
+        }
+        c->next = clients;
+        clients = c;
+    }
+    if (!c->pwd && homedir)
+        c->pwd = dupstr(homedir);
+
+    current_client = c;
+    pwd = c->pwd;
+}
+
+static void remove_client(unsigned tag)
+{
+    struct sftp_client **prev, *c;
+
+    for (prev = &clients; *prev; prev = &(*prev)->next) {
+        c = *prev;
+        if (c->tag == tag) {
+            *prev = c->next;
+            if (c == current_client) {
+                current_client = NULL;
+                c->pwd = pwd;
+                pwd = NULL;
+            }
+            sfree(c->pwd);
+            sfree(c);
+            return;
+        }
+    }
+}
+
 int sftp_cmd_null(struct sftp_command *cmd)
 {
     return 1;                          /* success */
@@ -632,6 +1007,25 @@ int sftp_cmd_proxy(struct sftp_command *cmd)
     return 1;
 }
 
+/*
+ * A client sharing this session is going away: abort its transfers
+ * and forget its state. There is no reply, the client no longer
+ * listens.
+ */
+int sftp_cmd_detach(struct sftp_command *cmd)
+{
+    if (!cmd->tag) {
+        fzprintf(sftpError, "detach: only valid for tagged commands");
+        return 0;
+    }
+
+    transfer_cancel(cmd->tag);
+    remove_client(cmd->tag);
+    pending_reply = false;
+
+    return 1;
+}
+
 int sftp_cmd_close(struct sftp_command *cmd)
 {
     if (!backend) {
@@ -650,6 +1044,53 @@ int sftp_cmd_close(struct sftp_command *cmd)
     return 0;
 }
 
+/*
+ * Directory entries are passed on in batches rather than one event
+ * per entry. A batch starts with the number of entries, each entry
+ * consists of its attributes followed by the filename and the
+ * longname, all encoded like in SFTP packets.
+ */
+#define LIST_BATCH_SIZE 65536
+
+/* Number of FXP_READDIR requests kept in flight, see sftp_cmd_ls */
+#define LIST_INITIAL_WINDOW 4
+#define LIST_MAX_WINDOW 64
+
+static strbuf *list_batch_new(void)
+{
+    strbuf *batch = strbuf_new();
+    put_uint32(batch, 0); /* entry count, filled in by list_batch_flush */
+    return batch;
+}
+
+static void list_batch_add(strbuf *batch, struct fxp_name *name)
+{
+    /* Attributes not flagged as present are left uninitialised. */
+    const struct fxp_attrs *attrs = &name->attrs;
+    bool has_uidgid = (attrs->flags & SSH_FILEXFER_ATTR_UIDGID) != 0;
+
+    put_uint32(batch, attrs->flags & ~SSH_FILEXFER_ATTR_EXTENDED);
+    put_uint64(batch, (attrs->flags & SSH_FILEXFER_ATTR_SIZE) ? attrs->size : 0);
+    put_uint32(batch, has_uidgid ? attrs->uid : 0);
+    put_uint32(batch, has_uidgid ? attrs->gid : 0);
+    put_uint32(batch, GET_PERMISSIONS(*attrs, 0));
+    put_uint64(batch, (attrs->flags & SSH_FILEXFER_ATTR_ACMODTIME) ? attrs->mtime : 0);
+    put_stringz(batch, name->filename);
+    put_stringz(batch, name->longname);
+
+    PUT_32BIT_MSB_FIRST(batch->u, GET_32BIT_MSB_FIRST(batch->u) + 1);
+}
+
+static strbuf *list_batch_flush(strbuf *batch)
+{
+    if (GET_32BIT_MSB_FIRST(batch->u)) {
+        fzprintf_batch(sftpListentry, batch->u, batch->len);
+        strbuf_free(batch);
+        batch = list_batch_new();
+    }
+    return batch;
+}
+
 /*
  * List a directory. If no arguments are given, list pwd; otherwise
  * list the directory given in words[1].
@@ -662,7 +1103,10 @@ int sftp_cmd_ls(struct sftp_command *cmd)
     char *cdir;
     struct sftp_packet *pktin;
     struct sftp_request *req;
-    struct sftp_request *reqs[4];
+    struct sftp_request *reqs[LIST_MAX_WINDOW];
+    int head = 0, outstanding = 0, window = LIST_INITIAL_WINDOW;
+    bool done = false;
+    strbuf *batch;
     int i;
 
     if (!backend) {
@@ -693,51 +1137,60 @@ int sftp_cmd_ls(struct sftp_command *cmd)
         return 0;
     }
 
-    reqs[0] = fxp_readdir_send(dirh);
-    reqs[1] = fxp_readdir_send(dirh);
-    reqs[2] = fxp_readdir_send(dirh);
-    reqs[3] = fxp_readdir_send(dirh);
-    int ri = 0;
-    while (1) {
+    /*
+     * Keep several FXP_READDIR requests in flight. Every reply that
+     * still carried names widens the window by one request, so it
+     * doubles each round trip until LIST_MAX_WINDOW. Nothing new is
+     * sent once the end of the directory has been seen, the requests
+     * still outstanding at that point are already on the wire.
+     */
+    batch = list_batch_new();
+    while (outstanding < window) {
+        reqs[(head + outstanding++) % LIST_MAX_WINDOW] = fxp_readdir_send(dirh);
+    }
+    while (outstanding) {
+        req = reqs[head];
+        head = (head + 1) % LIST_MAX_WINDOW;
+        --outstanding;
 
-        pktin = sftp_wait_for_reply(reqs[ri]);
-        names = fxp_readdir_recv(pktin, reqs[ri]);
-        reqs[ri] = NULL;
+        pktin = sftp_wait_for_reply(req);
+        names = fxp_readdir_recv(pktin, req);
 
+        if (done) {
+            if (names)
+                fxp_free_names(names);
+            continue;
+        }
         if (names == NULL) {
-            if (fxp_error_type() == SSH_FX_EOF)
-                break;
-            fzprintf(sftpError, "Reading directory %s: %s", dir, fxp_error());
-            break;
+            if (fxp_error_type() != SSH_FX_EOF)
+                fzprintf(sftpError, "Reading directory %s: %s", dir, fxp_error());
+            done = true;
+            continue;
         }
         if (names->nnames == 0) {
             fxp_free_names(names);
-            break;
+            done = true;
+            continue;
         }
 
         for (i = 0; i < names->nnames; i++) {
-            unsigned long mtime = 0;
-            if (names->names[i].attrs.flags & SSH_FILEXFER_ATTR_ACMODTIME) {
-                mtime = names->names[i].attrs.mtime;
-            }
-            fzprintf_raw_untrusted(sftpListentry, "%s", names->names[i].longname);
-            fzprintf_raw_untrusted(sftpUnknown, "%lu", mtime);
-            fzprintf_raw_untrusted(sftpUnknown, "%s", names->names[i].filename);
+            list_batch_add(batch, &names->names[i]);
+        }
+        if (batch->len >= LIST_BATCH_SIZE) {
+            batch = list_batch_flush(batch);
         }
 
         fxp_free_names(names);
-        reqs[ri++] = fxp_readdir_send(dirh);
-        ri %= 4;
-    }
-    for (i = 0; i < 4; ++i) {
-        if (reqs[ri]) {
-            pktin = sftp_wait_for_reply(reqs[ri]);
-            sfree(reqs[ri]);
-            sfree(pktin);
+
+        if (window < LIST_MAX_WINDOW)
+            ++window;
+        while (outstanding < window) {
+            reqs[(head + outstanding++) % LIST_MAX_WINDOW] = fxp_readdir_send(dirh);
         }
-        ++ri;
-        ri %= 4;
     }
+    batch = list_batch_flush(batch);
+    strbuf_free(batch);
+
     req = fxp_close_send(dirh);
     pktin = sftp_wait_for_reply(req);
     fxp_close_recv(pktin, req);
@@ -855,6 +1308,47 @@ int sftp_cmd_reget(struct sftp_command *cmd)
     return sftp_general_get(cmd, true);
 }
 
+/*
+ * getrange <offset> <length> <remote> <local>
+ */
+int sftp_cmd_getrange(struct sftp_command *cmd)
+{
+    char *fname, *end;
+    uint64_t offset, length;
+    int ret;
+
+    if (!backend) {
+        not_connected();
+        return 0;
+    }
+
+    if (cmd->nwords != 5) {
+        fzprintf(sftpError, "%s: expects offset, length and two filenames", cmd->words[0]);
+        return 0;
+    }
+
+    offset = strtoull(cmd->words[1], &end, 10);
+    if (*end || !*cmd->words[1]) {
+        fzprintf(sftpError, "%s: invalid offset", cmd->words[0]);
+        return 0;
+    }
+    length = strtoull(cmd->words[2], &end, 10);
+    if (*end || !*cmd->words[2]) {
+        fzprintf(sftpError, "%s: invalid length", cmd->words[0]);
+        return 0;
+    }
+
+    fname = canonify(cmd->words[3], false);
+    if (!fname) {
+        fzprintf(sftpError, "%s: canonify: %s", cmd->words[3], fxp_error());
+        return 0;
+    }
+
+    ret = sftp_get_file_range(fname, cmd->words[4], offset, length);
+    sfree(fname);
+    return ret;
+}
+
 /*
  * Send a file and store it at the remote end. We have three very
  * similar commands here. The basic one is `put'; `reput' differs
@@ -1404,6 +1898,84 @@ static int sftp_cmd_mtime(struct sftp_command *cmd)
     return 1;
 }
 
+/*
+ * Get the attributes of a single file. They are passed on like a
+ * directory listing with a single entry, followed by the reply. If
+ * the file does not exist, only the reply is sent.
+ *
+ * Like in a listing, a symlink is reported as such rather than as
+ * its target. Its longname is "name -> target", which is where the
+ * engine takes the target from in listings as well.
+ */
+static int sftp_cmd_stat(struct sftp_command *cmd)
+{
+    char *filename, *cname, *target = NULL, *longname = NULL;
+    bool result;
+    struct fxp_name name;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    strbuf *batch;
+
+    if (!backend) {
+        not_connected();
+        return 0;
+    }
+
+    if (cmd->nwords != 2) {
+        fzprintf(sftpError, "stat: expects exactly one filename as argument");
+        return 0;
+    }
+
+    filename = cmd->words[1];
+
+    /* Only canonify the parent, realpath would resolve a symlink */
+    cname = canonify(filename, true);
+    if (!cname) {
+        fzprintf(sftpError, "%s: canonify: %s", filename, fxp_error());
+        return 0;
+    }
+
+    memset(&name, 0, sizeof(name));
+    req = fxp_lstat_send(cname);
+    pktin = sftp_wait_for_reply(req);
+    result = fxp_lstat_recv(pktin, req, &name.attrs);
+
+    if (!result) {
+        if (fxp_error_type() == SSH_FX_NO_SUCH_FILE) {
+            fzprintf(sftpReply, "stat %s: not found", cname);
+            sfree(cname);
+            return 1;
+        }
+
+        fzprintf(sftpError, "get attrs for %s: %s", cname, fxp_error());
+        sfree(cname);
+        return 0;
+    }
+
+    if ((name.attrs.flags & SSH_FILEXFER_ATTR_PERMISSIONS) &&
+        (name.attrs.permissions & 0170000) == 0120000) {
+        req = fxp_readlink_send(cname);
+        pktin = sftp_wait_for_reply(req);
+        target = fxp_readlink_recv(pktin, req);
+        if (target)
+            longname = dupcat(filename, " -> ", target);
+    }
+
+    name.filename = filename;
+    name.longname = longname ? longname : "";
+
+    batch = list_batch_new();
+    list_batch_add(batch, &name);
+    batch = list_batch_flush(batch);
+    strbuf_free(batch);
+
+    fzprintf(sftpReply, "stat %s: OK", cname);
+    sfree(longname);
+    sfree(target);
+    sfree(cname);
+    return 1;
+}
+
 static int sftp_cmd_open(struct sftp_command *cmd)
 {
     int portnumber;
@@ -1467,12 +2039,18 @@ static struct sftp_cmd_lookup {
     {
         "delete", sftp_cmd_rm
     },
+    {
+        "detach", sftp_cmd_detach
+    },
     {
         "exit", sftp_cmd_quit
     },
     {
         "get", sftp_cmd_get
     },
+    {
+        "getrange", sftp_cmd_getrange
+    },
     {
         "keyfile", sftp_cmd_keyfile
     },
@@ -1515,6 +2093,9 @@ static struct sftp_cmd_lookup {
     },
     {
         "rmdir", sftp_cmd_rmdir
+    },
+    {
+        "stat", sftp_cmd_stat
     }
 };
 
@@ -1552,6 +2133,7 @@ struct sftp_command *sftp_getcmd()
     cmd->words = NULL;
     cmd->nwords = 0;
     cmd->wordssize = 0;
+    cmd->tag = 0;
 
     line = ssh_sftp_get_cmdline("psftp> ", !backend);
 
@@ -1564,6 +2146,17 @@ struct sftp_command *sftp_getcmd()
     line[strcspn(line, "\r\n")] = '\0';
 
     p = line;
+
+    /*
+     * A '#' followed by digits is a tag naming the client the command
+     * comes from, any other '#' starts a comment.
+     */
+    if (p[0] == '#' && p[1] >= '0' && p[1] <= '9') {
+        p++;
+        while (*p >= '0' && *p <= '9')
+            cmd->tag = cmd->tag * 10 + (*p++ - '0');
+    }
+
     while (*p && (*p == ' ' || *p == '\t'))
         p++;
 
@@ -1662,6 +2255,18 @@ static int do_sftp_init(void)
         return 1;                      /* failure */
     }
 
+    /*
+     * Find out how large our read and write requests may be.
+     */
+    if (fxp_supports_limits()) {
+        req = fxp_limits_send();
+        pktin = sftp_wait_for_reply(req);
+        if (fxp_limits_recv(pktin, req)) {
+            fzprintf(sftpVerbose, "Server limits: read %d, write %d",
+                     fxp_get_max_read_size(), fxp_get_max_write_size());
+        }
+    }
+
     /*
      * Find out where our home directory is.
      */
@@ -1715,6 +2320,7 @@ int do_sftp()
         cmd = sftp_getcmd();
         if (!cmd)
             break;
+        select_client(cmd->tag);
         pending_reply = true;
         ret = cmd->obey(cmd);
         if (cmd->words) {
@@ -1803,6 +2409,20 @@ bool sftp_recvdata(char *buf, size_t len)
 
     return true;
 }
+/*
+ * Returns true if a complete SFTP packet has been received, so that
+ * sftp_recv won't block.
+ */
+static bool sftp_packet_available(void)
+{
+    char x[4];
+
+    if (bufchain_size(&received_data) < 4)
+        return false;
+    bufchain_fetch(&received_data, x, 4);
+    return bufchain_size(&received_data) - 4 >= GET_32BIT_MSB_FIRST(x);
+}
+
 bool sftp_senddata(const char *buf, size_t len)
 {
     backend_send(backend, buf, len);
@@ -32,6 +32,14 @@ void get_file_times(char *filename, unsigned long *mtime,
  */
 int ssh_sftp_loop_iteration(void);
 
+/*
+ * Feed the file transfers running in the background with the replies
+ * that have arrived so far and complete those that have finished.
+ * Must be called by ssh_sftp_get_cmdline each time before it waits
+ * for input or network activity.
+ */
+void sftp_service_transfers(void);
+
 /*
  * Read a command line for PSFTP from standard input. Caller must
  * free.
@@ -8,11 +8,11 @@
 #include <assert.h>
 #include <limits.h>
 
+#include "putty.h"
 #include "misc.h"
 #include "tree234.h"
 #include "sftp.h"
 
-#include "fzprintf.h"
 #include "fzsftp.h"
 
 static char *fxp_error_message = NULL;
@@ -268,6 +268,15 @@ int fxp_error_type(void)
     return fxp_errtype;
 }
 
+/*
+ * Request sizes. Every server has to accept requests of the default
+ * size; larger ones are only used if the server tells us it accepts
+ * them.
+ */
+static bool fxp_has_limits_ext = false;
+static int fxp_max_read_size = FXP_DEFAULT_REQUEST_SIZE;
+static int fxp_max_write_size = FXP_DEFAULT_REQUEST_SIZE;
+
 /*
  * Perform exchange of init/version packets. Return 0 on failure.
  */
@@ -303,16 +312,99 @@ bool fxp_init(void)
         return false;
     }
     /*
-     * In principle, this packet might also contain extension-
-     * string pairs. We should work through them and look for any
-     * we recognise. In practice we don't currently do so because
-     * we know we don't recognise _any_.
+     * The packet may contain extension-string pairs. The only one we
+     * recognise is limits@openssh.com, which lets us ask the server
+     * for the largest read and write requests it accepts.
      */
+    fxp_has_limits_ext = false;
+    while (get_avail(pktin)) {
+        ptrlen name = get_string(pktin);
+        ptrlen data = get_string(pktin);
+        if (get_err(pktin))
+            break;
+        if (ptrlen_eq_string(name, "limits@openssh.com") &&
+            ptrlen_eq_string(data, "1"))
+            fxp_has_limits_ext = true;
+    }
     sftp_pkt_free(pktin);
 
     return true;
 }
 
+bool fxp_supports_limits(void)
+{
+    return fxp_has_limits_ext;
+}
+
+/*
+ * Query the server's limits, see fxp_supports_limits.
+ */
+struct sftp_request *fxp_limits_send(void)
+{
+    struct sftp_request *req = sftp_alloc_request();
+    struct sftp_packet *pktout;
+
+    pktout = sftp_pkt_init(SSH_FXP_EXTENDED);
+    put_uint32(pktout, req->id);
+    put_stringz(pktout, "limits@openssh.com");
+    sftp_send(pktout);
+
+    return req;
+}
+
+bool fxp_limits_recv(struct sftp_packet *pktin, struct sftp_request *req)
+{
+    sfree(req);
+
+    if (pktin->type == SSH_FXP_EXTENDED_REPLY) {
+        uint64_t max_packet = get_uint64(pktin);
+        uint64_t max_read = get_uint64(pktin);
+        uint64_t max_write = get_uint64(pktin);
+        get_uint64(pktin); /* max open handles */
+        if (get_err(pktin)) {
+            fxp_internal_error("malformed limits@openssh.com reply");
+            sftp_pkt_free(pktin);
+            return false;
+        }
+
+        /*
+         * Zero means no limit was given. Leave room for the packet
+         * headers below the maximum packet length.
+         */
+        if (max_packet && max_packet > 1024) {
+            if (!max_read || max_read > max_packet - 1024)
+                max_read = max_packet - 1024;
+            if (!max_write || max_write > max_packet - 1024)
+                max_write = max_packet - 1024;
+        }
+        if (max_read > FXP_MAX_REQUEST_SIZE || !max_read)
+            max_read = FXP_MAX_REQUEST_SIZE;
+        if (max_write > FXP_MAX_REQUEST_SIZE || !max_write)
+            max_write = FXP_MAX_REQUEST_SIZE;
+        if (max_read >= FXP_DEFAULT_REQUEST_SIZE)
+            fxp_max_read_size = (int)max_read;
+        if (max_write >= FXP_DEFAULT_REQUEST_SIZE)
+            fxp_max_write_size = (int)max_write;
+
+        sftp_pkt_free(pktin);
+        return true;
+    } else {
+        fxp_got_status(pktin);
+        sftp_pkt_free(pktin);
+        return false;
+    }
+}
+
+int fxp_get_max_read_size(void)
+{
+    return fxp_max_read_size;
+}
+
+int fxp_get_max_write_size(void)
+{
+    return fxp_max_write_size;
+}
+
 /*
  * Canonify a pathname.
  */
@@ -360,6 +452,53 @@ char *fxp_realpath_recv(struct sftp_packet *pktin, struct sftp_request *req)
     }
 }
 
+/*
+ * Read the target of a symlink.
+ */
+struct sftp_request *fxp_readlink_send(const char *path)
+{
+    struct sftp_request *req = sftp_alloc_request();
+    struct sftp_packet *pktout;
+
+    pktout = sftp_pkt_init(SSH_FXP_READLINK);
+    put_uint32(pktout, req->id);
+    put_stringz(pktout, path);
+    sftp_send(pktout);
+
+    return req;
+}
+
+char *fxp_readlink_recv(struct sftp_packet *pktin, struct sftp_request *req)
+{
+    sfree(req);
+
+    if (pktin->type == SSH_FXP_NAME) {
+        unsigned long count;
+        char *target;
+        ptrlen name;
+
+        count = get_uint32(pktin);
+        if (get_err(pktin) || count != 1) {
+            fxp_internal_error("READLINK did not return name count of 1");
+            sftp_pkt_free(pktin);
+            return NULL;
+        }
+        name = get_string(pktin);
+        if (get_err(pktin)) {
+            fxp_internal_error("READLINK returned malformed FXP_NAME");
+            sftp_pkt_free(pktin);
+            return NULL;
+        }
+        target = mkstr(name);
+        sftp_pkt_free(pktin);
+        return target;
+    } else {
+        fxp_got_status(pktin);
+        sftp_pkt_free(pktin);
+        return NULL;
+    }
+}
+
 /*
  * Open a file.
  */
@@ -601,6 +740,25 @@ bool fxp_stat_recv(struct sftp_packet *pktin, struct sftp_request *req,
     }
 }
 
+struct sftp_request *fxp_lstat_send(const char *fname)
+{
+    struct sftp_request *req = sftp_alloc_request();
+    struct sftp_packet *pktout;
+
+    pktout = sftp_pkt_init(SSH_FXP_LSTAT);
+    put_uint32(pktout, req->id);
+    put_stringz(pktout, fname);
+    sftp_send(pktout);
+
+    return req;
+}
+
+bool fxp_lstat_recv(struct sftp_packet *pktin, struct sftp_request *req,
+                    struct fxp_attrs *attrs)
+{
+    return fxp_stat_recv(pktin, req, attrs);
+}
+
 struct sftp_request *fxp_fstat_send(struct fxp_handle *handle)
 {
     struct sftp_request *req = sftp_alloc_request();
@@ -897,17 +1055,40 @@ struct req {
     char *buffer;
     int len, retlen, complete;
     uint64_t offset;
+    unsigned long sent;
+    struct fxp_xfer *xfer;
     struct req *next, *prev;
 };
 
+/*
+ * The amount of data requested but not yet received, or written but
+ * not yet acknowledged, starts at XFER_INITIAL_WINDOW. Both directions
+ * grow it up to XFER_MAX_WINDOW so that it covers twice the measured
+ * bandwidth-delay product.
+ *
+ * Uploads additionally stop queueing writes while more than
+ * XFER_UPLOAD_SENDBUFFER bytes sit in the SSH send buffer, so that a
+ * small SSH channel window or the speed limit doesn't make the whole
+ * upload window pile up in memory.
+ */
+#define XFER_INITIAL_WINDOW (4 * 1048576)
+#define XFER_MAX_WINDOW (64 * 1048576)
+#define XFER_WINDOW_INTERVAL 1000
+#define XFER_UPLOAD_SENDBUFFER (1 * 1048576)
+
 struct fxp_xfer {
     uint64_t offset, furthestdata, filesize;
+    uint64_t end; /* downloads stop requesting data here */
     int req_totalsize, req_maxsize;
     bool eof, err;
     struct fxp_handle *fh;
     struct req *head, *tail;
     _fztimer send_timer;
     int sent_interval;
+
+    /* Window tuning, see xfer_window_sample */
+    unsigned long min_rtt, interval_start;
+    uint64_t interval_bytes;
 };
 
 static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64_t offset)
@@ -918,16 +1099,62 @@ static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64_t offset)
     xfer->offset = offset;
     xfer->head = xfer->tail = NULL;
     xfer->req_totalsize = 0;
-    xfer->req_maxsize = 1048576*4;
+    xfer->req_maxsize = XFER_INITIAL_WINDOW;
     xfer->err = false;
     xfer->filesize = UINT64_MAX;
+    xfer->end = UINT64_MAX;
     xfer->furthestdata = 0;
     fz_timer_init(&xfer->send_timer);
     xfer->sent_interval = 0;
+    xfer->min_rtt = ULONG_MAX;
+    xfer->interval_start = GETTICKCOUNT();
+    xfer->interval_bytes = 0;
 
     return xfer;
 }
 
+/*
+ * Called for every completed read or write. Once per interval, compares the
+ * window against the bandwidth-delay product, using the throughput of
+ * the last interval and the smallest round-trip time seen, and grows
+ * it if it is too small to keep the link busy.
+ */
+static void xfer_window_sample(struct fxp_xfer *xfer, struct req *rr,
+                               int bytes)
+{
+    unsigned long now = GETTICKCOUNT();
+    unsigned long rtt = now - rr->sent;
+    unsigned long elapsed;
+
+    if (rtt < xfer->min_rtt)
+        xfer->min_rtt = rtt;
+    if (bytes > 0)
+        xfer->interval_bytes += bytes;
+
+    elapsed = now - xfer->interval_start;
+    if (elapsed < XFER_WINDOW_INTERVAL)
+        return;
+
+    if (xfer->min_rtt != ULONG_MAX) {
+        /* Treat sub-millisecond round trips as 1 ms */
+        uint64_t rtt_ms = xfer->min_rtt ? xfer->min_rtt : 1;
+        uint64_t bdp = xfer->interval_bytes * rtt_ms / elapsed;
+        uint64_t target = bdp * 2;
+        if (target > XFER_MAX_WINDOW)
+            target = XFER_MAX_WINDOW;
+        if (target > (uint64_t)xfer->req_maxsize) {
+#if defined(DEBUG_DOWNLOAD) || defined(DEBUG_UPLOAD)
+            printf("growing window from %d to %"PRIu64"\n",
+                   xfer->req_maxsize, target);
+#endif
+            xfer->req_maxsize = (int)target;
+        }
+    }
+
+    xfer->interval_start = now;
+    xfer->interval_bytes = 0;
+}
+
 bool xfer_done(struct fxp_xfer *xfer)
 {
     /*
@@ -947,6 +1174,12 @@ void xfer_download_queue(struct fxp_xfer *xfer)
         struct req *rr;
         struct sftp_request *req;
 
+        if (xfer->offset >= xfer->end) {
+            /* Everything requested, finish once the replies are in */
+            xfer->eof = true;
+            break;
+        }
+
         rr = snew(struct req);
         rr->offset = xfer->offset;
         rr->complete = 0;
@@ -960,8 +1193,12 @@ void xfer_download_queue(struct fxp_xfer *xfer)
         xfer->tail = rr;
         rr->next = NULL;
 
-        rr->len = 32768;
+        rr->len = fxp_max_read_size;
+        if (xfer->end - xfer->offset < (uint64_t)rr->len)
+            rr->len = (int)(xfer->end - xfer->offset);
         rr->buffer = snewn(rr->len, char);
+        rr->sent = GETTICKCOUNT();
+        rr->xfer = xfer;
         sftp_register(req = fxp_read_send(xfer->fh, rr->offset, rr->len));
         fxp_set_userdata(req, rr);
 
@@ -984,6 +1221,22 @@ struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset)
     return xfer;
 }
 
+/*
+ * Like xfer_download_init, but only downloads the data up to the
+ * given end offset.
+ */
+struct fxp_xfer *xfer_download_range_init(struct fxp_handle *fh,
+                                          uint64_t offset, uint64_t end)
+{
+    struct fxp_xfer *xfer = xfer_init(fh, offset);
+
+    xfer->eof = false;
+    xfer->end = end;
+    xfer_download_queue(xfer);
+
+    return xfer;
+}
+
 /*
  * Returns INT_MIN to indicate that it didn't even get as far as
  * fxp_read_recv and hence has not freed pktin.
@@ -991,13 +1244,20 @@ struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset)
 int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 {
     struct sftp_request *rreq;
-    struct req *rr;
 
     rreq = sftp_find_request(pktin);
     if (!rreq)
         return INT_MIN;            /* this packet doesn't even make sense */
+    return xfer_download_gotreq(xfer, rreq, pktin);
+}
+
+int xfer_download_gotreq(struct fxp_xfer *xfer, struct sftp_request *rreq,
+                         struct sftp_packet *pktin)
+{
+    struct req *rr;
+
     rr = (struct req *)fxp_get_userdata(rreq);
-    if (!rr) {
+    if (!rr || rr->xfer != xfer) {
         fxp_internal_error("request ID is not part of the current download");
         return INT_MIN;                /* this packet isn't ours */
     }
@@ -1021,6 +1281,7 @@ int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
     }
 
     rr->complete = 1;
+    xfer_window_sample(xfer, rr, rr->retlen);
 
     /*
      * Special case: if we have received fewer bytes than we
@@ -1130,7 +1391,8 @@ struct fxp_xfer *xfer_upload_init(struct fxp_handle *fh, uint64_t offset)
 
 bool xfer_upload_ready(struct fxp_xfer *xfer)
 {
-    return sftp_sendbuffer() == 0;
+    return xfer->req_totalsize < xfer->req_maxsize &&
+        sftp_sendbuffer() < XFER_UPLOAD_SENDBUFFER;
 }
 
 void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
@@ -1153,6 +1415,8 @@ void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
 
     rr->len = len;
     rr->buffer = NULL;
+    rr->sent = GETTICKCOUNT();
+    rr->xfer = xfer;
     sftp_register(req = fxp_write_send(xfer->fh, buffer, rr->offset, len));
     fxp_set_userdata(req, rr);
 
@@ -1172,14 +1436,21 @@ void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
 int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 {
     struct sftp_request *rreq;
-    struct req *rr, *prev, *next;
-    bool ret;
 
     rreq = sftp_find_request(pktin);
     if (!rreq)
         return INT_MIN;            /* this packet doesn't even make sense */
+    return xfer_upload_gotreq(xfer, rreq, pktin);
+}
+
+int xfer_upload_gotreq(struct fxp_xfer *xfer, struct sftp_request *rreq,
+                       struct sftp_packet *pktin)
+{
+    struct req *rr, *prev, *next;
+    bool ret;
+
     rr = (struct req *)fxp_get_userdata(rreq);
-    if (!rr) {
+    if (!rr || rr->xfer != xfer) {
         fxp_internal_error("request ID is not part of the current upload");
         return INT_MIN;                /* this packet isn't ours */
     }
@@ -1203,6 +1474,8 @@ int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
         xfer->tail = prev;
     xfer->req_totalsize -= rr->len;
     xfer->sent_interval += rr->len;
+    if (ret)
+        xfer_window_sample(xfer, rr, rr->len);
     if (fz_timer_check(&xfer->send_timer)) {
 	/* The data we sent is the data we earlier read from file */
         fzprintf(sftpTransfer, "%d", xfer->sent_interval);
@@ -1216,6 +1489,12 @@ int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
     return 1;
 }
 
+struct fxp_xfer *xfer_from_request(struct sftp_request *rreq)
+{
+    struct req *rr = (struct req *)fxp_get_userdata(rreq);
+    return rr ? rr->xfer : NULL;
+}
+
 void xfer_cleanup(struct fxp_xfer *xfer)
 {
     if (xfer->sent_interval > 0) {
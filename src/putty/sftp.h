@@ -22,6 +22,7 @@
 #define SSH_FXP_REALPATH                          16    /* 0x10 */
 #define SSH_FXP_STAT                              17    /* 0x11 */
 #define SSH_FXP_RENAME                            18    /* 0x12 */
+#define SSH_FXP_READLINK                          19    /* 0x13 */
 #define SSH_FXP_STATUS                            101   /* 0x65 */
 #define SSH_FXP_HANDLE                            102   /* 0x66 */
 #define SSH_FXP_DATA                              103   /* 0x67 */
@@ -168,6 +169,21 @@ int fxp_error_type(void);
  */
 bool fxp_init(void);
 
+/*
+ * Default size of read and write requests, every server accepts
+ * these. Larger requests, up to FXP_MAX_REQUEST_SIZE, are only sent
+ * if the server supports the limits@openssh.com extension and its
+ * limits allow them.
+ */
+#define FXP_DEFAULT_REQUEST_SIZE 32768
+#define FXP_MAX_REQUEST_SIZE (256 * 1024)
+
+bool fxp_supports_limits(void);
+struct sftp_request *fxp_limits_send(void);
+bool fxp_limits_recv(struct sftp_packet *pktin, struct sftp_request *req);
+int fxp_get_max_read_size(void);
+int fxp_get_max_write_size(void);
+
 /*
  * Canonify a pathname. Concatenate the two given path elements
  * with a separating slash, unless the second is NULL.
@@ -175,6 +191,12 @@ bool fxp_init(void);
 struct sftp_request *fxp_realpath_send(const char *path);
 char *fxp_realpath_recv(struct sftp_packet *pktin, struct sftp_request *req);
 
+/*
+ * Read the target of a symlink.
+ */
+struct sftp_request *fxp_readlink_send(const char *path);
+char *fxp_readlink_recv(struct sftp_packet *pktin, struct sftp_request *req);
+
 /*
  * Open a file. 'attrs' contains attributes to be applied to the file
  * if it's being created.
@@ -232,6 +254,10 @@ bool fxp_stat_recv(struct sftp_packet *pktin, struct sftp_request *req,
 struct sftp_request *fxp_fstat_send(struct fxp_handle *handle);
 bool fxp_fstat_recv(struct sftp_packet *pktin, struct sftp_request *req,
                     struct fxp_attrs *attrs);
+/* Like stat, but does not follow a symlink given as fname. */
+struct sftp_request *fxp_lstat_send(const char *fname);
+bool fxp_lstat_recv(struct sftp_packet *pktin, struct sftp_request *req,
+                    struct fxp_attrs *attrs);
 
 /*
  * Set file attributes.
@@ -299,14 +325,29 @@ struct sftp_packet *sftp_recv(void);
 struct fxp_xfer;
 
 struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset);
+struct fxp_xfer *xfer_download_range_init(struct fxp_handle *fh,
+                                          uint64_t offset, uint64_t end);
 void xfer_download_queue(struct fxp_xfer *xfer);
 int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin);
+int xfer_download_gotreq(struct fxp_xfer *xfer, struct sftp_request *rreq,
+                         struct sftp_packet *pktin);
 bool xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len);
 
 struct fxp_xfer *xfer_upload_init(struct fxp_handle *fh, uint64_t offset);
 bool xfer_upload_ready(struct fxp_xfer *xfer);
 void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len);
 int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin);
+int xfer_upload_gotreq(struct fxp_xfer *xfer, struct sftp_request *rreq,
+                       struct sftp_packet *pktin);
+
+/*
+ * Returns the transfer a request was queued for, or NULL if it
+ * doesn't belong to any. Lets several transfers share the
+ * connection: the caller looks up the request of an incoming packet
+ * with sftp_find_request and hands it to the *_gotreq function of
+ * the owning transfer.
+ */
+struct fxp_xfer *xfer_from_request(struct sftp_request *rreq);
 
 bool xfer_done(struct fxp_xfer *xfer);
 void xfer_set_error(struct fxp_xfer *xfer);
@@ -608,6 +608,7 @@ char *ssh_sftp_get_cmdline(const char *prompt, bool no_fds_ok)
 
 
     while (1) {
+        sftp_service_transfers();
         ret = ssh_sftp_do_select(true, no_fds_ok);
         if (ret < 0) {
             printf("connection died\n");
@@ -4,6 +4,8 @@
 
 #include <winsock2.h> /* need to put this first, for winelib builds */
 #include <assert.h>
+#include <fcntl.h>
+#include <io.h>
 
 #define NEED_DECLARATION_OF_SELECT
 
@@ -771,6 +773,10 @@ char *ssh_sftp_get_cmdline(const char *prompt, bool no_fds_ok)
     fflush(stdout);
     */
 
+    /* Commands that arrived while waiting for quota */
+    if (has_input_pushback())
+        return get_input_pushback();
+
     if ((sftp_ssh_socket == INVALID_SOCKET && no_fds_ok) ||
         p_WSAEventSelect == NULL) {
         return fgetline(stdin);        /* very simple */
@@ -791,6 +797,7 @@ char *ssh_sftp_get_cmdline(const char *prompt, bool no_fds_ok)
     }
 
     do {
+        sftp_service_transfers();
         ret = do_eventsel_loop(ctx->event);
 
         /* do_eventsel_loop can't return an error (unlike
@@ -821,6 +828,9 @@ int main(int argc, char *argv[])
 
     dll_hijacking_protection();
 
+    /* Directory listings are sent as binary data, no newline translation */
+    _setmode(_fileno(stdout), _O_BINARY);
+
     ret = psftp_main(argc, argv);
 
     return ret;
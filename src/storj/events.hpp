@@ -16,11 +16,12 @@ enum class storjEvent {
 	Transfer,
 	UsedQuotaRecv,
 	UsedQuotaSend,
+	ListCursor,
 
 	count
 };
 
-#define FZSTORJ_PROTOCOL_VERSION 1
+#define FZSTORJ_PROTOCOL_VERSION 3
 
 #endif
 
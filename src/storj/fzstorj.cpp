@@ -1,24 +1,48 @@
 #include <stdio.h>
-#include <fstream>
 #include <ctime>
 
 #include "events.hpp"
 
+#include <libfilezilla/file.hpp>
 #include <libfilezilla/format.hpp>
+#include <libfilezilla/local_filesys.hpp>
 #include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
 
 typedef bool _Bool;
 #include "libuplinkc.h"
-#include "require.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 
 fz::mutex output_mutex;
 
+// Tag of the command being processed by the current thread. Events
+// generated by tagged commands carry the tag so that the engine can
+// tell concurrently running commands apart.
+thread_local std::string current_tag;
+
+void fzprintf_tag()
+{
+	if (!current_tag.empty()) {
+		fputc('#', stdout);
+		fwrite(current_tag.c_str(), current_tag.size(), 1, stdout);
+		fputc(' ', stdout);
+	}
+}
+
 void fzprintf(storjEvent event)
 {
 	fz::scoped_lock l(output_mutex);
 
+	fzprintf_tag();
 	fputc('0' + static_cast<int>(event), stdout);
 
 	fflush(stdout);
@@ -29,6 +53,7 @@ void fzprintf(storjEvent event, Args &&... args)
 {
 	fz::scoped_lock l(output_mutex);
 
+	fzprintf_tag();
 	fputc('0' + static_cast<int>(event), stdout);
 
 	std::string s = fz::sprintf(std::forward<Args>(args)...);
@@ -101,7 +126,109 @@ std::string next_argument(std::string & line)
 namespace {
 #define DEBUG_MODE false
 
-extern "C" void fv_listBuckets(Project *project)
+fz::mutex cancel_mutex;
+std::set<std::string> canceled_tags;
+
+// Checked by long-running operations between chunks
+bool is_canceled()
+{
+	if (current_tag.empty()) {
+		return false;
+	}
+	fz::scoped_lock l(cancel_mutex);
+	return canceled_tags.find(current_tag) != canceled_tags.end();
+}
+
+// Runs tagged commands concurrently. Threads are started on demand up to
+// the configured maximum.
+class worker_pool final
+{
+public:
+	~worker_pool()
+	{
+		{
+			std::unique_lock<std::mutex> l(mutex_);
+			quit_ = true;
+		}
+		cond_.notify_all();
+		for (auto & t : threads_) {
+			t.join();
+		}
+	}
+
+	void set_max_workers(size_t max)
+	{
+		std::unique_lock<std::mutex> l(mutex_);
+		max_workers_ = max ? max : 1;
+	}
+
+	// Whether commands with the given tag are queued or running
+	bool active(std::string const& tag)
+	{
+		std::unique_lock<std::mutex> l(mutex_);
+		return active_.find(tag) != active_.end();
+	}
+
+	void add(std::string const& tag, std::function<void()> && task)
+	{
+		std::unique_lock<std::mutex> l(mutex_);
+		++active_[tag];
+		tasks_.emplace_back(tag, std::move(task));
+		if (!idle_ && threads_.size() < max_workers_) {
+			threads_.emplace_back([this]() { entry(); });
+		}
+		else {
+			cond_.notify_one();
+		}
+	}
+
+private:
+	void entry()
+	{
+		std::unique_lock<std::mutex> l(mutex_);
+		while (true) {
+			if (tasks_.empty()) {
+				if (quit_) {
+					break;
+				}
+				++idle_;
+				cond_.wait(l);
+				--idle_;
+				continue;
+			}
+
+			auto task = std::move(tasks_.front());
+			tasks_.pop_front();
+
+			l.unlock();
+			current_tag = task.first;
+			task.second();
+			current_tag.clear();
+
+			// Forget the cancel once the tag has nothing left to run. Same lock
+			// order as the cancel command, so no cancel gets recorded for an
+			// idle tag.
+			fz::scoped_lock cl(cancel_mutex);
+			l.lock();
+			auto it = active_.find(task.first);
+			if (it != active_.end() && !--it->second) {
+				active_.erase(it);
+				canceled_tags.erase(task.first);
+			}
+		}
+	}
+
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::deque<std::pair<std::string, std::function<void()>>> tasks_;
+	std::vector<std::thread> threads_;
+	std::map<std::string, size_t> active_;
+	size_t max_workers_{4};
+	size_t idle_{};
+	bool quit_{};
+};
+
+extern "C" bool fv_listBuckets(Project *project)
 {
 	BucketIterator *it = list_buckets(project, NULL);
 
@@ -129,21 +256,53 @@ extern "C" void fv_listBuckets(Project *project)
 		fzprintf(storjEvent::Error, "bucket listing failed: %s", err->message);
 		free_error(err);
 		free_bucket_iterator(it);
-		return;
-	}	
-		
+		return false;
+	}
+
 	free_bucket_iterator(it);
+	return true;
+}
+
+// Prints the object as Listentry, its name relative to the prefix. The
+// prefix is either empty or ends in a slash.
+void fv_printObject(Object *object, std::string const& prefix)
+{
+	char lc_a1_dateTime[64]{};
+	if (object->system.created != 0) {
+		std::time_t l_epoch = object->system.created;
+		std::strftime(lc_a1_dateTime, 64, "%Y/%m/%d %I:%M:%S %p", std::gmtime(&l_epoch));
+	}
+
+	std::string objectName = object->key;
+	if(!prefix.empty()) {
+		size_t pos = objectName.find(prefix);
+		if (pos != std::string::npos) {
+			objectName = objectName.substr(pos+prefix.size(), objectName.size());
+		}
+	}
+
+	if (prefix.empty()) {
+		fzprintf(storjEvent::Listentry, "%s\n%d\nid:%s\n%s", objectName, object->system.content_length, objectName, lc_a1_dateTime);
+	}
+	else {
+		fzprintf(storjEvent::Listentry, "%s\n%d\nid:%s%s\n%s", objectName, object->system.content_length, prefix, objectName, lc_a1_dateTime);
+	}
 }
 
-extern "C" void fv_listObjects(Project *project, std::string bucket, std::string prefix)
-{			
+// Listings are sent in pages of this many entries. If there are more,
+// the page ends with a ListCursor event, the engine then asks for the next
+// page starting after the cursor.
+int const list_page_size = 1000;
+
+extern "C" bool fv_listObjects(Project *project, std::string bucket, std::string prefix, std::string const& cursor)
+{
 	if(!(prefix.empty()))
 		prefix = prefix + "/";
-	
+
 	ListObjectsOptions options = {
 		prefix : const_cast<char*>(prefix.c_str()),
-		cursor : "",
-		recursive: false, 
+		cursor : const_cast<char*>(cursor.c_str()),
+		recursive: false,
 		system : true,
 		custom : true,
 	};
@@ -151,208 +310,1080 @@ extern "C" void fv_listObjects(Project *project, std::string bucket, std::string
 	ObjectIterator *it = list_objects(project, const_cast<char*>(bucket.c_str()), &options);
 
 	int count = 0;
+	std::string last_key;
 	while (object_iterator_next(it)) {
-		Object *object = object_iterator_item(it);
-		
-		char lc_a1_dateTime[64];
-		if (object->system.created != 0) {
-			std::time_t l_epoch = object->system.created;
-			std::strftime(lc_a1_dateTime, 64, "%Y/%m/%d %I:%M:%S %p", std::gmtime(&l_epoch));
-		}
-			
-		std::string objectName = object->key;
-		if(!prefix.empty()) {
-			size_t pos = objectName.find(prefix);
-			if (pos != std::string::npos) {
-				objectName = objectName.substr(pos+prefix.size(), objectName.size());
-			}
+		if (count == list_page_size) {
+			fzprintf(storjEvent::ListCursor, "%s", last_key);
+			break;
 		}
 
-		if (prefix.empty()) {
-			fzprintf(storjEvent::Listentry, "%s\n%d\nid:%s\n%s", objectName, object->system.content_length, objectName, lc_a1_dateTime);
-		} 
-		else {
-			fzprintf(storjEvent::Listentry, "%s\n%d\nid:%s%s\n%s", objectName, object->system.content_length, prefix, objectName, lc_a1_dateTime);
-		}
-				
+		Object *object = object_iterator_item(it);
+		fv_printObject(object, prefix);
+		last_key = object->key;
 		free_object(object);
 		count++;
 	}
-			
+
 	Error *err = object_iterator_err(it);
 	if (err) {
 		fzprintf(storjEvent::Error, "object listing failed: %s", err->message);
 		free_error(err);
 		free_object_iterator(it);
-		return;
+		return false;
 	}
 	free_object_iterator(it);
+	return true;
 }
 
-extern "C" void fv_downloadObject(Project *project, std::string bucket, std::string id, std::string file)
+// Coalesces progress into at most one Transfer event per interval, a
+// Transfer line per chunk floods the pipe to the engine. Can be shared
+// by the threads of a multipart upload.
+class progress_reporter final
 {
-	DownloadResult download_result = download_object(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(id.c_str()), NULL);
-    if (download_result.error) {
-        fzprintf(storjEvent::Error, "download starting failed: %s", download_result.error->message);
-        free_download_result(download_result);
-        return;
-    }
-
-	size_t buffer_size = 32768;
-    char *buffer = static_cast<char*>(malloc(buffer_size));
-	std::ofstream outfile (file, std::ofstream::binary);
-
-    Download *download = download_result.download;
-	
-	size_t downloaded_total = 0;
-    
-    while (true) {
-        ReadResult result = download_read(download, buffer, buffer_size);
-        downloaded_total += result.bytes_read;
-		
-		outfile.write(buffer, result.bytes_read);
-				
-		fzprintf(storjEvent::Transfer, "%u", result.bytes_read);
-
-        if (result.error) {
-            if (result.error->code == EOF) {
-                free_read_result(result);
-                break;
-            }
-            fzprintf(storjEvent::Error, "download failed to read: %s", result.error->message);
-            free_read_result(result);
-            return;
-        }
-        free_read_result(result);
-    }
-
-    Error *close_error = close_download(download);
-    if (close_error) {
-        fzprintf(storjEvent::Error, "download failed to close: %s", close_error->message);
-        free_error(close_error);
-    }
-
-    free_download_result(download_result);
+public:
+	~progress_reporter()
+	{
+		flush();
+	}
+
+	void add(int64_t bytes)
+	{
+		fz::scoped_lock l(mutex_);
+		pending_ += bytes;
+		auto const now = fz::monotonic_clock::now();
+		if (!last_ || (now - last_) >= fz::duration::from_milliseconds(100)) {
+			last_ = now;
+			flush();
+		}
+	}
+
+	void flush()
+	{
+		fz::scoped_lock l(mutex_);
+		if (pending_) {
+			fzprintf(storjEvent::Transfer, "%d", pending_);
+			pending_ = 0;
+		}
+	}
+
+private:
+	fz::mutex mutex_{true};
+	fz::monotonic_clock last_;
+	int64_t pending_{};
+};
+
+std::atomic<size_t> transfer_buffer_size{4 * 1024 * 1024};
+std::atomic<bool> preallocate_space{false};
+
+std::atomic<int> parallel_downloads{4};
+
+// Objects with at least this much left to download are fetched as
+// several ranged downloads at once
+int64_t const ranged_download_threshold = 256 * 1024 * 1024;
+int64_t const ranged_download_segment_size = 64 * 1024 * 1024;
+
+// Downloads length bytes of the object starting at offset into the already
+// opened file at its current position. A length of -1 reads to the end.
+bool fv_downloadRange(Project *project, std::string const& bucket, std::string const& id, std::string const& file, fz::file & outfile, int64_t offset, int64_t length, progress_reporter & progress)
+{
+	DownloadOptions options = {
+		offset : offset,
+		length : length,
+	};
+
+	DownloadResult download_result = download_object(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(id.c_str()), &options);
+	if (download_result.error) {
+		fzprintf(storjEvent::Error, "download starting failed: %s", download_result.error->message);
+		free_download_result(download_result);
+		return false;
+	}
+
+	Download *download = download_result.download;
+
+	size_t buffer_size = transfer_buffer_size;
+	if (length >= 0 && static_cast<int64_t>(buffer_size) > length) {
+		buffer_size = static_cast<size_t>(length ? length : 1);
+	}
+	std::vector<char> buffer(buffer_size);
+
+	bool success = true;
+	while (true) {
+		if (is_canceled()) {
+			fzprintf(storjEvent::Error, "download canceled");
+			success = false;
+			break;
+		}
+
+		// Fill the whole buffer before writing it out, download_read
+		// returns much smaller pieces than we want to write.
+		size_t filled = 0;
+		bool eof = false;
+		while (filled < buffer_size) {
+			ReadResult result = download_read(download, buffer.data() + filled, buffer_size - filled);
+			filled += result.bytes_read;
+
+			if (result.error) {
+				if (result.error->code == EOF) {
+					eof = true;
+				}
+				else {
+					fzprintf(storjEvent::Error, "download failed to read: %s", result.error->message);
+					success = false;
+				}
+				free_read_result(result);
+				break;
+			}
+			free_read_result(result);
+		}
+
+		if (filled && outfile.write(buffer.data(), filled) != static_cast<int64_t>(filled)) {
+			fzprintf(storjEvent::Error, "failed to write to %s", file);
+			success = false;
+		}
+		progress.add(filled);
+
+		if (!success || eof) {
+			break;
+		}
+	}
+
+	Error *close_error = close_download(download);
+	if (close_error) {
+		if (success) {
+			fzprintf(storjEvent::Error, "download failed to close: %s", close_error->message);
+			success = false;
+		}
+		free_error(close_error);
+	}
+
+	free_download_result(download_result);
+	return success;
+}
+
+// Ranged downloads write their segments out of order, so the size of the
+// local file does not tell how much of it is complete. While one is in
+// progress, the length of the complete data at the start of the file is
+// kept in a file next to it. If fzstorj gets killed, resuming continues
+// from there instead of from the end of the file.
+fz::native_string fv_progressFile(std::string const& file)
+{
+	return fz::to_native(fz::to_wstring_from_utf8(file + ".fzstorj"));
+}
+
+void fv_writeProgress(std::string const& file, int64_t size, int64_t valid)
+{
+	fz::file f;
+	if (f.open(fv_progressFile(file), fz::file::writing, fz::file::empty)) {
+		std::string const line = fz::sprintf("%d %d", size, valid);
+		f.write(line.c_str(), static_cast<int64_t>(line.size()));
+	}
 }
 
-extern "C" void fv_uploadObject(Project *project, std::string bucket, std::string prefix, std::string file, std::string objectName)
+// Returns -1 if there is no record for an object of this size
+int64_t fv_readProgress(std::string const& file, int64_t size)
 {
-	std::string object_key = bucket;
+	fz::file f;
+	if (!f.open(fv_progressFile(file), fz::file::reading)) {
+		return -1;
+	}
+
+	char buffer[64];
+	int64_t const read = f.read(buffer, sizeof(buffer) - 1);
+	if (read <= 0) {
+		return -1;
+	}
+	std::string const line(buffer, static_cast<size_t>(read));
+
+	size_t const pos = line.find(' ');
+	if (pos == std::string::npos || fz::to_integral<int64_t>(line.substr(0, pos), -1) != size) {
+		return -1;
+	}
+	return fz::to_integral<int64_t>(line.substr(pos + 1), -1);
+}
+
+// Splits the rest of the object from offset on into segments that get
+// downloaded concurrently, each written at its offset into the file.
+// Unless space has been preallocated, the last segment is only started
+// once all others are complete, so that the file never reaches its full
+// size with data missing. On failure the file is cut after the last
+// segment that completed without gaps, so that a later resume only
+// fetches what is missing.
+bool fv_downloadObjectRanged(Project *project, std::string const& bucket, std::string const& id, std::string const& file, fz::file & outfile, int64_t offset, int64_t size)
+{
+	std::vector<int64_t> segments;
+	for (int64_t start = offset; start < size; start += ranged_download_segment_size) {
+		segments.push_back(start);
+	}
+	std::vector<char> done(segments.size());
+
+	progress_reporter progress;
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	size_t next_segment = 0;
+	size_t completed = 0;
+	int64_t valid = offset;
+	bool failed = false;
+
+	bool const hold_back_last = !preallocate_space;
+
+	fv_writeProgress(file, size, valid);
+
+	auto const worker = [&](std::string const& tag) {
+		current_tag = tag;
+
+		fz::file segment_file;
+		if (!segment_file.open(fz::to_native(fz::to_wstring_from_utf8(file)), fz::file::writing, fz::file::existing)) {
+			fzprintf(storjEvent::Error, "failed to open %s for writing", file);
+			std::unique_lock<std::mutex> l(mutex);
+			failed = true;
+			cond.notify_all();
+			return;
+		}
+
+		while (true) {
+			size_t segment;
+			{
+				std::unique_lock<std::mutex> l(mutex);
+				while (!failed && next_segment + 1 == segments.size() && hold_back_last && completed + 1 < segments.size()) {
+					cond.wait(l);
+				}
+				if (failed || next_segment >= segments.size()) {
+					break;
+				}
+				segment = next_segment++;
+			}
+
+			int64_t const start = segments[segment];
+			int64_t const length = std::min(ranged_download_segment_size, size - start);
+
+			bool success = segment_file.seek(start, fz::file::begin) == start;
+			if (!success) {
+				fzprintf(storjEvent::Error, "could not seek to offset %d within %s", start, file);
+			}
+			else {
+				success = fv_downloadRange(project, bucket, id, file, segment_file, start, length, progress);
+			}
+
+			std::unique_lock<std::mutex> l(mutex);
+			if (!success) {
+				failed = true;
+				cond.notify_all();
+				break;
+			}
+			done[segment] = 1;
+			++completed;
+
+			int64_t const old_valid = valid;
+			for (size_t i = 0; i < segments.size() && done[i]; ++i) {
+				valid = std::min(segments[i] + ranged_download_segment_size, size);
+			}
+			if (valid != old_valid) {
+				fv_writeProgress(file, size, valid);
+			}
+			cond.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	size_t const workers = std::min(static_cast<size_t>(std::max(parallel_downloads.load(), 1)), segments.size());
+	for (size_t i = 1; i < workers; ++i) {
+		threads.emplace_back(worker, current_tag);
+	}
+	worker(current_tag);
+	for (auto & t : threads) {
+		t.join();
+	}
+
+	progress.flush();
+
+	if (failed) {
+		if (outfile.seek(valid, fz::file::begin) == valid) {
+			outfile.truncate();
+		}
+	}
+
+	// The file itself is accurate again
+	fz::remove_file(fv_progressFile(file));
+
+	return !failed;
+}
+
+extern "C" bool fv_downloadObject(Project *project, std::string bucket, std::string id, std::string file, int64_t offset)
+{
+	int64_t size = -1;
+	ObjectResult stat_result = stat_object(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(id.c_str()));
+	if (stat_result.error) {
+		fzprintf(storjEvent::Error, "failed to stat object %s: %s", id, stat_result.error->message);
+		free_object_result(stat_result);
+		return false;
+	}
+	if (stat_result.object) {
+		size = stat_result.object->system.content_length;
+	}
+	free_object_result(stat_result);
+
+	if (size >= 0 && offset > size) {
+		fzprintf(storjEvent::Error, "resume offset %d is past the end of the object", offset);
+		return false;
+	}
+
+	if (offset) {
+		// An earlier ranged download of the object might have left gaps
+		int64_t const valid = fv_readProgress(file, size);
+		if (valid >= 0 && valid < offset) {
+			fzprintf(storjEvent::Status, "resuming at offset %d, after the last complete segment", valid);
+			offset = valid;
+		}
+	}
+	fz::remove_file(fv_progressFile(file));
+
+	fz::file outfile;
+	if (!outfile.open(fz::to_native(fz::to_wstring_from_utf8(file)), fz::file::writing, offset ? fz::file::existing : fz::file::empty)) {
+		fzprintf(storjEvent::Error, "failed to open %s for writing", file);
+		return false;
+	}
+
+	if (size > offset && preallocate_space) {
+		// Reserve the full size up front to reduce fragmentation
+		if (outfile.seek(size, fz::file::begin) == size) {
+			outfile.truncate();
+		}
+	}
+	else if (offset && outfile.seek(offset, fz::file::begin) == offset) {
+		// Drop anything written past the resume offset
+		outfile.truncate();
+	}
+
+	if (outfile.seek(offset, fz::file::begin) != offset) {
+		fzprintf(storjEvent::Error, "could not seek to offset %d within %s", offset, file);
+		return false;
+	}
+
+	bool const ranged = size >= 0 && parallel_downloads > 1 && size - offset >= ranged_download_threshold;
+	if (ranged) {
+		return fv_downloadObjectRanged(project, bucket, id, file, outfile, offset, size);
+	}
+
+	bool success;
+	{
+		progress_reporter progress;
+		success = fv_downloadRange(project, bucket, id, file, outfile, offset, -1, progress);
+	}
+
+	// Drop any preallocated space past what has been written
+	outfile.truncate();
+
+	return success;
+}
+
+// Objects at least this large are uploaded in parts, several at once
+int64_t const multipart_threshold = 256 * 1024 * 1024;
+int64_t const multipart_part_size = 64 * 1024 * 1024;
+int const multipart_parallel_parts = 4;
+
+// Identifies the local file a multipart upload has been started from.
+// uplink's begin_upload does not take custom metadata, so it is stored
+// as ETag of each uploaded part instead.
+std::string fv_fileIdentity(std::string const& file, int64_t size)
+{
+	fz::datetime const mtime = fz::local_filesys::get_modification_time(fz::to_native(fz::to_wstring_from_utf8(file)));
+	return fz::sprintf("fz1:%d:%d", size, mtime.empty() ? 0 : static_cast<int64_t>(mtime.get_time_t()));
+}
+
+// Lists the parts of the pending upload. Returns false if the parts cannot
+// be reused for the file with the given size and identity.
+bool fv_checkPendingUpload(Project *project, std::string const& bucket, std::string const& key, std::string const& upload_id, int64_t size, std::string const& identity, std::set<uint32_t> & completed_parts)
+{
+	bool usable = true;
+
+	PartIterator *parts = list_upload_parts(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(key.c_str()), const_cast<char*>(upload_id.c_str()), NULL);
+	while (part_iterator_next(parts)) {
+		Part *part = part_iterator_item(parts);
+
+		// Part numbers start at 1
+		int64_t const offset = static_cast<int64_t>(part->part_number - 1) * multipart_part_size;
+		int64_t const expected = std::min(multipart_part_size, size - offset);
+		std::string const etag = part->etag ? std::string(part->etag, part->etag_length) : std::string();
+		if (part->part_number > 0 && offset < size && static_cast<int64_t>(part->size) == expected && etag == identity) {
+			completed_parts.insert(part->part_number);
+		}
+		else {
+			// Left over from a different file, or from before it got modified
+			usable = false;
+		}
+		free_part(part);
+	}
+	Error *err = part_iterator_err(parts);
+	if (err) {
+		fzprintf(storjEvent::Verbose, "listing uploaded parts failed: %s", err->message);
+		free_error(err);
+		usable = false;
+	}
+	free_part_iterator(parts);
+
+	if (!usable) {
+		completed_parts.clear();
+	}
+	return usable;
+}
+
+// Finds a pending multipart upload of the key from an earlier, interrupted
+// attempt to upload the same file. Returns its parts that are complete.
+// Pending uploads of the key that cannot be resumed get aborted.
+std::string fv_findPendingUpload(Project *project, std::string const& bucket, std::string const& key, int64_t size, std::string const& identity, std::set<uint32_t> & completed_parts)
+{
+	std::vector<std::string> upload_ids;
+
+	ListUploadsOptions options = {
+		prefix : const_cast<char*>(key.c_str()),
+		cursor : "",
+		recursive : true,
+		system : false,
+		custom : false,
+	};
+
+	UploadIterator *it = list_uploads(project, const_cast<char*>(bucket.c_str()), &options);
+	while (upload_iterator_next(it)) {
+		UploadInfo *info = upload_iterator_item(it);
+		if (key == info->key) {
+			upload_ids.emplace_back(info->upload_id);
+		}
+		free_upload_info(info);
+	}
+	Error *err = upload_iterator_err(it);
+	if (err) {
+		fzprintf(storjEvent::Verbose, "listing pending uploads failed: %s", err->message);
+		free_error(err);
+		upload_ids.clear();
+	}
+	free_upload_iterator(it);
+
+	std::string ret;
+	for (auto const& upload_id : upload_ids) {
+		if (ret.empty() && fv_checkPendingUpload(project, bucket, key, upload_id, size, identity, completed_parts)) {
+			ret = upload_id;
+			continue;
+		}
+
+		fzprintf(storjEvent::Verbose, "aborting stale pending upload %s", upload_id);
+		err = abort_upload(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(key.c_str()), const_cast<char*>(upload_id.c_str()));
+		if (err) {
+			fzprintf(storjEvent::Verbose, "aborting pending upload failed: %s", err->message);
+			free_error(err);
+		}
+	}
+
+	return ret;
+}
+
+bool fv_uploadPart(Project *project, std::string const& bucket, std::string const& key, std::string const& upload_id, std::string const& file, std::string const& identity, uint32_t part_number, int64_t offset, int64_t length, progress_reporter & progress)
+{
+	fz::file infile;
+	if (!infile.open(fz::to_native(fz::to_wstring_from_utf8(file)), fz::file::reading) || infile.seek(offset, fz::file::begin) != offset) {
+		fzprintf(storjEvent::Error, "failed to open %s for reading", file);
+		return false;
+	}
+
+	PartUploadResult part_result = upload_part(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(key.c_str()), const_cast<char*>(upload_id.c_str()), part_number);
+	if (part_result.error) {
+		fzprintf(storjEvent::Error, "starting part %u failed: %s", part_number, part_result.error->message);
+		free_part_upload_result(part_result);
+		return false;
+	}
+
+	PartUpload *part = part_result.part_upload;
+
+	size_t const buffer_size = std::min(static_cast<int64_t>(transfer_buffer_size), length);
+	std::vector<char> buffer(buffer_size);
+
+	bool success = true;
+	while (success && length > 0) {
+		if (is_canceled()) {
+			fzprintf(storjEvent::Error, "upload canceled");
+			success = false;
+			break;
+		}
+
+		int64_t const read = infile.read(buffer.data(), std::min(static_cast<int64_t>(buffer_size), length));
+		if (read <= 0) {
+			fzprintf(storjEvent::Error, "failed to read from %s", file);
+			success = false;
+			break;
+		}
+		length -= read;
+
+		size_t written = 0;
+		while (written < static_cast<size_t>(read)) {
+			WriteResult result = part_upload_write(part, buffer.data() + written, read - written);
+			written += result.bytes_written;
+			progress.add(result.bytes_written);
+
+			if (result.error || !result.bytes_written) {
+				fzprintf(storjEvent::Error, "part %u failed to write: %s", part_number, result.error ? result.error->message : "no data written");
+				free_write_result(result);
+				success = false;
+				break;
+			}
+			free_write_result(result);
+		}
+	}
+
+	if (success) {
+		Error *etag_err = part_upload_set_etag(part, const_cast<char*>(identity.c_str()));
+		if (etag_err) {
+			fzprintf(storjEvent::Error, "part %u failed to set ETag: %s", part_number, etag_err->message);
+			free_error(etag_err);
+			success = false;
+		}
+	}
+
+	if (success) {
+		Error *commit_err = part_upload_commit(part);
+		if (commit_err) {
+			fzprintf(storjEvent::Error, "part %u failed to commit: %s", part_number, commit_err->message);
+			free_error(commit_err);
+			success = false;
+		}
+	}
+	else {
+		Error *abort_err = part_upload_abort(part);
+		if (abort_err) {
+			free_error(abort_err);
+		}
+	}
+
+	free_part_upload_result(part_result);
+	return success;
+}
+
+// Uploads a large file in fixed size parts, several at once. Parts of an
+// earlier interrupted upload of the same key are not uploaded again, which
+// is why a failed upload is not aborted.
+bool fv_uploadObjectMultipart(Project *project, std::string const& bucket, std::string const& key, std::string const& file, int64_t size)
+{
+	std::string const identity = fv_fileIdentity(file, size);
+
+	std::set<uint32_t> completed_parts;
+	std::string upload_id = fv_findPendingUpload(project, bucket, key, size, identity, completed_parts);
+	if (upload_id.empty()) {
+		UploadInfoResult info_result = begin_upload(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(key.c_str()), NULL);
+		if (info_result.error) {
+			fzprintf(storjEvent::Error, "upload starting failed: %s", info_result.error->message);
+			free_upload_info_result(info_result);
+			return false;
+		}
+		upload_id = info_result.info->upload_id;
+		free_upload_info_result(info_result);
+	}
+	else {
+		fzprintf(storjEvent::Status, "resuming upload, %u parts already uploaded", completed_parts.size());
+	}
+
+	uint32_t const part_count = static_cast<uint32_t>((size + multipart_part_size - 1) / multipart_part_size);
+
+	progress_reporter progress;
+	for (auto const part_number : completed_parts) {
+		int64_t const offset = static_cast<int64_t>(part_number - 1) * multipart_part_size;
+		progress.add(std::min(multipart_part_size, size - offset));
+	}
+
+	std::mutex mutex;
+	uint32_t next_part = 1;
+	bool failed = false;
+
+	auto const worker = [&](std::string const& tag) {
+		current_tag = tag;
+		while (true) {
+			uint32_t part_number;
+			{
+				std::unique_lock<std::mutex> l(mutex);
+				while (next_part <= part_count && completed_parts.count(next_part)) {
+					++next_part;
+				}
+				if (failed || next_part > part_count) {
+					break;
+				}
+				part_number = next_part++;
+			}
+
+			int64_t const offset = static_cast<int64_t>(part_number - 1) * multipart_part_size;
+			if (!fv_uploadPart(project, bucket, key, upload_id, file, identity, part_number, offset, std::min(multipart_part_size, size - offset), progress)) {
+				std::unique_lock<std::mutex> l(mutex);
+				failed = true;
+				break;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < std::min<uint32_t>(multipart_parallel_parts, part_count); ++i) {
+		threads.emplace_back(worker, current_tag);
+	}
+	worker(current_tag);
+	for (auto & t : threads) {
+		t.join();
+	}
+
+	progress.flush();
+
+	if (failed) {
+		return false;
+	}
+
+	CommitUploadResult commit_result = commit_upload(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(key.c_str()), const_cast<char*>(upload_id.c_str()), NULL);
+	if (commit_result.error) {
+		fzprintf(storjEvent::Error, "upload failed to commit: %s", commit_result.error->message);
+		free_commit_upload_result(commit_result);
+		return false;
+	}
+
+	free_commit_upload_result(commit_result);
+	return true;
+}
+
+extern "C" bool fv_uploadObject(Project *project, std::string bucket, std::string prefix, std::string file, std::string objectName)
+{
+	std::string object_key = objectName;
 	if(prefix != "")
-		object_key = object_key + "/" + prefix;
-
-	std::ifstream is (file, std::ifstream::binary);
-  
-    // get length of file:
-    is.seekg (0, is.end);
-	size_t length = is.tellg();
-    is.seekg (0, is.beg);
-
-	size_t buffer_size = 32768;
-    char *buffer = static_cast<char*>(malloc(buffer_size));
-    
-    UploadResult upload_result = upload_object(project, const_cast<char*>(object_key.c_str()), const_cast<char*>(objectName.c_str()), NULL);
-    
-	require_noerror(upload_result.error);
-    require(upload_result.upload->_handle != 0);
-
-    Upload *upload = upload_result.upload;
-
-    size_t uploaded_total = 0;
-
-	while (uploaded_total < length) {
-		is.read (buffer, buffer_size);
-		WriteResult result = upload_write(upload, buffer, is.gcount());
-        uploaded_total += result.bytes_written;
-        
-		fzprintf(storjEvent::Transfer, "%u", result.bytes_written);
-
-		require_noerror(result.error);
-        require(result.bytes_written > 0);
-        free_write_result(result);
-    }
-
-    Error *commit_err = upload_commit(upload);
-    require_noerror(commit_err);
-
-    free_upload_result(upload_result);
+		object_key = prefix + "/" + objectName;
+
+	fz::file infile;
+	if (!file.empty() && !infile.open(fz::to_native(fz::to_wstring_from_utf8(file)), fz::file::reading)) {
+		fzprintf(storjEvent::Error, "failed to open %s for reading", file);
+		return false;
+	}
+
+	if (infile.opened()) {
+		int64_t const size = infile.size();
+		if (size >= multipart_threshold) {
+			infile.close();
+			return fv_uploadObjectMultipart(project, bucket, object_key, file, size);
+		}
+	}
+
+	size_t const buffer_size = transfer_buffer_size;
+	std::vector<char> buffer(buffer_size);
+
+	UploadResult upload_result = upload_object(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(object_key.c_str()), NULL);
+	if (upload_result.error) {
+		fzprintf(storjEvent::Error, "upload starting failed: %s", upload_result.error->message);
+		free_upload_result(upload_result);
+		return false;
+	}
+
+	Upload *upload = upload_result.upload;
+
+	progress_reporter progress;
+
+	while (infile.opened()) {
+		if (is_canceled()) {
+			fzprintf(storjEvent::Error, "upload canceled");
+			upload_abort(upload);
+			free_upload_result(upload_result);
+			return false;
+		}
+
+		int64_t const read = infile.read(buffer.data(), buffer_size);
+		if (read < 0) {
+			fzprintf(storjEvent::Error, "failed to read from %s", file);
+			upload_abort(upload);
+			free_upload_result(upload_result);
+			return false;
+		}
+		if (!read) {
+			break;
+		}
+
+		size_t written = 0;
+		while (written < static_cast<size_t>(read)) {
+			WriteResult result = upload_write(upload, buffer.data() + written, read - written);
+			written += result.bytes_written;
+			progress.add(result.bytes_written);
+
+			if (result.error || !result.bytes_written) {
+				fzprintf(storjEvent::Error, "upload failed to write: %s", result.error ? result.error->message : "no data written");
+				free_write_result(result);
+				upload_abort(upload);
+				free_upload_result(upload_result);
+				return false;
+			}
+			free_write_result(result);
+		}
+	}
+
+	progress.flush();
+
+	Error *commit_err = upload_commit(upload);
+	if (commit_err) {
+		fzprintf(storjEvent::Error, "upload failed to commit: %s", commit_err->message);
+		free_error(commit_err);
+		free_upload_result(upload_result);
+		return false;
+	}
+
+	free_upload_result(upload_result);
+	return true;
 }
 
-extern "C" void fv_deleteObject(Project *project, std::string bucketName, std::string objectKey)
-{	
+// Reports just the given object after it has been changed, instead of
+// listing its entire directory again.
+bool fv_printChangedObject(Project *project, std::string const& bucket, std::string const& prefix, std::string const& objectName)
+{
+	std::string const key = prefix.empty() ? objectName : (prefix + "/" + objectName);
+
+	ObjectResult object_result = stat_object(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(key.c_str()));
+	if (object_result.error) {
+		fzprintf(storjEvent::Error, "failed to stat object %s: %s", key, object_result.error->message);
+		free_object_result(object_result);
+		return false;
+	}
+
+	fv_printObject(object_result.object, prefix.empty() ? prefix : (prefix + "/"));
+	free_object_result(object_result);
+	return true;
+}
+
+extern "C" bool fv_deleteObject(Project *project, std::string bucketName, std::string objectKey)
+{
 	ObjectResult object_result = delete_object(project, const_cast<char*>(bucketName.c_str()), const_cast<char*>(objectKey.c_str()));
-	require_noerror(object_result.error);
-	require(object_result.object != NULL);
-	
+	if (object_result.error) {
+		fzprintf(storjEvent::Error, "failed to delete object %s: %s", objectKey, object_result.error->message);
+		free_object_result(object_result);
+		return false;
+	}
+
 	fzprintf(storjEvent::Status, "deleted object %s", objectKey);
 	free_object_result(object_result);
+	return true;
 }
 
-extern "C" void fv_createBucket(Project *project, std::string bucketName)
+extern "C" bool fv_createBucket(Project *project, std::string bucketName)
 {
 	BucketResult bucket_result = ensure_bucket(project, const_cast<char*>(bucketName.c_str()));
 	if (bucket_result.error) {
 		fzprintf(storjEvent::Error, "failed to create bucket %s: %s", bucketName, bucket_result.error->message);
 		free_bucket_result(bucket_result);
-		return;
+		return false;
 	}
-   
+
 	Bucket *bucket = bucket_result.bucket;
 	fzprintf(storjEvent::Status, "created bucket %s", bucket->name);
 	free_bucket_result(bucket_result);
+	return true;
 }
 
-extern "C" void fv_deleteBucket(Project *project, std::string bucketName)
+extern "C" bool fv_deleteBucket(Project *project, std::string bucketName)
 {
 	BucketResult bucket_result = delete_bucket(project, const_cast<char*>(bucketName.c_str()));
-	require_noerror(bucket_result.error);
-	require(bucket_result.bucket != NULL);
-			
-	Bucket *bucket = bucket_result.bucket;
-	fzprintf(storjEvent::Status, "deleted bucket %s", bucket->name);
-	free_bucket_result(bucket_result);
-}
+	if (bucket_result.error) {
+		fzprintf(storjEvent::Error, "failed to delete bucket %s: %s", bucketName, bucket_result.error->message);
+		free_bucket_result(bucket_result);
+		return false;
+	}
 
+	fzprintf(storjEvent::Status, "deleted bucket %s", bucketName);
+	free_bucket_result(bucket_result);
+	return true;
 }
 
-int main()
+// Credentials and the project opened with them. The project is kept open
+// across commands and shared by all workers. If the credentials change,
+// the old project is only closed on exit as workers may still use it.
+class session final
 {
-	fzprintf(storjEvent::Reply, "fzStorj started, protocol_version=%d", FZSTORJ_PROTOCOL_VERSION);
+public:
+	~session()
+	{
+		for (auto * project : projects_) {
+			Error *close_error = close_project(project);
+			if (close_error) {
+				fzprintf(storjEvent::Verbose, "failed to close project: %s", close_error->message);
+				free_error(close_error);
+			}
+			free_project_result(ProjectResult{project, nullptr});
+		}
+	}
+
+	void set_host(std::string const& host)
+	{
+		fz::scoped_lock l(mutex_);
+		serializedAccessGrantKey_ = satelliteURL_ = host;
+	}
+
+	void set_user(std::string const& user)
+	{
+		fz::scoped_lock l(mutex_);
+		apiKey_ = user;
+	}
+
+	void set_pass(std::string const& pass)
+	{
+		fz::scoped_lock l(mutex_);
+		encryptionPassPhrase_ = pass;
+	}
+
+	Project* get_project()
+	{
+		fz::scoped_lock l(mutex_);
+
+		std::string const credentials = serializedAccessGrantKey_ + '\n' + apiKey_ + '\n' + encryptionPassPhrase_;
+		if (project_ && credentials == credentials_) {
+			return project_;
+		}
+
+		Config config = {
+			user_agent : "FileZilla",
+		};
 
-	std::string ls_satelliteURL;
-	std::string ls_apiKey;
-	std::string ls_encryptionPassPhrase;
-	std::string ls_serializedAccessGrantKey;
-	
-	Config config = {
-        user_agent : "FileZilla",
-    };
-	
-	auto fv_openStorjProject = [&]() -> ProjectResult {
 		AccessResult access_result;
-		if(!(ls_apiKey.empty())) {
-			access_result = config_request_access_with_passphrase(config, const_cast<char*>(ls_satelliteURL.c_str()), const_cast<char*>(ls_apiKey.c_str()), const_cast<char*>(ls_encryptionPassPhrase.c_str()));
-			if (access_result.error) {
-				fzprintf(storjEvent::Error, "failed to parse access: %s", access_result.error->message);
-				free_access_result(access_result);
-			}
+		if(!(apiKey_.empty())) {
+			access_result = config_request_access_with_passphrase(config, const_cast<char*>(satelliteURL_.c_str()), const_cast<char*>(apiKey_.c_str()), const_cast<char*>(encryptionPassPhrase_.c_str()));
 		}
 		else {
-			access_result = parse_access(const_cast<char*>(ls_serializedAccessGrantKey.c_str()));
-			if (access_result.error) {
-				fzprintf(storjEvent::Error, "failed to parse access: %s", access_result.error->message);
-				free_access_result(access_result);
-			}
+			access_result = parse_access(const_cast<char*>(serializedAccessGrantKey_.c_str()));
+		}
+		if (access_result.error) {
+			fzprintf(storjEvent::Error, "failed to parse access: %s", access_result.error->message);
+			free_access_result(access_result);
+			return nullptr;
 		}
-		
+
 		ProjectResult project_result = config_open_project(config, access_result.access);
+		free_access_result(access_result);
 		if (project_result.error) {
 			fzprintf(storjEvent::Error, "failed to open project: %s", project_result.error->message);
 			free_project_result(project_result);
+			return nullptr;
 		}
-		return project_result;
-	};
-	
+
+		project_ = project_result.project;
+		projects_.push_back(project_);
+		credentials_ = credentials;
+		return project_;
+	}
+
+private:
+	fz::mutex mutex_;
+
+	std::string satelliteURL_;
+	std::string apiKey_;
+	std::string encryptionPassPhrase_;
+	std::string serializedAccessGrantKey_;
+
+	Project *project_{};
+	std::string credentials_;
+	std::vector<Project*> projects_;
+};
+
+// Executes commands that talk to the network. Emits exactly one
+// final Done or Error reply.
+void process_command(session & s, std::string const& command, std::string arg)
+{
+	if (command == "list-buckets") {
+		Project *project = s.get_project();
+		if (!project) {
+			return;
+		}
+		if (fv_listBuckets(project)) {
+			fzprintf(storjEvent::Done);
+		}
+	}
+	else if (command == "list") {
+
+		if (arg.empty()) {
+			fzprintf(storjEvent::Error, "Bad arguments");
+			return;
+		}
+
+		// list <bucket> ["<prefix>" ["<cursor>"]]
+		std::string bucket, prefix, cursor;
+
+		size_t pos = arg.find(' ');
+		if (pos == std::string::npos) {
+			bucket = arg;
+		}
+		else {
+			bucket = arg.substr(0, pos);
+
+			prefix = arg.substr(pos + 1);
+
+			if (!prefix.empty() && prefix.front() == '"') {
+				std::string rest = prefix;
+				prefix = next_argument(rest);
+				cursor = next_argument(rest);
+				if (!rest.empty()) {
+					fzprintf(storjEvent::Error, "Bad arguments");
+					return;
+				}
+			}
+
+			if (!prefix.empty() && prefix.back() != '/') {
+				fzprintf(storjEvent::Error, "Bad arguments");
+				return;
+			}
+		}
+
+		if (!prefix.empty()) {
+			size_t pos = prefix.find_last_of('/');
+			//
+			if (pos != std::string::npos) {
+				prefix = prefix.substr(0, pos);
+			}
+		}
+
+		Project *project = s.get_project();
+		if (!project) {
+			return;
+		}
+		if (fv_listObjects(project, bucket, prefix, cursor)) {
+			fzprintf(storjEvent::Done);
+		}
+	}
+	else if (command == "get") {
+		// get <bucket> <id> "<local file>" [<offset>]
+		size_t pos = arg.find(' ');
+		if (pos == std::string::npos) {
+			fzprintf(storjEvent::Error, "Bad arguments");
+			return;
+		}
+		std::string bucket = arg.substr(0, pos);
+		std::string others = arg.substr(pos + 1, arg.size());
+		size_t pos2 = others.find('"');
+		size_t pos3 = others.rfind('"');
+		if (pos2 == std::string::npos || pos2 < 1 || pos3 == pos2) {
+			fzprintf(storjEvent::Error, "Bad arguments");
+			return;
+		}
+
+		auto id = others.substr(0, pos2 - 1);
+		auto file = others.substr(pos2, pos3 - pos2 + 1);
+
+		int64_t offset = 0;
+		std::string tail = others.substr(pos3 + 1);
+		fz::trim(tail);
+		if (!tail.empty()) {
+			offset = fz::to_integral<int64_t>(tail, -1);
+			if (offset < 0) {
+				fzprintf(storjEvent::Error, "Bad arguments");
+				return;
+			}
+		}
+
+		if (file.size() >= 3 && file.front() == '"' && file.back() == '"') {
+			file = fz::replaced_substrings(file.substr(1, file.size() - 2), "\"\"", "\"");
+		}
+
+		Project *project = s.get_project();
+		if (!project) {
+			return;
+		}
+		if (fv_downloadObject(project, bucket, id, file, offset)) {
+			fzprintf(storjEvent::Done);
+		}
+	}
+	else if (command == "put") {
+		std::string bucket = next_argument(arg);
+		std::string file = next_argument(arg);
+		std::string remote_name = next_argument(arg);
+
+		if (bucket.empty() || file.empty() || remote_name.empty() || !arg.empty()) {
+			fzprintf(storjEvent::Error, "Bad arguments");
+			return;
+		}
+
+		if (file == "null" ) {
+			file = "";
+		}
+
+		std::string prefix="";
+		std::string objectName="";
+
+		size_t pos = remote_name.find_last_of('/');
+		if (pos != std::string::npos) {
+			prefix = remote_name.substr(0, pos);
+			objectName = remote_name.substr(pos+1,remote_name.size());
+		}
+		else {
+			objectName = remote_name;
+		}
+
+		Project *project = s.get_project();
+		if (!project) {
+			return;
+		}
+		if (!fv_uploadObject(project, bucket, prefix, file, objectName)) {
+			return;
+		}
+
+		// Only report the new object, the engine updates its cache with it
+		if (fv_printChangedObject(project, bucket, prefix, objectName)) {
+			fzprintf(storjEvent::Done);
+		}
+	}
+	else if (command == "rm") {
+		size_t space_pos = arg.find_first_of(' ');
+
+		std::string bucketName = arg.substr(0, space_pos);
+		std::string objectKey = arg.substr(space_pos+1, arg.size());
+
+		Project *project = s.get_project();
+		if (!project) {
+			return;
+		}
+		if (!fv_deleteObject(project, bucketName, objectKey)) {
+			return;
+		}
+
+		fzprintf(storjEvent::Done);
+	}
+	else if (command == "mkbucket") {
+		std::string bucketName = next_argument(arg);
+		if (bucketName.empty()) {
+			fzprintf(storjEvent::Error, "Bad arguments");
+			return;
+		}
+
+		Project *project = s.get_project();
+		if (!project) {
+			return;
+		}
+		if (!fv_createBucket(project, bucketName)) {
+			return;
+		}
+
+		fzprintf(storjEvent::Done);
+	}
+	else if (command == "rmbucket") {
+		std::string bucketName = arg;
+
+		Project *project = s.get_project();
+		if (!project) {
+			return;
+		}
+		if (!fv_deleteBucket(project, bucketName)) {
+			return;
+		}
+
+		fzprintf(storjEvent::Done);
+	}
+	else {
+		fzprintf(storjEvent::Error, "No such command: %s", command);
+	}
+}
+
+}
+
+int main()
+{
+	fzprintf(storjEvent::Reply, "fzStorj started, protocol_version=%d", FZSTORJ_PROTOCOL_VERSION);
+
+	session s;
+
+	// Declared after the session, workers must be gone before the
+	// projects get closed.
+	worker_pool workers;
+
 	int ret = 0;
 	while (true) {
 		std::string command;
@@ -365,10 +1396,19 @@ int main()
 			break;
 		}
 
-		///////////////////////////////////////////////////////////////
-		//fzprintf(storjEvent::Status, "Command(Before): %s", command);
-		///////////////////////////////////////////////////////////////
-		
+		// Commands prefixed with #<tag> run concurrently with other
+		// tagged commands, their events carry the same tag.
+		current_tag.clear();
+		if (command[0] == '#') {
+			std::size_t pos = command.find(' ');
+			if (pos == std::string::npos || pos == 1) {
+				fzprintf(storjEvent::Error, "Bad tag");
+				continue;
+			}
+			current_tag = command.substr(1, pos - 1);
+			command = command.substr(pos + 1);
+		}
+
 		std::size_t pos = command.find(' ');
 		std::string arg;
 		if (pos != std::string::npos) {
@@ -377,16 +1417,15 @@ int main()
 		}
 
 		if (command == "host") {
-			ls_serializedAccessGrantKey = ls_satelliteURL = arg;
+			s.set_host(arg);
 			fzprintf(storjEvent::Done);
 		}
 		else if (command == "user") {
-			ls_apiKey = arg;
-			//
+			s.set_user(arg);
 			fzprintf(storjEvent::Done);
 		}
 		else if (command == "pass") {
-			ls_encryptionPassPhrase = arg;
+			s.set_pass(arg);
 			fzprintf(storjEvent::Done);
 		}
 		else if (command == "genkey") {
@@ -407,171 +1446,49 @@ int main()
 		else if (command == "proxy") {
 			fzprintf(storjEvent::Done);
 		}
-		else if (command == "list-buckets") {
-			ProjectResult project_result = fv_openStorjProject();
-			fv_listBuckets(project_result.project);
-			
-			fzprintf(storjEvent::Done);
-		}
-		else if (command == "list") {
-			
-			if (arg.empty()) {
-				fzprintf(storjEvent::Error, "Bad arguments");
-				continue;
-			}
-
-			std::string bucket, prefix;
-
-			size_t pos = arg.find(' ');
-			if (pos == std::string::npos) {
-				bucket = arg;
-			}
-			else {
-				bucket = arg.substr(0, pos);
-
-				prefix = arg.substr(pos + 1);
-
-				if (prefix.size() >= 2 && prefix.front() == '"' && prefix.back() == '"') {
-					prefix = fz::replaced_substrings(prefix.substr(1, prefix.size() - 2), "\"\"", "\"");
-				}
-
-				if (!prefix.empty() && prefix.back() != '/') {
-					fzprintf(storjEvent::Error, "Bad arguments");
-					continue;
-				}
-			}
-			
-			if (!prefix.empty()) {
-				size_t pos = prefix.find_last_of('/');
-				//
-				if (pos != std::string::npos) {
-					prefix = prefix.substr(0, pos);
-				}
-			}
-
-			ProjectResult project_result = fv_openStorjProject();			
-			fv_listObjects(project_result.project, bucket, prefix);
-			
-			fzprintf(storjEvent::Done);			
-		}
-		else if (command == "get") {
-			size_t pos = arg.find(' ');
-			if (pos == std::string::npos) {
+		else if (command == "transfer-settings") {
+			// transfer-settings <buffer size> <preallocate> <parallel downloads>
+			std::string size = next_argument(arg);
+			std::string preallocate = next_argument(arg);
+			int parallel = fz::to_integral<int>(next_argument(arg), -1);
+
+			size_t buffer_size = fz::to_integral<size_t>(size);
+			if (buffer_size < 64 * 1024 || buffer_size > 64 * 1024 * 1024 || parallel < 1 || parallel > 16 || !arg.empty()) {
 				fzprintf(storjEvent::Error, "Bad arguments");
 				continue;
 			}
-			std::string bucket = arg.substr(0, pos);
-			std::string others = arg.substr(pos + 1, arg.size());
-			size_t pos2 = others.find_first_of(' "');
-
-			auto id = others.substr(0, pos2 - 1);
-			auto file = others.substr(pos2, others.size());
-
-			if (file.size() >= 3 && file.front() == '"' && file.back() == '"') {
-				file = fz::replaced_substrings(file.substr(1, file.size() - 2), "\"\"", "\"");
-			}
-
-			ProjectResult project_result = fv_openStorjProject();
-			fv_downloadObject(project_result.project, bucket, id, file);
-			
-			fzprintf(storjEvent::Done);			
+			transfer_buffer_size = buffer_size;
+			preallocate_space = preallocate == "1";
+			parallel_downloads = parallel;
+			fzprintf(storjEvent::Done);
 		}
-		else if (command == "put") {
-			std::string bucket = next_argument(arg);
-			std::string file = next_argument(arg);
-			std::string remote_name = next_argument(arg);
-
-			if (bucket.empty() || file.empty() || remote_name.empty() || !arg.empty()) {
-				fzprintf(storjEvent::Error, "Bad arguments");
-			}
-			
-			if (file == "null" ) {
-				file = "";
-			}
-
-			std::string prefix="";
-			std::string objectName="";
-			
-			size_t pos = remote_name.find_last_of('/');
-			if (pos != std::string::npos) {
-				prefix = remote_name.substr(0, pos);
-				objectName = remote_name.substr(pos+1,remote_name.size());
-			}
-			else {
-				objectName = remote_name;
-			}
-
-			ProjectResult project_result = fv_openStorjProject();
-			fv_uploadObject(project_result.project, bucket, prefix, file, objectName);
-
-			// refresh
-			fv_listObjects(project_result.project, bucket, prefix);
-
+		else if (command == "workers") {
+			workers.set_max_workers(fz::to_integral<size_t>(arg));
 			fzprintf(storjEvent::Done);
 		}
-		else if (command == "rm") {
-/*			auto args = fz::strtok(arg, ' ');
-			if (args.size() != 2) {
-				fzprintf(storjEvent::Error, "Bad arguments");
-				continue;
+		else if (command == "cancel") {
+			// Cancels whatever runs or is queued under the given tag.
+			// There is no reply, the canceled command itself fails.
+			// Ignored if nothing is left, the tag would never be removed.
+			fz::scoped_lock l(cancel_mutex);
+			if (workers.active(arg)) {
+				canceled_tags.insert(arg);
 			}
-
-			std::string bucketName = args[0];
-			std::string objectKey = args[1];
-			std::string prefix = "";
-*/			
-			////////////////////////////////////////////////////////////////
-			size_t space_pos = arg.find_first_of(' ');
-			
-			std::string bucketName = arg.substr(0, space_pos);
-			std::string objectKey = arg.substr(space_pos+1, arg.size());
-			std::string prefix = "";
-			////////////////////////////////////////////////////////////////
-			size_t pos = objectKey.find_last_of('/');
-			if (pos != std::string::npos) {
-				prefix = objectKey.substr(0, pos);
-			}	
-			
-			ProjectResult project_result = fv_openStorjProject();
-			fv_deleteObject(project_result.project, bucketName, objectKey);
-
-			// refresh
-			project_result = fv_openStorjProject();
-			fv_listObjects(project_result.project, bucketName, prefix);
-			
-			fzprintf(storjEvent::Done);	
-		}
-		else if (command == "mkbucket") {
-			std::string bucketName = next_argument(arg);
-			if (bucketName.empty()) {
-				fzprintf(storjEvent::Error, "Bad arguments");
-				continue;
-			}
-			
-			ProjectResult project_result = fv_openStorjProject();
-			fv_createBucket(project_result.project, bucketName);
-						
-			// refresh
-			fv_listBuckets(project_result.project);
-			
-			fzprintf(storjEvent::Done);		
-		}
-		else if (command == "rmbucket") {
-			std::string bucketName = arg;
-					
-			ProjectResult project_result = fv_openStorjProject();
-			fv_deleteBucket(project_result.project, bucketName);
-			
-			// refresh
-			fv_listBuckets(project_result.project);
-	
-			fzprintf(storjEvent::Done);
+		}
+		else if (current_tag.empty()) {
+			process_command(s, command, arg);
 		}
 		else {
-			fzprintf(storjEvent::Error, "No such command: %s", command);
+			std::string const tag = current_tag;
+			workers.add(tag, [&s, command, arg]() {
+				if (is_canceled()) {
+					fzprintf(storjEvent::Error, "canceled");
+					return;
+				}
+				process_command(s, command, arg);
+			});
 		}
-
 	}
 
 	return ret;
-}
\ No newline at end of file
+}
@@ -0,0 +1,221 @@
+#include <filezilla.h>
+#include "ftp/deflatelayer.h"
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <libfilezilla/event_handler.hpp>
+#include <libfilezilla/event_loop.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+#include <zlib.h>
+
+#include <errno.h>
+
+/*
+ * This testsuite asserts the correctness of the CDeflateLayer class on
+ * a data connection set up like a passive mode transfer: The layer is put
+ * on top of the socket before connecting to the server.
+ */
+
+class CDeflateLayerTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CDeflateLayerTest);
+	CPPUNIT_TEST(testPassiveDownload);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void testPassiveDownload();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CDeflateLayerTest);
+
+namespace {
+// Plays the server: Accepts a single data connection, sends the data and closes it.
+class server final : public fz::event_handler
+{
+public:
+	server(fz::event_loop & loop, fz::thread_pool & pool, std::string const& data)
+		: fz::event_handler(loop)
+		, listen_socket_(pool, this)
+		, data_(data)
+	{
+	}
+
+	virtual ~server()
+	{
+		remove_handler();
+	}
+
+	int listen()
+	{
+		listen_socket_.bind("127.0.0.1");
+		if (listen_socket_.listen(fz::address_type::ipv4)) {
+			return -1;
+		}
+		int error;
+		return listen_socket_.local_port(error);
+	}
+
+private:
+	virtual void operator()(fz::event_base const& ev) override
+	{
+		fz::dispatch<fz::socket_event>(ev, this, &server::on_socket_event);
+	}
+
+	void on_socket_event(fz::socket_event_source*, fz::socket_event_flag t, int error)
+	{
+		if (error) {
+			socket_.reset();
+			return;
+		}
+
+		if (t == fz::socket_event_flag::connection) {
+			socket_ = listen_socket_.accept(error);
+			if (socket_) {
+				socket_->set_event_handler(this);
+				send();
+			}
+		}
+		else if (t == fz::socket_event_flag::write) {
+			send();
+		}
+	}
+
+	void send()
+	{
+		while (socket_ && !data_.empty()) {
+			int error;
+			int written = socket_->write(data_.c_str(), static_cast<unsigned int>(data_.size()), error);
+			if (written <= 0) {
+				if (error != EAGAIN) {
+					socket_.reset();
+				}
+				return;
+			}
+			data_.erase(0, static_cast<size_t>(written));
+		}
+		if (socket_) {
+			socket_->shutdown();
+		}
+	}
+
+	fz::listen_socket listen_socket_;
+	std::unique_ptr<fz::socket> socket_;
+	std::string data_;
+};
+
+// Plays the transfer socket
+class client final : public fz::event_handler
+{
+public:
+	client(fz::event_loop & loop, fz::thread_pool & pool)
+		: fz::event_handler(loop)
+		, socket_(pool, nullptr)
+		, layer_(loop, this, socket_, false)
+	{
+	}
+
+	virtual ~client()
+	{
+		remove_handler();
+	}
+
+	bool connect(int port)
+	{
+		return !layer_.connect(fzT("127.0.0.1"), port);
+	}
+
+	// Waits for the end of the data, returns what has been received
+	bool wait(std::string & received)
+	{
+		fz::scoped_lock l(mutex_);
+		while (!done_) {
+			if (!cond_.wait(l, fz::duration::from_seconds(20))) {
+				return false;
+			}
+		}
+		received = received_;
+		return !failed_;
+	}
+
+private:
+	virtual void operator()(fz::event_base const& ev) override
+	{
+		fz::dispatch<fz::socket_event>(ev, this, &client::on_socket_event);
+	}
+
+	void on_socket_event(fz::socket_event_source*, fz::socket_event_flag t, int error)
+	{
+		fz::scoped_lock l(mutex_);
+		if (done_) {
+			return;
+		}
+
+		if (!error && t == fz::socket_event_flag::read) {
+			char buffer[1000];
+			while (true) {
+				int read = layer_.read(buffer, sizeof(buffer), error);
+				if (read > 0) {
+					received_.append(buffer, static_cast<size_t>(read));
+					continue;
+				}
+				if (read < 0 && error == EAGAIN) {
+					return;
+				}
+				failed_ = read < 0;
+				break;
+			}
+		}
+		else if (!error) {
+			return;
+		}
+		else {
+			failed_ = true;
+		}
+
+		done_ = true;
+		cond_.signal(l);
+	}
+
+	fz::socket socket_;
+	CDeflateLayer layer_;
+
+	fz::mutex mutex_;
+	fz::condition cond_;
+	bool done_{};
+	bool failed_{};
+	std::string received_;
+};
+}
+
+void CDeflateLayerTest::testPassiveDownload()
+{
+	// Compressible, yet larger than the internal buffers of the layer
+	std::string data;
+	for (int i = 0; data.size() < 500000; ++i) {
+		data += fz::sprintf("-rw-r--r-- 1 user group %d Jan 01 2020 file%d.txt\r\n", i * 7, i);
+	}
+
+	uLongf compressedSize = compressBound(static_cast<uLong>(data.size()));
+	std::string compressed(compressedSize, '\0');
+	CPPUNIT_ASSERT_EQUAL(Z_OK, compress(reinterpret_cast<Bytef*>(&compressed[0]), &compressedSize, reinterpret_cast<Bytef const*>(data.c_str()), static_cast<uLong>(data.size())));
+	compressed.resize(compressedSize);
+
+	fz::thread_pool pool;
+	fz::event_loop loop(pool);
+
+	server s(loop, pool, compressed);
+	int const port = s.listen();
+	CPPUNIT_ASSERT(port > 0);
+
+	client c(loop, pool);
+	CPPUNIT_ASSERT(c.connect(port));
+
+	std::string received;
+	CPPUNIT_ASSERT(c.wait(received));
+	CPPUNIT_ASSERT_EQUAL(data.size(), received.size());
+	CPPUNIT_ASSERT(received == data);
+}
@@ -0,0 +1,170 @@
+#include <filezilla.h>
+#include "directorycache.h"
+#include <cppunit/extensions/HelperMacros.h>
+
+/*
+ * This testsuite asserts the correctness of the memory budget and the
+ * sharding of the CDirectoryCache class.
+ */
+
+class CDirectoryCacheTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CDirectoryCacheTest);
+	CPPUNIT_TEST(testBudget);
+	CPPUNIT_TEST(testLeastRecentlyUsed);
+	CPPUNIT_TEST(testCaseInsensitivePath);
+	CPPUNIT_TEST(testStatistics);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void testBudget();
+	void testLeastRecentlyUsed();
+	void testCaseInsensitivePath();
+	void testStatistics();
+
+protected:
+	static CDirectoryListing MakeListing(std::wstring const& path, size_t files);
+
+	CServer const server_{FTP, DEFAULT, L"example.com", 21};
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CDirectoryCacheTest);
+
+CDirectoryListing CDirectoryCacheTest::MakeListing(std::wstring const& path, size_t files)
+{
+	std::vector<fz::shared_value<CDirentry>> entries;
+	for (size_t i = 0; i < files; ++i) {
+		CDirentry entry;
+		entry.name = L"file" + std::to_wstring(i);
+		entry.size = i;
+		entries.emplace_back(entry);
+	}
+
+	CDirectoryListing listing;
+	listing.path = CServerPath(path);
+	listing.m_firstListTime = fz::monotonic_clock::now();
+	listing.Assign(std::move(entries));
+	return listing;
+}
+
+void CDirectoryCacheTest::testBudget()
+{
+	size_t const budget = 1024 * 1024;
+
+	CDirectoryCache cache;
+	cache.SetMaxMemory(budget);
+
+	for (int i = 0; i < 500; ++i) {
+		cache.Store(MakeListing(L"/dir" + std::to_wstring(i), 100), server_);
+		CPPUNIT_ASSERT(cache.GetStatistics().memory <= budget);
+	}
+
+	auto stats = cache.GetStatistics();
+	CPPUNIT_ASSERT(stats.evictions > 0);
+	CPPUNIT_ASSERT(stats.directories < 500);
+
+	// Expanding listings on lookup must not push the cache over budget either
+	CDirectoryListing listing;
+	bool outdated{};
+	for (int i = 499; i >= 0; --i) {
+		cache.Lookup(listing, server_, CServerPath(L"/dir" + std::to_wstring(i)), true, outdated);
+		CPPUNIT_ASSERT(cache.GetStatistics().memory <= budget);
+	}
+
+	// Lowering the budget evicts right away
+	cache.SetMaxMemory(budget / 4);
+	stats = cache.GetStatistics();
+	CPPUNIT_ASSERT(stats.memory <= budget / 4);
+	CPPUNIT_ASSERT(stats.directories > 0);
+
+	// A single listing over budget is kept as long as it is the only one
+	cache.SetMaxMemory(1);
+	CPPUNIT_ASSERT_EQUAL(size_t(1), cache.GetStatistics().directories);
+}
+
+void CDirectoryCacheTest::testLeastRecentlyUsed()
+{
+	CDirectoryCache cache;
+
+	std::vector<std::wstring> paths;
+	for (int i = 0; i < 64; ++i) {
+		paths.push_back(L"/dir" + std::to_wstring(i));
+		cache.Store(MakeListing(paths.back(), 100), server_);
+	}
+	size_t const size = cache.GetStatistics().memory;
+
+	// Use the directories in reverse, making the first one the most recently used
+	bool outdated{};
+	int unsure{};
+	for (auto it = paths.rbegin(); it != paths.rend(); ++it) {
+		CPPUNIT_ASSERT(cache.DoesExist(server_, CServerPath(*it), unsure, outdated));
+	}
+
+	// Evicting half of them has to pick the least recently used ones, no
+	// matter which shard they are in.
+	cache.SetMaxMemory(size / 2);
+	auto const stats = cache.GetStatistics();
+	CPPUNIT_ASSERT(stats.directories >= 16);
+	CPPUNIT_ASSERT(stats.directories < paths.size());
+
+	for (size_t i = 0; i < paths.size(); ++i) {
+		bool const exists = cache.DoesExist(server_, CServerPath(paths[i]), unsure, outdated);
+		CPPUNIT_ASSERT_EQUAL(i < stats.directories, exists);
+	}
+}
+
+void CDirectoryCacheTest::testCaseInsensitivePath()
+{
+	CDirectoryCache cache;
+
+	// The server is not known to be case sensitive, so an operation on a
+	// path in different case has to reach the cached listing.
+	for (int i = 0; i < 64; ++i) {
+		std::wstring const path = L"/Dir" + std::to_wstring(i);
+		cache.Store(MakeListing(path, 10), server_);
+
+		CPPUNIT_ASSERT(cache.InvalidateFile(server_, CServerPath(L"/dIR" + std::to_wstring(i)), L"FILE1"));
+
+		CDirectoryListing listing;
+		bool outdated{};
+		CPPUNIT_ASSERT(!cache.Lookup(listing, server_, CServerPath(path), false, outdated));
+		CPPUNIT_ASSERT(cache.Lookup(listing, server_, CServerPath(path), true, outdated));
+		CPPUNIT_ASSERT(listing[1].is_unsure());
+		CPPUNIT_ASSERT(!listing[2].is_unsure());
+	}
+}
+
+void CDirectoryCacheTest::testStatistics()
+{
+	CDirectoryCache cache;
+
+	auto stats = cache.GetStatistics();
+	CPPUNIT_ASSERT_EQUAL(size_t(0), stats.directories);
+	CPPUNIT_ASSERT_EQUAL(size_t(0), stats.memory);
+
+	cache.Store(MakeListing(L"/foo", 10), server_);
+	cache.Store(MakeListing(L"/bar", 5), server_);
+
+	CDirectoryListing listing;
+	bool outdated{};
+	CPPUNIT_ASSERT(cache.Lookup(listing, server_, CServerPath(L"/foo"), true, outdated));
+	CPPUNIT_ASSERT(cache.Lookup(listing, server_, CServerPath(L"/bar"), true, outdated));
+	CPPUNIT_ASSERT(!cache.Lookup(listing, server_, CServerPath(L"/baz"), true, outdated));
+
+	stats = cache.GetStatistics();
+	CPPUNIT_ASSERT_EQUAL(uint64_t(2), stats.hits);
+	CPPUNIT_ASSERT_EQUAL(uint64_t(1), stats.misses);
+	CPPUNIT_ASSERT_EQUAL(uint64_t(0), stats.evictions);
+	CPPUNIT_ASSERT_EQUAL(size_t(2), stats.directories);
+	CPPUNIT_ASSERT_EQUAL(int64_t(15), stats.files);
+	CPPUNIT_ASSERT(stats.memory > 0);
+
+	cache.InvalidateServer(server_);
+	stats = cache.GetStatistics();
+	CPPUNIT_ASSERT_EQUAL(size_t(0), stats.directories);
+	CPPUNIT_ASSERT_EQUAL(int64_t(0), stats.files);
+	CPPUNIT_ASSERT_EQUAL(size_t(0), stats.memory);
+}
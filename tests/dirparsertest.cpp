@@ -2,17 +2,25 @@
 #include <directorylistingparser.h>
 
 #include <libfilezilla/format.hpp>
+#include <libfilezilla/thread_pool.hpp>
+#include <libfilezilla/time.hpp>
 #include <libfilezilla/util.hpp>
 
 #include <cppunit/extensions/HelperMacros.h>
+#include <algorithm>
+#include <iostream>
 #include <list>
 
+#include <stdlib.h>
 #include <string.h>
 /*
  * This testsuite asserts the correctness of the directory listing parser.
  * It's main purpose is to ensure that all known formats are recognized and
  * parsed as expected. Due to the high amount of variety and unfortunately
  * also ambiguity, the parser is very fragile.
+ *
+ * Set FZ_DIRPARSER_BENCHMARK to a number of lines to additionally measure
+ * the parser throughput for each entry, repeated that many times.
  */
 
 struct t_entry
@@ -31,6 +39,10 @@ class CDirectoryListingParserTest final : public CppUnit::TestFixture
 	}
 	CPPUNIT_TEST(testAll);
 	CPPUNIT_TEST(testSpecial);
+	CPPUNIT_TEST(testFormatStats);
+	CPPUNIT_TEST(testParallel);
+	CPPUNIT_TEST(testCompact);
+	CPPUNIT_TEST(testBenchmark);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -40,6 +52,10 @@ public:
 	void testIndividual();
 	void testAll();
 	void testSpecial();
+	void testFormatStats();
+	void testParallel();
+	void testCompact();
+	void testBenchmark();
 
 	static std::vector<t_entry> m_entries;
 
@@ -1471,10 +1487,7 @@ void CDirectoryListingParserTest::testIndividual()
 
 	CDirectoryListingParser parser(0, server);
 
-	size_t const len = entry.data.size();
-	char* data = new char[len];
-	memcpy(data, entry.data.c_str(), len);
-	parser.AddData(data, len);
+	parser.AddData(entry.data.c_str(), entry.data.size());
 
 	CDirectoryListing listing = parser.Parse(CServerPath());
 
@@ -1495,10 +1508,7 @@ void CDirectoryListingParserTest::testAll()
 	for (auto const& entry : m_entries) {
 		server.SetType(entry.serverType);
 		parser.SetServer(server);
-		size_t const len = entry.data.size();
-		char* data = new char[len];
-		memcpy(data, entry.data.c_str(), len);
-		parser.AddData(data, len);
+		parser.AddData(entry.data.c_str(), entry.data.size());
 	}
 	CDirectoryListing listing = parser.Parse(CServerPath());
 
@@ -1538,14 +1548,142 @@ void CDirectoryListingParserTest::testSpecial()
 
 			CDirectoryListingParser parser(0, server);
 
-			char* data = new char[line.size()];
-			memcpy(data, line.c_str(), line.size());
-			parser.AddData(data, line.size());
+			parser.AddData(line.c_str(), line.size());
 			parser.Parse(CServerPath());
 		}
 	}
 }
 
+void CDirectoryListingParserTest::testFormatStats()
+{
+	CServer server;
+	CDirectoryListingParser parser(0, server);
+
+	std::string const data =
+		"-rw-r--r--   1 root     other        531 Jan 29 03:26 file1\r\n"
+		"drwxr-xr-x   2 root     other        512 Apr  8  1994 dir\r\n"
+		"04-27-00  09:09PM       <DIR>          DOS dir\r\n"
+		"04-14-00  03:47PM                  589 DOS file\r\n"
+		"-rw-r--r--   1 root     other        531 Jan 29 03:26 file2\r\n";
+	parser.AddData(data.c_str(), data.size());
+	CDirectoryListing listing = parser.Parse(CServerPath());
+
+	CPPUNIT_ASSERT(listing.size() == 5);
+
+	// Each line but the first is tried with the format of the line before
+	auto const& stats = parser.GetFormatStats();
+	CPPUNIT_ASSERT_EQUAL(int64_t(4), stats.lines);
+	CPPUNIT_ASSERT_EQUAL(int64_t(2), stats.hits);
+}
+
+void CDirectoryListingParserTest::testParallel()
+{
+	// Enough lines for multiple chunks, chunk boundaries fall on
+	// different formats.
+	std::string data;
+	size_t lines{};
+	while (lines < 20000) {
+		for (auto const& entry : m_entries) {
+			if (entry.serverType == DEFAULT) {
+				data += entry.data;
+				++lines;
+			}
+		}
+	}
+
+	CServer server;
+
+	CDirectoryListingParser sequential(0, server);
+	sequential.AddData(data.c_str(), data.size());
+	CDirectoryListing const expected = sequential.Parse(CServerPath());
+
+	fz::thread_pool pool;
+	CDirectoryListingParser parallel(0, server);
+	parallel.EnableParallelParsing(pool);
+	for (size_t pos = 0; pos < data.size(); pos += 4096) {
+		parallel.AddData(data.c_str() + pos, std::min(size_t(4096), data.size() - pos));
+	}
+	CDirectoryListing const listing = parallel.Parse(CServerPath());
+
+	CPPUNIT_ASSERT_EQUAL(expected.size(), listing.size());
+	for (size_t i = 0; i < listing.size(); ++i) {
+		std::string msg = fz::sprintf("Entry %u Expected:\n%s\n  Got:\n%s", i, expected[i].dump(), listing[i].dump());
+		CPPUNIT_ASSERT_MESSAGE(msg, listing[i] == expected[i]);
+	}
+}
+
+void CDirectoryListingParserTest::testCompact()
+{
+	std::vector<fz::shared_value<CDirentry>> entries;
+	for (auto const& entry : m_entries) {
+		entries.emplace_back(entry.reference);
+	}
+	CDirectoryListing listing;
+	listing.path = CServerPath(L"/test");
+	listing.Assign(std::move(entries));
+
+	CCompactDirectoryListing compact(listing);
+	CDirectoryListing const expanded = compact.Expand();
+
+	CPPUNIT_ASSERT(expanded.path == listing.path);
+	CPPUNIT_ASSERT_EQUAL(listing.m_flags, expanded.m_flags);
+	CPPUNIT_ASSERT_EQUAL(listing.size(), expanded.size());
+	for (size_t i = 0; i < listing.size(); ++i) {
+		std::string msg = fz::sprintf("Entry %u Expected:\n%s\n  Got:\n%s", i, listing[i].dump(), expanded[i].dump());
+		CPPUNIT_ASSERT_MESSAGE(msg, expanded[i] == listing[i]);
+		CPPUNIT_ASSERT_MESSAGE(msg, expanded[i].time == listing[i].time);
+		CPPUNIT_ASSERT_MESSAGE(msg, expanded[i].target == listing[i].target);
+
+		CPPUNIT_ASSERT_EQUAL(listing.FindFile_CmpCase(listing[i].name), compact.FindFile_CmpCase(listing[i].name));
+		CPPUNIT_ASSERT_EQUAL(listing.FindFile_CmpNoCase(listing[i].name), compact.FindFile_CmpNoCase(listing[i].name));
+	}
+	CPPUNIT_ASSERT_EQUAL(std::string::npos, compact.FindFile_CmpCase(L"no such file"));
+
+	size_t const index = compact.FindFile_CmpCase(listing[0].name);
+	compact.SetName(index, L"renamed");
+	CPPUNIT_ASSERT_EQUAL(index, compact.FindFile_CmpNoCase(L"RENAMED"));
+	CPPUNIT_ASSERT(compact.RemoveEntry(index));
+	CPPUNIT_ASSERT_EQUAL(listing.size() - 1, compact.size());
+	CPPUNIT_ASSERT_EQUAL(std::string::npos, compact.FindFile_CmpCase(L"renamed"));
+	CPPUNIT_ASSERT(compact[0] == listing[1]);
+}
+
+void CDirectoryListingParserTest::testBenchmark()
+{
+	char const* env = getenv("FZ_DIRPARSER_BENCHMARK");
+	int const lines = env ? atoi(env) : 0;
+	if (lines <= 0) {
+		return;
+	}
+
+	std::cout << std::endl;
+	for (auto const& entry : m_entries) {
+		std::string data;
+		data.reserve(entry.data.size() * lines);
+		for (int i = 0; i < lines; ++i) {
+			data += entry.data;
+		}
+
+		CServer server;
+		server.SetType(entry.serverType);
+		CDirectoryListingParser parser(0, server);
+
+		auto const start = fz::monotonic_clock::now();
+		parser.AddData(data.c_str(), data.size());
+		CDirectoryListing listing = parser.Parse(CServerPath());
+		auto const ms = (fz::monotonic_clock::now() - start).get_milliseconds();
+
+		auto const& stats = parser.GetFormatStats();
+		std::string name = entry.data.substr(0, entry.data.find_first_of("\r\n"));
+		if (name.size() > 60) {
+			name = name.substr(0, 57) + "...";
+		}
+		std::cout << fz::sprintf("%-60s %10d lines/s, %3d%% fast path\n", name,
+			ms ? lines * int64_t(1000) / ms : int64_t(-1),
+			stats.lines ? stats.hits * 100 / stats.lines : int64_t(0));
+	}
+}
+
 void CDirectoryListingParserTest::setUp()
 {
 }
@@ -0,0 +1,138 @@
+#include <filezilla.h>
+#include "iothread.h"
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
+#include <string.h>
+
+/*
+ * This testsuite asserts the correctness of the CIOThread class.
+ */
+
+class CIOThreadTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CIOThreadTest);
+	CPPUNIT_TEST(testSegments);
+	CPPUNIT_TEST(testTruncate);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp();
+	void tearDown();
+
+	void testSegments();
+	void testTruncate();
+
+protected:
+	// Writes the data at the given offset of the file the way a segmented
+	// download does. Data written is the segment index repeated.
+	bool WriteSegment(int64_t offset, int64_t length, char value, bool finalize);
+
+	std::string ReadFile();
+
+	fz::thread_pool pool_;
+	fz::native_string file_;
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CIOThreadTest);
+
+namespace {
+int64_t const segment_size = 1000;
+int const segment_count = 3;
+}
+
+void CIOThreadTest::setUp()
+{
+	file_ = fzT("fz_iothreadtest.tmp");
+
+	// Preallocate as the queue does before starting the segments
+	fz::file f(file_, fz::file::writing, fz::file::empty);
+	CPPUNIT_ASSERT(f.opened());
+	CPPUNIT_ASSERT_EQUAL(segment_size * segment_count, f.seek(segment_size * segment_count, fz::file::begin));
+	CPPUNIT_ASSERT(f.truncate());
+}
+
+void CIOThreadTest::tearDown()
+{
+	fz::remove_file(file_);
+}
+
+bool CIOThreadTest::WriteSegment(int64_t offset, int64_t length, char value, bool finalize)
+{
+	auto file = std::make_unique<fz::file>();
+	if (!file->open(file_, fz::file::writing, fz::file::existing) || file->seek(offset, fz::file::begin) != offset) {
+		return false;
+	}
+
+	CIOThread thread;
+	thread.SetTruncateOnClose(false);
+	if (!thread.Create(pool_, std::move(file), false, true, length)) {
+		return false;
+	}
+
+	// The segments are small enough to fit into the first buffer
+	char* buffer{};
+	if (thread.GetNextWriteBuffer(&buffer) != IO_Success || thread.GetBufferSize() < length) {
+		return false;
+	}
+	memset(buffer, value, static_cast<size_t>(length));
+
+	if (finalize) {
+		return thread.Finalize(static_cast<int>(length));
+	}
+
+	// Simulates a segment failing before any data got written
+	thread.Destroy();
+	return true;
+}
+
+std::string CIOThreadTest::ReadFile()
+{
+	fz::file f(file_, fz::file::reading);
+	std::string ret;
+	if (f.opened()) {
+		ret.resize(static_cast<size_t>(f.size()));
+		if (f.read(&ret[0], static_cast<int64_t>(ret.size())) != static_cast<int64_t>(ret.size())) {
+			ret.clear();
+		}
+	}
+	return ret;
+}
+
+void CIOThreadTest::testSegments()
+{
+	// Segments finish in reverse order, the middle one fails first
+	CPPUNIT_ASSERT(WriteSegment(segment_size, segment_size, '1', false));
+	CPPUNIT_ASSERT(WriteSegment(segment_size * 2, segment_size, '2', true));
+	CPPUNIT_ASSERT(WriteSegment(0, segment_size, '0', true));
+
+	std::string expected(static_cast<size_t>(segment_size), '0');
+	expected += std::string(static_cast<size_t>(segment_size), '\0');
+	expected += std::string(static_cast<size_t>(segment_size), '2');
+	CPPUNIT_ASSERT(ReadFile() == expected);
+
+	// Retry of the failed segment
+	CPPUNIT_ASSERT(WriteSegment(segment_size, segment_size, '1', true));
+	expected.replace(static_cast<size_t>(segment_size), static_cast<size_t>(segment_size), std::string(static_cast<size_t>(segment_size), '1'));
+	CPPUNIT_ASSERT(ReadFile() == expected);
+}
+
+void CIOThreadTest::testTruncate()
+{
+	// Regular downloads still drop preallocated space past the written data
+	auto file = std::make_unique<fz::file>();
+	CPPUNIT_ASSERT(file->open(file_, fz::file::writing, fz::file::existing));
+
+	{
+		CIOThread thread;
+		CPPUNIT_ASSERT(thread.Create(pool_, std::move(file), false, true, segment_size));
+		char* buffer{};
+		CPPUNIT_ASSERT_EQUAL(static_cast<int>(IO_Success), thread.GetNextWriteBuffer(&buffer));
+		memset(buffer, 'x', static_cast<size_t>(segment_size));
+		CPPUNIT_ASSERT(thread.Finalize(static_cast<int>(segment_size)));
+	}
+
+	CPPUNIT_ASSERT(ReadFile() == std::string(static_cast<size_t>(segment_size), 'x'));
+}